@@ -0,0 +1,252 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "fitwr.h"
+#include "mlog.h"
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+
+// Schedule step type
+typedef enum SchedStepType {
+    schedSim = 1,       // set the sim parameters
+    schedErg = 2,       // set the target power
+} SchedStepType;
+
+// Schedule step
+typedef struct SchedStep {
+    uint32_t time;      // elapsed time since the start of the activity [s]
+    SchedStepType type;
+    double grade;       // [%]
+    double windSpeed;   // [m/s]
+    double crr;
+    double cw;          // [kg/m]
+    int tgtPower;       // [W]
+} SchedStep;
+
+// Load the schedule file. Each line specifies a step in
+// one of these formats:
+//
+//   <sec> sim <grade> [<windSpeed> [<crr> [<cw>]]]
+//   <sec> erg <power>
+//
+// The steps must be sorted by time. Empty lines and lines
+// starting with '#' are ignored.
+static int loadSched(const char *fileName, SchedStep **pSteps, int *pNumSteps)
+{
+    FILE *fp;
+    char line[256];
+    SchedStep *steps = NULL;
+    int numSteps = 0, maxSteps = 0;
+    int lineNum = 0;
+
+    if ((fp = fopen(fileName, "r")) == NULL) {
+        mlog(error, "Can't open schedule file %s! (%s)", fileName, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        SchedStep step = { .crr = PHY_DEF_CRR, .cw = PHY_DEF_CW };
+        char type[8];
+        int n;
+
+        lineNum++;
+
+        if ((sscanf(line, " %7s", type) != 1) || (type[0] == '#'))
+            continue;
+
+        if ((sscanf(line, "%u %7s%n", &step.time, type, &n) != 2) ||
+            ((numSteps != 0) && (step.time < steps[numSteps-1].time))) {
+            mlog(error, "Invalid schedule step at %s:%d", fileName, lineNum);
+            goto error;
+        }
+
+        if (strcmp(type, "sim") == 0) {
+            step.type = schedSim;
+            if (sscanf(&line[n], "%lf %lf %lf %lf", &step.grade, &step.windSpeed, &step.crr, &step.cw) < 1) {
+                mlog(error, "Invalid sim parameters at %s:%d", fileName, lineNum);
+                goto error;
+            }
+        } else if (strcmp(type, "erg") == 0) {
+            step.type = schedErg;
+            if (sscanf(&line[n], "%d", &step.tgtPower) != 1) {
+                mlog(error, "Invalid target power at %s:%d", fileName, lineNum);
+                goto error;
+            }
+        } else {
+            mlog(error, "Invalid schedule step type \"%s\" at %s:%d", type, fileName, lineNum);
+            goto error;
+        }
+
+        if (numSteps == maxSteps) {
+            SchedStep *newSteps;
+            maxSteps = (maxSteps != 0) ? (maxSteps * 2) : 64;
+            if ((newSteps = realloc(steps, (maxSteps * sizeof (SchedStep)))) == NULL) {
+                goto error;
+            }
+            steps = newSteps;
+        }
+
+        steps[numSteps++] = step;
+    }
+
+    fclose(fp);
+
+    *pSteps = steps;
+    *pNumSteps = numSteps;
+
+    return 0;
+
+error:
+    fclose(fp);
+    free(steps);
+
+    return -1;
+}
+
+static void applySchedStep(Server *server, const SchedStep *step)
+{
+    if (step->type == schedSim) {
+        serverSetSimParms(server, step->windSpeed, step->grade, step->crr, step->cw);
+    } else if (serverSetTgtPower(server, step->tgtPower) != 0) {
+        mlog(error, "Target power %d [W] at %u [s] is out of range!", step->tgtPower, step->time);
+    }
+}
+
+int batchRun(Server *server, const char *schedFile, const char *outName)
+{
+    SchedStep *steps = NULL;
+    int numSteps = 0, nextStep = 0;
+    char fileName[256];
+    struct timespec start, end;
+    FitWr *fw;
+    FILE *csv;
+    static char csvBuf[64 * 1024];
+    const TrkPtStore *store;
+    const TrkPt *tp;
+    time_t startTime, prevTime;
+    int n;
+
+    if ((server->actFile == NULL) && (server->actCache == NULL)) {
+        mlog(error, "Batch mode requires an activity file!");
+        return -1;
+    }
+
+    if ((schedFile != NULL) && (loadSched(schedFile, &steps, &numSteps) != 0)) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (serverLoadActivity(server) != 0) {
+        free(steps);
+        return -1;
+    }
+
+    if (((store = server->trkPtStore) == NULL) || (store->numTrkPts == 0)) {
+        mlog(error, "No trackpoints in the activity file!");
+        free(steps);
+        return -1;
+    }
+
+    startTime = prevTime = store->trkPts[0].timestamp;
+
+    snprintf(fileName, sizeof (fileName), "%s.fit", outName);
+    if ((fw = fitWrOpen(fileName, startTime, FIT_WR_BUF_SIZE, false)) == NULL) {
+        free(steps);
+        return -1;
+    }
+
+    snprintf(fileName, sizeof (fileName), "%s.csv", outName);
+    if ((csv = fopen(fileName, "w")) == NULL) {
+        mlog(error, "Can't create CSV file %s! (%s)", fileName, strerror(errno));
+        fitWrClose(fw);
+        free(steps);
+        return -1;
+    }
+    setvbuf(csv, csvBuf, _IOFBF, sizeof (csvBuf));
+    fprintf(csv, "timestamp,elapsed,power,cadence,heart_rate,speed,distance,grade,target_power\n");
+
+    // The speed and distance always come from the
+    // bike dynamics model.
+    phyInit(&server->phyState, server->mass);
+    server->physics = true;
+
+    for (n = 0; n < store->numTrkPts; n++) {
+        uint32_t elapsed;
+        FitWrRec rec;
+
+        tp = &store->trkPts[n];
+        elapsed = tp->timestamp - startTime;
+
+        // Apply all the schedule steps that are due
+        while ((nextStep < numSteps) && (steps[nextStep].time <= elapsed)) {
+            applySchedStep(server, &steps[nextStep++]);
+        }
+
+        server->cadence = tp->cadence;
+        server->heartRate = tp->heartRate;
+        server->power = tp->power;
+
+        serverUpdRideMetrics(server, (double) (tp->timestamp - prevTime));
+        prevTime = tp->timestamp;
+
+        rec.timestamp = tp->timestamp;
+        rec.cadence = server->cadence;
+        rec.heartRate = server->heartRate;
+        rec.power = server->power;
+        rec.speed = server->speed;
+        rec.distance = server->phyState.distance;
+        rec.grade = server->phyState.grade;
+        fitWrRecord(fw, &rec);
+
+        fprintf(csv, "%ld,%u,%u,%u,%u,%.3f,%.2f,%.2f,",
+                (long) tp->timestamp, elapsed, rec.power, rec.cadence, rec.heartRate,
+                (rec.speed * 3.6), rec.distance, rec.grade);
+        if (server->erg.active) {
+            fprintf(csv, "%.0f\n", server->erg.target);
+        } else {
+            fprintf(csv, "\n");
+        }
+    }
+
+    fclose(csv);
+    free(steps);
+
+    if (fitWrClose(fw) != 0) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    mlog(info, "Batch run done: %d trackpoints, distance %.2f [km], in %.3f [ms]",
+            store->numTrkPts, (server->phyState.distance / 1000.0),
+            (((end.tv_sec - start.tv_sec) * 1000.0) + ((end.tv_nsec - start.tv_nsec) / 1000000.0)));
+
+    return 0;
+}
+
+#endif  // CONFIG_FIT_ACTIVITY_FILE
@@ -0,0 +1,39 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "config.h"
+#include "server.h"
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+
+__BEGIN_DECLS
+
+// Run the activity through the ERG and bike dynamics models
+// as fast as possible, applying the sim parameters and target
+// power changes from the (optional) schedule file, and write
+// the resulting trackpoints to the files <outName>.fit and
+// <outName>.csv.
+extern int batchRun(Server *server, const char *schedFile, const char *outName);
+
+__END_DECLS
+
+#endif  // CONFIG_FIT_ACTIVITY_FILE
@@ -0,0 +1,729 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Micro-benchmarks for the hot paths of the indBikeSim app. Each
+// benchmark is run enough times to get a stable measurement, and
+// the results (ns/op and allocs/op) are written out as JSON. When
+// a baseline file is given, the results are compared against it
+// and the tool exits with a non-zero status if any benchmark has
+// regressed by more than the specified tolerance.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binbuf.h"
+#include "dircon.h"
+#include "fit/fit_convert.h"
+#include "fit/fit_crc.h"
+#include "mlog.h"
+#include "physics.h"
+#include "server.h"
+#include "uuid.h"
+
+// Max number of benchmark results
+#define MAX_RESULTS     64
+
+// Min run time of a benchmark [ns]
+#define MIN_RUN_TIME    200000000ULL
+
+typedef struct BenchResult {
+    char name[64];
+    uint64_t numIter;
+    double nsPerOp;
+    double allocsPerOp;
+} BenchResult;
+
+typedef struct Bench {
+    const char *name;
+    void (*func)(uint64_t numIter);
+} Bench;
+
+// Allocation counter, maintained by the malloc() family
+// wrappers below (see the "--wrap" linker options in the
+// Makefile).
+static uint64_t numAllocs;
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    numAllocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    numAllocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    numAllocs++;
+    return __real_realloc(ptr, size);
+}
+
+static volatile uint64_t sink;
+
+static Server benchServer;
+
+static uint8_t *fitData;
+static size_t fitDataLen;
+
+static int sockPair[2];
+
+static BenchResult results[MAX_RESULTS];
+static int numResults;
+
+static uint64_t nsNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+//
+// Codecs
+//
+
+static void benchBinBufPut(uint64_t numIter)
+{
+    uint8_t buf[32];
+    BinBuf binBuf;
+
+    binBufInit(&binBuf, buf, sizeof (buf), bigEndian);
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        binBufClear(&binBuf);
+        binBufPutUINT8(&binBuf, i);
+        binBufPutUINT16(&binBuf, i);
+        binBufPutUINT24(&binBuf, i);
+        binBufPutUINT32(&binBuf, i);
+        binBufPutUINT64(&binBuf, i);
+    }
+
+    sink = buf[0];
+}
+
+static void benchBinBufGet(uint64_t numIter)
+{
+    uint8_t buf[32] = {0};
+    BinBuf binBuf;
+    uint64_t sum = 0;
+
+    binBufInit(&binBuf, buf, sizeof (buf), bigEndian);
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        binBufClear(&binBuf);
+        sum += binBufGetUINT8(&binBuf);
+        sum += binBufGetUINT16(&binBuf);
+        sum += binBufGetUINT24(&binBuf);
+        sum += binBufGetUINT32(&binBuf);
+        sum += binBufGetUINT64(&binBuf);
+    }
+
+    sink = sum;
+}
+
+static void benchPutUINT16(uint64_t numIter)
+{
+    uint8_t buf[2];
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        putUINT16(buf, i);
+    }
+
+    sink = buf[0];
+}
+
+static void benchGetUINT16(uint64_t numIter)
+{
+    uint8_t buf[2] = { 0x34, 0x12 };
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        sum += getUINT16(buf);
+    }
+
+    sink = sum;
+}
+
+static void benchUuid128Eq(uint64_t numIter)
+{
+    Uuid128 uuid1, uuid2;
+    uint64_t sum = 0;
+
+    uint16ToUuid128(&uuid1, indoorBikeData);
+    uint16ToUuid128(&uuid2, indoorBikeData);
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        sum += uuid128Eq(&uuid1, &uuid2);
+    }
+
+    sink = sum;
+}
+
+static void benchFmtUuid128Name(uint64_t numIter)
+{
+    Uuid128 uuid;
+    uint64_t sum = 0;
+
+    uint16ToUuid128(&uuid, fitnessMachineControlPoint);
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        sum += (uintptr_t) fmtUuid128Name(&uuid);
+    }
+
+    sink = sum;
+}
+
+//
+// FIT decoding
+//
+
+// Build a synthetic FIT activity file with one RECORD message
+// per second of the specified duration.
+static int buildFitData(int numRecs)
+{
+    size_t bufSize = FIT_FILE_HDR_SIZE + 64 + (numRecs * 16) + FIT_FILE_CRC_SIZE;
+    uint8_t *buf, *p;
+    uint32_t timestamp = 1000000000;
+    uint16_t crc;
+
+    if ((buf = malloc(bufSize)) == NULL) {
+        return -1;
+    }
+
+    p = buf + FIT_FILE_HDR_SIZE;
+
+    // FILE_ID definition message (local #0)
+    *p++ = FIT_HDR_TYPE_DEF_BIT | 0;
+    *p++ = 0;   // reserved
+    *p++ = FIT_ARCH_ENDIAN_LITTLE;
+    putUINT16(p, FIT_MESG_NUM_FILE_ID); p += 2;
+    *p++ = 3;   // numFields
+    *p++ = FIT_FILE_ID_FIELD_NUM_TYPE; *p++ = 1; *p++ = FIT_BASE_TYPE_ENUM;
+    *p++ = FIT_FILE_ID_FIELD_NUM_MANUFACTURER; *p++ = 2; *p++ = FIT_BASE_TYPE_UINT16;
+    *p++ = FIT_FILE_ID_FIELD_NUM_TIME_CREATED; *p++ = 4; *p++ = FIT_BASE_TYPE_UINT32;
+
+    // FILE_ID data message
+    *p++ = 0;
+    *p++ = FIT_FILE_ACTIVITY;
+    putUINT16(p, FIT_MANUFACTURER_DEVELOPMENT); p += 2;
+    putUINT32(p, timestamp); p += 4;
+
+    // RECORD definition message (local #1)
+    *p++ = FIT_HDR_TYPE_DEF_BIT | 1;
+    *p++ = 0;   // reserved
+    *p++ = FIT_ARCH_ENDIAN_LITTLE;
+    putUINT16(p, FIT_MESG_NUM_RECORD); p += 2;
+    *p++ = 5;   // numFields
+    *p++ = FIT_RECORD_FIELD_NUM_TIMESTAMP; *p++ = 4; *p++ = FIT_BASE_TYPE_UINT32;
+    *p++ = FIT_RECORD_FIELD_NUM_POWER; *p++ = 2; *p++ = FIT_BASE_TYPE_UINT16;
+    *p++ = FIT_RECORD_FIELD_NUM_SPEED; *p++ = 2; *p++ = FIT_BASE_TYPE_UINT16;
+    *p++ = FIT_RECORD_FIELD_NUM_HEART_RATE; *p++ = 1; *p++ = FIT_BASE_TYPE_UINT8;
+    *p++ = FIT_RECORD_FIELD_NUM_CADENCE; *p++ = 1; *p++ = FIT_BASE_TYPE_UINT8;
+
+    // RECORD data messages
+    for (int n = 0; n < numRecs; n++) {
+        *p++ = 1;
+        putUINT32(p, timestamp + n); p += 4;
+        putUINT16(p, 150 + (n % 100)); p += 2;
+        putUINT16(p, 8000 + (n % 500)); p += 2;
+        *p++ = 120 + (n % 40);
+        *p++ = 80 + (n % 20);
+    }
+
+    // File header
+    buf[0] = FIT_FILE_HDR_SIZE;
+    buf[1] = FIT_PROTOCOL_VERSION;
+    putUINT16(&buf[2], FIT_PROFILE_VERSION);
+    putUINT32(&buf[4], (p - buf - FIT_FILE_HDR_SIZE));
+    memcpy(&buf[8], ".FIT", 4);
+    putUINT16(&buf[12], FitCRC_Calc16(buf, 12));
+
+    // File CRC
+    crc = FitCRC_Calc16(buf, (p - buf));
+    putUINT16(p, crc); p += 2;
+
+    fitData = buf;
+    fitDataLen = p - buf;
+
+    return 0;
+}
+
+static int loadFitData(const char *fileName)
+{
+    FILE *fp;
+    long len;
+
+    if ((fp = fopen(fileName, "r")) == NULL) {
+        fprintf(stderr, "Can't open FIT file %s (%s)\n", fileName, strerror(errno));
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+
+    if ((fitData = malloc(len)) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    if (fread(fitData, 1, len, fp) != len) {
+        fprintf(stderr, "Can't read FIT file %s\n", fileName);
+        fclose(fp);
+        return -1;
+    }
+
+    fitDataLen = len;
+
+    fclose(fp);
+
+    return 0;
+}
+
+static void benchFitConvertRead(uint64_t numIter)
+{
+    uint64_t numMesgs = 0;
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        FIT_CONVERT_RETURN conRet;
+
+        FitConvert_Init(FIT_TRUE);
+
+        while ((conRet = FitConvert_Read(fitData, fitDataLen)) == FIT_CONVERT_MESSAGE_AVAILABLE) {
+            if (FitConvert_GetMessageNumber() == FIT_MESG_NUM_RECORD) {
+                numMesgs++;
+            }
+        }
+
+        if (conRet != FIT_CONVERT_END_OF_FILE) {
+            fprintf(stderr, "Failed to decode FIT data! conRet=%d\n", conRet);
+            exit(1);
+        }
+    }
+
+    sink = numMesgs;
+}
+
+//
+// Notification encoding
+//
+
+static void benchInitIbdData(uint64_t numIter)
+{
+    uint8_t buf[64];
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        sum += initIbdData(&benchServer, (IndoorBikeData *) buf);
+    }
+
+    sink = sum;
+}
+
+#ifdef CONFIG_CPS
+static void benchInitCpmData(uint64_t numIter)
+{
+    uint8_t buf[64];
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        sum += initCpmData(&benchServer, (CycPowerMeas *) buf);
+    }
+
+    sink = sum;
+}
+#endif
+
+//
+// Bike dynamics
+//
+
+#define BENCH_NUM_RIDERS    1000
+
+static void benchPhyStep(uint64_t numIter)
+{
+    PhyState state;
+
+    phyInit(&state, PHY_DEF_MASS);
+    phySetSimParms(&state, 0.0, 2.5, PHY_DEF_CRR, PHY_DEF_CW);
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        phyStep(&state, 200.0, 1.0);
+    }
+
+    sink = (uint64_t) state.distance;
+}
+
+static void benchPhyBatchStep(uint64_t numIter)
+{
+    static PhyBatch *batch;
+
+    if (batch == NULL) {
+        PhyState state;
+
+        // Allocated once, so it isn't counted on each run
+        batch = phyBatchNew(BENCH_NUM_RIDERS);
+        phyInit(&state, PHY_DEF_MASS);
+        for (int r = 0; r < BENCH_NUM_RIDERS; r++) {
+            phySetSimParms(&state, 0.0, (r % 10), PHY_DEF_CRR, PHY_DEF_CW);
+            phyBatchSet(batch, r, &state);
+            batch->power[r] = 100.0 + (r % 300);
+        }
+    }
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        phyBatchStep(batch, 1.0);
+    }
+
+    sink = (uint64_t) batch->distance[0];
+}
+
+//
+// DIRCON message processing
+//
+
+// Drain all the data sent by the server
+static void drainSockPair(void)
+{
+    uint8_t buf[4096];
+
+    while (recv(sockPair[1], buf, sizeof (buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+static void sendRequest(DirconMesgId mesgId, uint8_t seqNum, const void *data, uint16_t dataLen)
+{
+    uint8_t buf[MAX_MESG_LEN];
+    DirconMesg *mesg = (DirconMesg *) buf;
+
+    mesg->version = DIRCON_VERSION;
+    mesg->mesgId = mesgId;
+    mesg->seqNum = seqNum;
+    mesg->respCode = SuccessRequest;
+    mesg->mesgLen = htons(dataLen);
+    memcpy(mesg->data, data, dataLen);
+
+    if (send(sockPair[1], buf, (sizeof (DirconMesg) + dataLen), 0) < 0) {
+        fprintf(stderr, "send() failed! (%s)\n", strerror(errno));
+        exit(1);
+    }
+}
+
+static void benchDiscoverServices(uint64_t numIter)
+{
+    for (uint64_t i = 0; i < numIter; i++) {
+        sendRequest(DiscoverServices, i, NULL, 0);
+        dirconProcMesg(&benchServer);
+        drainSockPair();
+    }
+}
+
+static void benchReadCharacteristic(uint64_t numIter)
+{
+    Uuid128 uuid;
+
+    uint16ToUuid128(&uuid, supportedPowerRange);
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        sendRequest(ReadCharacteristic, i, &uuid, sizeof (uuid));
+        dirconProcMesg(&benchServer);
+        drainSockPair();
+    }
+}
+
+static void benchWriteCharacteristic(uint64_t numIter)
+{
+    uint8_t buf[sizeof (Uuid128) + 1];
+
+    uint16ToUuid128((Uuid128 *) buf, fitnessMachineControlPoint);
+    buf[sizeof (Uuid128)] = FMCP_REQUEST_CONTROL;
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        sendRequest(WriteCharacteristic, i, buf, sizeof (buf));
+        dirconProcMesg(&benchServer);
+        drainSockPair();
+    }
+}
+
+static void benchNotifications(uint64_t numIter)
+{
+    DirconSession *sess = &benchServer.dirconSession;
+    struct timeval now = { .tv_sec = 1, .tv_usec = 0 };
+
+    sess->ibdNotificationsEnabled = true;
+#ifdef CONFIG_CPS
+    sess->cpmNotificationsEnabled = true;
+#endif
+
+    for (uint64_t i = 0; i < numIter; i++) {
+        // Force the clock tick
+        sess->nextClkTick = now;
+        dirconProcTimers(&benchServer, &now);
+        drainSockPair();
+    }
+
+    sess->ibdNotificationsEnabled = false;
+    sess->cpmNotificationsEnabled = false;
+}
+
+static int initBenchServer(void)
+{
+    Server *server = &benchServer;
+    Service *svc;
+    Uuid128 uuid;
+
+    TAILQ_INIT(&server->svcList);
+
+    server->cadence = 90;
+    server->heartRate = 140;
+    server->power = 200;
+    server->speed = 30.0 / 3.6;
+    server->minPower = 0;
+    server->maxPower = 1500;
+    server->incPower = 1;
+
+    uint16ToUuid128(&uuid, fitnessMachineService);
+    if ((svc = serverAddService(server, &uuid)) == NULL)
+        return -1;
+    uint16ToUuid128(&uuid, fitnessMachineFeature);
+    svcAddChar(svc, &uuid, DIRCON_CHAR_PROP_READ);
+    uint16ToUuid128(&uuid, indoorBikeData);
+    svcAddChar(svc, &uuid, DIRCON_CHAR_PROP_NOTIFY);
+    uint16ToUuid128(&uuid, supportedPowerRange);
+    svcAddChar(svc, &uuid, DIRCON_CHAR_PROP_READ);
+    uint16ToUuid128(&uuid, fitnessMachineControlPoint);
+    svcAddChar(svc, &uuid, DIRCON_CHAR_PROP_WRITE | DIRCON_CHAR_PROP_NOTIFY);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockPair) != 0) {
+        fprintf(stderr, "socketpair() failed! (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    server->dirconSession.cliSockFd = sockPair[0];
+    server->dirconSession.lastTxReqSeqNum = 0xff;
+
+    return 0;
+}
+
+static const Bench benchTbl[] = {
+    { "binBufPut",                  benchBinBufPut },
+    { "binBufGet",                  benchBinBufGet },
+    { "putUINT16",                  benchPutUINT16 },
+    { "getUINT16",                  benchGetUINT16 },
+    { "uuid128Eq",                  benchUuid128Eq },
+    { "fmtUuid128Name",             benchFmtUuid128Name },
+    { "FitConvert_Read",            benchFitConvertRead },
+    { "initIbdData",                benchInitIbdData },
+#ifdef CONFIG_CPS
+    { "initCpmData",                benchInitCpmData },
+#endif
+    { "phyStep",                    benchPhyStep },
+    { "phyBatchStep/1000riders",    benchPhyBatchStep },
+    { "dirconProcMesg/DiscoverServices",    benchDiscoverServices },
+    { "dirconProcMesg/ReadCharacteristic",  benchReadCharacteristic },
+    { "dirconProcMesg/WriteCharacteristic", benchWriteCharacteristic },
+    { "dirconProcTimers/Notifications",     benchNotifications },
+    { NULL,                         NULL },
+};
+
+static void runBench(const Bench *bench)
+{
+    BenchResult *res = &results[numResults++];
+    uint64_t numIter = 1;
+    uint64_t elapsed, allocs;
+
+    // Figure out how many iterations are needed to
+    // get a long enough run.
+    while (true) {
+        uint64_t start = nsNow();
+        allocs = numAllocs;
+        (*bench->func)(numIter);
+        elapsed = nsNow() - start;
+        allocs = numAllocs - allocs;
+        if (elapsed >= MIN_RUN_TIME)
+            break;
+        if (elapsed < (MIN_RUN_TIME / 100)) {
+            numIter *= 100;
+        } else {
+            numIter = (numIter * MIN_RUN_TIME * 12) / (elapsed * 10);
+        }
+    }
+
+    snprintf(res->name, sizeof (res->name), "%s", bench->name);
+    res->numIter = numIter;
+    res->nsPerOp = (double) elapsed / numIter;
+    res->allocsPerOp = (double) allocs / numIter;
+
+    printf("%-40s %12llu %12.1f ns/op %8.2f allocs/op\n",
+           res->name, (unsigned long long) numIter, res->nsPerOp, res->allocsPerOp);
+}
+
+static int writeResults(const char *fileName)
+{
+    FILE *fp;
+
+    if ((fp = fopen(fileName, "w")) == NULL) {
+        fprintf(stderr, "Can't create %s (%s)\n", fileName, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "{\n  \"benchmarks\": [\n");
+    for (int n = 0; n < numResults; n++) {
+        const BenchResult *res = &results[n];
+        fprintf(fp, "    { \"name\": \"%s\", \"iterations\": %llu, \"nsPerOp\": %.2f, \"allocsPerOp\": %.2f }%s\n",
+                res->name, (unsigned long long) res->numIter, res->nsPerOp, res->allocsPerOp,
+                ((n + 1) < numResults) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+
+    fclose(fp);
+
+    return 0;
+}
+
+// Compare the results against the baseline. Returns the
+// number of regressions found.
+static int checkBaseline(const char *fileName, double tolerance)
+{
+    FILE *fp;
+    char line[256];
+    int numRegr = 0;
+
+    if ((fp = fopen(fileName, "r")) == NULL) {
+        fprintf(stderr, "Can't open baseline %s (%s)\n", fileName, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        char name[64];
+        double nsPerOp, allocsPerOp;
+
+        if (sscanf(line, " { \"name\": \"%63[^\"]\", \"iterations\": %*u, \"nsPerOp\": %lf, \"allocsPerOp\": %lf",
+                   name, &nsPerOp, &allocsPerOp) != 3)
+            continue;
+
+        for (int n = 0; n < numResults; n++) {
+            const BenchResult *res = &results[n];
+            if (strcmp(res->name, name) == 0) {
+                if (res->nsPerOp > (nsPerOp * (1.0 + tolerance))) {
+                    printf("REGRESSION: %s: %.1f ns/op (baseline %.1f ns/op)\n", name, res->nsPerOp, nsPerOp);
+                    numRegr++;
+                }
+                if (res->allocsPerOp > allocsPerOp) {
+                    printf("REGRESSION: %s: %.2f allocs/op (baseline %.2f allocs/op)\n", name, res->allocsPerOp, allocsPerOp);
+                    numRegr++;
+                }
+                break;
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return numRegr;
+}
+
+static const char *help =
+        "SYNTAX:\n"
+        "    indBikeSimBench [OPTIONS]\n"
+        "\n"
+        "OPTIONS:\n"
+        "    --baseline <file>\n"
+        "        Compare the results against the specified baseline file.\n"
+        "    --fit <file>\n"
+        "        FIT file used by the FitConvert_Read benchmark. By default\n"
+        "        a synthetic 1-hour activity is used.\n"
+        "    --output <file>\n"
+        "        Write the results as JSON to the specified file.\n"
+        "    --tolerance <pct>\n"
+        "        Max slowdown (in percent) relative to the baseline that is\n"
+        "        not considered a regression. Default is 30.\n";
+
+int main(int argc, char *argv[])
+{
+    const char *baseline = NULL;
+    const char *fitFile = NULL;
+    const char *output = NULL;
+    double tolerance = 0.30;
+    int numRegr;
+
+    for (int n = 1; n < argc; n++) {
+        const char *arg = argv[n];
+        const char *val = argv[n+1];
+
+        if ((strcmp(arg, "--help") == 0) || (val == NULL)) {
+            fprintf(stdout, "%s\n", help);
+            return (strcmp(arg, "--help") == 0) ? 0 : -1;
+        } else if (strcmp(arg, "--baseline") == 0) {
+            baseline = val;
+        } else if (strcmp(arg, "--fit") == 0) {
+            fitFile = val;
+        } else if (strcmp(arg, "--output") == 0) {
+            output = val;
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            tolerance = atof(val) / 100.0;
+        } else {
+            fprintf(stderr, "Invalid argument: %s\n", arg);
+            return -1;
+        }
+        n++;
+    }
+
+    // Keep the benchmarks quiet
+    msgLogSetLevel(none);
+
+    if (((fitFile != NULL) ? loadFitData(fitFile) : buildFitData(3600)) != 0) {
+        return -1;
+    }
+
+    if (initBenchServer() != 0) {
+        return -1;
+    }
+
+    for (const Bench *bench = benchTbl; bench->name != NULL; bench++) {
+        runBench(bench);
+    }
+
+    if ((output != NULL) && (writeResults(output) != 0)) {
+        return -1;
+    }
+
+    if (baseline != NULL) {
+        if ((numRegr = checkBaseline(baseline, tolerance)) != 0) {
+            printf("%d regression(s) found!\n", numRegr);
+            return 1;
+        }
+        printf("No regressions found.\n");
+    }
+
+    return 0;
+}
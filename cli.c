@@ -63,6 +63,10 @@ typedef enum CmdStat {
 static const char *cliHelp = \
     "Supported CLI commands:\n"
     "\n"
+    "activity <file>\n"
+    "    Load a new FIT activity file (or trackpoint cache file) in\n"
+    "    the background, and switch all the bikes over to it.\n"
+    "\n"
     "exit\n"
     "    Exit the tool.\n"
     "\n"
@@ -91,6 +95,15 @@ typedef struct CliCmd {
 //    return ERROR;
 //}
 
+static CmdStat cliCmdActivity(CliInfo *cliInfo)
+{
+    if (serverSwapActivity(cliInfo->server, cliInfo->argv[1]) != 0) {
+        return ERROR;
+    }
+
+    return OK;
+}
+
 static CmdStat cliCmdExit(CliInfo *cliInfo)
 {
     // Exit the work loop
@@ -128,6 +141,7 @@ static CmdStat cliCmdShow(CliInfo *cliInfo)
 
 // CLI command table
 static CliCmd cliCmdTbl [] = {
+    { "activity",       cliCmdActivity,             2,  2, "<file>",            false },
     { "exit",           cliCmdExit,                 1,  1, NULL,                false },
     { "help",           cliCmdHelp,                 1,  1, NULL,                false },
     { "history",        cliCmdHistory,              1,  1, NULL,                false },
@@ -0,0 +1,126 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "clock.h"
+
+// All the timers and timestamps in the app go through this
+// clock, so that an activity can be run faster than real time
+// (scaledTime) or driven in lock-step by a test harness that
+// steps the clock one tick at a time (stepTime).
+
+static ClkMode clkMode = realTime;
+static double clkScale = 1.0;
+
+static struct timeval realBase;     // wall-clock time when the clock was started
+static struct timeval virtBase;     // clock time when the clock was started
+static struct timeval virtNow;      // current clock time (stepTime mode)
+
+// Protects virtNow, as the clock can be read and stepped
+// by the worker threads too.
+static pthread_mutex_t virtNowLock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile sig_atomic_t numStepReqs;
+
+int clkInit(ClkMode mode, double scale)
+{
+    if ((mode == scaledTime) && (scale <= 0.0)) {
+        return -1;
+    }
+
+    clkMode = mode;
+    clkScale = (mode == scaledTime) ? scale : 1.0;
+
+    gettimeofday(&realBase, NULL);
+    virtBase = virtNow = realBase;
+
+    return 0;
+}
+
+void clkGetTime(struct timeval *tv)
+{
+    if (clkMode == realTime) {
+        gettimeofday(tv, NULL);
+    } else if (clkMode == scaledTime) {
+        struct timeval now, delta;
+        uint64_t usec;
+
+        gettimeofday(&now, NULL);
+        tvSub(&delta, &now, &realBase);
+        usec = (uint64_t) ((((double) delta.tv_sec * 1000000.0) + delta.tv_usec) * clkScale);
+        delta.tv_sec = usec / 1000000;
+        delta.tv_usec = usec % 1000000;
+        tvAdd(tv, &virtBase, &delta);
+    } else {
+        pthread_mutex_lock(&virtNowLock);
+        *tv = virtNow;
+        pthread_mutex_unlock(&virtNowLock);
+    }
+}
+
+void clkStep(const struct timeval *delta)
+{
+    if (clkMode == stepTime) {
+        pthread_mutex_lock(&virtNowLock);
+        tvAdd(&virtNow, &virtNow, delta);
+        pthread_mutex_unlock(&virtNowLock);
+    }
+}
+
+void clkStepReq(void)
+{
+    numStepReqs++;
+}
+
+void clkSync(void)
+{
+    // Claim all the pending requests at once, so each
+    // one is applied only once even if several threads
+    // sync the clock at the same time.
+    int numSteps = __atomic_exchange_n(&numStepReqs, 0, __ATOMIC_ACQ_REL);
+
+    while (numSteps-- > 0) {
+        const struct timeval oneSec = { .tv_sec = 1, .tv_usec = 0 };
+        clkStep(&oneSec);
+    }
+}
+
+int clkRealMsec(const struct timeval *tv)
+{
+    double msec = ((double) tv->tv_sec * 1000.0) + (tv->tv_usec / 1000.0);
+
+    if (clkMode == scaledTime) {
+        msec /= clkScale;
+    }
+
+    // Round up, so a wait for a fraction of a millisecond
+    // doesn't turn into a busy poll() with a zero timeout.
+    return (int) ceil(msec);
+}
+
+ClkMode clkGetMode(void)
+{
+    return clkMode;
+}
@@ -0,0 +1,61 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <sys/time.h>
+
+#include "defs.h"
+
+// Clock mode
+typedef enum ClkMode {
+    realTime = 0,       // the clock follows the wall-clock time
+    scaledTime = 1,     // the clock runs N times faster than the wall-clock time
+    stepTime = 2,       // the clock only moves when explicitly stepped
+} ClkMode;
+
+__BEGIN_DECLS
+
+// Start the clock in the specified mode. The 'scale' factor
+// is only used in scaledTime mode.
+extern int clkInit(ClkMode mode, double scale);
+
+// Get the current time of the clock
+extern void clkGetTime(struct timeval *tv);
+
+// Advance the clock by the specified amount of time
+// (stepTime mode only).
+extern void clkStep(const struct timeval *delta);
+
+// Request a 1-sec step of the clock. This function is
+// async-signal-safe, so it can be called from a signal
+// handler.
+extern void clkStepReq(void);
+
+// Apply any pending step requests
+extern void clkSync(void);
+
+// Convert a time interval of the clock into the equivalent
+// wall-clock interval, in milliseconds, rounded up.
+extern int clkRealMsec(const struct timeval *tv);
+
+extern ClkMode clkGetMode(void);
+
+__END_DECLS
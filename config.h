@@ -25,6 +25,10 @@
 // Command Line Interface: adds an interactive CLI helpful for debugging
 #undef CONFIG_CLI
 
+// Control socket: allows a script or an orchestrator to drive the app
+// at runtime via a UNIX-domain socket.
+#define CONFIG_CTRL_SOCKET
+
 // Cycling Power Service: adds support for CPS in addition to FTMS
 #define CONFIG_CPS
 
@@ -32,6 +36,10 @@
 // to generate the cadence, heart rate, and power values.
 #define CONFIG_FIT_ACTIVITY_FILE
 
+// Live feed: allows an external process to drive the metrics of the
+// bikes in real time via a shared-memory ring.
+#define CONFIG_LIVE_FEED
+
 // mDNS Agent: allows the app to advertise the WFTNP service via its
 // own mDNS Agent, instead of using the native Avahi Daemon.
 #undef CONFIG_MDNS_AGENT
@@ -0,0 +1,676 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ctrl.h"
+#include "fmtbuf.h"
+#include "mlog.h"
+
+#ifdef CONFIG_CTRL_SOCKET
+
+// Max length of a request line
+#define CTRL_MAX_LINE   256
+
+// Max number of arguments of a request
+#define CTRL_MAX_ARGS   8
+
+// Max number of concurrent control connections
+#define CTRL_MAX_CONNS  16
+
+// Max length of a reply
+#define CTRL_MAX_REPLY  65536
+
+// Metrics that can be overridden through the control socket
+#define CTRL_CADENCE        0
+#define CTRL_HEART_RATE     1
+#define CTRL_POWER          2
+#define CTRL_SPEED          3
+#define CTRL_NUM_METRICS    4
+
+// Control state of a bike. It is written by the main thread,
+// and it is read at every tick by the bike and its sessions,
+// which may run in the worker threads, so all its fields are
+// accessed atomically.
+typedef struct CtrlBikeState {
+    uint32_t metricMask;                // metrics overridden (bitMask(CTRL_xxx))
+    uint32_t metrics[CTRL_NUM_METRICS]; // metric values (speed in [mm/s])
+    uint32_t seekGen;                   // bumped on every seek request
+    uint32_t seekTime;                  // activity time to seek to [sec]
+} CtrlBikeState;
+
+// Connection from a control client
+typedef struct CtrlConn {
+    TAILQ_ENTRY(CtrlConn) connListEnt;
+    int sockFd;
+    bool discard;                       // discarding the rest of an overlong line
+    int rxLen;                          // length of the partial line in rxBuf
+    char rxBuf[CTRL_MAX_LINE];
+} CtrlConn;
+
+typedef struct CtrlCmd {
+    const char *name;
+    const char *(*handler)(int argc, char *argv[], FmtBuf *reply);
+    int minArgCnt;
+    int maxArgCnt;
+    const char *args;
+} CtrlCmd;
+
+static struct {
+    Fleet *fleet;
+    const char *sockName;
+    int lsnSockFd;
+    TAILQ_HEAD(CtrlConnList, CtrlConn) connList;
+    int numConns;
+} ctrl;
+
+static CtrlBikeState ctrlBikeState[SERVER_MAX_BIKES];
+
+static char ctrlReplyBuf[CTRL_MAX_REPLY];
+
+static const char *ctrlMetricName[] = {
+    [CTRL_CADENCE] = "cadence",
+    [CTRL_HEART_RATE] = "hr",
+    [CTRL_POWER] = "power",
+    [CTRL_SPEED] = "speed",
+};
+
+// Max value of each metric that fits in the notifications
+static const double ctrlMetricMax[] = {
+    [CTRL_CADENCE] = 32767,     // 0.5 RPM units
+    [CTRL_HEART_RATE] = 255,    // 8-bit value
+    [CTRL_POWER] = 32767,       // signed 16-bit value
+    [CTRL_SPEED] = 655,         // 0.01 km/h units
+};
+
+static const char *ctrlHelp =
+    "activity <file>\n"
+    "    Load a new activity, and switch all the bikes over to it. The\n"
+    "    activity is loaded in the background, so the OK only means the\n"
+    "    loading has started: use activity-status to check the outcome.\n"
+    "activity-status\n"
+    "    Print the status of the activity loading, the generation of the\n"
+    "    current activity, and its number of trackpoints.\n"
+    "clear <bike>|all\n"
+    "    Stop overriding the metrics of the bike(s).\n"
+    "help\n"
+    "    Print this help.\n"
+    "hist <bike>\n"
+    "    Print the histogram of the lateness of the notification ticks.\n"
+    "    Not available in sharded mode.\n"
+    "log-level none|info|trace|debug\n"
+    "    Set the level of the messages logged.\n"
+    "seek <bike>|all <sec>\n"
+    "    Move the bike(s) to the specified time of the activity.\n"
+    "set <bike>|all <metric>=<val> [<metric>=<val>...]\n"
+    "    Override the metrics of the bike(s). The metrics are cadence\n"
+    "    (RPM, up to 32767), hr (BPM, up to 255), power (Watts, up to\n"
+    "    32767), and speed (km/h, up to 655).\n"
+    "stats\n"
+    "    Print the state and the message counts of the bikes.\n";
+
+// Parse the bike selector: either the number of a bike, or
+// "all" for all the bikes of the fleet.
+static int ctrlParseBikes(const char *arg, int *firstBike, int *lastBike)
+{
+    unsigned long bikeId;
+    char *end;
+
+    if (strcmp(arg, "all") == 0) {
+        *firstBike = 0;
+        *lastBike = ctrl.fleet->numBikes - 1;
+        return 0;
+    }
+
+    bikeId = strtoul(arg, &end, 10);
+    if ((end == arg) || (*end != '\0') || (bikeId >= ctrl.fleet->numBikes)) {
+        return -1;
+    }
+    *firstBike = *lastBike = bikeId;
+
+    return 0;
+}
+
+static Server *ctrlGetBike(int bikeId)
+{
+    Server *bike;
+
+    TAILQ_FOREACH(bike, &ctrl.fleet->bikeList, fleetEnt) {
+        if (bike->bikeId == bikeId) {
+            return bike;
+        }
+    }
+
+    return NULL;
+}
+
+static const char *ctrlCmdActivity(int argc, char *argv[], FmtBuf *reply)
+{
+    // The activity is loaded in the background, so the
+    // reply is sent before the bikes switch over to it.
+    if (serverSwapActivity(TAILQ_FIRST(&ctrl.fleet->bikeList), argv[1]) != 0) {
+        return "can't load activity";
+    }
+
+    return NULL;
+}
+
+static const char *ctrlCmdActStatus(int argc, char *argv[], FmtBuf *reply)
+{
+    ActStatus status;
+
+    serverGetActStatus(&status);
+    fmtBufAppend(reply, "loading=%d failed=%d gen=%u trkpts=%d\n",
+            status.loading, status.failed, status.gen, status.numTrkPts);
+
+    return NULL;
+}
+
+static const char *ctrlCmdClear(int argc, char *argv[], FmtBuf *reply)
+{
+    int firstBike, lastBike;
+
+    if (ctrlParseBikes(argv[1], &firstBike, &lastBike) != 0) {
+        return "invalid bike";
+    }
+
+    for (int bikeId = firstBike; bikeId <= lastBike; bikeId++) {
+        __atomic_store_n(&ctrlBikeState[bikeId].metricMask, 0, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static const char *ctrlCmdHelp(int argc, char *argv[], FmtBuf *reply)
+{
+    fmtBufAppend(reply, "%s", ctrlHelp);
+
+    return NULL;
+}
+
+static const char *ctrlCmdHist(int argc, char *argv[], FmtBuf *reply)
+{
+    int firstBike, lastBike;
+    const Server *bike;
+
+    // In sharded mode the ticks are run by the sessions,
+    // which are owned by the worker threads.
+    if (ctrl.fleet->numWorkers != 0) {
+        return "not available in sharded mode";
+    }
+
+    if ((ctrlParseBikes(argv[1], &firstBike, &lastBike) != 0) || (firstBike != lastBike)) {
+        return "invalid bike";
+    }
+    bike = ctrlGetBike(firstBike);
+
+    // Bin #N holds the ticks that were [2^(N-1), 2^N) usec
+    // late, and the last bin holds all the later ones.
+    for (int bin = 0; bin < SERVER_TICK_HIST_BINS; bin++) {
+        uint32_t lo = (bin != 0) ? bitMask(bin - 1) : 0;
+
+        if (bike->tickLateHist[bin] == 0) {
+            continue;
+        }
+        if (bin < (SERVER_TICK_HIST_BINS - 1)) {
+            fmtBufAppend(reply, "late-us=%u-%u count=%u\n", lo, bitMask(bin), bike->tickLateHist[bin]);
+        } else {
+            fmtBufAppend(reply, "late-us=%u- count=%u\n", lo, bike->tickLateHist[bin]);
+        }
+    }
+
+    return NULL;
+}
+
+static const char *ctrlCmdLogLevel(int argc, char *argv[], FmtBuf *reply)
+{
+    static const char *levelName[] = {
+        [none] = "none",
+        [info] = "info",
+        [trace] = "trace",
+        [debug] = "debug",
+    };
+
+    for (LogLevel level = none; level <= debug; level++) {
+        if (strcmp(argv[1], levelName[level]) == 0) {
+            msgLogSetLevel(level);
+            return NULL;
+        }
+    }
+
+    return "invalid log level";
+}
+
+static const char *ctrlCmdSeek(int argc, char *argv[], FmtBuf *reply)
+{
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    int firstBike, lastBike;
+    unsigned long time;
+    char *end;
+
+    if (ctrlParseBikes(argv[1], &firstBike, &lastBike) != 0) {
+        return "invalid bike";
+    }
+    time = strtoul(argv[2], &end, 10);
+    if ((end == argv[2]) || (*end != '\0') || (time > UINT32_MAX)) {
+        return "invalid time";
+    }
+
+    for (int bikeId = firstBike; bikeId <= lastBike; bikeId++) {
+        CtrlBikeState *state = &ctrlBikeState[bikeId];
+
+        __atomic_store_n(&state->seekTime, time, __ATOMIC_RELAXED);
+        __atomic_store_n(&state->seekGen, (state->seekGen + 1), __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+#else
+    return "activity files not supported";
+#endif
+}
+
+static const char *ctrlCmdSet(int argc, char *argv[], FmtBuf *reply)
+{
+    int firstBike, lastBike;
+    uint32_t metricMask = 0;
+    uint32_t metrics[CTRL_NUM_METRICS];
+
+    if (ctrlParseBikes(argv[1], &firstBike, &lastBike) != 0) {
+        return "invalid bike";
+    }
+
+    // Parse all the metrics first, so the request is
+    // either applied in full, or not at all.
+    for (int n = 2; n < argc; n++) {
+        char *val = strchr(argv[n], '=');
+        char *end;
+        double num;
+        int metric;
+
+        if (val == NULL) {
+            return "invalid metric";
+        }
+        *val++ = '\0';
+        for (metric = 0; metric < CTRL_NUM_METRICS; metric++) {
+            if (strcmp(argv[n], ctrlMetricName[metric]) == 0) {
+                break;
+            }
+        }
+        if (metric == CTRL_NUM_METRICS) {
+            return "invalid metric";
+        }
+        num = strtod(val, &end);
+        if ((end == val) || (*end != '\0') || (num < 0.0) || (num > ctrlMetricMax[metric])) {
+            return "invalid value";
+        }
+        metrics[metric] = (metric == CTRL_SPEED) ? (uint32_t) ((num * 1000.0 / 3.6) + 0.5) : (uint32_t) num;
+        metricMask |= bitMask(metric);
+    }
+
+    for (int bikeId = firstBike; bikeId <= lastBike; bikeId++) {
+        CtrlBikeState *state = &ctrlBikeState[bikeId];
+
+        for (int metric = 0; metric < CTRL_NUM_METRICS; metric++) {
+            if (bitTest(metric, metricMask)) {
+                __atomic_store_n(&state->metrics[metric], metrics[metric], __ATOMIC_RELAXED);
+            }
+        }
+        __atomic_store_n(&state->metricMask, (state->metricMask | metricMask), __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static const char *ctrlCmdStats(int argc, char *argv[], FmtBuf *reply)
+{
+    const Server *bike;
+
+    TAILQ_FOREACH(bike, &ctrl.fleet->bikeList, fleetEnt) {
+        const DirconSession *sess = &bike->dirconSession;
+
+        fmtBufAppend(reply, "bike=%d port=%u conn=%d state=%s power=%u cadence=%u hr=%u speed=%.1f rx=%u tx=%u",
+                bike->bikeId, ntohs(bike->srvAddr.sin_port), (sess->cliSockFd != 0), fmtIndBikeState(bike->indBikeState),
+                bike->power, bike->cadence, bike->heartRate, (bike->speed * 3.6), sess->rxMesgCnt, sess->txMesgCnt);
+        if (sess->relayLat.numSamples != 0) {
+            fmtBufAppend(reply, " relay-lat-us=%u/%u/%u", sess->relayLat.minLat,
+                    (uint32_t) (sess->relayLat.sumLat / sess->relayLat.numSamples), sess->relayLat.maxLat);
+        }
+        fmtBufAppend(reply, "\n");
+    }
+
+    // In sharded mode the sessions are owned by the worker
+    // threads, so only their number is reported.
+    for (int n = 0; n < ctrl.fleet->numWorkers; n++) {
+        const Worker *worker = &ctrl.fleet->workers[n];
+
+        fmtBufAppend(reply, "worker=%d sessions=%d\n", worker->workerId, __atomic_load_n(&worker->numSessions, __ATOMIC_RELAXED));
+    }
+
+    return NULL;
+}
+
+// Control command table
+static CtrlCmd ctrlCmdTbl[] = {
+    { "activity",       ctrlCmdActivity,            2,  2,              "<file>" },
+    { "activity-status", ctrlCmdActStatus,          1,  1,              NULL },
+    { "clear",          ctrlCmdClear,               2,  2,              "<bike>|all" },
+    { "help",           ctrlCmdHelp,                1,  1,              NULL },
+    { "hist",           ctrlCmdHist,                2,  2,              "<bike>" },
+    { "log-level",      ctrlCmdLogLevel,            2,  2,              "none|info|trace|debug" },
+    { "seek",           ctrlCmdSeek,                3,  3,              "<bike>|all <sec>" },
+    { "set",            ctrlCmdSet,                 3,  CTRL_MAX_ARGS,  "<bike>|all <metric>=<val> [<metric>=<val>...]" },
+    { "stats",          ctrlCmdStats,               1,  1,              NULL },
+    { NULL,             NULL,                       0,  0,              NULL },
+};
+
+static void ctrlCloseConn(CtrlConn *conn)
+{
+    evLoopDelFd(&ctrl.fleet->evLoop, conn->sockFd);
+    close(conn->sockFd);
+    TAILQ_REMOVE(&ctrl.connList, conn, connListEnt);
+    ctrl.numConns--;
+    free(conn);
+}
+
+static int ctrlSendReply(CtrlConn *conn, const FmtBuf *reply)
+{
+    // The replies are short, so they always fit in the
+    // socket buffer, unless the client has stopped reading
+    // them.
+    if (send(conn->sockFd, reply->buf, reply->offset, MSG_NOSIGNAL) != reply->offset) {
+        mlog(error, "Failed to send control reply!");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Run the command in the request line, and send back
+// its reply.
+static int ctrlProcLine(CtrlConn *conn, char *line)
+{
+    FmtBuf reply;
+    char *argv[CTRL_MAX_ARGS];
+    char *savePtr;
+    const char *err = "unknown command";
+    int argc = 0;
+
+    for (char *arg = strtok_r(line, " \t\r", &savePtr); arg != NULL; arg = strtok_r(NULL, " \t\r", &savePtr)) {
+        if (argc == CTRL_MAX_ARGS) {
+            argc++;
+            break;
+        }
+        argv[argc++] = arg;
+    }
+    if (argc == 0) {
+        // Empty line
+        return 0;
+    }
+
+    fmtBufInit(&reply, ctrlReplyBuf, sizeof (ctrlReplyBuf));
+    for (const CtrlCmd *cmd = &ctrlCmdTbl[0]; cmd->name != NULL; cmd++) {
+        if (strcmp(argv[0], cmd->name) == 0) {
+            if ((argc >= cmd->minArgCnt) && (argc <= cmd->maxArgCnt)) {
+                err = (*cmd->handler)(argc, argv, &reply);
+            } else {
+                fmtBufAppend(&reply, "usage: %s %s\n", cmd->name, (cmd->args != NULL) ? cmd->args : "");
+                err = "invalid syntax";
+            }
+            break;
+        }
+    }
+    if (reply.offset >= (reply.bufSize - 64)) {
+        // Truncated reply
+        fmtBufClear(&reply);
+        err = "reply too long";
+    }
+    fmtBufAppend(&reply, (err == NULL) ? "OK\n" : "ERR %s\n", err);
+
+    return ctrlSendReply(conn, &reply);
+}
+
+static void ctrlProcConnEvent(void *arg, int fd, short revents)
+{
+    CtrlConn *conn = arg;
+    char *line = conn->rxBuf;
+    char *eol;
+    ssize_t n;
+
+    if ((n = recv(fd, (conn->rxBuf + conn->rxLen), (sizeof (conn->rxBuf) - conn->rxLen), 0)) <= 0) {
+        if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+            return;
+        }
+        // Connection closed by the client
+        ctrlCloseConn(conn);
+        return;
+    }
+    conn->rxLen += n;
+
+    // Run all the complete request lines received so far
+    while ((eol = memchr(line, '\n', ((conn->rxBuf + conn->rxLen) - line))) != NULL) {
+        *eol = '\0';
+        if (conn->discard) {
+            conn->discard = false;
+        } else if (ctrlProcLine(conn, line) != 0) {
+            ctrlCloseConn(conn);
+            return;
+        }
+        line = eol + 1;
+    }
+    conn->rxLen -= (line - conn->rxBuf);
+    memmove(conn->rxBuf, line, conn->rxLen);
+
+    if (conn->rxLen == sizeof (conn->rxBuf)) {
+        // No room left for the rest of the line: reject
+        // it, and skip up to its end.
+        if (!conn->discard) {
+            FmtBuf reply;
+
+            fmtBufInit(&reply, ctrlReplyBuf, sizeof (ctrlReplyBuf));
+            fmtBufAppend(&reply, "ERR line too long\n");
+            if (ctrlSendReply(conn, &reply) != 0) {
+                ctrlCloseConn(conn);
+                return;
+            }
+        }
+        conn->discard = true;
+        conn->rxLen = 0;
+    }
+}
+
+static void ctrlProcLsnSockEvent(void *arg, int fd, short revents)
+{
+    CtrlConn *conn;
+    int sockFd;
+
+    if ((sockFd = accept4(fd, NULL, NULL, (SOCK_NONBLOCK | SOCK_CLOEXEC))) < 0) {
+        mlog(error, "accept() failed!");
+        return;
+    }
+
+    if (ctrl.numConns == CTRL_MAX_CONNS) {
+        mlog(info, "Too many control connections!");
+        close(sockFd);
+        return;
+    }
+
+    if ((conn = calloc(1, sizeof (CtrlConn))) == NULL) {
+        mlog(error, "Failed to alloc control connection!");
+        close(sockFd);
+        return;
+    }
+    conn->sockFd = sockFd;
+
+    if (evLoopAddFd(&ctrl.fleet->evLoop, sockFd, POLLIN, ctrlProcConnEvent, conn) != 0) {
+        close(sockFd);
+        free(conn);
+        return;
+    }
+    TAILQ_INSERT_TAIL(&ctrl.connList, conn, connListEnt);
+    ctrl.numConns++;
+}
+
+// Check whether some process is listening on the socket
+static bool ctrlSockInUse(const struct sockaddr_un *addr)
+{
+    bool inUse;
+    int sd;
+
+    if ((sd = socket(AF_UNIX, (SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0)) < 0) {
+        return false;
+    }
+
+    // A full backlog also means someone is listening
+    inUse = (connect(sd, (const struct sockaddr *) addr, sizeof (*addr)) == 0) || (errno == EAGAIN);
+    close(sd);
+
+    return inUse;
+}
+
+int ctrlInit(Fleet *fleet, const char *sockName)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+    int sockFd;
+
+    ctrl.fleet = fleet;
+    TAILQ_INIT(&ctrl.connList);
+
+    if (strlen(sockName) >= sizeof (addr.sun_path)) {
+        mlog(error, "Control socket name %s is too long!", sockName);
+        return -1;
+    }
+    strcpy(addr.sun_path, sockName);
+
+    // Remove the socket left behind by a previous run, but
+    // don't clobber any other kind of file, nor the socket
+    // of another instance that is still listening on it.
+    if ((lstat(sockName, &st) == 0) && S_ISSOCK(st.st_mode)) {
+        if (ctrlSockInUse(&addr)) {
+            mlog(error, "Control socket %s is in use!", sockName);
+            return -1;
+        }
+        unlink(sockName);
+    }
+
+    if ((sockFd = socket(AF_UNIX, (SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0)) < 0) {
+        mlog(error, "Failed to create control socket!");
+        return -1;
+    }
+
+    if (bind(sockFd, (struct sockaddr *) &addr, sizeof (addr)) != 0) {
+        mlog(error, "Failed to bind control socket to %s!", sockName);
+        close(sockFd);
+        return -1;
+    }
+
+    if (listen(sockFd, CTRL_MAX_CONNS) != 0) {
+        mlog(error, "Failed to listen on control socket!");
+        close(sockFd);
+        unlink(sockName);
+        return -1;
+    }
+
+    if (evLoopAddFd(&fleet->evLoop, sockFd, POLLIN, ctrlProcLsnSockEvent, NULL) != 0) {
+        close(sockFd);
+        unlink(sockName);
+        return -1;
+    }
+
+    ctrl.lsnSockFd = sockFd;
+    ctrl.sockName = sockName;
+
+    mlog(info, "Control socket listening on %s", sockName);
+
+    return 0;
+}
+
+void ctrlCleanup(void)
+{
+    CtrlConn *conn;
+
+    if (ctrl.sockName == NULL) {
+        return;
+    }
+
+    while ((conn = TAILQ_FIRST(&ctrl.connList)) != NULL) {
+        ctrlCloseConn(conn);
+    }
+
+    evLoopDelFd(&ctrl.fleet->evLoop, ctrl.lsnSockFd);
+    close(ctrl.lsnSockFd);
+    unlink(ctrl.sockName);
+    ctrl.sockName = NULL;
+}
+
+uint32_t ctrlSeekGen(int bikeId)
+{
+    return __atomic_load_n(&ctrlBikeState[bikeId].seekGen, __ATOMIC_ACQUIRE);
+}
+
+void ctrlSeekActivity(Server *server)
+{
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    const CtrlBikeState *state = &ctrlBikeState[server->bikeId];
+    uint32_t seekGen = __atomic_load_n(&state->seekGen, __ATOMIC_ACQUIRE);
+
+    if (seekGen != server->ctrlSeekGen) {
+        uint32_t seekTime = __atomic_load_n(&state->seekTime, __ATOMIC_RELAXED);
+
+        trkPtCursorSeek(&server->trkPtCursor, seekTime);
+        server->ctrlSeekGen = seekGen;
+        mlog(info, "Bike #%d: moved to activity time %u [s]", server->bikeId, seekTime);
+    }
+#endif
+}
+
+void ctrlOverrideMetrics(Server *server)
+{
+    const CtrlBikeState *state = &ctrlBikeState[server->bikeId];
+    uint32_t metricMask = __atomic_load_n(&state->metricMask, __ATOMIC_ACQUIRE);
+
+    if (metricMask == 0) {
+        return;
+    }
+
+    if (bitTest(CTRL_CADENCE, metricMask)) {
+        server->cadence = __atomic_load_n(&state->metrics[CTRL_CADENCE], __ATOMIC_RELAXED);
+    }
+    if (bitTest(CTRL_HEART_RATE, metricMask)) {
+        server->heartRate = __atomic_load_n(&state->metrics[CTRL_HEART_RATE], __ATOMIC_RELAXED);
+    }
+    if (bitTest(CTRL_POWER, metricMask)) {
+        server->power = __atomic_load_n(&state->metrics[CTRL_POWER], __ATOMIC_RELAXED);
+    }
+    if (bitTest(CTRL_SPEED, metricMask)) {
+        server->speed = (double) __atomic_load_n(&state->metrics[CTRL_SPEED], __ATOMIC_RELAXED) / 1000.0;
+    }
+}
+
+#endif  // CONFIG_CTRL_SOCKET
@@ -0,0 +1,54 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "config.h"
+#include "fleet.h"
+#include "server.h"
+
+#ifdef CONFIG_CTRL_SOCKET
+
+// Control socket: a UNIX-domain stream socket, served from
+// the event loop of the main thread, that lets a script or
+// an orchestrator drive the simulator at runtime. Each
+// request is a single line of text with a command and its
+// arguments. The reply has zero or more lines of data, and
+// it ends with a line that is either "OK" or "ERR <reason>".
+// See ctrlHelp for the supported commands.
+
+__BEGIN_DECLS
+
+extern int ctrlInit(Fleet *fleet, const char *sockName);
+extern void ctrlCleanup(void);
+
+// Generation of the last seek requested for the bike
+extern uint32_t ctrlSeekGen(int bikeId);
+
+// Move the rider to the requested activity time, if a
+// seek has been requested since the last call.
+extern void ctrlSeekActivity(Server *server);
+
+// Override the metrics of the rider with the ones set
+// through the control socket (if any).
+extern void ctrlOverrideMetrics(Server *server);
+
+__END_DECLS
+
+#endif  // CONFIG_CTRL_SOCKET
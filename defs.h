@@ -64,5 +64,16 @@ static __inline__ void tvSub(struct timeval *result, const struct timeval *x, co
     }
 }
 
+// Add two timeval values.
+static __inline__ void tvAdd(struct timeval *result, const struct timeval *x, const struct timeval *y)
+{
+    result->tv_sec = x->tv_sec + y->tv_sec;
+    result->tv_usec = x->tv_usec + y->tv_usec;
+    if (result->tv_usec >= 1000000L) {
+        result->tv_sec++;
+        result->tv_usec -= 1000000L;
+    }
+}
+
 __END_DECLS
 
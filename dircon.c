@@ -25,11 +25,14 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "clock.h"
 #include "cps.h"
+#include "ctrl.h"
 #include "dircon.h"
 #include "dump.h"
 #include "ftms.h"
 #include "mlog.h"
+#include "recorder.h"
 #include "server.h"
 
 // GET signed values
@@ -127,7 +130,7 @@ static int dirconSendMesg(Server *server, DirconSession *sess, MesgType mesgType
 
     sess->txMesgCnt++;
 
-    gettimeofday(&timestamp, NULL);
+    clkGetTime(&timestamp);
 
     if (mesgType == request) {
         mlog(debug, "mesgId=%u seqNum=%u mesgLen=%u", mesg->mesgId, mesg->seqNum, mesg->mesgLen);
@@ -198,7 +201,7 @@ int dirconSendReadCharacteristicMesg(Server *server, DirconSession *sess, const
 }
 
 #ifdef CONFIG_CPS
-static uint16_t initCpmData(Server *server, CycPowerMeas *cpm)
+uint16_t initCpmData(Server *server, CycPowerMeas *cpm)
 {
     uint16_t flags = CPM_PEDAL_POWER_BALANCE | CPM_PEDAL_POWER_BALANCE_REFERENCE | CPM_CRANK_REVOLUTION_DATA;
 
@@ -221,17 +224,30 @@ static uint16_t initCpmData(Server *server, CycPowerMeas *cpm)
 }
 #endif
 
-static uint16_t initIbdData(Server *server, IndoorBikeData *ibd)
+uint16_t initIbdData(Server *server, IndoorBikeData *ibd)
 {
     uint16_t flags = IBD_INSTANTANEOUS_CADENCE | IBD_INSTANTANEOUS_POWER | IBD_HEART_RATE;
+    uint8_t *data = ibd->data;
+
+    if (server->physics) {
+        flags |= IBD_TOTAL_DISTANCE;
+    }
 
     putUINT16(ibd->flags, flags);
-    putUINT16(&ibd->data[0], server->speed * 3.6 * 100);    // speed [km/h] X 100
-    putUINT16(&ibd->data[2], server->cadence * 2);          // cadence [RPM] X 2
-    putUINT16(&ibd->data[4], server->power);                // power [W]
-    putUINT8(&ibd->data[6], server->heartRate);             // HR [BPM]
+    putUINT16(data, server->speed * 3.6 * 100);     // speed [km/h] X 100
+    data += 2;
+    putUINT16(data, server->cadence * 2);           // cadence [RPM] X 2
+    data += 2;
+    if (flags & IBD_TOTAL_DISTANCE) {
+        putUINT24(data, server->phyState.distance); // distance [m]
+        data += 3;
+    }
+    putUINT16(data, server->power);                 // power [W]
+    data += 2;
+    putUINT8(data, server->heartRate);              // HR [BPM]
+    data += 1;
 
-    return (sizeof (IndoorBikeData) + 7);
+    return (sizeof (IndoorBikeData) + (data - ibd->data));
 }
 
 static int dirconSendUnsolicitedCharacteristicNotificationMesg(Server *server, DirconSession *sess, uint16_t charUuid)
@@ -265,11 +281,61 @@ int dirconProcTimers(Server *server, const struct timeval *time)
     DirconSession *sess = &server->dirconSession;
 
     if ((sess->nextClkTick.tv_sec != 0) && (tvCmp(time, &sess->nextClkTick) >= 0)) {
+        struct timeval late;
+        int bin = 0;
+
+        // Track how late the tick is. Bin #N holds the ticks
+        // that were [2^(N-1), 2^N) usec late.
+        tvSub(&late, time, &sess->nextClkTick);
+        if (late.tv_sec != 0) {
+            bin = SERVER_TICK_HIST_BINS - 1;
+        } else if (late.tv_usec != 0) {
+            bin = 32 - __builtin_clz(late.tv_usec);
+            if (bin >= SERVER_TICK_HIST_BINS) {
+                bin = SERVER_TICK_HIST_BINS - 1;
+            }
+        }
+        server->tickLateHist[bin]++;
+
         // Send out all applicable notifications
         if (sess->cpmNotificationsEnabled || sess->ibdNotificationsEnabled) {
+            bool dropout = false;
+            bool trkPtMetrics = false;
+            bool wkoMetrics = false;
+
+            if (server->workout != NULL) {
+                const WkoStep *step = wkoLookup(server->workout, &server->wkoCursor);
+
+                if ((step != NULL) && !step->freeRide) {
+                    // Follow the structured workout: drive the
+                    // metrics from its current step, instead of
+                    // from the activity.
+                    server->power = wkoPower(step, &server->wkoCursor);
+                    if (step->cadence != 0) {
+                        server->cadence = step->cadence;
+                    } else if (server->cadence == 0) {
+                        server->cadence = ERG_DEF_CADENCE;
+                    }
+                    wkoMetrics = true;
+                }
+                if (server->indBikeState == started) {
+                    // The workout only progresses while the
+                    // bike is started, and it holds its step
+                    // while the bike is paused or stopped.
+                    server->wkoCursor.elapsed++;
+                }
+            }
+
 #ifdef CONFIG_FIT_ACTIVITY_FILE
-            {
-                TrkPt *tp = TAILQ_FIRST(&server->trkPtList);
+            // If the activity has been swapped, switch over
+            // to the new one at this tick boundary.
+            serverSyncActivity(server);
+#ifdef CONFIG_CTRL_SOCKET
+            ctrlSeekActivity(server);
+#endif
+
+            if (!wkoMetrics) {
+                const TrkPt *tp = trkPtCursorGet(&server->trkPtCursor);
 
                 if (tp != NULL) {
                     // Override the static metrics with the values
@@ -278,25 +344,84 @@ int dirconProcTimers(Server *server, const struct timeval *time)
                     server->heartRate = tp->heartRate;
                     server->power = tp->power;
                     server->speed = tp->speed;
+                    trkPtMetrics = true;
+
+                    if (server->trkPtCursor.paused) {
+                        // The rider is stopped
+                        server->cadence = server->power = 0;
+                        server->speed = 0.0;
+                    }
+
+                    // Make this rider different from all the
+                    // others replaying the same activity.
+                    dropout = perturbApply(&server->perturb, &server->cadence,
+                                           &server->heartRate, &server->power);
 
-                    // If the activity is in-progress, remove this
-                    // trackpoint and move on to the next one...
+                    // If the activity is in-progress, move the
+                    // cursor on by the time elapsed since the
+                    // last tick. The trackpoints themselves are
+                    // shared by all the bikes and sessions, so
+                    // they are left untouched.
                     if (server->actInProg) {
-                        TAILQ_REMOVE(&server->trkPtList, tp, tqEntry);
-                        trkPtFree(tp);
+                        trkPtCursorUpdate(&server->trkPtCursor, time);
+                    }
+                }
+            }
+#endif
+
+            if ((server->synthParms.model != synthNone) && !trkPtMetrics && !wkoMetrics) {
+                // Generate the metrics of the synthetic
+                // workload of this rider.
+                synthUpdate(&server->synth, &server->cadence, &server->heartRate, &server->power);
+            }
+
+#ifdef CONFIG_LIVE_FEED
+            if (server->liveFeed != NULL) {
+                LiveMetrics live;
+                bool active = liveFeedRead(server->liveFeed, server->bikeId, &live);
+
+                if (active) {
+                    // The live feed overrides the metrics from
+                    // all the other sources.
+                    server->cadence = live.cadence;
+                    server->heartRate = live.heartRate;
+                    server->power = live.power;
+                    if (live.speedValid) {
+                        server->speed = live.speed;
                     }
                 }
+                if (active != server->liveFeedActive) {
+                    mlog(info, "Bike #%d: live feed %s", server->bikeId, active ? "active" : "inactive");
+                    server->liveFeedActive = active;
+                }
+            }
+#endif
+
+#ifdef CONFIG_CTRL_SOCKET
+            // The metrics set through the control socket
+            // override all the others.
+            ctrlOverrideMetrics(server);
+#endif
+
+            // Apply the ERG mode and the bike dynamics
+            // model (if enabled) to the metrics.
+            serverUpdRideMetrics(server, 1.0);
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            // Record the metrics being sent
+            if (!dropout) {
+                recMetrics(server, sess, time->tv_sec);
             }
 #endif
 
 #ifdef CONFIG_CPS
-            if (sess->cpmNotificationsEnabled) {
+            if (sess->cpmNotificationsEnabled && !dropout) {
                 // Send Cycling Power Measurement notification
                 dirconSendUnsolicitedCharacteristicNotificationMesg(server, sess, cyclingPowerMeasurement);
             }
 #endif
 
-            if (sess->ibdNotificationsEnabled) {
+            if (sess->ibdNotificationsEnabled && !dropout) {
                 // Send an Indoor Bike Data notification
                 dirconSendUnsolicitedCharacteristicNotificationMesg(server, sess, indoorBikeData);
             }
@@ -435,6 +560,11 @@ static int dirconProcReadCharacteristicMesg(Server *server, DirconSession *sess,
         FitMachFeat *fmf = (FitMachFeat *) resp->data;
         uint32_t fmFeat = FMF_CADENCE | FMF_HEART_RATE_MEASURMENT | FMF_POWER_MEASUREMENT;
         uint32_t tsFeat = TSF_POWER | TSF_INDOOR_BIKE_SIM_PARMS;
+        if (server->physics) {
+            // The total distance is only reported when it
+            // is computed by the physics model.
+            fmFeat |= FMF_TOTAL_DISTANCE;
+        }
         putUINT32(fmf->fmFeat, fmFeat);
         putUINT32(fmf->tsFeat, tsFeat);
         resp->hdr.mesgLen += sizeof (FitMachFeat);
@@ -497,12 +627,18 @@ static int dirconProcWriteCharacteristicMesg(Server *server, DirconSession *sess
         } else if (fmcp->opCode == FMCP_RESET) {
             server->controlGranted = false;
             server->indBikeState = stopped;
+            serverExitErgMode(server);
+            phyInit(&server->phyState, server->mass);
 #ifdef CONFIG_CPS
             server->cumulativeCrankRevolutions = 0;
             server->lastCrankEventTime = 0;
 #endif
         } else if (fmcp->opCode == FMCP_SET_TGT_POWER) {
-            // TBD
+            int tgtPower = getSINT16(fmcp->parm);
+            mlog(trace, "SET_TGT_POWER: tgtPower: %d [W]", tgtPower);
+            if (serverSetTgtPower(server, tgtPower) != 0) {
+                resultCode = FMCP_RC_INVALID_PARAMETER;
+            }
         } else if (fmcp->opCode == FMCP_START_OR_RESUME) {
             // Update indoor bike state
             if ((server->indBikeState == stopped) || (server->indBikeState == paused)) {
@@ -513,6 +649,7 @@ static int dirconProcWriteCharacteristicMesg(Server *server, DirconSession *sess
             // Update indoor bike state
             if (param == FMCP_STOP) {
                 server->indBikeState = stopped;
+                serverExitErgMode(server);
             } else if (param == FMCP_PAUSE) {
                 if (server->indBikeState != stopped) {
                     server->indBikeState = paused;
@@ -520,11 +657,13 @@ static int dirconProcWriteCharacteristicMesg(Server *server, DirconSession *sess
             }
         } else if (fmcp->opCode == FMCP_SET_INDOOR_BIKE_SIM_PARMS) {
             const IndBikeSimParms *ibsp = (IndBikeSimParms *) fmcp->parm;
+            double windSpeed = getSINT16(ibsp->windSpeed) / 1000.0;
+            double grade = getSINT16(ibsp->grade) / 100.0;
+            double crr = ibsp->crr / 10000.0;
+            double cw = ibsp->cw / 100.0;
             mlog(trace, "SET_INDOOR_BIKE_SIM_PARMS: windSpeed: %.3lf [mps], gradient: %.3lf [%%], crr: %.5lf, cw: %.3lf [kg/m]",
-                    (getUINT16(ibsp->windSpeed) / 1000.0),
-                    (getSINT16(ibsp->grade) / 100.0),
-                    (ibsp->crr / 10000.0),
-                    (ibsp->cw / 100.0));
+                    windSpeed, grade, crr, cw);
+            serverSetSimParms(server, windSpeed, grade, crr, cw);
             if ((server->indBikeState == started) && !server->actInProg) {
                 // Some virtual cycling apps send a "dummy"
                 // SET_INDOOR_BIKE_SIM_PARMS before the activity
@@ -557,6 +696,15 @@ static int dirconProcWriteCharacteristicMesg(Server *server, DirconSession *sess
             mlog(info, "Indoor bike state change: %s -> %s", fmtIndBikeState(currIndBikeState), fmtIndBikeState(server->indBikeState));
         }
 
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+        {
+            // Record the command
+            int numParmBytes = mesg->mesgLen - sizeof (writeChar->charUuid) - sizeof (fmcp->opCode);
+            uint16_t param = (numParmBytes >= 2) ? getUINT16(fmcp->parm) : (numParmBytes == 1) ? fmcp->parm[0] : 0;
+            recFmcpEvent(server, sess, fmcp->opCode, param);
+        }
+#endif
+
         // Schedule the NOTIFICATION that follows the WRITE Response
         schedFmcpNotification(server, chr, fmcp->opCode, resultCode);
     } else {
@@ -588,7 +736,7 @@ static int dirconProcEnableCharacteristicNotificationsMesg(Server *server, Dirco
         return dirconSendErrorResp(server, sess, mesg, CharacteristicOperationNotSupported, &enCharNot->charUuid);
     }
 
-    gettimeofday(&now, NULL);
+    clkGetTime(&now);
 
     bool enable = (enCharNot->enable & 0x01) ? true : false;
     EnCharNotMesg *resp = (EnCharNotMesg *) dirconInitMesg(server, mesg->mesgId, mesg->seqNum, SuccessRequest);
@@ -596,6 +744,15 @@ static int dirconProcEnableCharacteristicNotificationsMesg(Server *server, Dirco
     resp->enable = enCharNot->enable;
     resp->hdr.mesgLen = sizeof (resp->charUuid);
 
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    if (enable) {
+        // The playback resumes at the next notification
+        // tick, without catching up with the time it was
+        // idle.
+        trkPtCursorResync(&server->trkPtCursor);
+    }
+#endif
+
 #ifdef CONFIG_CPS
     if (chr->uuid16 == cyclingPowerMeasurement) {
         // Cycling Power Measurement
@@ -646,7 +803,7 @@ int dirconProcMesg(Server *server)
     int n, mesgLen;
     MesgType mesgType;
 
-    gettimeofday(&sess->rxMesgTimestamp, NULL);
+    clkGetTime(&sess->rxMesgTimestamp);
 
     // Read the message header
     if ((n = recv(sess->cliSockFd, mesg, sizeof (DirconMesg), 0)) != sizeof (DirconMesg)) {
@@ -22,6 +22,8 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include "cps.h"
+#include "ftms.h"
 #include "server.h"
 #include "uuid.h"
 
@@ -193,6 +195,11 @@ extern void putUINT16(uint8_t *data, uint16_t value);
 extern void putUINT24(uint8_t *data, uint32_t value);
 extern void putUINT32(uint8_t *data, uint32_t value);
 
+#ifdef CONFIG_CPS
+extern uint16_t initCpmData(Server *server, CycPowerMeas *cpm);
+#endif
+extern uint16_t initIbdData(Server *server, IndoorBikeData *ibd);
+
 extern int dirconInit(Server *server);
 extern int dirconProcConnReq(Server *server);
 extern int dirconProcConnDrop(Server *server);
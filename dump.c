@@ -29,10 +29,10 @@
 #include "ftms.h"
 #include "uuid.h"
 
-// Static FmtBuf used to dump the dissected message data
-static char dumpStrBuf[2048];
-static FmtBuf dumpFmtBuf;
-static FmtBuf *fmtBuf = &dumpFmtBuf;
+// Per-thread FmtBuf used to dump the dissected message data
+static __thread char dumpStrBuf[2048];
+static __thread FmtBuf dumpFmtBuf;
+static __thread FmtBuf *fmtBuf;
 
 static const char *fmtMesgDir(MesgDir dir)
 {
@@ -83,7 +83,7 @@ static const char *fmtRespCode(DirconRespCode respCode)
 
 static const char *fmtCharProp(uint8_t prop)
 {
-    static char fmtBuf[64];
+    static __thread char fmtBuf[64];
     int len = sizeof (fmtBuf);
     int n = 0;
     if (prop & DIRCON_CHAR_PROP_READ)
@@ -100,7 +100,7 @@ static const char *fmtCharProp(uint8_t prop)
 
 static const char *fmtIndBikeSimParms(const IndBikeSimParms *ibsp)
 {
-    static char buf[128];
+    static __thread char buf[128];
     FmtBuf fmtBuf;
 
     fmtBufInit(&fmtBuf, buf, sizeof (buf));
@@ -166,7 +166,7 @@ const char *fmtFmcpResultCode(uint8_t resCode)
 
 static const char *fmtFitMachCP(const FitMachCP *fmcp, int fmcpLen)
 {
-    static char buf[512];
+    static __thread char buf[512];
     FmtBuf fmtBuf;
     int parmLen = fmcpLen - sizeof (FitMachCP);
 
@@ -193,7 +193,7 @@ static const char *fmtFitMachCP(const FitMachCP *fmcp, int fmcpLen)
 
 static const char *fmtIndoorBikeData(const IndoorBikeData *ibd, size_t ibdLen)
 {
-    static char buf[512];
+    static __thread char buf[512];
     FmtBuf fmtBuf;
     uint16_t flags = getUINT16(ibd->flags);
     BinBuf binBuf;
@@ -405,6 +405,7 @@ void dirconDumpMesg(const struct timeval *pTs, Server *server, const DirconSessi
 
         printf("\n");
 
+        fmtBuf = &dumpFmtBuf;
         fmtBufInit(fmtBuf, dumpStrBuf, sizeof (dumpStrBuf));
 
         tvSub(&relTs, pTs, &server->baseTime);
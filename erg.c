@@ -0,0 +1,113 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+
+#include "erg.h"
+
+// This models how the power reported by a smart trainer in
+// ERG mode settles on a new target power: either right away,
+// with a first-order lag, or with the under-damped response
+// (overshoot and ringing) of a trainer with an aggressive
+// brake controller.
+
+#define ERG_DAMPING     0.4     // damping ratio of the ergOvershoot response
+#define ERG_MAX_STEP    0.05    // max integration step of the ergOvershoot response [s]
+
+void ergInit(ErgState *erg, ErgProfile profile, double timeConst)
+{
+    erg->profile = profile;
+    erg->timeConst = timeConst;
+    erg->target = 0.0;
+    erg->power = 0.0;
+    erg->rate = 0.0;
+    erg->active = false;
+}
+
+void ergStart(ErgState *erg, uint16_t currPower)
+{
+    erg->target = currPower;
+    erg->power = currPower;
+    erg->rate = 0.0;
+    erg->active = true;
+}
+
+void ergSetTarget(ErgState *erg, uint16_t target)
+{
+    erg->target = target;
+}
+
+void ergExit(ErgState *erg)
+{
+    erg->active = false;
+    erg->rate = 0.0;
+}
+
+uint16_t ergUpdate(ErgState *erg, double dt)
+{
+    if (erg->profile == ergStep) {
+        erg->power = erg->target;
+    } else if (erg->profile == ergLag) {
+        erg->power += (erg->target - erg->power) * (1.0 - exp(-dt / erg->timeConst));
+    } else {
+        // x'' = w^2 * (target - x) - 2 * zeta * w * x'
+        double w = 2.0 / erg->timeConst;
+        int numSteps = (dt > 0.0) ? (int) ceil(dt / ERG_MAX_STEP) : 1;
+        double h = dt / numSteps;
+
+        for (int n = 0; n < numSteps; n++) {
+            double accel = (w * w * (erg->target - erg->power)) - (2.0 * ERG_DAMPING * w * erg->rate);
+            erg->rate += accel * h;
+            erg->power += erg->rate * h;
+        }
+    }
+
+    if (erg->power < 0.0) {
+        erg->power = 0.0;
+    }
+
+    return (uint16_t) lround(erg->power);
+}
+
+uint16_t ergCadence(const ErgState *erg)
+{
+    double cadence = ERG_DEF_CADENCE + ((erg->power - ERG_REF_POWER) * ERG_CADENCE_SLOPE);
+
+    if (cadence < ERG_MIN_CADENCE) {
+        cadence = ERG_MIN_CADENCE;
+    } else if (cadence > ERG_MAX_CADENCE) {
+        cadence = ERG_MAX_CADENCE;
+    }
+
+    return (uint16_t) lround(cadence);
+}
+
+const char *fmtErgProfile(ErgProfile profile)
+{
+    if (profile == ergStep) {
+        return "step";
+    } else if (profile == ergLag) {
+        return "lag";
+    } else if (profile == ergOvershoot) {
+        return "overshoot";
+    }
+
+    return "???";
+}
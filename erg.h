@@ -0,0 +1,86 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defs.h"
+
+// Default ERG response time constant [s]
+#define ERG_DEF_TIME_CONST  2.0
+
+// Cadence used when the rider's cadence is unknown [RPM]
+#define ERG_DEF_CADENCE     90
+
+// In ERG mode the rider's cadence follows the power: it's
+// ERG_DEF_CADENCE at ERG_REF_POWER, and it changes by
+// ERG_CADENCE_SLOPE per Watt, within the min/max cadence.
+#define ERG_REF_POWER       200     // [W]
+#define ERG_CADENCE_SLOPE   0.08    // [RPM/W]
+#define ERG_MIN_CADENCE     60      // [RPM]
+#define ERG_MAX_CADENCE     110     // [RPM]
+
+// ERG response profile
+typedef enum ErgProfile {
+    ergStep = 0,        // the power jumps to the target right away
+    ergLag = 1,         // first-order lag towards the target
+    ergOvershoot = 2,   // under-damped second-order response
+} ErgProfile;
+
+// ERG mode state
+typedef struct ErgState {
+    ErgProfile profile;
+    double timeConst;   // response time constant [s]
+    double target;      // target power [W]
+    double power;       // current power [W]
+    double rate;        // rate of change of the power [W/s] (ergOvershoot)
+    bool active;
+
+    // Rider's metrics before entering ERG mode, which
+    // are restored when exiting ERG mode.
+    uint16_t baseCadence;
+    uint16_t basePower;
+    double baseSpeed;
+} ErgState;
+
+__BEGIN_DECLS
+
+extern void ergInit(ErgState *erg, ErgProfile profile, double timeConst);
+
+// Enter ERG mode. The current power is the starting point
+// of the response.
+extern void ergStart(ErgState *erg, uint16_t currPower);
+
+extern void ergSetTarget(ErgState *erg, uint16_t target);
+
+extern void ergExit(ErgState *erg);
+
+// Advance the response by the specified time interval (in
+// seconds), and return the new power.
+extern uint16_t ergUpdate(ErgState *erg, double dt);
+
+// Cadence of the rider at the current power
+extern uint16_t ergCadence(const ErgState *erg);
+
+extern const char *fmtErgProfile(ErgProfile profile);
+
+__END_DECLS
@@ -0,0 +1,258 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "evloop.h"
+#include "mlog.h"
+
+// The event loop multiplexes the I/O of all the sockets
+// of the app (or of a worker thread), and runs all its
+// timers. The timers are kept in a hashed timer wheel
+// indexed by their expiry tick, so arming, stopping and
+// expiring a timer is O(1) regardless of the number of
+// timers (e.g. one per bike in fleet mode).
+
+static uint64_t evTick(const struct timeval *tv)
+{
+    return (((uint64_t) tv->tv_sec * 1000000) + tv->tv_usec) / EV_TICK_USEC;
+}
+
+int evLoopInit(EvLoop *loop)
+{
+    struct timeval now;
+
+    memset(loop, 0, sizeof (*loop));
+
+    for (int n = 0; n < EV_WHEEL_SIZE; n++) {
+        TAILQ_INIT(&loop->wheel[n]);
+    }
+    TAILQ_INIT(&loop->expired);
+
+    clkGetTime(&now);
+    loop->currTick = evTick(&now);
+
+    return 0;
+}
+
+void evLoopCleanup(EvLoop *loop)
+{
+    free(loop->pollFdSet);
+    free(loop->fdTbl);
+    loop->pollFdSet = NULL;
+    loop->fdTbl = NULL;
+    loop->numFds = loop->maxFds = 0;
+}
+
+int evLoopAddFd(EvLoop *loop, int fd, short events, EvFdHandler handler, void *arg)
+{
+    if (loop->numFds == loop->maxFds) {
+        int maxFds = (loop->maxFds != 0) ? (loop->maxFds * 2) : 8;
+        struct pollfd *pollFdSet;
+        EvFd *fdTbl;
+
+        if ((pollFdSet = realloc(loop->pollFdSet, maxFds * sizeof (*pollFdSet))) == NULL) {
+            mlog(error, "Failed to grow the poll fd set!");
+            return -1;
+        }
+        loop->pollFdSet = pollFdSet;
+        if ((fdTbl = realloc(loop->fdTbl, maxFds * sizeof (*fdTbl))) == NULL) {
+            mlog(error, "Failed to grow the fd table!");
+            return -1;
+        }
+        loop->fdTbl = fdTbl;
+        loop->maxFds = maxFds;
+    }
+
+    loop->pollFdSet[loop->numFds].fd = fd;
+    loop->pollFdSet[loop->numFds].events = events;
+    loop->pollFdSet[loop->numFds].revents = 0;
+    loop->fdTbl[loop->numFds].handler = handler;
+    loop->fdTbl[loop->numFds].arg = arg;
+    loop->numFds++;
+
+    return 0;
+}
+
+void evLoopDelFd(EvLoop *loop, int fd)
+{
+    for (int n = 0; n < loop->numFds; n++) {
+        if (loop->pollFdSet[n].fd == fd) {
+            // The entry may belong to a poll() set that is
+            // being dispatched, so just invalidate it here,
+            // and remove it after the dispatch is done.
+            loop->pollFdSet[n].fd = -1;
+            loop->pollFdSet[n].revents = 0;
+            loop->compact = true;
+            return;
+        }
+    }
+}
+
+void evLoopSetEvents(EvLoop *loop, int fd, short events)
+{
+    for (int n = 0; n < loop->numFds; n++) {
+        if (loop->pollFdSet[n].fd == fd) {
+            loop->pollFdSet[n].events = events;
+            return;
+        }
+    }
+}
+
+static void evLoopCompact(EvLoop *loop)
+{
+    int numFds = 0;
+
+    for (int n = 0; n < loop->numFds; n++) {
+        if (loop->pollFdSet[n].fd >= 0) {
+            loop->pollFdSet[numFds] = loop->pollFdSet[n];
+            loop->fdTbl[numFds] = loop->fdTbl[n];
+            numFds++;
+        }
+    }
+
+    loop->numFds = numFds;
+    loop->compact = false;
+}
+
+void evTimerInit(EvTimer *timer, EvTimerHandler handler, void *arg)
+{
+    memset(timer, 0, sizeof (*timer));
+    timer->handler = handler;
+    timer->arg = arg;
+}
+
+void evTimerStart(EvLoop *loop, EvTimer *timer, const struct timeval *expiry)
+{
+    uint64_t slot;
+
+    evTimerStop(loop, timer);
+
+    timer->expiry = *expiry;
+    timer->expTick = evTick(expiry);
+
+    // A timer that is already due goes into the next
+    // slot to be processed.
+    slot = (timer->expTick > loop->currTick) ? timer->expTick : (loop->currTick + 1);
+    timer->list = &loop->wheel[slot & (EV_WHEEL_SIZE - 1)];
+    TAILQ_INSERT_TAIL(timer->list, timer, tqEntry);
+    loop->numTimers++;
+}
+
+void evTimerStop(EvLoop *loop, EvTimer *timer)
+{
+    if (timer->list != NULL) {
+        TAILQ_REMOVE(timer->list, timer, tqEntry);
+        timer->list = NULL;
+        loop->numTimers--;
+    }
+}
+
+static void evLoopProcTimers(EvLoop *loop, const struct timeval *now)
+{
+    uint64_t nowTick = evTick(now);
+    uint64_t numTicks;
+    EvTimer *timer;
+
+    if (nowTick <= loop->currTick) {
+        // Still in the same tick
+        return;
+    }
+
+    // Move all the expired timers to the expired list.
+    // Timers that are due in a later turn of the wheel
+    // stay in their slot.
+    numTicks = nowTick - loop->currTick;
+    if (numTicks > EV_WHEEL_SIZE) {
+        numTicks = EV_WHEEL_SIZE;
+    }
+    for (uint64_t tick = nowTick - numTicks + 1; tick <= nowTick; tick++) {
+        struct EvTimerList *slot = &loop->wheel[tick & (EV_WHEEL_SIZE - 1)];
+        EvTimer *next;
+
+        for (timer = TAILQ_FIRST(slot); timer != NULL; timer = next) {
+            next = TAILQ_NEXT(timer, tqEntry);
+            if (timer->expTick <= nowTick) {
+                TAILQ_REMOVE(slot, timer, tqEntry);
+                TAILQ_INSERT_TAIL(&loop->expired, timer, tqEntry);
+                timer->list = &loop->expired;
+            }
+        }
+    }
+
+    loop->currTick = nowTick;
+
+    // Run the handlers; they are free to re-arm their
+    // own timer, or to stop any other timer.
+    while ((timer = TAILQ_FIRST(&loop->expired)) != NULL) {
+        evTimerStop(loop, timer);
+        (*timer->handler)(timer->arg, now);
+    }
+}
+
+int evLoopRunOnce(EvLoop *loop)
+{
+    struct timeval now, timeout = { .tv_sec = 0 };
+    int numFds, numEnt;
+
+    if (loop->compact) {
+        evLoopCompact(loop);
+    }
+
+    // Wait until the next tick of the timer wheel
+    clkGetTime(&now);
+    timeout.tv_usec = EV_TICK_USEC - (now.tv_usec % EV_TICK_USEC);
+
+    numFds = loop->numFds;
+    if ((numEnt = poll(loop->pollFdSet, numFds, clkRealMsec(&timeout))) < 0) {
+        if (errno != EINTR) {
+            mlog(fatal, "poll() failed!");
+            return -1;
+        }
+        numEnt = 0;
+    }
+
+    // Apply any pending clock steps (lock-step mode)
+    clkSync();
+
+    clkGetTime(&now);
+
+    // Process the expired timers
+    evLoopProcTimers(loop, &now);
+
+    // Dispatch the I/O events. The handlers may add or
+    // remove fd's, so the entries are re-read on each
+    // iteration.
+    for (int n = 0; (n < numFds) && (numEnt > 0); n++) {
+        short revents = loop->pollFdSet[n].revents;
+
+        if ((revents != 0) && (loop->pollFdSet[n].fd >= 0)) {
+            EvFd evFd = loop->fdTbl[n];
+            numEnt--;
+            loop->pollFdSet[n].revents = 0;
+            (*evFd.handler)(evFd.arg, loop->pollFdSet[n].fd, revents);
+        }
+    }
+
+    return 0;
+}
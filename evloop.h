@@ -0,0 +1,91 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#include "defs.h"
+
+// Resolution of the timer wheel
+#define EV_TICK_USEC    10000   // 10 ms
+
+// Number of slots of the timer wheel (must be a power of 2)
+#define EV_WHEEL_SIZE   256
+
+typedef void (*EvFdHandler)(void *arg, int fd, short revents);
+typedef void (*EvTimerHandler)(void *arg, const struct timeval *now);
+
+TAILQ_HEAD(EvTimerList, EvTimer);
+
+// Event loop timer
+typedef struct EvTimer {
+    TAILQ_ENTRY(EvTimer) tqEntry;   // node in the timer list
+    struct EvTimerList *list;       // list the timer is in (NULL if not armed)
+    struct timeval expiry;          // when the timer is due
+    uint64_t expTick;               // expiry in wheel ticks
+    EvTimerHandler handler;
+    void *arg;
+} EvTimer;
+
+// File descriptor watched by the event loop
+typedef struct EvFd {
+    EvFdHandler handler;
+    void *arg;
+} EvFd;
+
+// Event loop: a poll() reactor plus a hashed timer wheel.
+// All the handlers run in the context of the thread that
+// runs the loop.
+typedef struct EvLoop {
+    struct pollfd *pollFdSet;       // fd's passed to poll()
+    EvFd *fdTbl;                    // handler of each entry of pollFdSet
+    int numFds;
+    int maxFds;
+    bool compact;                   // some fd's were removed during the dispatch
+
+    uint64_t currTick;              // last wheel tick processed
+    int numTimers;                  // number of armed timers
+    struct EvTimerList wheel[EV_WHEEL_SIZE];
+    struct EvTimerList expired;     // timers whose handler is about to run
+} EvLoop;
+
+__BEGIN_DECLS
+
+extern int evLoopInit(EvLoop *loop);
+extern void evLoopCleanup(EvLoop *loop);
+
+extern int evLoopAddFd(EvLoop *loop, int fd, short events, EvFdHandler handler, void *arg);
+extern void evLoopDelFd(EvLoop *loop, int fd);
+extern void evLoopSetEvents(EvLoop *loop, int fd, short events);
+
+extern void evTimerInit(EvTimer *timer, EvTimerHandler handler, void *arg);
+extern void evTimerStart(EvLoop *loop, EvTimer *timer, const struct timeval *expiry);
+extern void evTimerStop(EvLoop *loop, EvTimer *timer);
+
+// Wait for (at most) one wheel tick for I/O events, and
+// run the handlers of the ready fd's and expired timers.
+extern int evLoopRunOnce(EvLoop *loop);
+
+__END_DECLS
@@ -0,0 +1,530 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binbuf.h"
+#include "fitwr.h"
+#include "mlog.h"
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+
+#include "fit/fit_crc.h"
+#include "fit/fit_example.h"
+
+// FIT uses December 31, 1989 UTC as their Epoch. See below
+// for the details:
+//   https://developer.garmin.com/fit/cookbook/datetime/
+static const time_t fitEpoch = 631065600;
+
+// Local message types
+typedef enum FitLocalMesg {
+    fileIdMesg = 0,
+    eventMesg = 1,
+    recordMesg = 2,
+    lapMesg = 3,
+    sessionMesg = 4,
+    activityMesg = 5,
+} FitLocalMesg;
+
+typedef struct FitFieldDef {
+    uint8_t num;
+    uint8_t size;
+    uint8_t baseType;
+} FitFieldDef;
+
+typedef struct FitMesgDef {
+    FIT_MESG_NUM mesgNum;
+    int numFields;
+    const FitFieldDef *fields;
+} FitMesgDef;
+
+static const FitFieldDef fileIdFields[] = {
+    { FIT_FILE_ID_FIELD_NUM_TYPE, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_FILE_ID_FIELD_NUM_MANUFACTURER, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_FILE_ID_FIELD_NUM_TIME_CREATED, 4, FIT_BASE_TYPE_UINT32 },
+};
+
+static const FitFieldDef eventFields[] = {
+    { FIT_EVENT_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_EVENT_FIELD_NUM_DATA, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_EVENT_FIELD_NUM_EVENT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_EVENT_FIELD_NUM_EVENT_TYPE, 1, FIT_BASE_TYPE_ENUM },
+};
+
+static const FitFieldDef recordFields[] = {
+    { FIT_RECORD_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_RECORD_FIELD_NUM_DISTANCE, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_RECORD_FIELD_NUM_SPEED, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_RECORD_FIELD_NUM_POWER, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_RECORD_FIELD_NUM_GRADE, 2, FIT_BASE_TYPE_SINT16 },
+    { FIT_RECORD_FIELD_NUM_HEART_RATE, 1, FIT_BASE_TYPE_UINT8 },
+    { FIT_RECORD_FIELD_NUM_CADENCE, 1, FIT_BASE_TYPE_UINT8 },
+};
+
+static const FitFieldDef lapFields[] = {
+    { FIT_LAP_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_START_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_TOTAL_ELAPSED_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_TOTAL_TIMER_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_TOTAL_DISTANCE, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_LAP_FIELD_NUM_EVENT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_LAP_FIELD_NUM_EVENT_TYPE, 1, FIT_BASE_TYPE_ENUM },
+};
+
+static const FitFieldDef sessionFields[] = {
+    { FIT_SESSION_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_START_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_ELAPSED_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_TIMER_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_TOTAL_DISTANCE, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_SESSION_FIELD_NUM_AVG_POWER, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_MAX_POWER, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_FIRST_LAP_INDEX, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_NUM_LAPS, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_SESSION_FIELD_NUM_EVENT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_SESSION_FIELD_NUM_EVENT_TYPE, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_SESSION_FIELD_NUM_SPORT, 1, FIT_BASE_TYPE_ENUM },
+};
+
+static const FitFieldDef activityFields[] = {
+    { FIT_ACTIVITY_FIELD_NUM_TIMESTAMP, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_ACTIVITY_FIELD_NUM_TOTAL_TIMER_TIME, 4, FIT_BASE_TYPE_UINT32 },
+    { FIT_ACTIVITY_FIELD_NUM_NUM_SESSIONS, 2, FIT_BASE_TYPE_UINT16 },
+    { FIT_ACTIVITY_FIELD_NUM_TYPE, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_ACTIVITY_FIELD_NUM_EVENT, 1, FIT_BASE_TYPE_ENUM },
+    { FIT_ACTIVITY_FIELD_NUM_EVENT_TYPE, 1, FIT_BASE_TYPE_ENUM },
+};
+
+#define NUM_FIELDS(f)   (sizeof (f) / sizeof (FitFieldDef))
+
+// Indexed by FitLocalMesg
+static const FitMesgDef mesgDefTbl[] = {
+    { FIT_MESG_NUM_FILE_ID, NUM_FIELDS(fileIdFields), fileIdFields },
+    { FIT_MESG_NUM_EVENT, NUM_FIELDS(eventFields), eventFields },
+    { FIT_MESG_NUM_RECORD, NUM_FIELDS(recordFields), recordFields },
+    { FIT_MESG_NUM_LAP, NUM_FIELDS(lapFields), lapFields },
+    { FIT_MESG_NUM_SESSION, NUM_FIELDS(sessionFields), sessionFields },
+    { FIT_MESG_NUM_ACTIVITY, NUM_FIELDS(activityFields), activityFields },
+};
+
+static inline uint32_t fitTime(time_t time)
+{
+    return (uint32_t) (time - fitEpoch);
+}
+
+// Append the specified data bytes to the buffer
+static int fitWrPut(FitWr *fw, const uint8_t *data, size_t len)
+{
+    // The closing messages always fit in the buffer
+    size_t bufSize = fw->closing ? (fw->bufSize + FIT_WR_CLOSE_ROOM) : fw->bufSize;
+
+    if (((fw->bufLen + len) > bufSize) && (fitWrFlush(fw) != 0)) {
+        fw->numDrops++;
+        return -1;
+    }
+
+    memcpy(&fw->buf[fw->bufLen], data, len);
+    fw->bufLen += len;
+    fw->dataSize += len;
+    fw->crc = FitCRC_Update16(fw->crc, data, len);
+
+    return 0;
+}
+
+static int fitWrMesgDef(FitWr *fw, FitLocalMesg localMesg)
+{
+    const FitMesgDef *mesgDef = &mesgDefTbl[localMesg];
+    uint8_t mesg[64];
+    BinBuf bb;
+
+    binBufInit(&bb, mesg, sizeof (mesg), littleEndian);
+    binBufPutUINT8(&bb, (FIT_HDR_TYPE_DEF_BIT | localMesg));
+    binBufPutUINT8(&bb, 0);    // reserved
+    binBufPutUINT8(&bb, FIT_ARCH_ENDIAN_LITTLE);
+    binBufPutUINT16(&bb, mesgDef->mesgNum);
+    binBufPutUINT8(&bb, mesgDef->numFields);
+    for (int n = 0; n < mesgDef->numFields; n++) {
+        binBufPutUINT8(&bb, mesgDef->fields[n].num);
+        binBufPutUINT8(&bb, mesgDef->fields[n].size);
+        binBufPutUINT8(&bb, mesgDef->fields[n].baseType);
+    }
+
+    return fitWrPut(fw, mesg, bb.offset);
+}
+
+static int fitWrWrite(int fd, const uint8_t *buf, size_t len, off_t offset)
+{
+    while (len != 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            mlog(error, "Failed to write FIT file! (%s)", strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+// Write the file header with the specified data size
+static int fitWrHdr(int fd, uint32_t dataSize)
+{
+    uint8_t hdr[FIT_FILE_HDR_SIZE];
+    BinBuf bb;
+
+    binBufInit(&bb, hdr, sizeof (hdr), littleEndian);
+    binBufPutUINT8(&bb, FIT_FILE_HDR_SIZE);
+    binBufPutUINT8(&bb, FIT_PROTOCOL_VERSION);
+    binBufPutUINT16(&bb, FIT_PROFILE_VERSION);
+    binBufPutUINT32(&bb, dataSize);
+    binBufPutHex(&bb, ".FIT", 4);
+    binBufPutUINT16(&bb, FitCRC_Calc16(hdr, bb.offset));
+
+    return fitWrWrite(fd, hdr, sizeof (hdr), 0);
+}
+
+// Write out the last 'len' bytes of the data, followed by
+// the file CRC, and update the data size in the header.
+// This way the file is always valid, even if the app gets
+// killed before the file is closed.
+static int fitWrCommit(int fd, const uint8_t *data, size_t len, uint32_t dataSize, uint16_t crc)
+{
+    off_t offset = FIT_FILE_HDR_SIZE + dataSize - len;
+    uint8_t fileCrc[2] = { (crc & 0xff), ((crc >> 8) & 0xff) };
+
+    if ((fitWrWrite(fd, data, len, offset) != 0) ||
+        (fitWrWrite(fd, fileCrc, sizeof (fileCrc), (offset + len)) != 0)) {
+        return -1;
+    }
+
+    return fitWrHdr(fd, dataSize);
+}
+
+static void fitWrFree(FitWr *fw)
+{
+    close(fw->fd);
+    free(fw->spareBuf);
+    free(fw->buf);
+    free(fw);
+}
+
+// Number of FIT files being closed by their writer thread
+static pthread_mutex_t closeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t closeCond = PTHREAD_COND_INITIALIZER;
+static int numClosing;
+
+static void *fitWrThread(void *arg)
+{
+    FitWr *fw = arg;
+
+    pthread_mutex_lock(&fw->lock);
+
+    while (true) {
+        while ((fw->pendBuf == NULL) && !fw->exit) {
+            pthread_cond_wait(&fw->cond, &fw->lock);
+        }
+
+        if (fw->pendBuf == NULL) {
+            // Time to go!
+            break;
+        }
+
+        pthread_mutex_unlock(&fw->lock);
+        fitWrCommit(fw->fd, fw->pendBuf, fw->pendLen, fw->pendDataSize, fw->pendCrc);
+        pthread_mutex_lock(&fw->lock);
+
+        // The buffer is available again
+        fw->spareBuf = fw->pendBuf;
+        fw->pendBuf = NULL;
+        pthread_cond_signal(&fw->cond);
+    }
+
+    pthread_mutex_unlock(&fw->lock);
+
+    // Write out the closing messages left in the
+    // buffer by fitWrClose(), and clean up.
+    fitWrCommit(fw->fd, fw->buf, fw->bufLen, fw->dataSize, fw->crc);
+    pthread_mutex_destroy(&fw->lock);
+    pthread_cond_destroy(&fw->cond);
+    fitWrFree(fw);
+
+    pthread_mutex_lock(&closeLock);
+    if (--numClosing == 0) {
+        pthread_cond_broadcast(&closeCond);
+    }
+    pthread_mutex_unlock(&closeLock);
+
+    return NULL;
+}
+
+FitWr *fitWrOpen(const char *fileName, time_t startTime, size_t bufSize, bool async)
+{
+    FitWr *fw;
+    uint8_t mesg[16];
+    BinBuf bb;
+
+    if ((fw = calloc(1, sizeof (FitWr))) == NULL) {
+        return NULL;
+    }
+
+    if ((fw->buf = malloc(bufSize + FIT_WR_CLOSE_ROOM)) == NULL) {
+        free(fw);
+        return NULL;
+    }
+    fw->bufSize = bufSize;
+
+    if ((fw->fd = open(fileName, (O_WRONLY | O_CREAT | O_TRUNC), 0644)) < 0) {
+        mlog(error, "Can't create FIT file %s! (%s)", fileName, strerror(errno));
+        free(fw->buf);
+        free(fw);
+        return NULL;
+    }
+
+    // Start with a valid (empty) file
+    if (fitWrCommit(fw->fd, NULL, 0, 0, 0) != 0) {
+        fitWrFree(fw);
+        return NULL;
+    }
+
+    if (async) {
+        if ((fw->spareBuf = malloc(bufSize + FIT_WR_CLOSE_ROOM)) == NULL) {
+            fitWrFree(fw);
+            return NULL;
+        }
+        pthread_mutex_init(&fw->lock, NULL);
+        pthread_cond_init(&fw->cond, NULL);
+        if (pthread_create(&fw->thread, NULL, fitWrThread, fw) != 0) {
+            mlog(error, "Failed to create FIT writer thread!");
+            pthread_mutex_destroy(&fw->lock);
+            pthread_cond_destroy(&fw->cond);
+            fitWrFree(fw);
+            return NULL;
+        }
+        fw->async = true;
+    }
+
+    fw->startTime = fw->lastTime = startTime;
+
+    // All the message definitions go up front
+    for (FitLocalMesg localMesg = fileIdMesg; localMesg <= activityMesg; localMesg++) {
+        fitWrMesgDef(fw, localMesg);
+    }
+
+    // FILE_ID
+    binBufInit(&bb, mesg, sizeof (mesg), littleEndian);
+    binBufPutUINT8(&bb, fileIdMesg);
+    binBufPutUINT8(&bb, FIT_FILE_ACTIVITY);
+    binBufPutUINT16(&bb, FIT_MANUFACTURER_DEVELOPMENT);
+    binBufPutUINT32(&bb, fitTime(startTime));
+    fitWrPut(fw, mesg, bb.offset);
+
+    // Start the timer
+    fitWrEvent(fw, startTime, FIT_EVENT_TIMER, FIT_EVENT_TYPE_START, 0);
+
+    return fw;
+}
+
+int fitWrRecord(FitWr *fw, const FitWrRec *rec)
+{
+    uint8_t mesg[32];
+    BinBuf bb;
+
+    binBufInit(&bb, mesg, sizeof (mesg), littleEndian);
+    binBufPutUINT8(&bb, recordMesg);
+    binBufPutUINT32(&bb, fitTime(rec->timestamp));
+    binBufPutUINT32(&bb, (uint32_t) (rec->distance * 100.0));  // [cm]
+    binBufPutUINT16(&bb, (uint16_t) (rec->speed * 1000.0));    // [mm/s]
+    binBufPutUINT16(&bb, rec->power);
+    binBufPutUINT16(&bb, (uint16_t) (int16_t) (rec->grade * 100.0));
+    binBufPutUINT8(&bb, (rec->heartRate != 0) ? rec->heartRate : FIT_UINT8_INVALID);
+    binBufPutUINT8(&bb, rec->cadence);
+
+    if (fitWrPut(fw, mesg, bb.offset) != 0) {
+        return -1;
+    }
+
+    // Update the activity summary
+    fw->lastTime = rec->timestamp;
+    fw->distance = rec->distance;
+    fw->sumPower += rec->power;
+    if (rec->power > fw->maxPower) {
+        fw->maxPower = rec->power;
+    }
+    fw->numRecs++;
+
+    return 0;
+}
+
+int fitWrEvent(FitWr *fw, time_t timestamp, uint8_t event, uint8_t eventType, uint32_t data)
+{
+    uint8_t mesg[16];
+    BinBuf bb;
+
+    binBufInit(&bb, mesg, sizeof (mesg), littleEndian);
+    binBufPutUINT8(&bb, eventMesg);
+    binBufPutUINT32(&bb, fitTime(timestamp));
+    binBufPutUINT32(&bb, data);
+    binBufPutUINT8(&bb, event);
+    binBufPutUINT8(&bb, eventType);
+
+    return fitWrPut(fw, mesg, bb.offset);
+}
+
+int fitWrFlush(FitWr *fw)
+{
+    if (fw->async) {
+        int retVal = -1;
+
+        pthread_mutex_lock(&fw->lock);
+        if (fw->pendBuf == NULL) {
+            // Hand the buffer over to the writer thread,
+            // and carry on with the spare one.
+            fw->pendBuf = fw->buf;
+            fw->pendLen = fw->bufLen;
+            fw->pendDataSize = fw->dataSize;
+            fw->pendCrc = fw->crc;
+            fw->buf = fw->spareBuf;
+            fw->spareBuf = NULL;
+            fw->bufLen = 0;
+            pthread_cond_signal(&fw->cond);
+            retVal = 0;
+        }
+        pthread_mutex_unlock(&fw->lock);
+
+        return retVal;
+    }
+
+    if (fitWrCommit(fw->fd, fw->buf, fw->bufLen, fw->dataSize, fw->crc) != 0) {
+        return -1;
+    }
+
+    fw->bufLen = 0;
+
+    return 0;
+}
+
+// Write the LAP, SESSION, and ACTIVITY summary messages
+static void fitWrSummary(FitWr *fw)
+{
+    uint32_t timestamp = fitTime(fw->lastTime);
+    uint32_t elapsedTime = (uint32_t) (fw->lastTime - fw->startTime) * 1000;   // [ms]
+    uint32_t distance = (uint32_t) (fw->distance * 100.0);                      // [cm]
+    uint16_t avgPower = (fw->numRecs != 0) ? (fw->sumPower / fw->numRecs) : 0;
+    uint8_t mesg[64];
+    BinBuf bb;
+
+    // LAP
+    binBufInit(&bb, mesg, sizeof (mesg), littleEndian);
+    binBufPutUINT8(&bb, lapMesg);
+    binBufPutUINT32(&bb, timestamp);
+    binBufPutUINT32(&bb, fitTime(fw->startTime));
+    binBufPutUINT32(&bb, elapsedTime);
+    binBufPutUINT32(&bb, elapsedTime);
+    binBufPutUINT32(&bb, distance);
+    binBufPutUINT8(&bb, FIT_EVENT_LAP);
+    binBufPutUINT8(&bb, FIT_EVENT_TYPE_STOP);
+    fitWrPut(fw, mesg, bb.offset);
+
+    // SESSION
+    binBufInit(&bb, mesg, sizeof (mesg), littleEndian);
+    binBufPutUINT8(&bb, sessionMesg);
+    binBufPutUINT32(&bb, timestamp);
+    binBufPutUINT32(&bb, fitTime(fw->startTime));
+    binBufPutUINT32(&bb, elapsedTime);
+    binBufPutUINT32(&bb, elapsedTime);
+    binBufPutUINT32(&bb, distance);
+    binBufPutUINT16(&bb, avgPower);
+    binBufPutUINT16(&bb, fw->maxPower);
+    binBufPutUINT16(&bb, 0);   // first lap index
+    binBufPutUINT16(&bb, 1);   // num laps
+    binBufPutUINT8(&bb, FIT_EVENT_SESSION);
+    binBufPutUINT8(&bb, FIT_EVENT_TYPE_STOP);
+    binBufPutUINT8(&bb, FIT_SPORT_CYCLING);
+    fitWrPut(fw, mesg, bb.offset);
+
+    // ACTIVITY
+    binBufInit(&bb, mesg, sizeof (mesg), littleEndian);
+    binBufPutUINT8(&bb, activityMesg);
+    binBufPutUINT32(&bb, timestamp);
+    binBufPutUINT32(&bb, elapsedTime);
+    binBufPutUINT16(&bb, 1);   // num sessions
+    binBufPutUINT8(&bb, FIT_ACTIVITY_MANUAL);
+    binBufPutUINT8(&bb, FIT_EVENT_ACTIVITY);
+    binBufPutUINT8(&bb, FIT_EVENT_TYPE_STOP);
+    fitWrPut(fw, mesg, bb.offset);
+}
+
+int fitWrClose(FitWr *fw)
+{
+    int retVal = 0;
+
+    if (fw->numDrops != 0) {
+        mlog(error, "FIT writer fell behind: %u message(s) dropped!", fw->numDrops);
+    }
+
+    fw->closing = true;
+    fitWrEvent(fw, fw->lastTime, FIT_EVENT_TIMER, FIT_EVENT_TYPE_STOP_ALL, 0);
+    fitWrSummary(fw);
+
+    if (fw->async) {
+        // Let the writer thread write out the closing
+        // messages and clean up, so the caller doesn't
+        // block on the file I/O.
+        pthread_mutex_lock(&closeLock);
+        numClosing++;
+        pthread_mutex_unlock(&closeLock);
+
+        pthread_mutex_lock(&fw->lock);
+        fw->exit = true;
+        pthread_cond_signal(&fw->cond);
+        pthread_mutex_unlock(&fw->lock);
+        pthread_detach(fw->thread);
+
+        return 0;
+    }
+
+    if (fitWrFlush(fw) != 0) {
+        retVal = -1;
+    }
+
+    fitWrFree(fw);
+
+    return retVal;
+}
+
+void fitWrWaitClose(void)
+{
+    pthread_mutex_lock(&closeLock);
+    while (numClosing != 0) {
+        pthread_cond_wait(&closeCond, &closeLock);
+    }
+    pthread_mutex_unlock(&closeLock);
+}
+
+#endif  // CONFIG_FIT_ACTIVITY_FILE
@@ -0,0 +1,114 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+
+// Default size of the FIT writer buffer
+#define FIT_WR_BUF_SIZE     (16 * 1024)
+
+// Extra room in the buffer reserved for the
+// closing messages.
+#define FIT_WR_CLOSE_ROOM   128
+
+// Metrics of a FIT RECORD message
+typedef struct FitWrRec {
+    time_t timestamp;   // in seconds since the Epoch
+    uint16_t cadence;   // cadence [RPM]
+    uint16_t heartRate; // heart rate [BPM]
+    uint16_t power;     // power [W]
+    double speed;       // speed [m/s]
+    double distance;    // total distance [m]
+    double grade;       // road grade [%]
+} FitWrRec;
+
+// Buffered FIT activity file writer
+typedef struct FitWr {
+    int fd;                 // file descriptor of the FIT file
+    uint8_t *buf;           // encoding buffer
+    size_t bufSize;
+    size_t bufLen;          // number of bytes in the buffer
+    uint32_t dataSize;      // number of data bytes encoded so far
+    uint16_t crc;           // running CRC of the data bytes
+
+    // In async mode the buffer is handed over to a writer
+    // thread when it fills up (or when it's flushed), so
+    // the caller never blocks on the file I/O. If the
+    // writer thread falls behind, the new messages are
+    // dropped.
+    bool async;
+    bool exit;              // tell the writer thread to close the file and exit
+    pthread_t thread;       // writer thread
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *spareBuf;      // spare buffer (NULL while the writer thread owns it)
+    uint8_t *pendBuf;       // buffer being written out by the writer thread
+    size_t pendLen;
+    uint32_t pendDataSize;  // data size including the pending buffer
+    uint16_t pendCrc;       // CRC of the data including the pending buffer
+    uint32_t numDrops;      // number of messages dropped
+    bool closing;           // writing the closing messages
+
+    // Activity summary
+    time_t startTime;
+    time_t lastTime;
+    double distance;
+    uint64_t sumPower;
+    uint32_t numRecs;
+    uint16_t maxPower;
+} FitWr;
+
+__BEGIN_DECLS
+
+// Create the FIT file, and write the FILE_ID message and
+// the TIMER START event.
+extern FitWr *fitWrOpen(const char *fileName, time_t startTime, size_t bufSize, bool async);
+
+extern int fitWrRecord(FitWr *fw, const FitWrRec *rec);
+extern int fitWrEvent(FitWr *fw, time_t timestamp, uint8_t event, uint8_t eventType, uint32_t data);
+
+// Write the buffered data out to the file. It's done
+// automatically when the buffer fills up. In async mode
+// the data is only handed over to the writer thread, and
+// the call fails if the writer thread is busy.
+extern int fitWrFlush(FitWr *fw);
+
+// Write the TIMER STOP event and the LAP, SESSION, and
+// ACTIVITY summary messages, followed by the file CRC,
+// update the file header, and close the file. In async
+// mode this is done by the writer thread, and the call
+// returns right away.
+extern int fitWrClose(FitWr *fw);
+
+// Wait for the writer threads to finish closing their
+// files.
+extern void fitWrWaitClose(void);
+
+__END_DECLS
+
+#endif  // CONFIG_FIT_ACTIVITY_FILE
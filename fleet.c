@@ -0,0 +1,154 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cli.h"
+#include "ctrl.h"
+#include "fleet.h"
+#include "mdns.h"
+#include "mlog.h"
+
+#ifdef CONFIG_CLI
+static void fleetProcStdinEvent(void *arg, int fd, short revents)
+{
+    // Process CLI console input
+    cliReadChar();
+}
+#endif
+
+// Stop the worker threads, and close the control socket,
+// whichever of them have been started.
+static void fleetStop(Fleet *fleet)
+{
+    for (int n = 0; n < fleet->numWorkers; n++) {
+        workerStop(&fleet->workers[n]);
+    }
+    free(fleet->workers);
+    fleet->workers = NULL;
+    fleet->numWorkers = 0;
+
+#ifdef CONFIG_CTRL_SOCKET
+    ctrlCleanup();
+#endif
+}
+
+// Init the fleet. The specified server object becomes the
+// first bike, and the rest of the bikes are cloned from it.
+int fleetInit(Fleet *fleet, Server *server, int numBikes)
+{
+    evLoopInit(&fleet->evLoop);
+    TAILQ_INIT(&fleet->bikeList);
+
+    server->evLoop = &fleet->evLoop;
+    server->bikeId = 0;
+    if (serverInit(server) != 0) {
+        return -1;
+    }
+    TAILQ_INSERT_TAIL(&fleet->bikeList, server, fleetEnt);
+    fleet->numBikes = 1;
+
+    while (fleet->numBikes < numBikes) {
+        Server *bike;
+
+        if ((bike = serverNewBike(server, fleet->numBikes)) == NULL) {
+            mlog(error, "Failed to create bike #%d!", fleet->numBikes);
+            return -1;
+        }
+        TAILQ_INSERT_TAIL(&fleet->bikeList, bike, fleetEnt);
+        fleet->numBikes++;
+    }
+
+    if (numBikes > 1) {
+        mlog(info, "Fleet of %d bikes on TCP ports %u-%u", numBikes,
+                ntohs(server->srvAddr.sin_port), ntohs(server->srvAddr.sin_port) + numBikes - 1);
+    }
+
+#ifdef CONFIG_CLI
+    // CLI console input
+    if (evLoopAddFd(&fleet->evLoop, server->stdinFd, POLLIN, fleetProcStdinEvent, server) != 0) {
+        return -1;
+    }
+#endif
+
+#ifdef CONFIG_CTRL_SOCKET
+    // Control socket
+    if ((server->ctrlSockName != NULL) && (ctrlInit(fleet, server->ctrlSockName) != 0)) {
+        return -1;
+    }
+#endif
+
+#ifdef CONFIG_MDNS_AGENT
+    // Initialize mDNS for all the bikes
+    if (mdnsInit(server) != 0) {
+        goto error;
+    }
+#endif
+
+    if (server->numWorkers > 0) {
+        // Start the worker threads that serve the
+        // app connections (sharded mode).
+        if ((fleet->workers = calloc(server->numWorkers, sizeof (Worker))) == NULL) {
+            mlog(error, "Failed to alloc worker table!");
+            goto error;
+        }
+        while (fleet->numWorkers < server->numWorkers) {
+            if (workerStart(&fleet->workers[fleet->numWorkers], fleet->numWorkers, fleet) != 0) {
+                goto error;
+            }
+            fleet->numWorkers++;
+        }
+        mlog(info, "Serving the app connections with %d worker threads", fleet->numWorkers);
+    }
+
+    return 0;
+
+error:
+    fleetStop(fleet);
+
+    return -1;
+}
+
+int fleetRun(Fleet *fleet)
+{
+    Server *server = TAILQ_FIRST(&fleet->bikeList);
+    int s = 0;
+
+    // Main work loop
+    while (true) {
+        if (evLoopRunOnce(&fleet->evLoop) != 0) {
+            s = -1;
+            break;
+        }
+
+        // Exit the tool?
+        if (server->exit) {
+            cliPreExitCleanup(server);
+            break;
+        }
+    }
+
+    fleetStop(fleet);
+
+    return s;
+}
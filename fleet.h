@@ -0,0 +1,45 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <sys/queue.h>
+
+#include "evloop.h"
+#include "server.h"
+#include "worker.h"
+
+// Fleet of virtual bikes hosted by the same process. All
+// the bikes share the event loop (and so its timer wheel),
+// the mDNS socket, and the activity data.
+typedef struct Fleet {
+    EvLoop evLoop;
+    TAILQ_HEAD(BikeList, Server) bikeList;
+    int numBikes;
+    Worker *workers;                // worker threads (sharded mode)
+    int numWorkers;
+} Fleet;
+
+__BEGIN_DECLS
+
+extern int fleetInit(Fleet *fleet, Server *server, int numBikes);
+extern int fleetRun(Fleet *fleet);
+
+__END_DECLS
@@ -0,0 +1,372 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "livefeed.h"
+#include "mlog.h"
+
+#ifdef CONFIG_LIVE_FEED
+
+// Size of the ring of a channel
+static size_t liveFeedRingSize(uint32_t numRecs)
+{
+    return sizeof (LiveFeedRing) + (numRecs * sizeof (LiveFeedRec));
+}
+
+static LiveFeedRing *liveFeedGetRing(const LiveFeedMap *map, uint32_t chan)
+{
+    return (LiveFeedRing *) ((uint8_t *) map->hdr + sizeof (LiveFeedHdr) + (chan * liveFeedRingSize(map->numRecs)));
+}
+
+// A name with a slash other than the leading one is the
+// path to a file, otherwise it is the name of a POSIX
+// shared memory object.
+static bool liveFeedIsFile(const char *name)
+{
+    return (strchr(name + 1, '/') != NULL);
+}
+
+static int liveFeedOpenFd(const char *name, int flags)
+{
+    if (liveFeedIsFile(name)) {
+        return open(name, flags, 0644);
+    }
+
+    return shm_open(name, flags, 0644);
+}
+
+static void liveFeedUnlink(const char *name)
+{
+    if (liveFeedIsFile(name)) {
+        unlink(name);
+    } else {
+        shm_unlink(name);
+    }
+}
+
+static uint64_t liveFeedNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// Map the live-metrics region for reading, and validate
+// its layout, so the readers never access past its end.
+// The errors are logged at the specified level.
+static LiveFeedMap *liveFeedMapRegion(const char *name, LogLevel errLevel)
+{
+    LiveFeedMap *map;
+    LiveFeedHdr *hdr;
+    struct stat st;
+    int fd;
+
+    if ((fd = liveFeedOpenFd(name, O_RDONLY)) < 0) {
+        mlog(errLevel, "Can't open live feed %s! (%s)", name, strerror(errno));
+        return NULL;
+    }
+
+    if ((fstat(fd, &st) != 0) || (st.st_size < sizeof (LiveFeedHdr))) {
+        mlog(errLevel, "Invalid live feed %s!", name);
+        close(fd);
+        return NULL;
+    }
+
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        mlog(errLevel, "Can't map live feed %s! (%s)", name, strerror(errno));
+        return NULL;
+    }
+
+    // The magic number is set last by the producer
+    if ((__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != LIVE_FEED_MAGIC) ||
+        (hdr->version != LIVE_FEED_VERSION) ||
+        (hdr->recSize != sizeof (LiveFeedRec)) ||
+        (hdr->numChans == 0) || (hdr->numChans > LIVE_FEED_MAX_CHANS) ||
+        (hdr->numRecs == 0) || (hdr->numRecs > LIVE_FEED_MAX_RECS) || ((hdr->numRecs & (hdr->numRecs - 1)) != 0) ||
+        (st.st_size < (sizeof (LiveFeedHdr) + (hdr->numChans * liveFeedRingSize(hdr->numRecs))))) {
+        mlog(errLevel, "Unsupported live feed %s: magic=0x%08x version=%u recSize=%u numChans=%u numRecs=%u",
+             name, hdr->magic, hdr->version, hdr->recSize, hdr->numChans, hdr->numRecs);
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+
+    if ((map = calloc(1, sizeof (LiveFeedMap))) == NULL) {
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+    map->hdr = hdr;
+    map->size = st.st_size;
+    map->numChans = hdr->numChans;
+    map->numRecs = hdr->numRecs;
+    map->dev = st.st_dev;
+    map->ino = st.st_ino;
+
+    mlog(info, "Live feed %s: numChans=%u numRecs=%u", name, map->numChans, map->numRecs);
+
+    return map;
+}
+
+static LiveFeed *liveFeedNew(const char *name, LiveFeedMap *map, bool producer)
+{
+    LiveFeed *feed;
+
+    if ((feed = calloc(1, sizeof (LiveFeed))) == NULL) {
+        return NULL;
+    }
+
+    if ((feed->name = strdup(name)) == NULL) {
+        free(feed);
+        return NULL;
+    }
+
+    feed->map = map;
+    feed->producer = producer;
+    pthread_mutex_init(&feed->lock, NULL);
+
+    return feed;
+}
+
+LiveFeed *liveFeedOpen(const char *name)
+{
+    LiveFeedMap *map;
+    LiveFeed *feed;
+
+    if ((map = liveFeedMapRegion(name, error)) == NULL) {
+        return NULL;
+    }
+
+    if ((feed = liveFeedNew(name, map, false)) == NULL) {
+        munmap(map->hdr, map->size);
+        free(map);
+        return NULL;
+    }
+
+    return feed;
+}
+
+LiveFeed *liveFeedCreate(const char *name, uint32_t numChans, uint32_t numRecs)
+{
+    LiveFeed *feed;
+    LiveFeedMap *map;
+    LiveFeedHdr *hdr;
+    size_t size;
+    int fd;
+
+    if ((numChans == 0) || (numChans > LIVE_FEED_MAX_CHANS) ||
+        (numRecs == 0) || (numRecs > LIVE_FEED_MAX_RECS) || ((numRecs & (numRecs - 1)) != 0)) {
+        mlog(error, "Invalid live feed size: numChans=%u numRecs=%u", numChans, numRecs);
+        return NULL;
+    }
+
+    size = sizeof (LiveFeedHdr) + (numChans * liveFeedRingSize(numRecs));
+
+    // Always create a new region, rather than truncating
+    // the existing one, which the readers may still have
+    // mapped. They switch over to the new region when the
+    // old one goes stale.
+    liveFeedUnlink(name);
+    if ((fd = liveFeedOpenFd(name, (O_RDWR | O_CREAT | O_EXCL))) < 0) {
+        mlog(error, "Can't create live feed %s! (%s)", name, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        mlog(error, "Can't size live feed %s! (%s)", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    hdr = mmap(NULL, size, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        mlog(error, "Can't map live feed %s! (%s)", name, strerror(errno));
+        return NULL;
+    }
+
+    if ((map = calloc(1, sizeof (LiveFeedMap))) == NULL) {
+        munmap(hdr, size);
+        return NULL;
+    }
+    map->hdr = hdr;
+    map->size = size;
+    map->numChans = numChans;
+    map->numRecs = numRecs;
+
+    if ((feed = liveFeedNew(name, map, true)) == NULL) {
+        munmap(hdr, size);
+        free(map);
+        return NULL;
+    }
+
+    // The region is zero-filled, so all the rings start
+    // empty. The magic number is set last, so a reader
+    // never sees a partially initialized header.
+    hdr->version = LIVE_FEED_VERSION;
+    hdr->recSize = sizeof (LiveFeedRec);
+    hdr->numChans = numChans;
+    hdr->numRecs = numRecs;
+    __atomic_store_n(&hdr->magic, LIVE_FEED_MAGIC, __ATOMIC_RELEASE);
+
+    return feed;
+}
+
+void liveFeedFree(LiveFeed *feed)
+{
+    LiveFeedMap *map, *prev;
+
+    if (feed != NULL) {
+        for (map = feed->map; map != NULL; map = prev) {
+            prev = map->prev;
+            munmap(map->hdr, map->size);
+            free(map);
+        }
+        pthread_mutex_destroy(&feed->lock);
+        free(feed->name);
+        free(feed);
+    }
+}
+
+void liveFeedPublish(LiveFeed *feed, uint32_t chan, const LiveMetrics *metrics)
+{
+    const LiveFeedMap *map = feed->map;
+    LiveFeedRing *ring;
+    LiveFeedRec *rec;
+    uint64_t head;
+
+    if (chan >= map->numChans) {
+        return;
+    }
+
+    ring = liveFeedGetRing(map, chan);
+
+    // Single producer: nobody else updates the head
+    head = ring->head;
+    rec = &ring->recs[head & (map->numRecs - 1)];
+    rec->seqNum = head;
+    rec->timestamp = liveFeedNow();
+    rec->cadence = metrics->cadence;
+    rec->heartRate = metrics->heartRate;
+    rec->power = metrics->power;
+    rec->flags = metrics->speedValid ? LIVE_FEED_SPEED_VALID : 0;
+    rec->speed = metrics->speedValid ? (uint32_t) (metrics->speed * 1000.0) : 0;
+
+    // Make the record visible to the readers
+    __atomic_store_n(&ring->head, (head + 1), __ATOMIC_RELEASE);
+}
+
+// The feed went stale: if the producer has been restarted,
+// and has created a new region, switch over to it. The old
+// mapping is kept until the feed is freed, as some other
+// thread may still be reading from it.
+static void liveFeedReopen(LiveFeed *feed)
+{
+    uint64_t now = liveFeedNow();
+    LiveFeedMap *map, *newMap;
+    struct stat st;
+    int fd;
+
+    if ((now < __atomic_load_n(&feed->nextCheck, __ATOMIC_RELAXED)) ||
+        (pthread_mutex_trylock(&feed->lock) != 0)) {
+        return;
+    }
+
+    __atomic_store_n(&feed->nextCheck, (now + (LIVE_FEED_REOPEN_INT * 1000000ULL)), __ATOMIC_RELAXED);
+
+    map = feed->map;
+    if ((fd = liveFeedOpenFd(feed->name, O_RDONLY)) >= 0) {
+        if ((fstat(fd, &st) == 0) && ((st.st_dev != map->dev) || (st.st_ino != map->ino)) &&
+            ((newMap = liveFeedMapRegion(feed->name, debug)) != NULL)) {
+            mlog(info, "Live feed %s re-opened", feed->name);
+            newMap->prev = map;
+            __atomic_store_n(&feed->map, newMap, __ATOMIC_RELEASE);
+        }
+        close(fd);
+    }
+
+    pthread_mutex_unlock(&feed->lock);
+}
+
+static bool liveFeedReadMap(const LiveFeedMap *map, uint32_t chan, LiveMetrics *metrics)
+{
+    const LiveFeedRing *ring;
+    LiveFeedRec rec;
+    uint64_t head;
+
+    if (chan >= map->numChans) {
+        return false;
+    }
+
+    ring = liveFeedGetRing(map, chan);
+
+    if ((head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) == 0) {
+        // Nothing published yet
+        return false;
+    }
+
+    memcpy(&rec, &ring->recs[(head - 1) & (map->numRecs - 1)], sizeof (rec));
+
+    // If the producer has wrapped around the ring while we
+    // were copying the record, it may be torn: just skip
+    // this tick.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - (head - 1)) >= map->numRecs) {
+        return false;
+    }
+    if (rec.seqNum != (head - 1)) {
+        return false;
+    }
+
+    if ((liveFeedNow() - rec.timestamp) > (LIVE_FEED_STALE_TIME * 1000000ULL)) {
+        // The producer is gone, or stalled
+        return false;
+    }
+
+    metrics->cadence = rec.cadence;
+    metrics->heartRate = rec.heartRate;
+    metrics->power = rec.power;
+    metrics->speedValid = (rec.flags & LIVE_FEED_SPEED_VALID);
+    metrics->speed = (double) rec.speed / 1000.0;
+
+    return true;
+}
+
+bool liveFeedRead(LiveFeed *feed, uint32_t chan, LiveMetrics *metrics)
+{
+    if (liveFeedReadMap(__atomic_load_n(&feed->map, __ATOMIC_ACQUIRE), chan, metrics)) {
+        return true;
+    }
+
+    liveFeedReopen(feed);
+
+    return false;
+}
+
+#endif  // CONFIG_LIVE_FEED
@@ -0,0 +1,170 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+#ifdef CONFIG_LIVE_FEED
+
+// Live-metrics feed: a shared-memory region, created by an
+// external producer (e.g. a test rig, or another simulator),
+// that drives the metrics of the bikes in real time. The
+// region is either a POSIX shared memory object, or any file
+// that can be mapped (e.g. a memfd via /proc/<pid>/fd/<n>).
+//
+// The region has a header, followed by one ring of records
+// per channel. Bike #N reads channel N. All the fields are in
+// the native byte order of the host:
+//
+//   offset  size  field
+//   ------  ----  -----
+//        0     4  magic (LIVE_FEED_MAGIC)
+//        4     2  version (LIVE_FEED_VERSION)
+//        6     2  size of a record, in bytes (32)
+//        8     4  number of channels
+//       12     4  number of records per ring (power of 2)
+//       16    48  reserved (zero)
+//       64     -  channel #0: ring head (8 bytes, padded to 64),
+//                 then the array of records
+//       ...       channel #1...
+//
+// Each ring has a single producer, and it never waits for
+// the readers: the producer writes the record at index
+// (head % numRecs), and then increments the head with
+// release semantics. The records are read lock-free: a
+// reader loads the head with acquire semantics, copies the
+// latest record, and then checks that the producer hasn't
+// lapped it while copying. The readers don't write to the
+// shared memory at all, so any number of bikes and sessions
+// can follow the same channel.
+//
+// If the producer is restarted, and creates the region anew,
+// the readers map the new region as soon as they notice that
+// the old one went stale.
+
+#define LIVE_FEED_MAGIC         0x4c464542  // "BEFL"
+#define LIVE_FEED_VERSION       1
+#define LIVE_FEED_MAX_CHANS     1024
+#define LIVE_FEED_MAX_RECS      4096
+
+// The metrics of a record older than this are stale, and
+// no longer override the other sources [ms]
+#define LIVE_FEED_STALE_TIME    3000
+
+// While the feed is stale, check this often whether the
+// producer has created a new region [ms]
+#define LIVE_FEED_REOPEN_INT    1000
+
+// Flags of a live-metrics record
+#define LIVE_FEED_SPEED_VALID   0x0001      // use the speed of the record
+
+// Live-metrics record
+typedef struct LiveFeedRec {
+    uint64_t seqNum;        // sequence number of the record (head value when written)
+    uint64_t timestamp;     // CLOCK_MONOTONIC time when produced [ns]
+    uint16_t cadence;       // [RPM]
+    uint16_t heartRate;     // [BPM]
+    uint16_t power;         // [W]
+    uint16_t flags;         // LIVE_FEED_XXX flags
+    uint32_t speed;         // [mm/s]
+    uint32_t reserved;
+} LiveFeedRec;
+
+// Header of the live-metrics region
+typedef struct LiveFeedHdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recSize;
+    uint32_t numChans;
+    uint32_t numRecs;
+    uint8_t reserved[48];
+} LiveFeedHdr;
+
+// Ring of a channel
+typedef struct LiveFeedRing {
+    uint64_t head;          // number of records written so far
+    uint8_t pad[56];        // keep the head in its own cache line
+    LiveFeedRec recs[];
+} LiveFeedRing;
+
+// Mapping of the live-metrics region. The number of
+// channels and records are the ones validated when the
+// region was mapped, as the header in the shared memory
+// can be changed by the producer at any time.
+typedef struct LiveFeedMap {
+    LiveFeedHdr *hdr;
+    size_t size;            // size of the mapped region
+    uint32_t numChans;
+    uint32_t numRecs;
+    dev_t dev;              // identity of the mapped object
+    ino_t ino;
+    struct LiveFeedMap *prev;   // previous mapping, unmapped when the feed is freed
+} LiveFeedMap;
+
+// Live-metrics feed, as mapped by the producer or the
+// readers. It is read-only for the readers, so it can be
+// shared by all the bikes and sessions of the process.
+typedef struct LiveFeed {
+    char *name;
+    LiveFeedMap *map;       // current mapping (accessed with the __atomic builtins)
+    pthread_mutex_t lock;   // serializes the re-opening of the feed
+    uint64_t nextCheck;     // when to check for a new region [ns]
+    bool producer;
+} LiveFeed;
+
+// Metrics read from the live feed
+typedef struct LiveMetrics {
+    uint16_t cadence;       // [RPM]
+    uint16_t heartRate;     // [BPM]
+    uint16_t power;         // [W]
+    bool speedValid;
+    double speed;           // [m/s]
+} LiveMetrics;
+
+__BEGIN_DECLS
+
+// Map an existing live feed, for reading. The name is
+// either the name of a POSIX shared memory object, or the
+// path to a file.
+extern LiveFeed *liveFeedOpen(const char *name);
+
+// Create a new live feed (producer side), with the
+// specified number of channels and ring size.
+extern LiveFeed *liveFeedCreate(const char *name, uint32_t numChans, uint32_t numRecs);
+
+extern void liveFeedFree(LiveFeed *feed);
+
+// Publish a new record on the specified channel (producer
+// side).
+extern void liveFeedPublish(LiveFeed *feed, uint32_t chan, const LiveMetrics *metrics);
+
+// Get the latest metrics of the specified channel. Returns
+// false if there are no fresh metrics.
+extern bool liveFeedRead(LiveFeed *feed, uint32_t chan, LiveMetrics *metrics);
+
+__END_DECLS
+
+#endif  // CONFIG_LIVE_FEED
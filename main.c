@@ -25,8 +25,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "batch.h"
 #include "cli.h"
+#include "clock.h"
 #include "dircon.h"
+#include "fitwr.h"
+#include "fleet.h"
 #include "mdns.h"
 #include "mlog.h"
 #include "server.h"
@@ -35,16 +39,12 @@
 #define PROG_VER_MAJOR  0
 #define PROG_VER_MINOR  0
 
-typedef enum PollFdIndex {
-    connSock = 0,
-    mdnsSock = 1,
-    srvSock = 2,
-    stdInput = 3,
-} PollFdIndex;
-
-// The main Server object
+// The main Server object (first bike of the fleet)
 static Server serverObj = {0};
 
+// The fleet of bikes
+static Fleet fleetObj;
+
 static const char *help =
         "SYNTAX:\n"
         "    indBikeSim [OPTIONS]\n"
@@ -54,10 +54,41 @@ static const char *help =
         "        Specifies the FIT file of the cycling activity to be used to\n"
         "        get the metrics sent in the 'Indoor Bike Data' notification\n"
         "        messages.\n"
+        "    --activity-cache <file>\n"
+        "        Specifies a cache file for the trackpoints of the activity.\n"
+        "        If the file exists, the trackpoints are mapped read-only from\n"
+        "        it, instead of parsing the FIT file, so all the processes that\n"
+        "        use the same cache file share a single copy of the trackpoints\n"
+        "        in memory. Otherwise the file is created from the trackpoints\n"
+        "        of the --activity file. The file is rebuilt automatically if\n"
+        "        the --activity file, or the --resample option, changes.\n"
+        "    --activity-gaps {keep|skip}\n"
+        "        Specifies how the pauses of the activity (gaps of more than\n"
+        "        10 seconds between trackpoints) are played back: in real time,\n"
+        "        with zero power, cadence and speed, or skipped altogether. The\n"
+        "        default is 'skip'.\n"
+        "    --batch <out-name>\n"
+        "        Run the activity through the ERG and bike dynamics models as\n"
+        "        fast as possible, without any network I/O, and write the\n"
+        "        resulting trackpoints to the files <out-name>.fit and\n"
+        "        <out-name>.csv. Requires the --activity option.\n"
+        "    --bikes <num>\n"
+        "        Run the specified number of virtual bikes in this process,\n"
+        "        sharing one event loop and the activity data. Each bike\n"
+        "        listens on its own TCP port (the base port plus the bike's\n"
+        "        index), and has its own MAC address and serial number, and\n"
+        "        so its own mDNS name. Default is 1.\n"
         "    --cadence <val>\n"
         "        Specifies a fixed cadence value (in RPM) to be sent in the\n"
         "        periodic 'Cycling Power Measurement' and 'Indoor Bike Data'\n"
         "        notifications.\n"
+#ifdef CONFIG_CTRL_SOCKET
+        "    --ctrl-socket <path>\n"
+        "        Serve a UNIX-domain control socket at the specified path, to\n"
+        "        drive the app at runtime: set the metrics, seek or swap the\n"
+        "        activity, dump the stats, or change the log level. Send the\n"
+        "        'help' command for the details.\n"
+#endif
         "    --dissect <mesg-id>\n"
         "        Dissect the WFTNP messages that match the specified message ID\n"
         "        Valid values are:\n"
@@ -68,6 +99,18 @@ static const char *help =
         "          4 - Write Characteristic\n"
         "          5 - Enable Characteristic Notifications\n"
         "          6 - Unsolicited Characteristic Notification\n"
+        "    --erg-profile {step|lag|overshoot}\n"
+        "        Specifies how the power settles on the target power set by\n"
+        "        the FMCP SET_TARGET_POWER command (ERG mode): right away, with\n"
+        "        a first-order lag, or with overshoot and ringing. The rider's\n"
+        "        cadence and the speed follow the power. The default is 'lag'.\n"
+        "    --erg-time-const <sec>\n"
+        "        Specifies the time constant of the ERG mode response. Default\n"
+        "        is 2 seconds.\n"
+        "    --ftp <watts>\n"
+        "        Specifies the rider's Functional Threshold Power, used to\n"
+        "        convert the relative power targets of the --workout file to\n"
+        "        Watts. Default is 200 W.\n"
         "    --heart-rate <val>\n"
         "        Specifies a fixed heart rate value (in BPM) to be sent\n"
         "        in the periodic 'Indoor Bike Data' notifications.\n"
@@ -75,34 +118,129 @@ static const char *help =
         "        Show this help and exit.\n"
         "    --hex-dump\n"
         "        Do a hex dump of the DIRCON messages sent and received.\n"
+        "    --interfaces {all|<name>[,<name>...]}\n"
+        "        Serve the DIRCON connections, and advertise the WFTNP mDNS\n"
+        "        service over both IPv4 and IPv6, on all the interfaces of\n"
+        "        the system, or on the specified ones. By default only the\n"
+        "        interface with the --ip-address, or else the first one with\n"
+        "        an IPv4 address, is used.\n"
         "    --ip-address <addr>\n"
         "        Specifies the interface IP address to use to advertise the\n"
         "        WFTNP mDNS service.\n"
+#ifdef CONFIG_LIVE_FEED
+        "    --live-feed <name>\n"
+        "        Drive the metrics sent in the notifications from the live\n"
+        "        feed created by an external process: a POSIX shared memory\n"
+        "        object, or a file, with one ring of records per bike (see\n"
+        "        livefeed.h for the layout). While the feed is fresh, its\n"
+        "        metrics override the ones from all the other sources. If the\n"
+        "        producer is restarted, the new feed is picked up on the fly.\n"
+        "        Use tools/liveFeedGen as a stand-in producer.\n"
+#endif
+        "    --lock-step\n"
+        "        Run the app's clock in lock-step mode: the clock only advances\n"
+        "        by 1 second each time the app receives a SIGUSR1 signal.\n"
         "    --log-dest {both|console|file}\n"
         "        Specifies the destination of the log messages. The default is\n"
         "        'console'.\n"
         "    --log-level {none|info|trace|debug}\n"
         "        Set the specified message log level. The default level is\n"
         "        \"info\".\n"
+        "    --mass <kg>\n"
+        "        Specifies the combined mass of the rider and the bike used\n"
+        "        by the physics model. Default is 85 kg.\n"
 #ifdef CONFIG_MDNS_AGENT
         "    --no-mdns\n"
         "        Don't use mDNS to advertise the WFTNP service on the local\n"
         "        network.\n"
 #endif
+        "    --perturb <seed>[,<power>,<cadence>,<hr>,<offset>,<dropout>]\n"
+        "        Perturb the metrics of the activity, so that each bike (or\n"
+        "        session, in sharded mode) emulates a different rider. Each\n"
+        "        rider gets its own power scale, within +/-<power> percent,\n"
+        "        cadence noise within +/-<cadence> RPM, heart rate offset\n"
+        "        within +/-<hr> BPM, an additional start offset of up to\n"
+        "        <offset> seconds, and a <dropout> percent probability of\n"
+        "        missing the notifications of each second. The perturbations\n"
+        "        are derived from the <seed> and the bike/session number, so\n"
+        "        they are repeatable. Default is <seed>,5,3,5,300,1. The max\n"
+        "        values are 99, 50, 50, 86400 and 100, respectively.\n"
+        "    --physics\n"
+        "        Derive the speed and distance sent in the notifications from\n"
+        "        the current power, using a bike dynamics model driven by the\n"
+        "        parameters of the FMCP SET_INDOOR_BIKE_SIM_PARMS command.\n"
+        "    --playback-speed <factor>\n"
+        "        Specifies the speed at which the activity is played back,\n"
+        "        relative to the app's clock; e.g. 2 plays back a 1-hour\n"
+        "        activity in 30 minutes. Default is 1.\n"
         "    --power <val>\n"
         "        Specifies a fixed pedal power value (in Watts) to be sent\n"
         "        in the periodic 'Indoor Bike Data' notifications.\n"
+        "    --proxy <addr>[:<port>]\n"
+        "        Run as a DIRCON proxy that relays the messages between the\n"
+        "        app and the upstream DIRCON trainer at the specified address.\n"
+        "        An IPv6 address with a port is written as [<addr>]:<port>.\n"
+        "        The default port is 36866.\n"
+        "    --record <dir>\n"
+        "        Record the metrics sent to the app, and the FMCP commands\n"
+        "        received from it, to a FIT activity file per session in the\n"
+        "        specified directory.\n"
+        "    --resample {linear|previous}[,<sec>]\n"
+        "        Resample the trackpoints of the activity, when loading it, to\n"
+        "        one every <sec> seconds (default is 1), using either linear\n"
+        "        or previous-value interpolation. This normalizes the variable\n"
+        "        intervals and duplicated timestamps of some FIT files. The\n"
+        "        pauses of the activity are preserved.\n"
+        "    --schedule <file>\n"
+        "        Specifies the schedule of sim parameters and target power\n"
+        "        changes applied in batch mode. Each line of the file is one\n"
+        "        of: \"<sec> sim <grade> [<wind-speed> [<crr> [<cw>]]]\" or\n"
+        "        \"<sec> erg <power>\", with <sec> the elapsed time since the\n"
+        "        start of the activity.\n"
         "    --speed <val>\n"
         "        Specifies a fixed speed value (in km/h) to be sent\n"
         "        in the periodic 'Indoor Bike Data' notifications.\n"
+        "    --start-offset <sec>[:<step>]\n"
+        "        Start the playback of the activity the specified number of\n"
+        "        seconds into it. In fleet mode, each bike starts <step> more\n"
+        "        seconds into the activity than the previous one, so that the\n"
+        "        bikes don't all send the same metrics. Default is 0:0.\n"
         "    --supported-power-range <min,max,inc>\n"
         "        Specifies the minimum, maximum, and increment power values\n"
         "        (in Watts) used by the Supported Power Range characteristic.\n"
         "        Default is 0,1500,1.\n"
+        "    --synth {steady|intervals|sprints}[,<power>[,<seed>]]\n"
+        "        Generate the power, cadence and heart rate sent in the\n"
+        "        notifications, when there is no --activity, from a synthetic\n"
+        "        workload: a mean-reverting random walk around the mean power,\n"
+        "        optionally with work/rest intervals or random sprint bursts.\n"
+        "        The cadence follows the power, and the heart rate lags behind\n"
+        "        it. Each bike (or session, in sharded mode) is a different\n"
+        "        rider, derived from the <seed>. Default power is 180 W, and\n"
+        "        default seed is 0. Use --physics to derive the speed.\n"
         "    --tcp-port <num>\n"
         "        Specifies the TCP port to use. Default is 36866.\n"
+        "    --time-scale <factor>\n"
+        "        Run the app's clock (timers and timestamps) the specified\n"
+        "        factor faster than the wall-clock time; e.g. 10 runs a 1-hour\n"
+        "        activity in 6 minutes.\n"
         "    --version\n"
         "        Show version information and exit.\n"
+        "    --workers <num>\n"
+        "        Serve the app connections with the specified number of worker\n"
+        "        threads, each with its own SO_REUSEPORT listening socket,\n"
+        "        event loop and session table. In this mode each bike accepts\n"
+        "        any number of app connections, and the kernel spreads them\n"
+        "        across the workers. Default is 0 (single-threaded, one app\n"
+        "        connection per bike).\n"
+        "    --workout <file>\n"
+        "        Specifies a structured workout file (Zwift .zwo, or .erg/.mrc)\n"
+        "        for the rider to follow: the power (and cadence, if set) sent\n"
+        "        in the notifications follow the target of the current step\n"
+        "        of the workout, instead of the activity. Free ride steps, and\n"
+        "        the time after the end of the workout, use the activity (or\n"
+        "        the synthetic workload, or the fixed metrics). The workout\n"
+        "        time only advances while the activity is in progress.\n"
         "\n"
         "BUGS:\n"
         "    Report bugs and enhancement requests to: marcelo_mourier@yahoo.com\n";
@@ -129,6 +267,13 @@ static int parseArgs(int argc, char **argv, Server *server)
     server->minPower = 0;
     server->maxPower = 1500;
     server->incPower = 1;
+    server->mass = PHY_DEF_MASS;
+    server->numBikes = 1;
+    server->ftp = WKO_DEF_FTP;
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    server->playbackSpeed = 1.0;
+#endif
+    ergInit(&server->erg, ergLag, ERG_DEF_TIME_CONST);
 
     for (n = 1, numArgs = argc -1; n <= numArgs; n++) {
         const char *arg;
@@ -146,9 +291,54 @@ static int parseArgs(int argc, char **argv, Server *server)
                 return invalidArgument(arg, val);
             }
             server->actFile = fp;
+            server->actFileName = val;
+#else
+            return invalidArgument(arg, NULL);
+#endif
+        } else if (strcmp(arg, "--activity-cache") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->actCache = val;
+#else
+            return invalidArgument(arg, NULL);
+#endif
+        } else if (strcmp(arg, "--activity-gaps") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if (strcmp(val, "keep") == 0) {
+                server->gapMode = trkPtKeepGaps;
+            } else if (strcmp(val, "skip") == 0) {
+                server->gapMode = trkPtSkipGaps;
+            } else {
+                return invalidArgument(arg, val);
+            }
 #else
             return invalidArgument(arg, NULL);
 #endif
+        } else if (strcmp(arg, "--batch") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->batchOut = val;
+#else
+            return invalidArgument(arg, NULL);
+#endif
+        } else if (strcmp(arg, "--bikes") == 0) {
+            int numBikes;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%d", &numBikes) != 1) ||
+                (numBikes < 1) ||
+                (numBikes > SERVER_MAX_BIKES)) {
+                return invalidArgument(arg, val);
+            }
+            server->numBikes = numBikes;
         } else if (strcmp(arg, "--cadence") == 0) {
             uint16_t cadence;
             if ((val = argv[++n]) == NULL) {
@@ -158,6 +348,13 @@ static int parseArgs(int argc, char **argv, Server *server)
                 return invalidArgument(arg, val);
             }
             server->cadence = cadence;
+#ifdef CONFIG_CTRL_SOCKET
+        } else if (strcmp(arg, "--ctrl-socket") == 0) {
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->ctrlSockName = val;
+#endif
         } else if (strcmp(arg, "--dissect") == 0) {
             int dissectMesgId;
             if ((val = argv[++n]) == NULL) {
@@ -170,6 +367,37 @@ static int parseArgs(int argc, char **argv, Server *server)
             }
             server->dissectMesgId = dissectMesgId;
             server->dissect = true;
+        } else if (strcmp(arg, "--erg-profile") == 0) {
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if (strcmp(val, "step") == 0) {
+                server->erg.profile = ergStep;
+            } else if (strcmp(val, "lag") == 0) {
+                server->erg.profile = ergLag;
+            } else if (strcmp(val, "overshoot") == 0) {
+                server->erg.profile = ergOvershoot;
+            } else {
+                return invalidArgument(arg, val);
+            }
+        } else if (strcmp(arg, "--erg-time-const") == 0) {
+            double timeConst;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%lf", &timeConst) != 1) || (timeConst <= 0.0)) {
+                return invalidArgument(arg, val);
+            }
+            server->erg.timeConst = timeConst;
+        } else if (strcmp(arg, "--ftp") == 0) {
+            uint32_t ftp;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%u", &ftp) != 1) || (ftp == 0) || (ftp > 2000)) {
+                return invalidArgument(arg, val);
+            }
+            server->ftp = ftp;
         } else if (strcmp(arg, "--heart-rate") == 0) {
             uint16_t heartRate;
             if ((val = argv[++n]) == NULL) {
@@ -184,6 +412,11 @@ static int parseArgs(int argc, char **argv, Server *server)
             exit(0);
         } else if (strcmp(arg, "--hex-dump") == 0) {
             server->hexDumpMesg = true;
+        } else if (strcmp(arg, "--interfaces") == 0) {
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->intfNames = val;
         } else if (strcmp(arg, "--ip-address") == 0) {
             if ((val = argv[++n]) == NULL) {
                 return missingArgValue(arg);
@@ -191,6 +424,15 @@ static int parseArgs(int argc, char **argv, Server *server)
             if (inet_pton(AF_INET, val, &server->srvAddr.sin_addr) != 1) {
                 return invalidArgument(arg, val);
             }
+#ifdef CONFIG_LIVE_FEED
+        } else if (strcmp(arg, "--live-feed") == 0) {
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->liveFeedName = val;
+#endif
+        } else if (strcmp(arg, "--lock-step") == 0) {
+            clkInit(stepTime, 1.0);
 #ifdef CONFIG_MSGLOG
         } else if (strcmp(arg, "--log-dest") == 0) {
             if ((val = argv[++n]) == NULL) {
@@ -225,9 +467,55 @@ static int parseArgs(int argc, char **argv, Server *server)
             }
             msgLogSetLevel(level);
 #endif
+        } else if (strcmp(arg, "--mass") == 0) {
+            double mass;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%lf", &mass) != 1) || (mass <= 0.0)) {
+                return invalidArgument(arg, val);
+            }
+            server->mass = mass;
 #ifdef CONFIG_MDNS_AGENT
         } else if (strcmp(arg, "--no-mdns") == 0) {
             server->noMdns = true;
+#endif
+        } else if (strcmp(arg, "--perturb") == 0) {
+            PerturbParms *parms = &server->perturbParms;
+            int numVals;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            parms->power = PERTURB_DEF_POWER;
+            parms->cadence = PERTURB_DEF_CADENCE;
+            parms->heartRate = PERTURB_DEF_HEART_RATE;
+            parms->offset = PERTURB_DEF_OFFSET;
+            parms->dropout = PERTURB_DEF_DROPOUT;
+            numVals = sscanf(val, "%u,%u,%u,%u,%u,%u", &parms->seed, &parms->power, &parms->cadence,
+                             &parms->heartRate, &parms->offset, &parms->dropout);
+            if (((numVals != 1) && (numVals != 6)) ||
+                (parms->power >= 100) ||
+                (parms->cadence > PERTURB_MAX_CADENCE) ||
+                (parms->heartRate > PERTURB_MAX_HEART_RATE) ||
+                (parms->offset > PERTURB_MAX_OFFSET) ||
+                (parms->dropout > 100)) {
+                return invalidArgument(arg, val);
+            }
+            parms->enabled = true;
+        } else if (strcmp(arg, "--physics") == 0) {
+            server->physics = true;
+        } else if (strcmp(arg, "--playback-speed") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            double speed;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%lf", &speed) != 1) || (speed <= 0.0)) {
+                return invalidArgument(arg, val);
+            }
+            server->playbackSpeed = speed;
+#else
+            return invalidArgument(arg, NULL);
 #endif
         } else if (strcmp(arg, "--power") == 0) {
             uint16_t power;
@@ -238,6 +526,102 @@ static int parseArgs(int argc, char **argv, Server *server)
                 return invalidArgument(arg, val);
             }
             server->power = power;
+        } else if (strcmp(arg, "--proxy") == 0) {
+            struct sockaddr_in *sin = (struct sockaddr_in *) &server->trainerAddr;
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &server->trainerAddr;
+            char addrBuf[INET6_ADDRSTRLEN];
+            unsigned long tcpPort = DIRCON_TCP_PORT;
+            const char *addr, *port;
+            size_t addrLen;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if (*val == '[') {
+                // [<addr6>][:<port>]
+                const char *bracket;
+                if ((bracket = strchr(val, ']')) == NULL) {
+                    return invalidArgument(arg, val);
+                }
+                addr = val + 1;
+                addrLen = bracket - addr;
+                if (bracket[1] == ':') {
+                    port = bracket + 2;
+                } else if (bracket[1] == '\0') {
+                    port = NULL;
+                } else {
+                    return invalidArgument(arg, val);
+                }
+            } else {
+                // <addr4>[:<port>] or <addr6>
+                addr = val;
+                if (((port = strchr(val, ':')) != NULL) && (strchr((port + 1), ':') != NULL)) {
+                    port = NULL;
+                }
+                addrLen = (port != NULL) ? (port++ - val) : strlen(val);
+            }
+            if (addrLen >= sizeof (addrBuf)) {
+                return invalidArgument(arg, val);
+            }
+            memcpy(addrBuf, addr, addrLen);
+            addrBuf[addrLen] = '\0';
+            if (port != NULL) {
+                char *end;
+                tcpPort = strtoul(port, &end, 10);
+                if ((end == port) || (*end != '\0') || (tcpPort == 0) || (tcpPort > UINT16_MAX)) {
+                    return invalidArgument(arg, val);
+                }
+            }
+            memset(&server->trainerAddr, 0, sizeof (server->trainerAddr));
+            if ((*val != '[') && (inet_pton(AF_INET, addrBuf, &sin->sin_addr) == 1)) {
+                sin->sin_family = AF_INET;
+                sin->sin_port = htons(tcpPort);
+            } else if (inet_pton(AF_INET6, addrBuf, &sin6->sin6_addr) == 1) {
+                sin6->sin6_family = AF_INET6;
+                sin6->sin6_port = htons(tcpPort);
+            } else {
+                return invalidArgument(arg, val);
+            }
+            server->proxy = true;
+        } else if (strcmp(arg, "--record") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->recordDir = val;
+#else
+            return invalidArgument(arg, NULL);
+#endif
+        } else if (strcmp(arg, "--resample") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            char method[16];
+            uint32_t interval = 1;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%15[a-z],%u", method, &interval) < 1) ||
+                (interval == 0) || (interval > 60)) {
+                return invalidArgument(arg, val);
+            }
+            if (strcmp(method, "linear") == 0) {
+                server->resample = trkPtLinear;
+            } else if (strcmp(method, "previous") == 0) {
+                server->resample = trkPtPrevious;
+            } else {
+                return invalidArgument(arg, val);
+            }
+            server->resampleInterval = interval;
+#else
+            return invalidArgument(arg, NULL);
+#endif
+        } else if (strcmp(arg, "--schedule") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->schedFile = val;
+#else
+            return invalidArgument(arg, NULL);
+#endif
         } else if (strcmp(arg, "--speed") == 0) {
             uint16_t speed;
             if ((val = argv[++n]) == NULL) {
@@ -247,6 +631,20 @@ static int parseArgs(int argc, char **argv, Server *server)
                 return invalidArgument(arg, val);
             }
             server->speed = (double) speed / 3.6; // convert km/h to m/s
+        } else if (strcmp(arg, "--start-offset") == 0) {
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+            uint32_t offset, step = 0;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if (sscanf(val, "%u:%u", &offset, &step) < 1) {
+                return invalidArgument(arg, val);
+            }
+            server->startOffset = offset;
+            server->startStep = step;
+#else
+            return invalidArgument(arg, NULL);
+#endif
         } else if (strcmp(arg, "--supported-power-range") == 0) {
             uint16_t minPwr, maxPwr, incPwr;
             if ((val = argv[++n]) == NULL) {
@@ -258,6 +656,29 @@ static int parseArgs(int argc, char **argv, Server *server)
             server->minPower = minPwr;
             server->maxPower = maxPwr;
             server->incPower = incPwr;
+        } else if (strcmp(arg, "--synth") == 0) {
+            SynthParms *parms = &server->synthParms;
+            char model[16];
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            parms->power = SYNTH_DEF_POWER;
+            parms->seed = 0;
+            if (sscanf(val, "%15[a-z],%u,%u", model, &parms->power, &parms->seed) < 1) {
+                return invalidArgument(arg, val);
+            }
+            if (strcmp(model, "steady") == 0) {
+                parms->model = synthSteady;
+            } else if (strcmp(model, "intervals") == 0) {
+                parms->model = synthIntervals;
+            } else if (strcmp(model, "sprints") == 0) {
+                parms->model = synthSprints;
+            } else {
+                return invalidArgument(arg, val);
+            }
+            if ((parms->power == 0) || (parms->power > 2000)) {
+                return invalidArgument(arg, val);
+            }
         } else if (strcmp(arg, "--tcp-port") == 0) {
             uint16_t tcpPort;
             if ((val = argv[++n]) == NULL) {
@@ -269,9 +690,34 @@ static int parseArgs(int argc, char **argv, Server *server)
                 return invalidArgument(arg, val);
             }
             server->srvAddr.sin_port = htons(tcpPort);
+        } else if (strcmp(arg, "--time-scale") == 0) {
+            double scale;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%lf", &scale) != 1) ||
+                (clkInit(scaledTime, scale) != 0)) {
+                return invalidArgument(arg, val);
+            }
         } else if (strcmp(arg, "--version") == 0) {
             fprintf(stdout, "Program version %d.%d built on %s %s\n", PROG_VER_MAJOR, PROG_VER_MINOR, __DATE__, __TIME__);
             exit(0);
+        } else if (strcmp(arg, "--workers") == 0) {
+            int numWorkers;
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            if ((sscanf(val, "%d", &numWorkers) != 1) ||
+                (numWorkers < 0) ||
+                (numWorkers > SERVER_MAX_WORKERS)) {
+                return invalidArgument(arg, val);
+            }
+            server->numWorkers = numWorkers;
+        } else if (strcmp(arg, "--workout") == 0) {
+            if ((val = argv[++n]) == NULL) {
+                return missingArgValue(arg);
+            }
+            server->wkoFile = val;
         } else if (strncmp(arg, "--", 2) == 0) {
             return invalidArgument(arg, NULL);
         }
@@ -282,8 +728,13 @@ static int parseArgs(int argc, char **argv, Server *server)
 
 static void sigHandler(int sigNum, siginfo_t *sigInfo, void *ucontext)
 {
-    // Gracefully exit the app
-    serverObj.exit = true;
+    if (sigNum == SIGUSR1) {
+        // Step the clock (lock-step mode)
+        clkStepReq();
+    } else {
+        // Gracefully exit the app
+        serverObj.exit = true;
+    }
 }
 
 int main(int argc, char *argv[])
@@ -298,6 +749,16 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    // Install SIGUSR1 handler
+    if (sigaction(SIGUSR1, &sigAct, NULL) != 0) {
+        return -1;
+    }
+
+    // Start the clock in real-time mode; it can be
+    // changed by the --lock-step and --time-scale
+    // options.
+    clkInit(realTime, 1.0);
+
     // Parse the command line arguments
     if (parseArgs(argc, argv, server) != 0) {
         return -1;
@@ -305,6 +766,13 @@ int main(int argc, char *argv[])
 
     mlog(info, "dirconServer version %d.%d built on %s %s", PROG_VER_MAJOR, PROG_VER_MINOR, __DATE__, __TIME__);
 
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    if (server->batchOut != NULL) {
+        // Run in batch mode
+        return (batchRun(server, server->schedFile, server->batchOut) == 0) ? 0 : -1;
+    }
+#endif
+
 #ifdef CONFIG_CLI
     // Initialize CLI
     if (cliInit(server) != 0) {
@@ -312,25 +780,22 @@ int main(int argc, char *argv[])
     }
 #endif
 
-    // Initialize Server
-    if (serverInit(server) != 0) {
+    // Initialize the fleet of bikes (and mDNS)
+    if (fleetInit(&fleetObj, server, server->numBikes) != 0) {
         cliPreExitCleanup(server);
         return -1;
     }
 
-#ifdef CONFIG_MDNS_AGENT
-    // Initialize mDNS
-    if (mdnsInit(server) != 0) {
+    // Run the fleet's work loop
+    if (fleetRun(&fleetObj) != 0) {
         cliPreExitCleanup(server);
         return -1;
     }
-#endif
 
-    // Run server's work loop
-    if (serverRun(server) != 0) {
-        cliPreExitCleanup(server);
-        return -1;
-    }
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    // Let the recorded sessions be closed
+    fitWrWaitClose();
+#endif
 
     return 0;
 }
@@ -25,13 +25,17 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include "binbuf.h"
+#include "clock.h"
 #include "dump.h"
 #include "fmtbuf.h"
 #include "mdns.h"
@@ -216,6 +220,7 @@ static __inline__ uint8_t getRespCode(uint16_t flags) { return (flags & 0x000f);
 #define TYPE_PTR    ((uint16_t) 12)
 #define TYPE_HINFO  ((uint16_t) 13)
 #define TYPE_TXT    ((uint16_t) 16)
+#define TYPE_AAAA   ((uint16_t) 28)
 #define TYPE_SRV    ((uint16_t) 33)
 #define TYPE_ANY    ((uint16_t) 255)
 
@@ -228,16 +233,26 @@ static __inline__ uint8_t getRespCode(uint16_t flags) { return (flags & 0x000f);
 // Period between mDNS Advertisements
 static const struct timeval mdnsAdvPeriod = { .tv_sec = 60, .tv_usec = 0 };
 
-// Time of the last mDNS Advertisement
-static struct timeval mdnsLastAdv;
-
-// Device name: ""Wahoo-KICKR-NNNN.local"
-static char deviceNameBuf[128];
-static FmtBuf mdnsDeviceName;
-
-// Service name: "Wahoo KICKR NNNN._wahoo-fitness-tnp._tcp.local"
-static char serviceNameBuf[256];
-static FmtBuf mdnsServiceName;
+// Startup sequence: the advertisement query is sent a few
+// times, and then the service is announced (RFC 6762 section
+// 8.3). There is no conflict detection, as the names are
+// derived from the MAC address of each bike.
+#define MDNS_NUM_QUERIES    3
+#define MDNS_NUM_ANNOUNCES  3
+static const struct timeval mdnsQueryDelay = { .tv_sec = 0, .tv_usec = 250000 };
+
+// RFC 6762 section 6: a record is not multicast again until
+// one second after its last multicast, and the responses
+// are delayed a random amount of time, so the answers to
+// several queries can be aggregated.
+static const struct timeval mdnsRecMinInterval = { .tv_sec = 1, .tv_usec = 0 };
+#define MDNS_RESP_DELAY_MIN     20      // [ms]
+#define MDNS_RESP_DELAY_MAX     120     // [ms]
+#define MDNS_TC_RESP_DELAY_MIN  400     // [ms]
+#define MDNS_TC_RESP_DELAY_MAX  500     // [ms]
+
+// TTL of the PTR records [sec]
+#define MDNS_PTR_TTL    4500
 
 // Wahoo Fitness TNP name: "_wahoo-fitness-tnp._tcp.local"
 static char wahooFitnessTnpNameBuf[64];
@@ -247,25 +262,63 @@ FmtBuf wahooFitnessTnpName;
 static char servicesDnsSdNameBuf[64];
 static FmtBuf servicesDnsSdName;
 
-static void mdnsAddName(BinBuf *mesgBuf, const FmtBuf *name)
+// Max number of names (and name suffixes) remembered in
+// a message, for compression.
+#define MDNS_MAX_SUFFIXES   32
+
+// mDNS message being built. It remembers where each name,
+// and each one of its suffixes, was written, so any later
+// occurrence can be replaced by a compression pointer to
+// the earlier one (RFC 1035 section 4.1.4).
+typedef struct MdnsMesg {
+    BinBuf buf;
+    int numSuffixes;
+    struct {
+        const char *name;   // the suffix, as a dotted string
+        uint16_t offset;    // its offset in the message
+    } suffixes[MDNS_MAX_SUFFIXES];
+} MdnsMesg;
+
+static void mdnsMesgInit(MdnsMesg *mesg, uint8_t *buf, size_t bufSize)
+{
+    binBufInit(&mesg->buf, buf, bufSize, bigEndian);
+    mesg->numSuffixes = 0;
+}
+
+static void mdnsAddName(MdnsMesg *mesg, const FmtBuf *name)
 {
     const char *label = name->buf;
-    int labelLen = 0;
-
-    for (const char *p = label; *p != '\0'; p++) {
-        if (*p == '.') {
-            binBufPutUINT8(mesgBuf, labelLen);
-            binBufPutHex(mesgBuf, label, labelLen);
-            label = p+1;
-            labelLen = 0;
-        } else {
-            labelLen++;
+
+    while (*label != '\0') {
+        size_t labelLen = strcspn(label, ".");
+
+        // If this suffix of the name has already been
+        // written, just point to it.
+        for (int i = 0; i < mesg->numSuffixes; i++) {
+            if (strcasecmp(mesg->suffixes[i].name, label) == 0) {
+                binBufPutUINT16(&mesg->buf, (0xc000 | mesg->suffixes[i].offset));
+                return;
+            }
+        }
+
+        // Remember where this suffix is written. The
+        // pointer's OFFSET field is 14 bits long.
+        if ((mesg->numSuffixes < MDNS_MAX_SUFFIXES) && (mesg->buf.offset < 0x4000)) {
+            mesg->suffixes[mesg->numSuffixes].name = label;
+            mesg->suffixes[mesg->numSuffixes].offset = mesg->buf.offset;
+            mesg->numSuffixes++;
+        }
+
+        binBufPutUINT8(&mesg->buf, labelLen);
+        binBufPutHex(&mesg->buf, label, labelLen);
+
+        label += labelLen;
+        if (*label == '.') {
+            label++;
         }
     }
-    binBufPutUINT8(mesgBuf, labelLen);
-    binBufPutHex(mesgBuf, label, labelLen);
 
-    binBufPutUINT8(mesgBuf, 0);
+    binBufPutUINT8(&mesg->buf, 0);
 }
 
 static int mdnsRemName(BinBuf *mesgBuf, FmtBuf *name)
@@ -273,7 +326,14 @@ static int mdnsRemName(BinBuf *mesgBuf, FmtBuf *name)
     uint8_t labelLen;
     char label[256];
 
-    while ((labelLen = binBufGetUINT8(mesgBuf)) != 0) {
+    for (;;) {
+        if (mesgBuf->offset >= mesgBuf->bufSize) {
+            mlog(debug, "SPONG! Unterminated name: name=%s", name->buf);
+            return -1;
+        }
+        if ((labelLen = binBufGetUINT8(mesgBuf)) == 0) {
+            break;
+        }
         if (labelLen & 0xc0) {
             uint8_t flags = (labelLen >> 6);
             if (flags == 0x03) {
@@ -298,13 +358,25 @@ static int mdnsRemName(BinBuf *mesgBuf, FmtBuf *name)
                 // the start of the message (i.e., the first octet of the ID field in the
                 // domain header).  A zero offset specifies the first byte of the ID field,
                 // etc.
-                uint16_t offset = ((labelLen &0x3f) << 8) | binBufGetUINT8(mesgBuf);
+                uint32_t ptrOffset = mesgBuf->offset - 1;
+                uint16_t offset;
+                BinBuf ptrBuf;
+                if (mesgBuf->offset >= mesgBuf->bufSize) {
+                    mlog(debug, "SPONG! Truncated pointer: name=%s", name->buf);
+                    return -1;
+                }
+                offset = ((labelLen &0x3f) << 8) | binBufGetUINT8(mesgBuf);
+                ptrBuf = *mesgBuf;
                 //mlog(debug, "OFFSET=%u", offset);
-                labelLen = mesgBuf->buf[offset];
-                memcpy(label, &mesgBuf->buf[offset+1], labelLen);
-                label[labelLen] = '\0';
-                (name->offset == 0) ? fmtBufAppend(name, "%s", label) : fmtBufAppend(name, ".%s", label);
-                return 0;
+                // The pointer must point to a prior occurrence
+                // of the name, which also guarantees that we
+                // don't loop forever.
+                if (offset >= ptrOffset) {
+                    mlog(debug, "SPONG! Forward pointer: offset=%u", offset);
+                    return -1;
+                }
+                ptrBuf.offset = offset;
+                return mdnsRemName(&ptrBuf, name);
             } else {
                 mlog(debug, "SPONG! Reserved flags value 0x%02x !", flags);
                 return -1;
@@ -368,11 +440,11 @@ static void mdnsAddString(BinBuf *mesgBuf, const char *str)
 //                  For example, the QCLASS field is IN for the Internet.
 //
 
-static int mdnsAddQuestion(BinBuf *mesgBuf, const FmtBuf *qname, uint16_t qtype, uint16_t qclass)
+static int mdnsAddQuestion(MdnsMesg *mesg, const FmtBuf *qname, uint16_t qtype, uint16_t qclass)
 {
-    mdnsAddName(mesgBuf, qname);        // NAME
-    binBufPutUINT16(mesgBuf, qtype);    // QTYPE
-    binBufPutUINT16(mesgBuf, qclass);   // QCLASS
+    mdnsAddName(mesg, qname);               // NAME
+    binBufPutUINT16(&mesg->buf, qtype);     // QTYPE
+    binBufPutUINT16(&mesg->buf, qclass);    // QCLASS
 
     return 0;
 }
@@ -431,338 +503,1028 @@ static int mdnsAddQuestion(BinBuf *mesgBuf, const FmtBuf *qname, uint16_t qtype,
 //                  according to the TYPE and CLASS of the resource record.
 //
 
-static int mdnsAddResourceRec(BinBuf *mesgBuf, const FmtBuf *qname, uint16_t type,
-                              uint16_t class, uint32_t ttl, const BinBuf *rdata)
+// Add the fixed part of a resource record. The RDATA is
+// then written right into the message, so that the names
+// in it can be compressed too, and the record is closed
+// by mdnsEndResourceRec(), which fills in the RDLENGTH.
+static uint32_t mdnsBeginResourceRec(MdnsMesg *mesg, const FmtBuf *qname, uint16_t type,
+                                     uint16_t class, uint32_t ttl)
 {
-    size_t rdlen = rdata->offset;
+    uint32_t rdlenOffset;
 
-    mdnsAddName(mesgBuf, qname);        // NAME
-    binBufPutUINT16(mesgBuf, type);     // TYPE
-    binBufPutUINT16(mesgBuf, class);    // CLASS
-    binBufPutUINT32(mesgBuf, ttl);      // TTL
-    binBufPutUINT16(mesgBuf, rdlen);    // RDLENGTH
-    binBufPutHex(mesgBuf, rdata->buf, rdlen); // RDATA
+    mdnsAddName(mesg, qname);               // NAME
+    binBufPutUINT16(&mesg->buf, type);      // TYPE
+    binBufPutUINT16(&mesg->buf, class);     // CLASS
+    binBufPutUINT32(&mesg->buf, ttl);       // TTL
+    rdlenOffset = mesg->buf.offset;
+    binBufPutUINT16(&mesg->buf, 0);         // RDLENGTH
 
-    return 0;
+    return rdlenOffset;
 }
 
-static int mdnsSendMesg(Server *server, const BinBuf *mesgBuf)
+static void mdnsEndResourceRec(MdnsMesg *mesg, uint32_t rdlenOffset)
 {
-    size_t mesgLen;
-    ssize_t n;
+    uint32_t offset = mesg->buf.offset;
 
-    if (server->noMdns) {
-        // We are not using mDNS, so just return
-        return 0;
+    mesg->buf.offset = rdlenOffset;
+    binBufPutUINT16(&mesg->buf, (offset - rdlenOffset - sizeof (uint16_t)));
+    mesg->buf.offset = offset;
+}
+
+// Records of a bike in the response to a PTR query
+enum {
+    mdnsPtrRec = 0,         // pointer record
+    mdnsAddrRec = 1,        // address records (A and/or AAAA)
+    mdnsSrvRec = 2,         // service record
+    mdnsTxtRec = 3,         // text record
+};
+
+// Pre-serialized mDNS messages of a bike
+enum {
+    mdnsAdvPkt = 0,         // advertisement
+    mdnsAdvRespPkt = 1,     // advertisement response
+};
+
+// Responses of the fleet to the PTR queries
+enum {
+    mdnsSvcsResp = 0,       // response to "_services._dns-sd._udp.local" query
+    mdnsTnpResp = 1,        // response to "_wahoo-fitness-tnp._tcp.local" query
+};
+
+// Address families served by the mDNS agent
+enum {
+    mdnsIPv4 = 0,
+    mdnsIPv6 = 1,
+    mdnsNumFamilies = 2,
+};
+
+// Number of mDNS messages received/sent per system call
+#define MDNS_RX_BATCH   16
+#define MDNS_TX_BATCH   32
+
+// Max length of an mDNS message. As per RFC 6762 section 17
+// it should fit in a single Ethernet frame.
+#define MDNS_MAX_PKT_LEN    1472
+
+// Ancillary data of an mDNS message: the packet info that
+// tells the interface the message is received on, or sent
+// to.
+typedef union MdnsCtrlBuf {
+    struct cmsghdr hdr;
+    uint8_t buf[CMSG_SPACE(sizeof (struct in6_pktinfo))];
+} MdnsCtrlBuf;
+
+// mDNS socket of an address family. It is shared by all the
+// interfaces: the interface of each message is given by its
+// packet info.
+typedef struct MdnsSock {
+    struct MdnsAgent *agent;
+    int family;                             // mdnsIPv4 or mdnsIPv6
+    int sd;                                 // socket descriptor (-1 if not open)
+    struct sockaddr_storage mcastAddr;      // mDNS group: 224.0.0.251 or ff02::fb
+    socklen_t mcastAddrLen;
+
+    struct mmsghdr rxMsgs[MDNS_RX_BATCH];
+    struct iovec rxIov[MDNS_RX_BATCH];
+    struct sockaddr_storage rxAddrs[MDNS_RX_BATCH];
+    MdnsCtrlBuf rxCtrl[MDNS_RX_BATCH];
+
+    int numTx;                              // number of messages pending to be sent
+    struct mmsghdr txMsgs[MDNS_TX_BATCH];
+    struct iovec txIov[MDNS_TX_BATCH];
+    MdnsCtrlBuf txCtrl[MDNS_TX_BATCH];
+} MdnsSock;
+
+// Response to a PTR query, pending to be sent on one of the
+// interfaces.
+typedef struct MdnsPendResp {
+    struct MdnsAgent *agent;
+    int intfIdx;                            // interface the query was received on
+    int respId;                             // mdnsSvcsResp or mdnsTnpResp
+    uint32_t families;                      // address families the query was received on
+    int numQueries;                         // number of queries aggregated into the response
+    bool tcPend;                            // the known-answer list of a query is truncated
+    struct sockaddr_storage tcFrom;         // querier that sent the truncated query
+    EvTimer timer;                          // when the response is sent
+} MdnsPendResp;
+
+// mDNS agent: the state shared by all the bikes of the
+// fleet, i.e. the sockets, the pending responses, and the
+// buffers used to receive and send the mDNS messages in
+// batches.
+typedef struct MdnsAgent {
+    Server *fleet;                          // first bike of the fleet
+    MdnsSock socks[mdnsNumFamilies];
+    MdnsPendResp pendResps[SERVER_MAX_INTFS][MDNS_NUM_RESPS];
+    struct timeval svcsPtrTime[SERVER_MAX_INTFS];   // last multicast of the "_services._dns-sd._udp.local" PTR record
+
+    uint8_t rxBufs[MDNS_RX_BATCH][MDNS_MAX_PKT_LEN];
+
+    int numTxBufs;                          // number of Tx buffers in use
+    // Leave room for the records of one bike beyond the
+    // max message length.
+    uint8_t txBufs[MDNS_TX_BATCH][MDNS_MAX_PKT_LEN + MAX_MESG_LEN];
+} MdnsAgent;
+
+// Check whether the interface has an address of the
+// specified family.
+static bool mdnsIntfHasAddr(const NetIntf *intf, int family)
+{
+    if (family == mdnsIPv4) {
+        return (intf->addr.s_addr != INADDR_ANY);
     }
 
-    server->txMdnsMesgCnt++;
+    return !IN6_IS_ADDR_UNSPECIFIED(&intf->addr6);
+}
+
+// Fill in a count field of the message header
+static void mdnsSetCount(MdnsMesg *mesg, uint32_t countOffset, uint16_t count)
+{
+    uint32_t offset = mesg->buf.offset;
 
-    mesgLen = mesgBuf->offset;
+    mesg->buf.offset = countOffset;
+    binBufPutUINT16(&mesg->buf, count);
+    mesg->buf.offset = offset;
+}
 
-    mlog(debug, "mesgLen=%zu", mesgLen);
-    //hexDump(mesgBuf->buf, mesgLen);
+// Offsets of the count fields of the message header
+#define MDNS_ANCOUNT_OFFSET     6
+#define MDNS_NSCOUNT_OFFSET     8
 
-    if ((n = sendto(server->mdnsSockFd, mesgBuf->buf, mesgLen, 0, (struct sockaddr *) &server->mdnsAddr, sizeof (server->mdnsAddr))) != mesgLen) {
-        mlog(error, "Failed to send MDNS query! sd=%d mesgLen=%zd n=%zd",
-                server->mdnsSockFd, mesgLen, n);
-        return -1;
+// Send all the mDNS messages queued for transmission, with
+// as few system calls as possible.
+static int mdnsFlushTx(MdnsAgent *agent)
+{
+    int s = 0;
+
+    for (int f = 0; f < mdnsNumFamilies; f++) {
+        MdnsSock *sock = &agent->socks[f];
+        int numSent = 0;
+
+        while (numSent < sock->numTx) {
+            int n;
+            if ((n = sendmmsg(sock->sd, &sock->txMsgs[numSent], (sock->numTx - numSent), 0)) < 0) {
+                // Drop the message that failed, e.g. because
+                // its interface went down, and keep sending
+                // the other ones.
+                mlog(error, "Failed to send MDNS message! sd=%d numTx=%d numSent=%d",
+                        sock->sd, sock->numTx, numSent);
+                s = -1;
+                numSent++;
+                continue;
+            }
+            numSent += n;
+            agent->fleet->txMdnsMesgCnt += n;
+        }
+
+        sock->numTx = 0;
     }
 
-    return 0;
+    agent->numTxBufs = 0;
+
+    return s;
+}
+
+// Queue an mDNS message for transmission on the specified
+// interface. The message is not copied, so it must remain
+// valid until flushed.
+static void mdnsQueueTx(MdnsAgent *agent, int family, int intfIdx, const uint8_t *mesg, size_t mesgLen)
+{
+    MdnsSock *sock = &agent->socks[family];
+    const NetIntf *intf = &agent->fleet->intfs[intfIdx];
+    struct msghdr *msgHdr;
+    struct cmsghdr *cmsg;
+
+    if ((sock->sd < 0) || !mdnsIntfHasAddr(intf, family)) {
+        // Address family not served on this interface
+        return;
+    }
+
+    if (sock->numTx == MDNS_TX_BATCH) {
+        mdnsFlushTx(agent);
+    }
+
+    sock->txIov[sock->numTx].iov_base = (void *) mesg;
+    sock->txIov[sock->numTx].iov_len = mesgLen;
+    msgHdr = &sock->txMsgs[sock->numTx].msg_hdr;
+    memset(msgHdr, 0, sizeof (*msgHdr));
+    msgHdr->msg_name = &sock->mcastAddr;
+    msgHdr->msg_namelen = sock->mcastAddrLen;
+    msgHdr->msg_iov = &sock->txIov[sock->numTx];
+    msgHdr->msg_iovlen = 1;
+    msgHdr->msg_control = &sock->txCtrl[sock->numTx];
+
+    // The packet info selects the outgoing interface, and
+    // the source address of the message.
+    if (family == mdnsIPv4) {
+        struct in_pktinfo pktInfo = { .ipi_ifindex = intf->index, .ipi_spec_dst = intf->addr };
+        msgHdr->msg_controllen = CMSG_SPACE(sizeof (pktInfo));
+        cmsg = CMSG_FIRSTHDR(msgHdr);
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof (pktInfo));
+        memcpy(CMSG_DATA(cmsg), &pktInfo, sizeof (pktInfo));
+    } else {
+        struct in6_pktinfo pktInfo = { .ipi6_addr = intf->addr6, .ipi6_ifindex = intf->index };
+        msgHdr->msg_controllen = CMSG_SPACE(sizeof (pktInfo));
+        cmsg = CMSG_FIRSTHDR(msgHdr);
+        cmsg->cmsg_level = IPPROTO_IPV6;
+        cmsg->cmsg_type = IPV6_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof (pktInfo));
+        memcpy(CMSG_DATA(cmsg), &pktInfo, sizeof (pktInfo));
+    }
+
+    sock->numTx++;
+}
+
+// Get a buffer to build an mDNS message in. It remains in
+// use until the queued messages are flushed.
+static uint8_t *mdnsGetTxBuf(MdnsAgent *agent)
+{
+    // Each message built is queued at most once on each
+    // socket, so make sure there is room for it.
+    if ((agent->numTxBufs == MDNS_TX_BATCH) ||
+        (agent->socks[mdnsIPv4].numTx == MDNS_TX_BATCH) ||
+        (agent->socks[mdnsIPv6].numTx == MDNS_TX_BATCH)) {
+        mdnsFlushTx(agent);
+    }
+
+    return agent->txBufs[agent->numTxBufs++];
 }
 
 int mdnsSendQuery(Server *server, const FmtBuf *qname)
 {
-    BinBuf mesgBuf;
+    MdnsAgent *agent = server->mdnsAgent;
+    MdnsMesg mesg;
 
-    mlog(debug, "mdnsSockFd=%d", server->mdnsSockFd);
+    if (server->noMdns) {
+        // We are not using mDNS, so just return
+        return 0;
+    }
 
-    binBufInit(&mesgBuf, server->txMesgBuf, sizeof (server->txMesgBuf), bigEndian);
+    mdnsMesgInit(&mesg, mdnsGetTxBuf(agent), sizeof (agent->txBufs[0]));
 
     // Init message header
-    binBufPutUINT16(&mesgBuf, 0);    // ID
-    binBufPutUINT16(&mesgBuf, 0);    // QR=0, OPCODE=QUERY
-    binBufPutUINT16(&mesgBuf, 1);    // QDCOUNT=1
-    binBufPutUINT16(&mesgBuf, 0);    // ANCOUNT=0
-    binBufPutUINT16(&mesgBuf, 0);    // NSCOUNT=0
-    binBufPutUINT16(&mesgBuf, 0);    // ARCOUNT=0
+    binBufPutUINT16(&mesg.buf, 0);    // ID
+    binBufPutUINT16(&mesg.buf, 0);    // QR=0, OPCODE=QUERY
+    binBufPutUINT16(&mesg.buf, 1);    // QDCOUNT=1
+    binBufPutUINT16(&mesg.buf, 0);    // ANCOUNT=0
+    binBufPutUINT16(&mesg.buf, 0);    // NSCOUNT=0
+    binBufPutUINT16(&mesg.buf, 0);    // ARCOUNT=0
 
     // Add question #1
-    mdnsAddQuestion(&mesgBuf, qname, TYPE_PTR, CLASS_IN);
+    mdnsAddQuestion(&mesg, qname, TYPE_PTR, CLASS_IN);
 
-    return mdnsSendMesg(server, &mesgBuf);
+    for (int i = 0; i < server->numIntfs; i++) {
+        for (int f = 0; f < mdnsNumFamilies; f++) {
+            mdnsQueueTx(agent, f, i, mesg.buf.buf, mesg.buf.offset);
+        }
+    }
+
+    return mdnsFlushTx(agent);
 }
 
-static int mdnsSendAdv(Server *server, const struct timeval *time)
+// Add the address records of the bike on the interface:
+// TYPE=A and/or TYPE=AAAA, TTL=120. Returns the number of
+// records added.
+static int mdnsAddAddrRecs(MdnsMesg *mesg, Server *server, const NetIntf *intf, uint16_t class)
 {
-    BinBuf mesgBuf;
-    uint8_t buf[512];
-    BinBuf rdata;
-    int s;
+    uint32_t rdlen;
+    int numRecs = 0;
+
+    if (mdnsIntfHasAddr(intf, mdnsIPv4)) {
+        rdlen = mdnsBeginResourceRec(mesg, &server->mdnsDeviceName, TYPE_A, class, 120);
+        binBufPutHex(&mesg->buf, &intf->addr, sizeof (intf->addr));
+        mdnsEndResourceRec(mesg, rdlen);
+        numRecs++;
+    }
+
+    if (mdnsIntfHasAddr(intf, mdnsIPv6)) {
+        rdlen = mdnsBeginResourceRec(mesg, &server->mdnsDeviceName, TYPE_AAAA, class, 120);
+        binBufPutHex(&mesg->buf, &intf->addr6, sizeof (intf->addr6));
+        mdnsEndResourceRec(mesg, rdlen);
+        numRecs++;
+    }
+
+    return numRecs;
+}
+
+// Add the host info record of the bike: TYPE=HINFO, TTL=7200
+static void mdnsAddHinfoRec(MdnsMesg *mesg, Server *server, uint16_t class)
+{
+    const char *wftnp = "WFTNP";
+    uint32_t rdlen = mdnsBeginResourceRec(mesg, &server->mdnsDeviceName, TYPE_HINFO, class, 7200);
+    mdnsAddString(&mesg->buf, wftnp);   // CPU=<name>
+    mdnsAddString(&mesg->buf, wftnp);   // OS=<name>
+    mdnsEndResourceRec(mesg, rdlen);
+}
 
-    mlog(debug, "mdnsSockFd=%d", server->mdnsSockFd);
+// Add the service record of the bike: TYPE=SRV, TTL=120
+static void mdnsAddSrvRec(MdnsMesg *mesg, Server *server, uint16_t class)
+{
+    uint16_t port = ntohs(server->srvAddr.sin_port);
+    uint32_t rdlen = mdnsBeginResourceRec(mesg, &server->mdnsServiceName, TYPE_SRV, class, 120);
+    binBufPutUINT16(&mesg->buf, 0);     // PRIORITY=0
+    binBufPutUINT16(&mesg->buf, 0);     // WEIGHT=0
+    binBufPutUINT16(&mesg->buf, port);  // PORT=<port>
+    mdnsAddName(mesg, &server->mdnsDeviceName); // TARGET=<name>
+    mdnsEndResourceRec(mesg, rdlen);
+}
 
-    binBufInit(&mesgBuf, server->txMesgBuf, sizeof (server->txMesgBuf), bigEndian);
+static void mdnsBuildAdv(Server *server, const NetIntf *intf, MdnsMesg *mesg)
+{
+    int nsCount;
 
     // Init message header
-    binBufPutUINT16(&mesgBuf, 0);    // ID
-    binBufPutUINT16(&mesgBuf, 0);    // QR=0, OPCODE=QUERY
-    binBufPutUINT16(&mesgBuf, 3);    // QDCOUNT=3
-    binBufPutUINT16(&mesgBuf, 0);    // ANCOUNT=0
-    binBufPutUINT16(&mesgBuf, 3);    // NSCOUNT=3
-    binBufPutUINT16(&mesgBuf, 0);    // ARCOUNT=0
+    binBufPutUINT16(&mesg->buf, 0);    // ID
+    binBufPutUINT16(&mesg->buf, 0);    // QR=0, OPCODE=QUERY
+    binBufPutUINT16(&mesg->buf, 3);    // QDCOUNT=3
+    binBufPutUINT16(&mesg->buf, 0);    // ANCOUNT=0
+    binBufPutUINT16(&mesg->buf, 0);    // NSCOUNT=<filled in later>
+    binBufPutUINT16(&mesg->buf, 0);    // ARCOUNT=0
 
     // Add question #1
-    mdnsAddQuestion(&mesgBuf, &mdnsDeviceName, TYPE_ANY, CLASS_IN);
+    mdnsAddQuestion(mesg, &server->mdnsDeviceName, TYPE_ANY, CLASS_IN);
 
     // Add question #2
-    mdnsAddQuestion(&mesgBuf, &mdnsDeviceName, TYPE_ANY, CLASS_IN);
+    mdnsAddQuestion(mesg, &server->mdnsDeviceName, TYPE_ANY, CLASS_IN);
 
     // Add question #3
-    mdnsAddQuestion(&mesgBuf, &mdnsServiceName, TYPE_ANY, CLASS_IN);
+    mdnsAddQuestion(mesg, &server->mdnsServiceName, TYPE_ANY, CLASS_IN);
 
-    // Add address resource record: TYPE=A, CLASS=IN, TTL=120
-    {
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        binBufPutHex(&rdata, &server->srvAddr.sin_addr, sizeof (server->srvAddr.sin_addr));
-        mdnsAddResourceRec(&mesgBuf, &mdnsDeviceName, TYPE_A, CLASS_IN, 120, &rdata);
-    }
+    // Add address resource records: TYPE=A/AAAA, CLASS=IN, TTL=120
+    nsCount = mdnsAddAddrRecs(mesg, server, intf, CLASS_IN);
 
     // Add host info record: TYPE=HINFO, CLASS=IN, TTL=7200
-    {
-        const char *wftnp = "WFTNP";
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        mdnsAddString(&rdata, wftnp);   // CPU=<name>
-        mdnsAddString(&rdata, wftnp);   // OS=<name>
-        mdnsAddResourceRec(&mesgBuf, &mdnsDeviceName, TYPE_HINFO, CLASS_IN, 7200, &rdata);
-    }
+    mdnsAddHinfoRec(mesg, server, CLASS_IN);
 
     // Add service record: TYPE=SRV, CLASS=IN, TTL=120
-    {
-        uint16_t port = ntohs(server->srvAddr.sin_port);
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        binBufPutUINT16(&rdata, 0);     // PRIORITY=0
-        binBufPutUINT16(&rdata, 0);     // WEIGHT=0
-        binBufPutUINT16(&rdata, port);  // PORT=<port>
-        mdnsAddName(&rdata, &mdnsDeviceName); // TARGET=<name>
-        mdnsAddResourceRec(&mesgBuf, &mdnsServiceName, TYPE_SRV, CLASS_IN, 120, &rdata);
-    }
-
-    if ((s = mdnsSendMesg(server, &mesgBuf)) == 0) {
-        mdnsLastAdv = *time;
-    }
+    mdnsAddSrvRec(mesg, server, CLASS_IN);
 
-    return s;
+    mdnsSetCount(mesg, MDNS_NSCOUNT_OFFSET, (nsCount + 2));
 }
 
-static int mdnsSendAdvResp(Server *server)
+static void mdnsBuildAdvResp(Server *server, const NetIntf *intf, MdnsMesg *mesg)
 {
-    BinBuf mesgBuf;
-    uint8_t buf[512];
-    BinBuf rdata;
-
-    mlog(debug, "mdnsSockFd=%d", server->mdnsSockFd);
-
-    binBufInit(&mesgBuf, server->txMesgBuf, sizeof (server->txMesgBuf), bigEndian);
+    int anCount;
 
     // Init message header
-    binBufPutUINT16(&mesgBuf, 0);       // ID
-    binBufPutUINT16(&mesgBuf, 0x8000);  // QR=1, OPCODE=QUERY
-    binBufPutUINT16(&mesgBuf, 0);       // QDCOUNT=0
-    binBufPutUINT16(&mesgBuf, 3);       // ANCOUNT=3
-    binBufPutUINT16(&mesgBuf, 0);       // NSCOUNT=0
-    binBufPutUINT16(&mesgBuf, 0);       // ARCOUNT=0
+    binBufPutUINT16(&mesg->buf, 0);       // ID
+    binBufPutUINT16(&mesg->buf, 0x8000);  // QR=1, OPCODE=QUERY
+    binBufPutUINT16(&mesg->buf, 0);       // QDCOUNT=0
+    binBufPutUINT16(&mesg->buf, 0);       // ANCOUNT=<filled in later>
+    binBufPutUINT16(&mesg->buf, 0);       // NSCOUNT=0
+    binBufPutUINT16(&mesg->buf, 0);       // ARCOUNT=0
 
-    // Add address resource record: TYPE=A, CLASS=IN, CACHE-FLUSH=1, TTL=120
-    {
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        binBufPutHex(&rdata, &server->srvAddr.sin_addr, sizeof (server->srvAddr.sin_addr));
-        mdnsAddResourceRec(&mesgBuf, &mdnsDeviceName, TYPE_A, (CLASS_IN | CACHE_FLUSH), 120, &rdata);
-    }
+    // Add address resource records: TYPE=A/AAAA, CLASS=IN, CACHE-FLUSH=1, TTL=120
+    anCount = mdnsAddAddrRecs(mesg, server, intf, (CLASS_IN | CACHE_FLUSH));
 
-    // Add host info record: TYPE=HINFO, CLASS=IN, TTL=7200
-    {
-        const char *wftnp = "WFTNP";
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        mdnsAddString(&rdata, wftnp);   // CPU=<name>
-        mdnsAddString(&rdata, wftnp);   // OS=<name>
-        mdnsAddResourceRec(&mesgBuf, &mdnsDeviceName, TYPE_HINFO, (CLASS_IN | CACHE_FLUSH), 7200, &rdata);
-    }
+    // Add host info record: TYPE=HINFO, CLASS=IN, CACHE-FLUSH=1, TTL=7200
+    mdnsAddHinfoRec(mesg, server, (CLASS_IN | CACHE_FLUSH));
 
     // Add service record: TYPE=SRV, CLASS=IN, CACHE-FLUSH=1, TTL=120
-    {
-        uint16_t port = ntohs(server->srvAddr.sin_port);
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        binBufPutUINT16(&rdata, 0);     // PRIORITY=0
-        binBufPutUINT16(&rdata, 0);     // WEIGHT=0
-        binBufPutUINT16(&rdata, port);  // PORT=<port>
-        mdnsAddName(&rdata, &mdnsDeviceName); // TARGET=<name>
-        mdnsAddResourceRec(&mesgBuf, &mdnsServiceName, TYPE_SRV, (CLASS_IN | CACHE_FLUSH), 120, &rdata);
-    }
+    mdnsAddSrvRec(mesg, server, (CLASS_IN | CACHE_FLUSH));
 
-    return mdnsSendMesg(server, &mesgBuf);
+    mdnsSetCount(mesg, MDNS_ANCOUNT_OFFSET, (anCount + 2));
 }
 
-static int mdnsSendResp(Server *server, uint16_t id, const FmtBuf *qname)
+// Add the records that answer a PTR query to the response:
+// the PTR record itself, followed by the records of the
+// service instance of the bike on the interface, as
+// selected by 'recs'. Returns the number of records added.
+static int mdnsAddRespRecs(MdnsMesg *mesg, Server *server, const NetIntf *intf,
+                           const FmtBuf *qname, uint32_t recs)
 {
-    BinBuf mesgBuf;
-    uint8_t buf[512];
-    BinBuf rdata;
-
-    binBufInit(&mesgBuf, server->txMesgBuf, sizeof (server->txMesgBuf), bigEndian);
+    uint32_t rdlen;
+    int numRecs = 0;
 
-    // Init message header
-    binBufPutUINT16(&mesgBuf, 0);       // ID
-    binBufPutUINT16(&mesgBuf, 0x8000);  // QR=1, OPCODE=QUERY
-    binBufPutUINT16(&mesgBuf, 0);       // QDCOUNT=0
-    binBufPutUINT16(&mesgBuf, 4);       // ANCOUNT=4
-    binBufPutUINT16(&mesgBuf, 0);       // NSCOUNT=0
-    binBufPutUINT16(&mesgBuf, 0);       // ARCOUNT=0
-
-    // Add pointer record: TYPE=PTR, CLASS=IN, TTL=4500
-    {
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
+    if (bitTest(mdnsPtrRec, recs)) {
+        // Add pointer record: TYPE=PTR, CLASS=IN, TTL=4500
+        rdlen = mdnsBeginResourceRec(mesg, qname, TYPE_PTR, CLASS_IN, MDNS_PTR_TTL);
         if (fmtBufComp(qname, &servicesDnsSdName) == 0) {
             // qname="_services._dns-sd._udp.local"
-            mdnsAddName(&rdata, &wahooFitnessTnpName); // TARGET="_wahoo-fitness-tnp._tcp.local"
+            mdnsAddName(mesg, &wahooFitnessTnpName); // TARGET="_wahoo-fitness-tnp._tcp.local"
         } else {
             // qname="_wahoo-fitness-tnp._tcp.local"
-            mdnsAddName(&rdata, &mdnsServiceName);  // TARGET="Wahoo KICKR NNNN._wahoo-fitness-tnp._tcp.local"
+            mdnsAddName(mesg, &server->mdnsServiceName);  // TARGET="Wahoo KICKR NNNN._wahoo-fitness-tnp._tcp.local"
         }
-        mdnsAddResourceRec(&mesgBuf, qname, TYPE_PTR, CLASS_IN, 4500, &rdata);
+        mdnsEndResourceRec(mesg, rdlen);
+        numRecs++;
     }
 
-    // Add address resource record: TYPE=A, CLASS=IN, CACHE-FLUSH=1, TTL=120
-    {
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        binBufPutHex(&rdata, &server->srvAddr.sin_addr, sizeof (server->srvAddr.sin_addr));
-        mdnsAddResourceRec(&mesgBuf, &mdnsDeviceName, TYPE_A, (CLASS_IN | CACHE_FLUSH), 120, &rdata);
+    if (bitTest(mdnsAddrRec, recs)) {
+        // Add address resource records: TYPE=A/AAAA, CLASS=IN, CACHE-FLUSH=1, TTL=120
+        numRecs += mdnsAddAddrRecs(mesg, server, intf, (CLASS_IN | CACHE_FLUSH));
     }
 
-    // Add service record: TYPE=SRV, CLASS=IN, CACHE-FLUSH=1, TTL=120
-    {
-        uint16_t port = ntohs(server->srvAddr.sin_port);
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        binBufPutUINT16(&rdata, 0);     // PRIORITY=0
-        binBufPutUINT16(&rdata, 0);     // WEIGHT=0
-        binBufPutUINT16(&rdata, port);  // PORT=<port>
-        mdnsAddName(&rdata, &mdnsDeviceName); // TARGET=<name>
-        mdnsAddResourceRec(&mesgBuf, &mdnsServiceName, TYPE_SRV, (CLASS_IN | CACHE_FLUSH), 120, &rdata);
-    }
-
-    // Add text record: TYPE=TXT, CLASS=IN, TTL=4500
-    {
+    if (bitTest(mdnsSrvRec, recs)) {
+        // Add service record: TYPE=SRV, CLASS=IN, CACHE-FLUSH=1, TTL=120
+        mdnsAddSrvRec(mesg, server, (CLASS_IN | CACHE_FLUSH));
+        numRecs++;
+    }
+
+    if (bitTest(mdnsTxtRec, recs)) {
+        // Add text record: TYPE=TXT, CLASS=IN, TTL=4500
+        char serialNum[64];
         char macAddr[64];
-        binBufInit(&rdata, buf, sizeof (buf), bigEndian);
-        mdnsAddString(&rdata, "serial-number=123456789");
+        rdlen = mdnsBeginResourceRec(mesg, &server->mdnsServiceName, TYPE_TXT, CLASS_IN, 120);
+        snprintf(serialNum, sizeof (serialNum), "serial-number=%u", server->serialNum);
+        mdnsAddString(&mesg->buf, serialNum);
         snprintf(macAddr, sizeof (macAddr), "mac-address=%02X-%02X-%02X-%02X-%02X-%02X",
                  server->macAddr[0], server->macAddr[1], server->macAddr[2],
                  server->macAddr[3], server->macAddr[4], server->macAddr[5]);
-        mdnsAddString(&rdata, macAddr);
-        mdnsAddString(&rdata, "ble-service-uuids=0x1818,0x1826");
-        mdnsAddResourceRec(&mesgBuf, &mdnsServiceName, TYPE_TXT, CLASS_IN, 120, &rdata);
+        mdnsAddString(&mesg->buf, macAddr);
+        mdnsAddString(&mesg->buf, "ble-service-uuids=0x1818,0x1826");
+        mdnsEndResourceRec(mesg, rdlen);
+        numRecs++;
     }
 
-    return mdnsSendMesg(server, &mesgBuf);
+    return numRecs;
 }
 
-int mdnsInit(Server *server)
+// Encode the mDNS messages of the bike on the interface,
+// unless they are already cached: their records only
+// change when the TCP port of the bike changes.
+static void mdnsUpdPkts(Server *server, int intfIdx)
 {
-    int sd;
-    struct sockaddr_in locAddr = {0};
-    struct ip_mreq mreq = {{0},{0}};
+    MdnsIntfState *state = &server->mdnsIntfs[intfIdx];
+    const NetIntf *intf = &server->intfs[intfIdx];
+    MdnsMesg mesg;
+    MdnsPkt *pkt;
 
-    if (server->noMdns) {
-        // We are not using mDNS, so just return
-        return 0;
+    if ((state->pkts[mdnsAdvPkt].len != 0) && (state->pktsPort == server->srvAddr.sin_port)) {
+        return;
     }
 
-    fmtBufInit(&mdnsDeviceName, deviceNameBuf, sizeof (deviceNameBuf));
-    fmtBufAppend(&mdnsDeviceName, "Wahoo-KICKR-%02X%02X.local",
-                 server->macAddr[4], server->macAddr[5]);
+    pkt = &state->pkts[mdnsAdvPkt];
+    mdnsMesgInit(&mesg, pkt->buf, sizeof (pkt->buf));
+    mdnsBuildAdv(server, intf, &mesg);
+    pkt->len = mesg.buf.offset;
 
-    fmtBufInit(&mdnsServiceName, serviceNameBuf, sizeof (serviceNameBuf));
-    fmtBufAppend(&mdnsServiceName, "Wahoo KICKR %02X%02X._wahoo-fitness-tnp._tcp.local",
-                 server->macAddr[4], server->macAddr[5]);
+    pkt = &state->pkts[mdnsAdvRespPkt];
+    mdnsMesgInit(&mesg, pkt->buf, sizeof (pkt->buf));
+    mdnsBuildAdvResp(server, intf, &mesg);
+    pkt->len = mesg.buf.offset;
 
-    fmtBufInit(&wahooFitnessTnpName, wahooFitnessTnpNameBuf, sizeof (wahooFitnessTnpNameBuf));
-    fmtBufAppend(&wahooFitnessTnpName, "_wahoo-fitness-tnp._tcp.local");
+    state->pktsPort = server->srvAddr.sin_port;
 
-    fmtBufInit(&servicesDnsSdName, servicesDnsSdNameBuf, sizeof (servicesDnsSdNameBuf));
-    fmtBufAppend(&servicesDnsSdName, "_services._dns-sd._udp.local");
+    mlog(debug, "Bike #%d: mDNS messages encoded for interface %s", server->bikeId, intf->name);
+}
 
-    if ((sd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        mlog(error, "Failed to open UDP socket!");
-        return -1;
+// Queue one of the pre-serialized messages of the bike on
+// all the interfaces, and address families.
+static void mdnsQueuePkt(Server *server, int pktId)
+{
+    for (int i = 0; i < server->numIntfs; i++) {
+        const MdnsPkt *pkt = &server->mdnsIntfs[i].pkts[pktId];
+
+        mdnsUpdPkts(server, i);
+
+        for (int f = 0; f < mdnsNumFamilies; f++) {
+            mdnsQueueTx(server->mdnsAgent, f, i, pkt->buf, pkt->len);
+        }
+    }
+}
+
+static void mdnsQueueAdv(Server *server)
+{
+    mdnsQueuePkt(server, mdnsAdvPkt);
+}
+
+static void mdnsQueueAdvResp(Server *server, const struct timeval *now)
+{
+    // The advertisement response multicasts the address
+    // and service records of the bike.
+    for (int i = 0; i < server->numIntfs; i++) {
+        server->mdnsIntfs[i].recTime[mdnsAddrRec] = *now;
+        server->mdnsIntfs[i].recTime[mdnsSrvRec] = *now;
+    }
+
+    mdnsQueuePkt(server, mdnsAdvRespPkt);
+}
+
+// Start a response message
+static void mdnsBeginResp(MdnsAgent *agent, MdnsMesg *mesg)
+{
+    mdnsMesgInit(mesg, mdnsGetTxBuf(agent), sizeof (agent->txBufs[0]));
+
+    // Init message header
+    binBufPutUINT16(&mesg->buf, 0);       // ID
+    binBufPutUINT16(&mesg->buf, 0x8000);  // QR=1, OPCODE=QUERY
+    binBufPutUINT16(&mesg->buf, 0);       // QDCOUNT=0
+    binBufPutUINT16(&mesg->buf, 0);       // ANCOUNT=<filled in later>
+    binBufPutUINT16(&mesg->buf, 0);       // NSCOUNT=0
+    binBufPutUINT16(&mesg->buf, 0);       // ARCOUNT=0
+}
+
+// Close the response message, and queue it for transmission
+// on the interface, over the specified address families.
+static void mdnsEndResp(MdnsAgent *agent, MdnsMesg *mesg, uint16_t anCount, int intfIdx, uint32_t families)
+{
+    mdnsSetCount(mesg, MDNS_ANCOUNT_OFFSET, anCount);
+
+    for (int f = 0; f < mdnsNumFamilies; f++) {
+        if (bitTest(f, families)) {
+            mdnsQueueTx(agent, f, intfIdx, mesg->buf.buf, mesg->buf.offset);
+        }
+    }
+}
+
+// Send the response of the fleet to a PTR query received on
+// one of the interfaces. The records of all the bikes
+// included in the response are packed in as few messages as
+// possible, leaving out the records that were multicast on
+// the interface less than one second ago (RFC 6762 section
+// 6).
+static void mdnsSendFleetResp(MdnsAgent *agent, MdnsPendResp *pendResp, const struct timeval *now)
+{
+    int intfIdx = pendResp->intfIdx;
+    int respId = pendResp->respId;
+    const NetIntf *intf = &agent->fleet->intfs[intfIdx];
+    const FmtBuf *qname = (respId == mdnsSvcsResp) ? &servicesDnsSdName : &wahooFitnessTnpName;
+    struct timeval minTime;
+    bool svcsPtrOk;
+    MdnsMesg mesg;
+    uint16_t anCount = 0;
+    Server *bike = agent->fleet;
+
+    // Only the records last multicast at or before this
+    // time can be multicast again.
+    tvSub(&minTime, now, &mdnsRecMinInterval);
+
+    // The PTR record of the "_services._dns-sd._udp.local"
+    // query is the same for all the bikes, so if it was
+    // just multicast the whole response is dropped.
+    svcsPtrOk = (tvCmp(&agent->svcsPtrTime[intfIdx], &minTime) <= 0);
+
+    while (bike != NULL) {
+        MdnsIntfState *state = &bike->mdnsIntfs[intfIdx];
+        uint32_t offset;
+        int numSuffixes;
+        int numRecs;
+        uint32_t recs = 0;
+
+        if (!state->respPend[respId]) {
+            bike = TAILQ_NEXT(bike, fleetEnt);
+            continue;
+        }
+
+        for (int r = 0; r < MDNS_NUM_RECS; r++) {
+            if (tvCmp(&state->recTime[r], &minTime) <= 0) {
+                recs |= bitMask(r);
+            }
+        }
+
+        if (respId == mdnsSvcsResp) {
+            // The shared PTR record is only added once to
+            // each message.
+            if (!svcsPtrOk) {
+                recs = 0;
+            } else {
+                recs &= ~bitMask(mdnsPtrRec);
+                if (anCount == 0) {
+                    recs |= bitMask(mdnsPtrRec);
+                }
+            }
+        } else if (!bitTest(mdnsPtrRec, recs)) {
+            // The answer itself was just multicast, so leave
+            // out the other records of the bike too.
+            recs = 0;
+        }
+
+        if (recs == 0) {
+            state->respPend[respId] = false;
+            bike = TAILQ_NEXT(bike, fleetEnt);
+            continue;
+        }
+
+        if (anCount == 0) {
+            // Start a new message
+            mdnsBeginResp(agent, &mesg);
+        }
+
+        offset = mesg.buf.offset;
+        numSuffixes = mesg.numSuffixes;
+        numRecs = mdnsAddRespRecs(&mesg, bike, intf, qname, recs);
+
+        if ((mesg.buf.offset > MDNS_MAX_PKT_LEN) && (anCount != 0)) {
+            // The records of this bike don't fit: remove
+            // them, and move them to a new message.
+            mesg.buf.offset = offset;
+            mesg.numSuffixes = numSuffixes;
+            mdnsEndResp(agent, &mesg, anCount, intfIdx, pendResp->families);
+            anCount = 0;
+            continue;
+        }
+
+        // Remember when the records were multicast
+        for (int r = 0; r < MDNS_NUM_RECS; r++) {
+            if (bitTest(r, recs)) {
+                if ((respId == mdnsSvcsResp) && (r == mdnsPtrRec)) {
+                    agent->svcsPtrTime[intfIdx] = *now;
+                } else {
+                    state->recTime[r] = *now;
+                }
+            }
+        }
+
+        anCount += numRecs;
+        state->respPend[respId] = false;
+        bike = TAILQ_NEXT(bike, fleetEnt);
+    }
+
+    if (anCount != 0) {
+        mdnsEndResp(agent, &mesg, anCount, intfIdx, pendResp->families);
+    }
+
+    pendResp->families = 0;
+    pendResp->numQueries = 0;
+    pendResp->tcPend = false;
+
+    mdnsFlushTx(agent);
+}
+
+static void mdnsRespTimerHandler(void *arg, const struct timeval *now)
+{
+    MdnsPendResp *pendResp = arg;
+
+    mdnsSendFleetResp(pendResp->agent, pendResp, now);
+}
+
+// Schedule the response to a PTR query. It is sent after a
+// random 20-120 ms delay, so the same question asked by
+// several queriers in the meantime gets a single response.
+// If the known-answer list of the query is truncated, the
+// delay is 400-500 ms, to give the querier time to send
+// the rest of the list (RFC 6762 section 7.2).
+static void mdnsSchedResp(MdnsAgent *agent, int family, int intfIdx, int respId, bool truncated,
+                          const struct sockaddr_storage *fromAddr)
+{
+    MdnsPendResp *pendResp = &agent->pendResps[intfIdx][respId];
+    struct timeval now, delay, expiry;
+    long msec;
+
+    pendResp->families |= bitMask(family);
+    pendResp->numQueries++;
+    if (truncated) {
+        // The rest of the known answers follow
+        pendResp->tcPend = true;
+        pendResp->tcFrom = *fromAddr;
+    }
+
+    if ((pendResp->timer.list != NULL) && !truncated) {
+        // Aggregated into the pending response
+        return;
+    }
+
+    if (truncated) {
+        msec = MDNS_TC_RESP_DELAY_MIN + (random() % (MDNS_TC_RESP_DELAY_MAX - MDNS_TC_RESP_DELAY_MIN + 1));
+    } else {
+        msec = MDNS_RESP_DELAY_MIN + (random() % (MDNS_RESP_DELAY_MAX - MDNS_RESP_DELAY_MIN + 1));
     }
+    delay.tv_sec = 0;
+    delay.tv_usec = msec * 1000;
+
+    clkGetTime(&now);
+    tvAdd(&expiry, &now, &delay);
+    evTimerStart(agent->fleet->evLoop, &pendResp->timer, &expiry);
+}
+
+// The mDNS advertisements of each bike are driven by its
+// timer: first the queries, 250 ms apart, then the
+// announcements, 1 s apart and doubling, and finally the
+// periodic advertisements. So the startup sequence never
+// blocks the event loop.
+static void mdnsAdvTimerHandler(void *arg, const struct timeval *now)
+{
+    Server *server = arg;
+    struct timeval delay = mdnsAdvPeriod;
+    struct timeval expiry;
+
+    if (server->mdnsState == mdnsQuerying) {
+        mdnsQueueAdv(server);
+        delay = mdnsQueryDelay;
+        if (++server->mdnsCount == MDNS_NUM_QUERIES) {
+            server->mdnsState = mdnsAnnouncing;
+            server->mdnsCount = 0;
+        }
+    } else if (server->mdnsState == mdnsAnnouncing) {
+        mdnsQueueAdvResp(server, now);
+        delay.tv_sec = 1 << server->mdnsCount;
+        delay.tv_usec = 0;
+        if (++server->mdnsCount == MDNS_NUM_ANNOUNCES) {
+            mlog(info, "Bike #%d: mDNS service %s announced", server->bikeId, server->mdnsServiceName.buf);
+            server->mdnsState = mdnsAdvertising;
+            delay = mdnsAdvPeriod;
+        }
+    } else {
+        // Time to send a new mDNS advertisement!
+        mdnsQueueAdv(server);
+        mdnsQueueAdvResp(server, now);
+    }
+
+    mdnsFlushTx(server->mdnsAgent);
+
+    tvAdd(&expiry, now, &delay);
+    evTimerStart(server->evLoop, &server->mdnsTimer, &expiry);
+}
+
+static int mdnsProcSockMesgs(MdnsSock *sock);
+
+static void mdnsProcSockEvent(void *arg, int fd, short revents)
+{
+    // Process mDNS message(s)
+    mdnsProcSockMesgs((MdnsSock *) arg);
+}
+
+// Open the mDNS socket of the specified address family, and
+// join the mDNS group on all the interfaces that have an
+// address of that family.
+static int mdnsOpenSock(MdnsAgent *agent, int family)
+{
+    Server *server = agent->fleet;
+    MdnsSock *sock = &agent->socks[family];
+    int enable = 1;
+    int numGroups = 0;
+    int sd;
+
+    sock->agent = agent;
+    sock->family = family;
 
-    locAddr.sin_family = AF_INET;
-    locAddr.sin_port = htons(5353);
-    if (bind(sd, (struct sockaddr *) &locAddr, sizeof (locAddr)) < 0) {
-        int errNo = errno;
-        mlog(error, "Failed to bind UDP socket!");
-        if (errNo == EADDRINUSE) {
-            mlog(error, "Make sure there is no Zeroconf/Bonjour service running on this system...");
+    if (family == mdnsIPv4) {
+        struct sockaddr_in locAddr = { .sin_family = AF_INET, .sin_port = htons(MDNS_UDP_PORT) };
+        struct sockaddr_in *mcastAddr = (struct sockaddr_in *) &sock->mcastAddr;
+
+        if ((sd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+            mlog(error, "Failed to open UDP socket!");
+            return -1;
         }
+        if (bind(sd, (struct sockaddr *) &locAddr, sizeof (locAddr)) < 0) {
+            int errNo = errno;
+            mlog(error, "Failed to bind UDP socket!");
+            if (errNo == EADDRINUSE) {
+                mlog(error, "Make sure there is no Zeroconf/Bonjour service running on this system...");
+            }
+            close(sd);
+            return -1;
+        }
+        if (setsockopt(sd, IPPROTO_IP, IP_PKTINFO, &enable, sizeof (enable)) < 0) {
+            mlog(error, "setsockopt(IP_PKTINFO) failed!");
+            close(sd);
+            return -1;
+        }
+
+        // Initialize well-known mDNS socket address
+        mcastAddr->sin_family = AF_INET;
+        mcastAddr->sin_addr.s_addr = htonl(0xe00000fb);   // 224.0.0.251
+        mcastAddr->sin_port = htons(MDNS_UDP_PORT);
+        sock->mcastAddrLen = sizeof (*mcastAddr);
+
+        for (int i = 0; i < server->numIntfs; i++) {
+            const NetIntf *intf = &server->intfs[i];
+            struct ip_mreqn mreq = { .imr_multiaddr = mcastAddr->sin_addr, .imr_address = intf->addr, .imr_ifindex = intf->index };
+            if (!mdnsIntfHasAddr(intf, family)) {
+                continue;
+            }
+            if (setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)) < 0) {
+                mlog(error, "Failed to join MDNS mcast group on %s!", intf->name);
+                continue;
+            }
+            numGroups++;
+        }
+    } else {
+        struct sockaddr_in6 locAddr = { .sin6_family = AF_INET6, .sin6_port = htons(MDNS_UDP_PORT) };
+        struct sockaddr_in6 *mcastAddr = (struct sockaddr_in6 *) &sock->mcastAddr;
+
+        if ((sd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) {
+            mlog(error, "Failed to open UDPv6 socket!");
+            return -1;
+        }
+        // The IPv4 messages are received on their own
+        // socket.
+        if (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &enable, sizeof (enable)) < 0) {
+            mlog(error, "setsockopt(IPV6_V6ONLY) failed!");
+            close(sd);
+            return -1;
+        }
+        if (bind(sd, (struct sockaddr *) &locAddr, sizeof (locAddr)) < 0) {
+            mlog(error, "Failed to bind UDPv6 socket!");
+            close(sd);
+            return -1;
+        }
+        if (setsockopt(sd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &enable, sizeof (enable)) < 0) {
+            mlog(error, "setsockopt(IPV6_RECVPKTINFO) failed!");
+            close(sd);
+            return -1;
+        }
+
+        // Initialize well-known mDNS socket address
+        mcastAddr->sin6_family = AF_INET6;
+        inet_pton(AF_INET6, "ff02::fb", &mcastAddr->sin6_addr);
+        mcastAddr->sin6_port = htons(MDNS_UDP_PORT);
+        sock->mcastAddrLen = sizeof (*mcastAddr);
+
+        for (int i = 0; i < server->numIntfs; i++) {
+            const NetIntf *intf = &server->intfs[i];
+            struct ipv6_mreq mreq = { .ipv6mr_multiaddr = mcastAddr->sin6_addr, .ipv6mr_interface = intf->index };
+            if (!mdnsIntfHasAddr(intf, family)) {
+                continue;
+            }
+            if (setsockopt(sd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof (mreq)) < 0) {
+                mlog(error, "Failed to join MDNS IPv6 mcast group on %s!", intf->name);
+                continue;
+            }
+            numGroups++;
+        }
+    }
+
+    if (numGroups == 0) {
         close(sd);
         return -1;
     }
 
-    // Initialize well-known mDNS socket address
-    server->mdnsAddr.sin_family = AF_INET;
-    server->mdnsAddr.sin_addr.s_addr = htonl(0xe00000fb);   // 224.0.0.251
-    server->mdnsAddr.sin_port = htons(MDNS_UDP_PORT);
-
-    mreq.imr_multiaddr = server->mdnsAddr.sin_addr;
-    mreq.imr_interface = server->srvAddr.sin_addr;
-    if (setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)) < 0) {
-        mlog(error, "Failed to join MDNS mcast group!");
+    if (evLoopAddFd(server->evLoop, sd, POLLIN, mdnsProcSockEvent, sock) != 0) {
         close(sd);
         return -1;
     }
 
-    server->mdnsSockFd = sd;
+    sock->sd = sd;
+
+    return 0;
+}
 
-    // Send the initial mDNS advertisements...
-    for (int i = 0; i < 3; i++) {
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        mdnsSendAdv(server, &now);
-        usleep(250000); // 250 ms delay
+// Undo a partially initialized agent: close its sockets,
+// and free the mDNS state of the bikes and the agent.
+static void mdnsFreeAgent(MdnsAgent *agent)
+{
+    Server *server = agent->fleet;
+
+    for (int f = 0; f < mdnsNumFamilies; f++) {
+        MdnsSock *sock = &agent->socks[f];
+        if (sock->sd >= 0) {
+            evLoopDelFd(server->evLoop, sock->sd);
+            close(sock->sd);
+        }
     }
 
-    // ... and the matching responses
-    for (int i = 0; i < 3; i++) {
-        mdnsSendAdvResp(server);
-        usleep(10000); // 10 ms delay
+    for (Server *bike = server; bike != NULL; bike = TAILQ_NEXT(bike, fleetEnt)) {
+        free(bike->mdnsIntfs);
+        bike->mdnsIntfs = NULL;
+        bike->mdnsAgent = NULL;
     }
 
-    return 0;
+    free(agent);
 }
 
-int mdnsProcTimers(Server *server, const struct timeval *time)
+// Init the mDNS agent of the specified bike, and of all
+// the other bikes of its fleet. All the bikes share the
+// same mDNS sockets, one per address family, but each one
+// advertises its own service instance on all the
+// interfaces.
+int mdnsInit(Server *server)
 {
-    struct timeval delta;
+    struct timeval now, expiry;
+    MdnsAgent *agent;
+    Server *bike;
+    int numSocks = 0;
 
     if (server->noMdns) {
         // We are not using mDNS, so just return
         return 0;
     }
 
-    tvSub(&delta, time, &mdnsLastAdv);
+    fmtBufInit(&wahooFitnessTnpName, wahooFitnessTnpNameBuf, sizeof (wahooFitnessTnpNameBuf));
+    fmtBufAppend(&wahooFitnessTnpName, "_wahoo-fitness-tnp._tcp.local");
 
-    if (tvCmp(&delta, &mdnsAdvPeriod) >= 0) {
-        // Time to send a new mDNS advertisement!
-        mdnsSendAdv(server, time);
-        mdnsSendAdvResp(server);
+    fmtBufInit(&servicesDnsSdName, servicesDnsSdNameBuf, sizeof (servicesDnsSdNameBuf));
+    fmtBufAppend(&servicesDnsSdName, "_services._dns-sd._udp.local");
+
+    if ((agent = calloc(1, sizeof (MdnsAgent))) == NULL) {
+        mlog(error, "Failed to allocate the mDNS agent!");
+        return -1;
+    }
+    agent->fleet = server;
+
+    for (int f = 0; f < mdnsNumFamilies; f++) {
+        bool needed = false;
+
+        agent->socks[f].sd = -1;
+        for (int i = 0; i < server->numIntfs; i++) {
+            needed |= mdnsIntfHasAddr(&server->intfs[i], f);
+        }
+        if (!needed) {
+            continue;
+        }
+
+        if (mdnsOpenSock(agent, f) == 0) {
+            numSocks++;
+        } else if (f == mdnsIPv4) {
+            // IPv4 is a must
+            free(agent);
+            return -1;
+        } else {
+            mlog(warning, "mDNS service not advertised over IPv6");
+        }
+    }
+
+    if (numSocks == 0) {
+        free(agent);
+        return -1;
+    }
+
+    for (int i = 0; i < server->numIntfs; i++) {
+        for (int r = 0; r < MDNS_NUM_RESPS; r++) {
+            MdnsPendResp *pendResp = &agent->pendResps[i][r];
+            pendResp->agent = agent;
+            pendResp->intfIdx = i;
+            pendResp->respId = r;
+            evTimerInit(&pendResp->timer, mdnsRespTimerHandler, pendResp);
+        }
+    }
+
+    for (bike = server; bike != NULL; bike = TAILQ_NEXT(bike, fleetEnt)) {
+        fmtBufInit(&bike->mdnsDeviceName, bike->mdnsDeviceNameBuf, sizeof (bike->mdnsDeviceNameBuf));
+        fmtBufAppend(&bike->mdnsDeviceName, "Wahoo-KICKR-%02X%02X.local",
+                     bike->macAddr[4], bike->macAddr[5]);
+
+        fmtBufInit(&bike->mdnsServiceName, bike->mdnsServiceNameBuf, sizeof (bike->mdnsServiceNameBuf));
+        fmtBufAppend(&bike->mdnsServiceName, "Wahoo KICKR %02X%02X._wahoo-fitness-tnp._tcp.local",
+                     bike->macAddr[4], bike->macAddr[5]);
+
+        if ((bike->mdnsIntfs = calloc(server->numIntfs, sizeof (MdnsIntfState))) == NULL) {
+            mlog(error, "Failed to allocate the mDNS state of bike #%d!", bike->bikeId);
+            mdnsFreeAgent(agent);
+            return -1;
+        }
+        bike->mdnsAgent = agent;
+    }
+
+    // Start the advertisement sequence of each bike. The
+    // first query is sent after a random 0-250 ms delay, as
+    // per RFC 6762, which also spreads the queries of all
+    // the bikes of the fleet.
+    clkGetTime(&now);
+    srandom(getpid() ^ now.tv_usec);
+    for (bike = server; bike != NULL; bike = TAILQ_NEXT(bike, fleetEnt)) {
+        struct timeval delay = { .tv_sec = 0, .tv_usec = (random() % 250) * 1000 };
+
+        bike->mdnsState = mdnsQuerying;
+        bike->mdnsCount = 0;
+        tvAdd(&expiry, &now, &delay);
+        evTimerInit(&bike->mdnsTimer, mdnsAdvTimerHandler, bike);
+        evTimerStart(bike->evLoop, &bike->mdnsTimer, &expiry);
     }
 
     return 0;
 }
 
-int mdnsProcQueryMesg(Server *server, const DnsMesgHdr *hdr, BinBuf *mesgBuf)
+// Find the bike of the fleet that owns the specified
+// service instance name.
+static Server *mdnsFindBike(MdnsAgent *agent, const FmtBuf *serviceName)
+{
+    for (Server *bike = agent->fleet; bike != NULL; bike = TAILQ_NEXT(bike, fleetEnt)) {
+        if (strcasecmp(bike->mdnsServiceName.buf, serviceName->buf) == 0) {
+            return bike;
+        }
+    }
+
+    return NULL;
+}
+
+// Check whether the message is the continuation of the
+// known-answer list of a truncated query (RFC 6762 section
+// 7.2), i.e. an answer-only message from the querier of the
+// pending response.
+static bool mdnsTcCont(const MdnsPendResp *pendResp, const DnsMesgHdr *hdr,
+                       const struct sockaddr_storage *fromAddr)
 {
+    const struct sockaddr_storage *tcFrom = &pendResp->tcFrom;
+
+    if ((hdr->qdCount != 0) || (hdr->anCount == 0) ||
+        (pendResp->timer.list == NULL) || !pendResp->tcPend ||
+        (fromAddr->ss_family != tcFrom->ss_family)) {
+        return false;
+    }
+
+    if (fromAddr->ss_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) fromAddr;
+        const struct sockaddr_in *tcSin = (const struct sockaddr_in *) tcFrom;
+        return (sin->sin_port == tcSin->sin_port) && (sin->sin_addr.s_addr == tcSin->sin_addr.s_addr);
+    } else {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) fromAddr;
+        const struct sockaddr_in6 *tcSin6 = (const struct sockaddr_in6 *) tcFrom;
+        return (sin6->sin6_port == tcSin6->sin6_port) && IN6_ARE_ADDR_EQUAL(&sin6->sin6_addr, &tcSin6->sin6_addr);
+    }
+}
+
+int mdnsProcQueryMesg(MdnsAgent *agent, int family, int intfIdx, const DnsMesgHdr *hdr, BinBuf *mesgBuf,
+                      const struct sockaddr_storage *fromAddr)
+{
+    bool asked[MDNS_NUM_RESPS] = { false };
+    bool tcCont[MDNS_NUM_RESPS] = { false };
+    bool svcsKnown = false;
+    Server *bike;
+
     mlog(debug, "id=0x%04x opcode=%u tc=%u qdcnt=%u ancnt=%u nscnt=%u arcnt=%u",
                  hdr->id, getOpCode(hdr->flags), getTcFlag(hdr->flags),
                  hdr->qdCount, hdr->anCount, hdr->nsCount, hdr->arCount);
@@ -782,6 +1544,11 @@ int mdnsProcQueryMesg(Server *server, const DnsMesgHdr *hdr, BinBuf *mesgBuf)
             return 0;
         }
 
+        if ((mesgBuf->bufSize - mesgBuf->offset) < (2 * sizeof (uint16_t))) {
+            mlog(debug, "Ignoring truncated message...");
+            return 0;
+        }
+
         // Get the QTYPE and QCLASS values
         qtype = binBufGetUINT16(mesgBuf);
         qclass = binBufGetUINT16(mesgBuf) & ~CACHE_FLUSH;
@@ -798,20 +1565,118 @@ int mdnsProcQueryMesg(Server *server, const DnsMesgHdr *hdr, BinBuf *mesgBuf)
         // PTR domains:
         //   "_services._dns-sd._udp.local"
         //   "_wahoo-fitness-tnp._tcp.local"
-        if ((fmtBufComp(&qnameBuf, &servicesDnsSdName) != 0) &&
-            (fmtBufComp(&qnameBuf, &wahooFitnessTnpName) != 0)) {
-            // Not interested
+        if (fmtBufComp(&qnameBuf, &servicesDnsSdName) == 0) {
+            asked[mdnsSvcsResp] = true;
+        } else if (fmtBufComp(&qnameBuf, &wahooFitnessTnpName) == 0) {
+            asked[mdnsTnpResp] = true;
+        }
+    }
+
+    // The rest of the known answers of a truncated query
+    // come in answer-only messages.
+    for (int respId = 0; respId < MDNS_NUM_RESPS; respId++) {
+        if (mdnsTcCont(&agent->pendResps[intfIdx][respId], hdr, fromAddr)) {
+            asked[respId] = tcCont[respId] = true;
+        }
+    }
+
+    if (!asked[mdnsSvcsResp] && !asked[mdnsTnpResp]) {
+        // Not interested
+        return 0;
+    }
+
+    // RFC 6762 section 7.1: known-answer suppression. The
+    // answer section of the query lists the records the
+    // querier already knows, so there is no need to send
+    // them again, unless their TTL is less than half of
+    // the true one.
+    for (bike = agent->fleet; bike != NULL; bike = TAILQ_NEXT(bike, fleetEnt)) {
+        bike->mdnsKnownAns = false;
+    }
+    for (int i = 0; i < hdr->anCount; i++) {
+        FmtBuf nameBuf, targetBuf;
+        char name[256], target[256];
+        uint16_t type, class, rdlen;
+        uint32_t ttl, rdataOffset;
+
+        fmtBufInit(&nameBuf, name, sizeof (name));
+        if ((mdnsRemName(mesgBuf, &nameBuf) != 0) ||
+            ((mesgBuf->bufSize - mesgBuf->offset) < 10)) {
+            // Just send the records
+            mlog(debug, "Ignoring malformed known answers...");
+            break;
+        }
+
+        type = binBufGetUINT16(mesgBuf);
+        class = binBufGetUINT16(mesgBuf) & ~CACHE_FLUSH;
+        ttl = binBufGetUINT32(mesgBuf);
+        rdlen = binBufGetUINT16(mesgBuf);
+        rdataOffset = mesgBuf->offset;
+        if (rdlen > (mesgBuf->bufSize - rdataOffset)) {
+            mlog(debug, "Ignoring malformed known answers...");
+            break;
+        }
+
+        if ((type == TYPE_PTR) && (class == CLASS_IN) && (ttl >= (MDNS_PTR_TTL / 2))) {
+            fmtBufInit(&targetBuf, target, sizeof (target));
+            if (mdnsRemName(mesgBuf, &targetBuf) == 0) {
+                mlog(debug, "#%d: known answer: name=%s target=%s ttl=%u", i, nameBuf.buf, targetBuf.buf, ttl);
+                if (fmtBufComp(&nameBuf, &servicesDnsSdName) == 0) {
+                    if (fmtBufComp(&targetBuf, &wahooFitnessTnpName) == 0) {
+                        svcsKnown = true;
+                    }
+                } else if (fmtBufComp(&nameBuf, &wahooFitnessTnpName) == 0) {
+                    if ((bike = mdnsFindBike(agent, &targetBuf)) != NULL) {
+                        bike->mdnsKnownAns = true;
+                    }
+                }
+            }
+        }
+
+        mesgBuf->offset = rdataOffset + rdlen;
+    }
+
+    // Add the bikes to the pending responses on the
+    // interface. If several queriers ask the same question
+    // before the response is sent, a record is only left
+    // out if all of them know it.
+    for (int respId = 0; respId < MDNS_NUM_RESPS; respId++) {
+        bool pend = false;
+
+        if (!asked[respId]) {
             continue;
         }
 
-        // Send the query response
-        return mdnsSendResp(server, hdr->id, &qnameBuf);
+        if (tcCont[respId]) {
+            // Leave out the bikes the querier knows about,
+            // unless other queriers asked the same question.
+            if (agent->pendResps[intfIdx][respId].numQueries == 1) {
+                for (bike = agent->fleet; bike != NULL; bike = TAILQ_NEXT(bike, fleetEnt)) {
+                    if ((respId == mdnsSvcsResp) ? svcsKnown : bike->mdnsKnownAns) {
+                        bike->mdnsIntfs[intfIdx].respPend[respId] = false;
+                    }
+                }
+            }
+            continue;
+        }
+
+        for (bike = agent->fleet; bike != NULL; bike = TAILQ_NEXT(bike, fleetEnt)) {
+            MdnsIntfState *state = &bike->mdnsIntfs[intfIdx];
+            if (!((respId == mdnsSvcsResp) ? svcsKnown : bike->mdnsKnownAns)) {
+                state->respPend[respId] = true;
+            }
+            pend |= state->respPend[respId];
+        }
+
+        if (pend) {
+            mdnsSchedResp(agent, family, intfIdx, respId, getTcFlag(hdr->flags), fromAddr);
+        }
     }
 
     return 0;
 }
 
-int mdnsProcQueryRespMesg(Server *server, const DnsMesgHdr *hdr, BinBuf *mesgBuf)
+int mdnsProcQueryRespMesg(MdnsAgent *agent, const DnsMesgHdr *hdr, BinBuf *mesgBuf)
 {
     mlog(debug, "id=0x%04x opcode=%u aa=%u rcode=%u qdcnt=%u ancnt=%u nscnt=%u arcnt=%u",
                  hdr->id, getOpCode(hdr->flags), getAaFlag(hdr->flags), getRespCode(hdr->flags),
@@ -822,41 +1687,74 @@ int mdnsProcQueryRespMesg(Server *server, const DnsMesgHdr *hdr, BinBuf *mesgBuf
     return 0;
 }
 
-int mdnsProcMesg(Server *server)
+// Check whether an mDNS message was sourced by us, i.e.
+// sent from the mDNS port of one of the interfaces.
+static bool mdnsOwnMesg(MdnsAgent *agent, int family, const struct sockaddr_storage *fromAddr)
 {
-    struct sockaddr_in fromAddr = {0};
-    socklen_t fromAddrLen = sizeof (fromAddr);
-    ssize_t mesgLen;
-    BinBuf mesgBuf;
-    DnsMesgHdr hdr;
-    int s;
-
-    if ((mesgLen = recvfrom(server->mdnsSockFd, server->rxMesgBuf, sizeof (server->rxMesgBuf),
-                            0, (struct sockaddr *) &fromAddr, &fromAddrLen)) < 0) {
-        mlog(error, "Failed to read MDNS message!");
-        return -1;
+    const Server *server = agent->fleet;
+
+    for (int i = 0; i < server->numIntfs; i++) {
+        const NetIntf *intf = &server->intfs[i];
+        if (family == mdnsIPv4) {
+            const struct sockaddr_in *sin = (const struct sockaddr_in *) fromAddr;
+            if ((sin->sin_port == htons(MDNS_UDP_PORT)) && (sin->sin_addr.s_addr == intf->addr.s_addr)) {
+                return true;
+            }
+        } else {
+            const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) fromAddr;
+            if ((sin6->sin6_port == htons(MDNS_UDP_PORT)) && IN6_ARE_ADDR_EQUAL(&sin6->sin6_addr, &intf->addr6)) {
+                return true;
+            }
+        }
     }
 
-    if (mesgLen < sizeof (DnsMesgHdr)) {
-        mlog(error, "Runt message: mesgLen=%zd", mesgLen);
-        return -1;
+    return false;
+}
+
+// Get the index of the interface an mDNS message was
+// received on, from its packet info. Returns -1 if the
+// interface is not served.
+static int mdnsRxIntf(MdnsAgent *agent, struct msghdr *msgHdr)
+{
+    const Server *server = agent->fleet;
+    unsigned int ifIndex = 0;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msgHdr); cmsg != NULL; cmsg = CMSG_NXTHDR(msgHdr, cmsg)) {
+        if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO)) {
+            struct in_pktinfo pktInfo;
+            memcpy(&pktInfo, CMSG_DATA(cmsg), sizeof (pktInfo));
+            ifIndex = pktInfo.ipi_ifindex;
+        } else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO)) {
+            struct in6_pktinfo pktInfo;
+            memcpy(&pktInfo, CMSG_DATA(cmsg), sizeof (pktInfo));
+            ifIndex = pktInfo.ipi6_ifindex;
+        }
     }
 
-    // Ignore mDNS messages sourced by us...
-    if (fromAddr.sin_addr.s_addr == server->srvAddr.sin_addr.s_addr) {
-        //mlog(debug, "Ignoring own mDNS message...");
-        return 0;
+    for (int i = 0; i < server->numIntfs; i++) {
+        if (server->intfs[i].index == ifIndex) {
+            return i;
+        }
     }
 
-    server->rxMdnsMesgCnt++;
+    return -1;
+}
+
+static int mdnsProcRxMesg(MdnsAgent *agent, int family, int intfIdx, const uint8_t *mesg, size_t mesgLen,
+                          const struct sockaddr_storage *fromAddr)
+{
+    BinBuf mesgBuf;
+    DnsMesgHdr hdr;
 
-    {
-        mlog(debug, "sender=%s mesgLen=%zd", fmtSockaddr(&fromAddr, true), mesgLen);
-        //hexDump(server->rxMesgBuf, mesgLen);
+    if (mesgLen < sizeof (DnsMesgHdr)) {
+        mlog(error, "Runt message: mesgLen=%zu", mesgLen);
+        return -1;
     }
 
+    agent->fleet->rxMdnsMesgCnt++;
+
     // Get the fixed-size header
-    binBufInit(&mesgBuf, server->rxMesgBuf, mesgLen, bigEndian);
+    binBufInit(&mesgBuf, (uint8_t *) mesg, mesgLen, bigEndian);
     binBufGetHex(&mesgBuf, &hdr, sizeof (hdr));
     hdr.id = ntohs(hdr.id);
     hdr.flags = ntohs(hdr.flags);
@@ -865,10 +1763,88 @@ int mdnsProcMesg(Server *server)
     hdr.nsCount = ntohs(hdr.nsCount);
     hdr.arCount = ntohs(hdr.arCount);
 
+    // The mDNS sockets are shared by all the bikes of the
+    // fleet, so the message is parsed only once, and the
+    // response includes the records of all the bikes.
     if (isQueryResp(hdr.flags)) {
-        s = mdnsProcQueryRespMesg(server, &hdr, &mesgBuf);
-    } else {
-        s = mdnsProcQueryMesg(server, &hdr, &mesgBuf);
+        return mdnsProcQueryRespMesg(agent, &hdr, &mesgBuf);
+    }
+
+    return mdnsProcQueryMesg(agent, family, intfIdx, &hdr, &mesgBuf, fromAddr);
+}
+
+// Drain the mDNS socket, receiving the messages in batches,
+// and then send all the responses in one go.
+static int mdnsProcSockMesgs(MdnsSock *sock)
+{
+    MdnsAgent *agent = sock->agent;
+    int n;
+    int s = 0;
+
+    do {
+        for (int i = 0; i < MDNS_RX_BATCH; i++) {
+            struct msghdr *msgHdr = &sock->rxMsgs[i].msg_hdr;
+            sock->rxIov[i].iov_base = agent->rxBufs[i];
+            sock->rxIov[i].iov_len = sizeof (agent->rxBufs[i]);
+            memset(msgHdr, 0, sizeof (*msgHdr));
+            msgHdr->msg_name = &sock->rxAddrs[i];
+            msgHdr->msg_namelen = sizeof (sock->rxAddrs[i]);
+            msgHdr->msg_iov = &sock->rxIov[i];
+            msgHdr->msg_iovlen = 1;
+            msgHdr->msg_control = &sock->rxCtrl[i];
+            msgHdr->msg_controllen = sizeof (sock->rxCtrl[i]);
+        }
+
+        if ((n = recvmmsg(sock->sd, sock->rxMsgs, MDNS_RX_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                mlog(error, "Failed to read MDNS messages!");
+                s = -1;
+            }
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int intfIdx;
+
+            // Ignore mDNS messages sourced by us...
+            if (mdnsOwnMesg(agent, sock->family, &sock->rxAddrs[i])) {
+                //mlog(debug, "Ignoring own mDNS message...");
+                continue;
+            }
+
+            // ...and the ones received on interfaces we
+            // don't serve.
+            if ((intfIdx = mdnsRxIntf(agent, &sock->rxMsgs[i].msg_hdr)) < 0) {
+                continue;
+            }
+
+            mlog(debug, "intf=%s family=%s mesgLen=%u", agent->fleet->intfs[intfIdx].name,
+                 (sock->family == mdnsIPv4) ? "IPv4" : "IPv6", sock->rxMsgs[i].msg_len);
+
+            if (mdnsProcRxMesg(agent, sock->family, intfIdx, agent->rxBufs[i], sock->rxMsgs[i].msg_len,
+                               &sock->rxAddrs[i]) != 0) {
+                s = -1;
+            }
+        }
+    } while (n == MDNS_RX_BATCH);
+
+    if (mdnsFlushTx(agent) != 0) {
+        s = -1;
+    }
+
+    return s;
+}
+
+// Process the mDNS messages received on any of the sockets
+int mdnsProcMesg(Server *server)
+{
+    MdnsAgent *agent = server->mdnsAgent;
+    int s = 0;
+
+    for (int f = 0; f < mdnsNumFamilies; f++) {
+        if ((agent->socks[f].sd >= 0) && (mdnsProcSockMesgs(&agent->socks[f]) != 0)) {
+            s = -1;
+        }
     }
 
     return s;
@@ -35,7 +35,6 @@ extern int mdnsInit(Server *server);
 
 extern int mdnsSendQuery(Server *server, const FmtBuf *qname);
 
-extern int mdnsProcTimers(Server *server, const struct timeval *time);
 extern int mdnsProcMesg(Server *server);
 
 __END_DECLS
@@ -24,6 +24,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "clock.h"
 #include "defs.h"
 #include "fmtbuf.h"
 #include "mlog.h"
@@ -48,11 +49,11 @@ static const char *fmtTimestamp(void)
 {
     struct timeval now;
     struct tm brkDwnTime;
-    static char tsBuf[32];  // YYYY-MM-DDTHH:MM:SS.xxxxxx
+    static __thread char tsBuf[32];  // YYYY-MM-DDTHH:MM:SS.xxxxxx
     size_t bufLen = sizeof (tsBuf);
     int n;
 
-    gettimeofday(&now, NULL);
+    clkGetTime(&now);
     n = strftime(tsBuf, bufLen, "%Y-%m-%dT%H:%M:%S", gmtime_r(&now.tv_sec, &brkDwnTime));
     snprintf((tsBuf + n), (bufLen - n), ".%06u", (unsigned) now.tv_usec);
 
@@ -64,7 +65,7 @@ void msgLog(LogLevel logLevel, const char *funcName, int lineNum, int errNo, con
     // Everything at or above "warning" is
     // always printed...
     if ((logLevel <= msgLogLevel) || (logLevel >= warning)) {
-        static char msgLogBuf[1024];
+        static __thread char msgLogBuf[1024];
         FmtBuf fmtBuf;
         va_list ap;
 
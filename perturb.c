@@ -0,0 +1,62 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "perturb.h"
+
+void perturbInit(PerturbState *ps, const PerturbParms *parms, uint32_t riderId)
+{
+    ps->parms = parms;
+    rngInit(&ps->rng, parms->seed, riderId);
+
+    // Per-rider constants
+    ps->powerScale = 1.0 + (rngRange(&ps->rng, parms->power * 10) / 1000.0);
+    ps->heartRateBias = rngRange(&ps->rng, parms->heartRate);
+    ps->offset = rngNext(&ps->rng) % ((uint64_t) parms->offset + 1);
+}
+
+static uint16_t addClamp(uint16_t val, int delta)
+{
+    int res = (int) val + delta;
+
+    return (res < 0) ? 0 : (res > UINT16_MAX) ? UINT16_MAX : res;
+}
+
+bool perturbApply(PerturbState *ps, uint16_t *cadence, uint16_t *heartRate, uint16_t *power)
+{
+    const PerturbParms *parms = ps->parms;
+
+    if ((parms == NULL) || !parms->enabled) {
+        return false;
+    }
+
+    *power = addClamp(0, (int) ((*power * ps->powerScale) + 0.5));
+
+    if (*cadence != 0) {
+        *cadence = addClamp(*cadence, rngRange(&ps->rng, parms->cadence));
+    }
+
+    if (*heartRate != 0) {
+        // Constant bias, plus +/-1 BPM of jitter
+        *heartRate = addClamp(*heartRate, ps->heartRateBias + rngRange(&ps->rng, 1));
+    }
+
+    return ((rngNext(&ps->rng) % 100) < parms->dropout);
+}
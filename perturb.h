@@ -0,0 +1,72 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defs.h"
+#include "rng.h"
+
+// Default perturbation parameters
+#define PERTURB_DEF_POWER       5       // [%]
+#define PERTURB_DEF_CADENCE     3       // [RPM]
+#define PERTURB_DEF_HEART_RATE  5       // [BPM]
+#define PERTURB_DEF_OFFSET      300     // [sec]
+#define PERTURB_DEF_DROPOUT     1       // [%]
+
+// Max perturbation parameters
+#define PERTURB_MAX_CADENCE     50      // [RPM]
+#define PERTURB_MAX_HEART_RATE  50      // [BPM]
+#define PERTURB_MAX_OFFSET      86400   // [sec]
+
+// Perturbation parameters, shared by all the riders
+typedef struct PerturbParms {
+    uint32_t seed;          // base seed
+    uint32_t power;         // max deviation of the power scale [%]
+    uint32_t cadence;       // max cadence noise [RPM]
+    uint32_t heartRate;     // max heart rate offset [BPM]
+    uint32_t offset;        // max additional start offset [sec]
+    uint32_t dropout;       // probability of a notification dropout [%]
+    bool enabled;
+} PerturbParms;
+
+// Perturbation state of one rider (bike or session).
+// The state is derived from the base seed and the rider
+// ID, so the same rider always gets the same sequence of
+// perturbations.
+typedef struct PerturbState {
+    const PerturbParms *parms;
+    Rng rng;                // PRNG state
+    double powerScale;      // rider's power scale
+    int heartRateBias;      // rider's heart rate offset [BPM]
+    uint32_t offset;        // rider's additional start offset [sec]
+} PerturbState;
+
+__BEGIN_DECLS
+
+extern void perturbInit(PerturbState *ps, const PerturbParms *parms, uint32_t riderId);
+
+// Apply the perturbation to the specified metrics. Returns
+// true if the notifications of this clock tick are to be
+// dropped.
+extern bool perturbApply(PerturbState *ps, uint16_t *cadence, uint16_t *heartRate, uint16_t *power);
+
+__END_DECLS
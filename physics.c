@@ -0,0 +1,193 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "physics.h"
+
+// Simple longitudinal bike dynamics model: the propulsive
+// force derived from the rider's power is balanced against
+// gravity, rolling resistance, and aerodynamic drag, and
+// the net force accelerates the rider + bike mass plus the
+// equivalent mass of the rotating wheels.
+
+#define PHY_GRAVITY     9.80665 // [m/s^2]
+#define PHY_MIN_SPEED   1.0     // min speed used to derive the propulsive force [m/s]
+#define PHY_MAX_STEP    0.1     // max integration step [s]
+
+static inline double phyAccel(double power, double speed, double mass,
+                              double sinGrade, double cosGrade,
+                              double windSpeed, double crr, double cw)
+{
+    double airSpeed = speed + windSpeed;
+    double fDrive = (PHY_DEF_EFFICIENCY * power) / fmax(speed, PHY_MIN_SPEED);
+    double fAero = cw * airSpeed * fabs(airSpeed);
+    double fGrav = mass * PHY_GRAVITY * sinGrade;
+    double fRoll = crr * mass * PHY_GRAVITY * cosGrade;
+
+    return (fDrive - fAero - fGrav - fRoll) / (mass + PHY_DEF_INERTIA);
+}
+
+// Split the time interval into integration steps
+static inline int phyNumSteps(double dt, double *h)
+{
+    int numSteps = (int) ceil(dt / PHY_MAX_STEP);
+
+    if (numSteps < 1)
+        numSteps = 1;
+
+    *h = dt / numSteps;
+
+    return numSteps;
+}
+
+void phyInit(PhyState *state, double mass)
+{
+    state->mass = mass;
+    state->speed = 0.0;
+    state->distance = 0.0;
+
+    // Start on a flat road with no wind
+    phySetSimParms(state, 0.0, 0.0, PHY_DEF_CRR, PHY_DEF_CW);
+}
+
+void phySetSimParms(PhyState *state, double windSpeed, double grade, double crr, double cw)
+{
+    // The grade is a percentage (rise over run), so
+    // convert it to the road angle once here, rather
+    // than on each step.
+    double angle = atan(grade / 100.0);
+
+    state->grade = grade;
+    state->sinGrade = sin(angle);
+    state->cosGrade = cos(angle);
+    state->windSpeed = windSpeed;
+    state->crr = crr;
+    state->cw = cw;
+}
+
+void phyStep(PhyState *state, double power, double dt)
+{
+    double h;
+    int numSteps = phyNumSteps(dt, &h);
+    double speed = state->speed;
+    double distance = state->distance;
+
+    // Semi-implicit Euler integration
+    for (int n = 0; n < numSteps; n++) {
+        double accel = phyAccel(power, speed, state->mass, state->sinGrade, state->cosGrade,
+                                state->windSpeed, state->crr, state->cw);
+        speed = fmax((speed + (accel * h)), 0.0);
+        distance += speed * h;
+    }
+
+    state->speed = speed;
+    state->distance = distance;
+}
+
+PhyBatch *phyBatchNew(int numRiders)
+{
+    PhyBatch *batch;
+    double *data;
+
+    if ((batch = calloc(1, sizeof (PhyBatch))) == NULL) {
+        return NULL;
+    }
+
+    // All the arrays are carved out of a single block
+    if ((data = calloc((9 * numRiders), sizeof (double))) == NULL) {
+        free(batch);
+        return NULL;
+    }
+
+    batch->numRiders = numRiders;
+    batch->power = data;
+    batch->mass = batch->power + numRiders;
+    batch->sinGrade = batch->mass + numRiders;
+    batch->cosGrade = batch->sinGrade + numRiders;
+    batch->windSpeed = batch->cosGrade + numRiders;
+    batch->crr = batch->windSpeed + numRiders;
+    batch->cw = batch->crr + numRiders;
+    batch->speed = batch->cw + numRiders;
+    batch->distance = batch->speed + numRiders;
+
+    return batch;
+}
+
+void phyBatchFree(PhyBatch *batch)
+{
+    if (batch != NULL) {
+        free(batch->power);
+        free(batch);
+    }
+}
+
+void phyBatchSet(PhyBatch *batch, int rider, const PhyState *state)
+{
+    batch->mass[rider] = state->mass;
+    batch->sinGrade[rider] = state->sinGrade;
+    batch->cosGrade[rider] = state->cosGrade;
+    batch->windSpeed[rider] = state->windSpeed;
+    batch->crr[rider] = state->crr;
+    batch->cw[rider] = state->cw;
+    batch->speed[rider] = state->speed;
+    batch->distance[rider] = state->distance;
+}
+
+void phyBatchGet(const PhyBatch *batch, int rider, PhyState *state)
+{
+    state->mass = batch->mass[rider];
+    state->sinGrade = batch->sinGrade[rider];
+    state->cosGrade = batch->cosGrade[rider];
+    state->windSpeed = batch->windSpeed[rider];
+    state->crr = batch->crr[rider];
+    state->cw = batch->cw[rider];
+    state->speed = batch->speed[rider];
+    state->distance = batch->distance[rider];
+}
+
+void phyBatchStep(PhyBatch *batch, double dt)
+{
+    double h;
+    int numSteps = phyNumSteps(dt, &h);
+    int numRiders = batch->numRiders;
+    const double *restrict power = batch->power;
+    const double *restrict mass = batch->mass;
+    const double *restrict sinGrade = batch->sinGrade;
+    const double *restrict cosGrade = batch->cosGrade;
+    const double *restrict windSpeed = batch->windSpeed;
+    const double *restrict crr = batch->crr;
+    const double *restrict cw = batch->cw;
+    double *restrict speed = batch->speed;
+    double *restrict distance = batch->distance;
+
+    // The riders are independent of each other, so the
+    // inner loop has no branches and no loop-carried
+    // dependencies, and can be vectorized.
+    for (int n = 0; n < numSteps; n++) {
+        for (int r = 0; r < numRiders; r++) {
+            double accel = phyAccel(power[r], speed[r], mass[r], sinGrade[r], cosGrade[r],
+                                    windSpeed[r], crr[r], cw[r]);
+            speed[r] = fmax((speed[r] + (accel * h)), 0.0);
+            distance[r] += speed[r] * h;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include "defs.h"
+
+// Default model parameters
+#define PHY_DEF_MASS        85.0    // rider + bike [kg]
+#define PHY_DEF_INERTIA     1.2     // equivalent mass of the rotating wheels [kg]
+#define PHY_DEF_CRR         0.0040  // rolling resistance coefficient
+#define PHY_DEF_CW          0.51    // wind resistance coefficient [kg/m]
+#define PHY_DEF_EFFICIENCY  0.976   // drivetrain efficiency
+
+// Bike dynamics state of a single rider
+typedef struct PhyState {
+    double mass;        // rider + bike [kg]
+    double grade;       // road grade [%]
+    double sinGrade;    // sin() of the road angle
+    double cosGrade;    // cos() of the road angle
+    double windSpeed;   // headwind speed [m/s]
+    double crr;         // rolling resistance coefficient
+    double cw;          // wind resistance coefficient [kg/m]
+    double speed;       // current speed [m/s]
+    double distance;    // total distance [m]
+} PhyState;
+
+// Bike dynamics state of a group of riders, stored as a
+// structure of arrays so that the step loop can be easily
+// vectorized by the compiler.
+typedef struct PhyBatch {
+    int numRiders;
+    double *power;      // current power [W]
+    double *mass;
+    double *sinGrade;
+    double *cosGrade;
+    double *windSpeed;
+    double *crr;
+    double *cw;
+    double *speed;
+    double *distance;
+} PhyBatch;
+
+__BEGIN_DECLS
+
+extern void phyInit(PhyState *state, double mass);
+
+// Update the simulation parameters as specified by the FMCP
+// SET_INDOOR_BIKE_SIM_PARMS command.
+extern void phySetSimParms(PhyState *state, double windSpeed, double grade, double crr, double cw);
+
+// Advance the state of the rider by the specified time
+// interval (in seconds), at the specified power.
+extern void phyStep(PhyState *state, double power, double dt);
+
+extern PhyBatch *phyBatchNew(int numRiders);
+extern void phyBatchFree(PhyBatch *batch);
+extern void phyBatchSet(PhyBatch *batch, int rider, const PhyState *state);
+extern void phyBatchGet(const PhyBatch *batch, int rider, PhyState *state);
+
+// Advance the state of all the riders in the batch
+extern void phyBatchStep(PhyBatch *batch, double dt);
+
+__END_DECLS
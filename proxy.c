@@ -0,0 +1,318 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "dircon.h"
+#include "dump.h"
+#include "mlog.h"
+#include "proxy.h"
+#include "server.h"
+
+// In proxy mode the DIRCON messages are relayed as-is between
+// the client app and the upstream trainer. Unless we need to
+// look inside the messages (e.g. to dissect them) the data is
+// moved from one socket to the other using splice(), so that
+// it never gets copied to/from user space.
+
+// Max number of bytes moved in a single splice() call
+#define MAX_SPLICE_LEN  (64 * 1024)
+
+// NOTE: the latency is measured using the wall-clock time,
+// regardless of the mode of the app's clock.
+static void updLatStats(LatStats *stats, const struct timeval *rxTime, size_t numBytes)
+{
+    struct timeval now, delta;
+    uint32_t lat;
+
+    gettimeofday(&now, NULL);
+    tvSub(&delta, &now, rxTime);
+    lat = (delta.tv_sec * 1000000) + delta.tv_usec;
+
+    if ((stats->numSamples == 0) || (lat < stats->minLat))
+        stats->minLat = lat;
+    if (lat > stats->maxLat)
+        stats->maxLat = lat;
+    stats->sumLat += lat;
+    stats->numBytes += numBytes;
+    stats->numSamples++;
+
+    mlog(debug, "numBytes=%zu lat=%u [us]", numBytes, lat);
+}
+
+// Write the data received on the 'from' session, and still
+// pending to be relayed, to the 'to' session. Return -1 on
+// error; otherwise the pending byte count is updated, and
+// it is left non-zero if the destination is full. The relay
+// latency is sampled when the last byte has been sent, so
+// it includes the time the data waited for the destination
+// to be writable.
+static int proxyFlushData(Server *server, DirconSession *from, DirconSession *to)
+{
+    while (from->relayPend != 0) {
+        ssize_t k;
+
+#ifdef __linux__
+        if (!server->dissect) {
+            k = splice(from->relayPipe[0], NULL, to->cliSockFd, NULL, from->relayPend,
+                       (SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+        } else
+#endif
+        {
+            k = send(to->cliSockFd, from->relayBuf, from->relayPend, (MSG_DONTWAIT | MSG_NOSIGNAL));
+            if (k > 0) {
+                memmove(from->relayBuf, (from->relayBuf + k), (from->relayPend - k));
+            }
+        }
+        if (k <= 0) {
+            if ((k < 0) && (errno == EAGAIN)) {
+                // Wait for the destination to be writable
+                return 0;
+            }
+            mlog(error, "Failed to relay DIRCON data! fd=%d n=%zd", to->cliSockFd, k);
+            return -1;
+        }
+        from->relayPend -= k;
+        if (from->relayPend == 0) {
+            updLatStats(&from->relayLat, &from->relayRxTime, from->relayLen);
+        }
+    }
+
+    return 0;
+}
+
+#ifdef __linux__
+// Zero-copy relay: move all the data available in the
+// source socket to the destination socket.
+static ssize_t proxySpliceData(Server *server, DirconSession *from, DirconSession *to)
+{
+    ssize_t n;
+
+    if (from->relayPipe[0] == 0) {
+        if (pipe2(from->relayPipe, O_NONBLOCK) != 0) {
+            mlog(error, "pipe2() failed!");
+            from->relayPipe[0] = from->relayPipe[1] = 0;
+            return -1;
+        }
+    }
+
+    // Socket -> pipe
+    if ((n = splice(from->cliSockFd, NULL, from->relayPipe[1], NULL, MAX_SPLICE_LEN,
+                    (SPLICE_F_MOVE | SPLICE_F_NONBLOCK))) <= 0) {
+        return n;
+    }
+
+    // Pipe -> socket
+    gettimeofday(&from->relayRxTime, NULL);
+    from->relayLen = from->relayPend = n;
+    if (proxyFlushData(server, from, to) != 0) {
+        return -1;
+    }
+
+    return n;
+}
+#endif
+
+// Length of the DIRCON message being assembled on the
+// session: just the header until it has been received.
+static size_t proxyPduLen(const DirconSession *sess)
+{
+    const DirconMesg *mesg = (const DirconMesg *) sess->relayRxBuf;
+
+    if (sess->relayRxLen < sizeof (DirconMesg)) {
+        return sizeof (DirconMesg);
+    }
+
+    return sizeof (DirconMesg) + ntohs(mesg->mesgLen);
+}
+
+// Copy relay: assemble a full DIRCON message, dissect it,
+// and then forward it to the other end. The socket is non
+// blocking, so the message is assembled from as many reads
+// as it takes, without stalling the event loop; until then
+// -1 is returned with errno set to EAGAIN.
+static ssize_t proxyCopyMesg(Server *server, DirconSession *from, DirconSession *to)
+{
+    DirconMesg *mesg = (DirconMesg *) from->relayRxBuf;
+    bool fromApp = (from == &server->dirconSession);
+    MesgType mesgType;
+    size_t pduLen;
+    ssize_t n;
+
+    while (from->relayRxLen < (pduLen = proxyPduLen(from))) {
+        if (pduLen > sizeof (from->relayRxBuf)) {
+            mlog(error, "DIRCON message length (%zu) is way too large!", pduLen);
+            return -1;
+        }
+        if ((n = recv(from->cliSockFd, (from->relayRxBuf + from->relayRxLen),
+                      (pduLen - from->relayRxLen), MSG_DONTWAIT)) <= 0) {
+            return n;
+        }
+        from->relayRxLen += n;
+    }
+    from->relayRxLen = 0;
+
+    gettimeofday(&from->relayRxTime, NULL);
+    clkGetTime(&from->rxMesgTimestamp);
+
+    // The app sends the requests, and the trainer sends
+    // the responses and the notifications.
+    if (fromApp || (mesg->mesgId == UnsolicitedCharacteristicNotification)) {
+        mesgType = request;
+    } else {
+        mesgType = response;
+    }
+
+    mlog(debug, "fromApp=%u mesgId=%u seqNum=%u respCode=%u mesgLen=%zu",
+            fromApp, mesg->mesgId, mesg->seqNum, mesg->respCode, (pduLen - sizeof (DirconMesg)));
+
+    if (server->dissect) {
+        uint16_t mesgLen = mesg->mesgLen;
+
+        mesg->mesgLen = ntohs(mesgLen);
+        dirconDumpMesg(&from->rxMesgTimestamp, server, from, (fromApp ? RxDir : TxDir), mesgType, mesg);
+        mesg->mesgLen = mesgLen;
+    }
+
+    // Whatever doesn't fit in the destination socket is
+    // sent once it becomes writable.
+    memcpy(from->relayBuf, mesg, pduLen);
+    from->relayLen = from->relayPend = pduLen;
+    if (proxyFlushData(server, from, to) != 0) {
+        return -1;
+    }
+
+    to->txMesgCnt++;
+
+    return pduLen;
+}
+
+int proxyProcMesg(Server *server, DirconSession *from, DirconSession *to)
+{
+    ssize_t n;
+
+    if (from->relayPend != 0) {
+        // Only a hangup or an error is reported while the
+        // previous data is waiting to be relayed.
+        return serverProcConnDrop(server);
+    }
+
+#ifdef __linux__
+    if (!server->dissect) {
+        clkGetTime(&from->rxMesgTimestamp);
+        n = proxySpliceData(server, from, to);
+    } else
+#endif
+    {
+        n = proxyCopyMesg(server, from, to);
+    }
+
+    if (n == 0) {
+        // Connection dropped
+        return serverProcConnDrop(server);
+    } else if (n < 0) {
+        if (errno == EAGAIN) {
+            // Spurious wakeup, or partial message
+            return 0;
+        }
+        mlog(error, "Failed to relay DIRCON data! fd=%d", from->cliSockFd);
+        return serverProcConnDrop(server);
+    }
+
+    from->rxMesgCnt++;
+
+    if (from->relayPend != 0) {
+        // The destination is full: stop reading from the
+        // source until it drains.
+        proxyUpdEvents(server);
+    }
+
+    return 0;
+}
+
+int proxyProcWritable(Server *server, DirconSession *from, DirconSession *to)
+{
+    if (proxyFlushData(server, from, to) != 0) {
+        serverProcConnDrop(server);
+        return -1;
+    }
+
+    if (from->relayPend == 0) {
+        // Resume reading from the source
+        proxyUpdEvents(server);
+    }
+
+    return 0;
+}
+
+// Events watched on the socket of a session: the socket is
+// not read while its data is waiting to be relayed, or while
+// the other end is still connecting, and it is watched for
+// POLLOUT while the other end's data is waiting for it.
+static short proxySessEvents(const DirconSession *sess, const DirconSession *peer)
+{
+    short events = 0;
+
+    if ((sess->relayPend == 0) && !peer->connPend) {
+        events |= (POLLIN | POLLRDHUP);
+    }
+    if ((peer->relayPend != 0) || sess->connPend) {
+        events |= POLLOUT;
+    }
+
+    return events;
+}
+
+void proxyUpdEvents(Server *server)
+{
+    DirconSession *app = &server->dirconSession;
+    DirconSession *trainer = &server->trainerSession;
+
+    if (app->cliSockFd != 0) {
+        evLoopSetEvents(server->evLoop, app->cliSockFd, proxySessEvents(app, trainer));
+    }
+    if (trainer->cliSockFd != 0) {
+        evLoopSetEvents(server->evLoop, trainer->cliSockFd, proxySessEvents(trainer, app));
+    }
+}
+
+static void logLatStats(const char *dir, const LatStats *stats)
+{
+    if (stats->numSamples != 0) {
+        mlog(info, "%s: numSamples=%u numBytes=%llu latency: min=%u avg=%llu max=%u [us]",
+                dir, stats->numSamples, (unsigned long long) stats->numBytes, stats->minLat,
+                (unsigned long long) (stats->sumLat / stats->numSamples), stats->maxLat);
+    }
+}
+
+void proxyLogStats(const Server *server)
+{
+    logLatStats("App->Trainer", &server->dirconSession.relayLat);
+    logLatStats("Trainer->App", &server->trainerSession.relayLat);
+}
@@ -0,0 +1,39 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "server.h"
+
+__BEGIN_DECLS
+
+extern int proxyProcMesg(Server *server, DirconSession *from, DirconSession *to);
+
+// Relay the pending data of the 'from' session, now that
+// the 'to' session is writable. Return -1 if the session
+// had to be dropped.
+extern int proxyProcWritable(Server *server, DirconSession *from, DirconSession *to);
+
+// Update the events watched on the sockets of the app and
+// of the trainer, based on the state of the relay.
+extern void proxyUpdEvents(Server *server);
+extern void proxyLogStats(const Server *server);
+
+__END_DECLS
@@ -0,0 +1,112 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <limits.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "clock.h"
+#include "fitwr.h"
+#include "mlog.h"
+#include "recorder.h"
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+
+#include "fit/fit_example.h"
+
+// The notification metrics are appended to an in-memory
+// buffer, which is handed over to a writer thread when it
+// fills up, or every REC_FLUSH_INT seconds, so the file I/O
+// never delays the notification tick.
+
+int recStart(Server *server, DirconSession *sess)
+{
+    char fileName[PATH_MAX];
+    char timeBuf[32];
+    struct timeval now;
+    struct tm tm;
+
+    clkGetTime(&now);
+    localtime_r(&now.tv_sec, &tm);
+    strftime(timeBuf, sizeof (timeBuf), "%Y%m%d-%H%M%S", &tm);
+    snprintf(fileName, sizeof (fileName), "%s/indBikeSim-%s-%u.fit",
+             server->recordDir, timeBuf, sockaddrPort(&sess->remCliAddr));
+
+    if ((sess->recFile = fitWrOpen(fileName, now.tv_sec, FIT_WR_BUF_SIZE, true)) == NULL) {
+        mlog(error, "Can't record the session!");
+        return -1;
+    }
+
+    mlog(info, "Recording session to %s", fileName);
+
+    return 0;
+}
+
+void recMetrics(Server *server, DirconSession *sess, time_t timestamp)
+{
+    FitWr *fw = sess->recFile;
+    FitWrRec rec;
+
+    if (fw == NULL)
+        return;
+
+    rec.timestamp = timestamp;
+    rec.cadence = server->cadence;
+    rec.heartRate = server->heartRate;
+    rec.power = server->power;
+    rec.speed = server->speed;
+    rec.distance = server->phyState.distance;
+    rec.grade = server->phyState.grade;
+    fitWrRecord(fw, &rec);
+
+    if ((fw->numRecs % REC_FLUSH_INT) == 0) {
+        // If the writer thread is busy, the data
+        // simply stays in the buffer until the
+        // next time.
+        fitWrFlush(fw);
+    }
+}
+
+void recFmcpEvent(Server *server, DirconSession *sess, uint8_t opCode, uint16_t param)
+{
+    struct timeval now;
+
+    if (sess->recFile == NULL)
+        return;
+
+    // The FMCP commands are recorded as marker events,
+    // with the op code in the upper byte of the data
+    // field, and the (first) parameter in the lower
+    // 16 bits.
+    clkGetTime(&now);
+    fitWrEvent(sess->recFile, now.tv_sec, FIT_EVENT_USER_MARKER, FIT_EVENT_TYPE_MARKER,
+               (((uint32_t) opCode << 24) | param));
+}
+
+void recStop(Server *server, DirconSession *sess)
+{
+    if (sess->recFile != NULL) {
+        fitWrClose(sess->recFile);
+        sess->recFile = NULL;
+        mlog(info, "Session recording stopped.");
+    }
+}
+
+#endif  // CONFIG_FIT_ACTIVITY_FILE
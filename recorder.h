@@ -0,0 +1,48 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "config.h"
+#include "server.h"
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+
+// How often the recorded data is handed over to the
+// writer thread [s]
+#define REC_FLUSH_INT   10
+
+__BEGIN_DECLS
+
+// Start recording the session to a new FIT activity file
+extern int recStart(Server *server, DirconSession *sess);
+
+// Record the metrics sent in the notifications
+extern void recMetrics(Server *server, DirconSession *sess, time_t timestamp);
+
+// Record an FMCP command received from the app
+extern void recFmcpEvent(Server *server, DirconSession *sess, uint8_t opCode, uint16_t param);
+
+// Stop recording, and close the FIT activity file
+extern void recStop(Server *server, DirconSession *sess);
+
+__END_DECLS
+
+#endif  // CONFIG_FIT_ACTIVITY_FILE
@@ -0,0 +1,74 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "defs.h"
+
+// Small and fast PRNG (xorshift64*) used to generate the
+// per-rider noise. It is good enough for that purpose, and
+// fully deterministic: the same seed always produces the
+// same sequence.
+typedef uint64_t Rng;
+
+__BEGIN_DECLS
+
+// Seed the PRNG from a seed and a stream ID (e.g. the rider
+// ID), using SplitMix64 to get a well-mixed initial state.
+static __inline__ void rngInit(Rng *rng, uint32_t seed, uint32_t streamId)
+{
+    uint64_t x = (((uint64_t) seed << 32) | streamId) + 0x9e3779b97f4a7c15ULL;
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= (x >> 31);
+
+    *rng = (x != 0) ? x : 1;
+}
+
+static __inline__ uint32_t rngNext(Rng *rng)
+{
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return (*rng * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+// Uniform random integer in the range [-max, +max]
+static __inline__ int rngRange(Rng *rng, uint32_t max)
+{
+    return (int) (rngNext(rng) % ((2 * (uint64_t) max) + 1)) - (int) max;
+}
+
+// Uniform random number in the range [0, 1)
+static __inline__ double rngUniform(Rng *rng)
+{
+    return rngNext(rng) / 4294967296.0;
+}
+
+// Approximately normal random number with zero mean and unit
+// variance (Irwin-Hall, with 4 uniform samples)
+static __inline__ double rngGauss(Rng *rng)
+{
+    return (rngUniform(rng) + rngUniform(rng) + rngUniform(rng) + rngUniform(rng) - 2.0) * 1.7320508;
+}
+
+__END_DECLS
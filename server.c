@@ -19,10 +19,13 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,11 +41,16 @@
 #endif
 
 #include "cli.h"
+#include "clock.h"
 #include "config.h"
+#include "ctrl.h"
 #include "dircon.h"
 #include "mdns.h"
 #include "mlog.h"
+#include "proxy.h"
+#include "recorder.h"
 #include "server.h"
+#include "worker.h"
 
 #ifdef CONFIG_FIT_ACTIVITY_FILE
 // FIT SDK files
@@ -85,16 +93,15 @@ static void fitRecToTrkPt(const FIT_RECORD_MESG *record, TrkPt *tp)
     //        tp->timestamp, tp->cadence, tp->heartRate, tp->power);
 }
 
-// Parse the FIT file and create a list of Track Points (TrkPt's)
-static int parseFitFile(Server *server)
+// Parse the FIT file and load its Track Points (TrkPt's)
+// into the specified store.
+static int parseFitFile(FILE *fp, TrkPtStore *store)
 {
-    FILE *fp = server->actFile;
     FIT_UINT8 inBuf[8];
     FIT_CONVERT_RETURN conRet = FIT_CONVERT_CONTINUE;
     FIT_UINT32 bufSize;
     FIT_MANUFACTURER manufacturer = FIT_MANUFACTURER_INVALID;
     bool timerRunning = true;
-    int numTrkPts = 0;
 
     FitConvert_Init(FIT_TRUE);
 
@@ -141,20 +148,16 @@ static int parseFitFile(Server *server)
                                  (record->enhanced_altitude == FIT_UINT32_INVALID))) {
                                 //printf(" *** SKIPPED ***");
                             } else {
-                                TrkPt *pTrkPt;
-
-                                // Alloc new TrkPt object
-                                if ((pTrkPt = trkPtNew(numTrkPts++)) == NULL) {
-                                    fprintf(stderr, "Failed to create TrkPt object !!!\n");
-                                    return -1;
-                                }
+                                TrkPt trkPt = {0};
 
                                 // Init TrkPt object with the values from the FIT
                                 // RECORD message.
-                                fitRecToTrkPt(record, pTrkPt);
+                                fitRecToTrkPt(record, &trkPt);
 
-                                // Insert track point at the tail of the queue
-                                TAILQ_INSERT_TAIL(&server->trkPtList, pTrkPt, tqEntry);
+                                // Append track point at the end of the store
+                                if (trkPtStoreAppend(store, &trkPt) != 0) {
+                                    return -1;
+                                }
                             }
                         } else {
                             fprintf(stderr, "Hu? RECORD message while timer not running !!!\n");
@@ -211,6 +214,56 @@ static int parseFitFile(Server *server)
 
     return 0;
 }
+
+// Parse the FIT activity file, and resample its trackpoints
+// (if requested). The file is closed on return.
+static TrkPtStore *serverParseActivity(FILE *fp, TrkPtResample resample, uint32_t interval)
+{
+    TrkPtStore *store, *resampled;
+
+    if ((store = trkPtStoreNew()) == NULL) {
+        mlog(error, "Failed to alloc trackpoint store!");
+        fclose(fp);
+        return NULL;
+    }
+    if (parseFitFile(fp, store) != 0) {
+        mlog(error, "Failed to load FIT activity file!");
+        trkPtStoreFree(store);
+        return NULL;
+    }
+    if (resample == trkPtNoResample) {
+        return store;
+    }
+
+    if ((resampled = trkPtStoreResample(store, resample, interval)) == NULL) {
+        mlog(error, "Failed to resample the trackpoints!");
+        trkPtStoreFree(store);
+        return NULL;
+    }
+    mlog(info, "Resampled %d trackpoints to %d, at %u [s] intervals",
+            store->numTrkPts, resampled->numTrkPts, interval);
+    trkPtStoreFree(store);
+
+    return resampled;
+}
+
+// The activity played back by all the bikes and sessions.
+// It can be swapped at runtime: each rider notices the new
+// generation at its next tick, and switches over to it.
+static struct {
+    pthread_mutex_t lock;
+    TrkPtStore *store;      // current activity
+    uint32_t gen;           // generation of the current activity
+    bool loading;           // a new activity is being loaded
+    bool failed;            // the last activity failed to load
+} actSwap = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Request to load a new activity
+typedef struct ActLoadReq {
+    char *fileName;
+    TrkPtResample resample;
+    uint32_t resampleInterval;
+} ActLoadReq;
 #endif  // CONFIG_FIT_ACTIVITY_FILE
 
 Service *serverAddService(Server *server, const Uuid128 *uuid)
@@ -334,21 +387,122 @@ static int serverCreateFitnessMachineService(Server *server)
     return 0;
 }
 
-const char *fmtSockaddr(const struct sockaddr_in *sockAddr, bool printPort)
+// Format an IPv4 or IPv6 socket address
+const char *fmtSockaddr(const void *sockAddr, bool printPort)
 {
-    static char fmtBuf[INET_ADDRSTRLEN + 7];    // "AAA.BBB.CCC.DDD[NNNNN]"
+    static __thread char fmtBuf[INET6_ADDRSTRLEN + 7];   // "AAA.BBB.CCC.DDD[NNNNN]" or "XXXX:...:XXXX[NNNNN]"
+    const struct sockaddr *sa = sockAddr;
+    char addrBuf[INET6_ADDRSTRLEN];
+
+    if (sa->sa_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6 *) sa)->sin6_addr, addrBuf, sizeof (addrBuf));
+    } else {
+        inet_ntop(AF_INET, &((const struct sockaddr_in *) sa)->sin_addr, addrBuf, sizeof (addrBuf));
+    }
 
     if (printPort) {
-        char addrBuf[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &sockAddr->sin_addr, addrBuf, sizeof (addrBuf));
-        snprintf(fmtBuf, sizeof (fmtBuf), "%s[%hu]", addrBuf, ntohs(sockAddr->sin_port));
+        snprintf(fmtBuf, sizeof (fmtBuf), "%s[%hu]", addrBuf, sockaddrPort(sa));
     } else {
-        inet_ntop(AF_INET, &sockAddr->sin_addr, fmtBuf, sizeof (fmtBuf));
+        snprintf(fmtBuf, sizeof (fmtBuf), "%s", addrBuf);
     }
 
     return fmtBuf;
 }
 
+// Get the port number of an IPv4 or IPv6 socket address
+uint16_t sockaddrPort(const void *sockAddr)
+{
+    const struct sockaddr *sa = sockAddr;
+
+    if (sa->sa_family == AF_INET6) {
+        return ntohs(((const struct sockaddr_in6 *) sa)->sin6_port);
+    }
+
+    return ntohs(((const struct sockaddr_in *) sa)->sin_port);
+}
+
+static void serverEnterErgMode(Server *server)
+{
+    ErgState *erg = &server->erg;
+
+    if (!erg->active) {
+        // Save the rider's metrics, as they are
+        // overridden while in ERG mode.
+        erg->baseCadence = server->cadence;
+        erg->basePower = server->power;
+        erg->baseSpeed = server->speed;
+        ergStart(erg, server->power);
+        mlog(info, "ERG mode enabled: profile=%s timeConst=%.1lf [s]", fmtErgProfile(erg->profile), erg->timeConst);
+    }
+}
+
+void serverExitErgMode(Server *server)
+{
+    ErgState *erg = &server->erg;
+
+    if (erg->active) {
+        ergExit(erg);
+        server->cadence = erg->baseCadence;
+        server->power = erg->basePower;
+        if (!server->physics) {
+            // Otherwise the bike keeps the speed it has
+            // built up while in ERG mode.
+            server->speed = erg->baseSpeed;
+        }
+        mlog(info, "ERG mode disabled.");
+    }
+}
+
+// Set the target power (ERG mode). The target must be
+// within the supported power range, and it's rounded to
+// the nearest supported increment.
+int serverSetTgtPower(Server *server, int tgtPower)
+{
+    if ((tgtPower < server->minPower) || (tgtPower > server->maxPower)) {
+        return -1;
+    }
+
+    if (server->incPower > 1) {
+        tgtPower = server->minPower + ((((tgtPower - server->minPower) + (server->incPower / 2)) / server->incPower) * server->incPower);
+        if (tgtPower > server->maxPower) {
+            tgtPower -= server->incPower;
+        }
+    }
+
+    serverEnterErgMode(server);
+    ergSetTarget(&server->erg, tgtPower);
+
+    return 0;
+}
+
+// Set the simulation parameters (SIM mode)
+void serverSetSimParms(Server *server, double windSpeed, double grade, double crr, double cw)
+{
+    phySetSimParms(&server->phyState, windSpeed, grade, crr, cw);
+    serverExitErgMode(server);
+}
+
+// Update the ride metrics after the specified time interval
+// (in seconds) has elapsed.
+void serverUpdRideMetrics(Server *server, double dt)
+{
+    if (server->erg.active) {
+        // In ERG mode the trainer drives the power
+        // towards the target, regardless of the
+        // rider's power. The rider's cadence and
+        // the speed follow the power.
+        server->power = ergUpdate(&server->erg, dt);
+        server->cadence = ergCadence(&server->erg);
+    }
+
+    if (server->physics || server->erg.active) {
+        // Derive the speed and distance from the
+        // current power and simulation parameters.
+        phyStep(&server->phyState, server->power, dt);
+        server->speed = server->phyState.speed;
+    }
+}
+
 const char *fmtIndBikeState(IndBikeState indBikeState)
 {
     if (indBikeState == stopped) {
@@ -441,87 +595,419 @@ static int getIntfMacAddr(Server *server, const char *intfName)
 }
 #endif
 
+// Check whether the specified interface is in the list of
+// interfaces to serve.
+static bool serverIntfSelected(const Server *server, const char *intfName)
+{
+    const char *name = server->intfNames;
+    size_t nameLen = strlen(intfName);
+
+    while (*name != '\0') {
+        size_t len = strcspn(name, ",");
+        if ((len == nameLen) && (strncmp(name, intfName, len) == 0)) {
+            return true;
+        }
+        name += len;
+        if (*name == ',') {
+            name++;
+        }
+    }
+
+    return false;
+}
+
+// Figure out the interfaces served by the bikes, and their
+// addresses. By default only one interface is served: the
+// first one with an IPv4 address, or the one with the IPv4
+// address specified via --ip-address. The first interface
+// of the list provides the IP and MAC addresses of the
+// bikes.
 static int findIntfAddr(Server *server)
 {
     struct ifaddrs *ifAddrLst = NULL;
-    int s = -1;
+    bool allIntfs = (server->intfNames != NULL) && (strcmp(server->intfNames, "all") == 0);
+    NetIntf *intfs;
+    int numIntfs = 0;
+    int primary = -1;
 
     if (getifaddrs(&ifAddrLst) == -1) {
         mlog(error, "getifaddrs() failed! (%s)", strerror(errno));
         return -1;
     }
 
+    if ((intfs = calloc(SERVER_MAX_INTFS, sizeof (NetIntf))) == NULL) {
+        mlog(error, "Failed to allocate the interface list!");
+        freeifaddrs(ifAddrLst);
+        return -1;
+    }
+
     /* Walk through linked list, maintaining head pointer so we
        can free list later */
 
     for (struct ifaddrs *ifAddr = ifAddrLst; ifAddr != NULL; ifAddr = ifAddr->ifa_next) {
         const struct sockaddr *sockAddr = ifAddr->ifa_addr;
+        NetIntf *intf = NULL;
 
         if (sockAddr == NULL)
             continue;
 
-        if (sockAddr->sa_family != AF_INET)
+        if ((sockAddr->sa_family != AF_INET) && (sockAddr->sa_family != AF_INET6))
             continue;
 
-        {
-            const struct sockaddr_in *sin = (struct sockaddr_in *) sockAddr;
-            if (ntohl(sin->sin_addr.s_addr) != INADDR_LOOPBACK) {
-                if ((server->srvAddr.sin_family == 0) || (sin->sin_addr.s_addr == server->srvAddr.sin_addr.s_addr)) {
-                    // Get the IP address
-                    server->srvAddr.sin_family = sin->sin_family;
-                    server->srvAddr.sin_addr.s_addr = sin->sin_addr.s_addr;
-
-                    // Get the MAC address
-                    s = getIntfMacAddr(server, ifAddr->ifa_name);
-                }
+        // The loopback interface is only served when
+        // explicitly requested.
+        if ((server->intfNames == NULL) || allIntfs) {
+            if (ifAddr->ifa_flags & IFF_LOOPBACK)
+                continue;
+        } else if (!serverIntfSelected(server, ifAddr->ifa_name)) {
+            continue;
+        }
+
+        for (int i = 0; i < numIntfs; i++) {
+            if (strcmp(intfs[i].name, ifAddr->ifa_name) == 0) {
+                intf = &intfs[i];
                 break;
             }
         }
+        if (intf == NULL) {
+            if (numIntfs == SERVER_MAX_INTFS) {
+                mlog(warning, "Too many interfaces: ignoring %s", ifAddr->ifa_name);
+                continue;
+            }
+            intf = &intfs[numIntfs++];
+            snprintf(intf->name, sizeof (intf->name), "%s", ifAddr->ifa_name);
+            intf->index = if_nametoindex(ifAddr->ifa_name);
+        }
+
+        if (sockAddr->sa_family == AF_INET) {
+            const struct sockaddr_in *sin = (struct sockaddr_in *) sockAddr;
+            if (intf->addr.s_addr == INADDR_ANY) {
+                intf->addr = sin->sin_addr;
+            }
+            // The loopback interface has no MAC address,
+            // so it can't be the primary one.
+            if ((primary == -1) && !(ifAddr->ifa_flags & IFF_LOOPBACK) &&
+                ((server->srvAddr.sin_addr.s_addr == htonl(INADDR_ANY)) || (sin->sin_addr.s_addr == server->srvAddr.sin_addr.s_addr))) {
+                primary = intf - intfs;
+            }
+        } else {
+            // Prefer a routable IPv6 address over the
+            // link-local one.
+            const struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) sockAddr;
+            if (IN6_IS_ADDR_UNSPECIFIED(&intf->addr6) ||
+                (IN6_IS_ADDR_LINKLOCAL(&intf->addr6) && !IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr))) {
+                intf->addr6 = sin6->sin6_addr;
+            }
+        }
     }
 
     freeifaddrs(ifAddrLst);
 
-    return s;
+    // On IPv6-only segments the interface named explicitly
+    // has no IPv4 address at all.
+    if ((primary == -1) && (numIntfs != 0) &&
+        (server->intfNames != NULL) && (server->srvAddr.sin_addr.s_addr == htonl(INADDR_ANY))) {
+        primary = 0;
+    }
+
+    if (primary == -1) {
+        free(intfs);
+        return -1;
+    }
+
+    // Make the primary interface the first one of the
+    // list, and drop the other ones unless asked to serve
+    // them too.
+    if (primary != 0) {
+        NetIntf intf = intfs[0];
+        intfs[0] = intfs[primary];
+        intfs[primary] = intf;
+    }
+    if (server->intfNames == NULL) {
+        numIntfs = 1;
+    }
+
+    // Get the IP address
+    server->srvAddr.sin_family = AF_INET;
+    server->srvAddr.sin_addr = intfs[0].addr;
+    server->intfs = intfs;
+    server->numIntfs = numIntfs;
+
+    for (int i = 0; i < numIntfs; i++) {
+        char addr6Buf[INET6_ADDRSTRLEN] = "none";
+        if (!IN6_IS_ADDR_UNSPECIFIED(&intfs[i].addr6)) {
+            inet_ntop(AF_INET6, &intfs[i].addr6, addr6Buf, sizeof (addr6Buf));
+        }
+        mlog(info, "Serving interface %s: index=%u addr=%s addr6=%s",
+             intfs[i].name, intfs[i].index, inet_ntoa(intfs[i].addr), addr6Buf);
+    }
+
+    // Get the MAC address
+    return getIntfMacAddr(server, intfs[0].name);
 }
 
-static int initServerSock(Server *server)
+// Get the address the DIRCON listening socket of the
+// specified family (AF_INET or AF_INET6) is bound to. When
+// serving several interfaces the socket accepts the
+// connections on any of them. Returns the length of the
+// address, or 0 if the family is not served.
+socklen_t serverGetLsnAddr(const Server *server, int family, struct sockaddr_storage *lsnAddr)
 {
-    int reuseAddr = 1;
+    memset(lsnAddr, 0, sizeof (*lsnAddr));
+
+    if (family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) lsnAddr;
+        if ((server->numIntfs == 1) && (server->intfs[0].addr.s_addr == INADDR_ANY)) {
+            // No IPv4 address to listen on
+            return 0;
+        }
+        *sin = server->srvAddr;
+        if (server->numIntfs > 1) {
+            sin->sin_addr.s_addr = htonl(INADDR_ANY);
+        }
+        return sizeof (*sin);
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) lsnAddr;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = server->srvAddr.sin_port;
+        if (server->numIntfs > 1) {
+            sin6->sin6_addr = in6addr_any;
+        } else if ((server->numIntfs == 1) && !IN6_IS_ADDR_UNSPECIFIED(&server->intfs[0].addr6)) {
+            sin6->sin6_addr = server->intfs[0].addr6;
+            if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
+                sin6->sin6_scope_id = server->intfs[0].index;
+            }
+        } else {
+            // No IPv6 address to listen on
+            return 0;
+        }
+        return sizeof (*sin6);
+    }
+}
+
+// Open the DIRCON listening socket of the specified family
+// (AF_INET or AF_INET6). The IPv6 socket only accepts IPv6
+// connections, so the two sockets can be bound to the same
+// port. Returns the socket descriptor, 0 if the family is
+// not served, or -1 on error.
+int serverOpenLsnSock(const Server *server, int family, bool reusePort)
+{
+    struct sockaddr_storage lsnAddr;
+    socklen_t addrLen;
+    int enable = 1;
     int sd;
 
-    if ((sd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    if ((addrLen = serverGetLsnAddr(server, family, &lsnAddr)) == 0) {
+        return 0;
+    }
+
+    if ((sd = socket(family, SOCK_STREAM, 0)) < 0) {
         mlog(error, "socket() failed!");
         return -1;
     }
-    if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof (reuseAddr)) < 0) {
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof (enable)) < 0) {
         mlog(error, "setsockopt(SO_REUSEADDR) failed!");
+        close(sd);
+        return -1;
+    }
+    if (reusePort && (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof (enable)) < 0)) {
+        mlog(error, "setsockopt(SO_REUSEPORT) failed!");
+        close(sd);
+        return -1;
+    }
+    if ((family == AF_INET6) && (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &enable, sizeof (enable)) < 0)) {
+        mlog(error, "setsockopt(IPV6_V6ONLY) failed!");
+        close(sd);
         return -1;
     }
-    if (bind(sd, (struct sockaddr *) &server->srvAddr, sizeof (server->srvAddr)) < 0) {
-        mlog(error, "bind() failed!");
+    if (bind(sd, (struct sockaddr *) &lsnAddr, addrLen) < 0) {
+        mlog(error, "bind() to %s failed!", fmtSockaddr(&lsnAddr, true));
+        close(sd);
         return -1;
     }
-    if (listen(sd, 5) < 0) {
+    if (listen(sd, (reusePort ? SOMAXCONN : 5)) < 0) {
         mlog(error, "listen() failed!");
+        close(sd);
         return -1;
     }
 
+    return sd;
+}
+
+static int initServerSock(Server *server)
+{
+    int sd;
+
+    if ((sd = serverOpenLsnSock(server, AF_INET, false)) < 0) {
+        return -1;
+    }
     server->srvSockFd = sd;
 
+    // The IPv6 listener is optional: the IPv4 clients can
+    // still connect if it can't be opened.
+    if ((sd = serverOpenLsnSock(server, AF_INET6, false)) < 0) {
+        mlog(warning, "Bike #%d: DIRCON connections not accepted over IPv6", server->bikeId);
+        sd = 0;
+    }
+    server->srvSock6Fd = sd;
+
+    return ((server->srvSockFd != 0) || (server->srvSock6Fd != 0)) ? 0 : -1;
+}
+
+static void serverClkTimerHandler(void *arg, const struct timeval *now)
+{
+    Server *server = arg;
+
+    dirconProcTimers(server, now);
+
+    // Re-arm the timer for the next clock tick
+    evTimerStart(server->evLoop, &server->clkTimer, &server->dirconSession.nextClkTick);
+}
+
+static int serverSetNonBlocking(int sd, bool nonBlocking)
+{
+    int flags;
+
+    if ((flags = fcntl(sd, F_GETFL)) < 0) {
+        mlog(error, "fcntl(F_GETFL) failed!");
+        return -1;
+    }
+    flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (fcntl(sd, F_SETFL, flags) != 0) {
+        mlog(error, "fcntl(F_SETFL) failed!");
+        return -1;
+    }
+
     return 0;
 }
 
-int serverInit(Server *server)
+// Complete the non-blocking connect() to the trainer
+static int serverFinishTrainerConn(Server *server)
+{
+    DirconSession *sess = &server->trainerSession;
+    socklen_t addrLen = sizeof (sess->locCliAddr);
+    socklen_t optLen = sizeof (int);
+    int err;
+
+    if (getsockopt(sess->cliSockFd, SOL_SOCKET, SO_ERROR, &err, &optLen) != 0) {
+        mlog(error, "getsockopt(SO_ERROR) failed!");
+        return -1;
+    }
+    if (err != 0) {
+        errno = err;
+        mlog(error, "connect() to %s failed!", fmtSockaddr(&server->trainerAddr, true));
+        return -1;
+    }
+
+    if (getsockname(sess->cliSockFd, (struct sockaddr *) &sess->locCliAddr, &addrLen) < 0) {
+        mlog(error, "getsockname() failed!");
+        return -1;
+    }
+
+    mlog(info, "Trainer connection established: %s", fmtSockaddr(&sess->remCliAddr, true));
+
+    sess->connPend = false;
+    proxyUpdEvents(server);
+
+    return 0;
+}
+
+static void serverProcSrvSockEvent(void *arg, int fd, short revents)
+{
+    // Process connection request
+    serverProcConnReq((Server *) arg, fd);
+}
+
+static void serverProcAppSockEvent(void *arg, int fd, short revents)
+{
+    Server *server = arg;
+
+    if (server->proxy) {
+        if ((revents & POLLOUT) &&
+            (proxyProcWritable(server, &server->trainerSession, &server->dirconSession) != 0)) {
+            return;
+        }
+        if (revents & ~POLLOUT) {
+            // Relay DIRCON message(s) from app
+            proxyProcMesg(server, &server->dirconSession, &server->trainerSession);
+        }
+    } else if (revents & (POLLRDHUP | POLLHUP | POLLERR)) {
+        // Process connection drop
+        serverProcConnDrop(server);
+    } else {
+        // Process DIRCON message from app
+        dirconProcMesg(server);
+    }
+}
+
+static void serverProcTrainerSockEvent(void *arg, int fd, short revents)
 {
-    gettimeofday(&server->baseTime, NULL);
+    Server *server = arg;
+
+    if (server->trainerSession.connPend) {
+        // The connection to the trainer is complete
+        if (serverFinishTrainerConn(server) != 0) {
+            mlog(error, "Can't connect to the upstream trainer!");
+            serverProcConnDrop(server);
+        }
+        return;
+    }
+
+    if ((revents & POLLOUT) &&
+        (proxyProcWritable(server, &server->dirconSession, &server->trainerSession) != 0)) {
+        return;
+    }
+    if (revents & ~POLLOUT) {
+        // Relay DIRCON message(s) from trainer
+        proxyProcMesg(server, &server->trainerSession, &server->dirconSession);
+    }
+}
+
+// Init the rider emulated by a bike, or by a session
+// (sharded mode): its perturbation state, and where it
+// starts the playback of the activity.
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+// Position the playback cursor of the rider at its start
+// offset into the activity.
+static void serverInitTrkPtCursor(Server *server)
+{
+    uint32_t offset = server->startOffset + (server->bikeId * server->startStep);
+
+    if (server->perturbParms.enabled) {
+        offset += server->perturb.offset;
+    }
+    trkPtCursorInit(&server->trkPtCursor, server->trkPtStore, server->gapMode, offset, server->playbackSpeed);
+}
+#endif
+
+static void serverInitRider(Server *server, uint32_t riderId)
+{
+    perturbInit(&server->perturb, &server->perturbParms, riderId);
+    memset(&server->wkoCursor, 0, sizeof (server->wkoCursor));
+    if (server->synthParms.model != synthNone) {
+        synthInit(&server->synth, &server->synthParms, riderId);
+    }
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    serverInitTrkPtCursor(server);
+#endif
+#ifdef CONFIG_CTRL_SOCKET
+    // The rider starts at its own offset, regardless of
+    // the seeks requested before it joined.
+    server->ctrlSeekGen = ctrlSeekGen(server->bikeId);
+#endif
+}
+
+// Init the ride state and the services of a bike, or of
+// a session (sharded mode).
+static int serverInitState(Server *server)
+{
+    clkGetTime(&server->baseTime);
 
     TAILQ_INIT(&server->svcList);
 
-    server->dirconSession.lastTxReqSeqNum = 0xff;
+    phyInit(&server->phyState, server->mass);
 
-    // Start the notification timer with a 1-sec expiry
-    server->dirconSession.nextClkTick = server->baseTime;
-    server->dirconSession.nextClkTick.tv_sec++;
+    server->dirconSession.lastTxReqSeqNum = 0xff;
 
 #ifdef CONFIG_CPS
     // Create the CPS instance
@@ -537,15 +1023,68 @@ int serverInit(Server *server)
         return -1;
     }
 
-#ifdef CONFIG_FIT_ACTIVITY_FILE
-    TAILQ_INIT(&server->trkPtList);
+    // Start the notification timer with a 1-sec expiry
+    server->dirconSession.nextClkTick = server->baseTime;
+    server->dirconSession.nextClkTick.tv_sec++;
+    evTimerInit(&server->clkTimer, serverClkTimerHandler, server);
+    evTimerStart(server->evLoop, &server->clkTimer, &server->dirconSession.nextClkTick);
 
-    if (server->actFile != NULL) {
-        // Load the FIT activity file
-        if (parseFitFile(server) != 0) {
-            mlog(error, "Failed to load FIT activity file!");
-            return -1;
-        }
+    return 0;
+}
+
+// Init the state, services and sockets that are private
+// to each bike.
+static int serverInitBike(Server *server)
+{
+    mlog(info, "Bike #%d using socket address: %s at %02x-%02x-%02x-%02x-%02x-%02x",
+            server->bikeId, fmtSockaddr(&server->srvAddr, true),
+            server->macAddr[0], server->macAddr[1], server->macAddr[2],
+            server->macAddr[3], server->macAddr[4], server->macAddr[5]);
+
+    if (server->numWorkers != 0) {
+        // Sharded mode: the app connections to this bike
+        // are accepted, and served, by the worker threads.
+        return 0;
+    }
+
+    if (serverInitState(server) != 0) {
+        return -1;
+    }
+
+    // Init the DIRCON server socket
+    if (initServerSock(server) != 0) {
+        mlog(fatal, "Failed to init DIRCON server socket!");
+    }
+    if ((server->srvSockFd != 0) &&
+        (evLoopAddFd(server->evLoop, server->srvSockFd, POLLIN, serverProcSrvSockEvent, server) != 0)) {
+        return -1;
+    }
+    if ((server->srvSock6Fd != 0) &&
+        (evLoopAddFd(server->evLoop, server->srvSock6Fd, POLLIN, serverProcSrvSockEvent, server) != 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int serverInit(Server *server)
+{
+    // Load the activity file (if any)
+    if (serverLoadActivity(server) != 0) {
+        return -1;
+    }
+
+    // Load the structured workout (if any)
+    if ((server->wkoFile != NULL) &&
+        ((server->workout = wkoLoad(server->wkoFile, server->ftp)) == NULL)) {
+        return -1;
+    }
+
+#ifdef CONFIG_LIVE_FEED
+    // Map the live feed (if any)
+    if ((server->liveFeedName != NULL) &&
+        ((server->liveFeed = liveFeedOpen(server->liveFeedName)) == NULL)) {
+        return -1;
     }
 #endif
 
@@ -555,36 +1094,373 @@ int serverInit(Server *server)
         return -1;
     }
 
-    mlog(info, "Using socket address: %s at %02x-%02x-%02x-%02x-%02x-%02x",
-            fmtSockaddr(&server->srvAddr, true),
-            server->macAddr[0], server->macAddr[1], server->macAddr[2],
-            server->macAddr[3], server->macAddr[4], server->macAddr[5]);
+    if (server->serialNum == 0) {
+        server->serialNum = SERVER_DEF_SERIAL_NUM;
+    }
 
-    // Init the DIRCON server socket
-    if (initServerSock(server) != 0) {
-        mlog(fatal, "Failed to init DIRCON server socket!");
+    if (server->synthParms.model != synthNone) {
+        mlog(info, "Synthetic workload: model=%s power=%u [W] seed=%u",
+                fmtSynthModel(server->synthParms.model), server->synthParms.power, server->synthParms.seed);
+    }
+
+    serverInitRider(server, 0);
+
+    return serverInitBike(server);
+}
+
+// Allocate a copy of the specified bike, with a clean
+// ride state.
+static Server *serverClone(const Server *server)
+{
+    Server *bike;
+
+    if ((bike = malloc(sizeof (Server))) == NULL) {
+        return NULL;
+    }
+
+    *bike = *server;
+
+    // Start with a clean ride state
+    memset(&bike->dirconSession, 0, sizeof (bike->dirconSession));
+    memset(&bike->trainerSession, 0, sizeof (bike->trainerSession));
+    memset(&bike->cpRespInfo, 0, sizeof (bike->cpRespInfo));
+    memset(&bike->clkTimer, 0, sizeof (bike->clkTimer));
+    bike->srvSockFd = 0;
+    bike->srvSock6Fd = 0;
+    bike->indBikeState = stopped;
+    bike->actInProg = false;
+    bike->controlGranted = false;
+    bike->rxMdnsMesgCnt = bike->txMdnsMesgCnt = 0;
+    memset(bike->tickLateHist, 0, sizeof (bike->tickLateHist));
+#ifdef CONFIG_CPS
+    bike->cumulativeCrankRevolutions = 0;
+    bike->lastCrankEventTime = 0;
+#endif
+    TAILQ_INIT(&bike->svcList);
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    // Play back the latest activity, which may have
+    // been swapped since the original was created.
+    pthread_mutex_lock(&actSwap.lock);
+    bike->trkPtStore = trkPtStoreHold(actSwap.store);
+    bike->actGen = actSwap.gen;
+    pthread_mutex_unlock(&actSwap.lock);
+#endif
+
+    return bike;
+}
+
+// Create an additional bike of the fleet. The new bike has
+// the same configuration as the specified (first) bike,
+// and shares its activity data, but it has its own socket,
+// identity and ride state:
+//
+//   TCP port = base port + bikeId
+//   MAC address = interface MAC address + bikeId (lower 16 bits)
+//   serial number = base serial number + bikeId
+//
+Server *serverNewBike(const Server *server, int bikeId)
+{
+    Server *bike;
+    uint16_t macLow;
+
+    if ((bike = serverClone(server)) == NULL) {
+        mlog(error, "Failed to alloc bike #%d!", bikeId);
+        return NULL;
+    }
+
+    bike->bikeId = bikeId;
+    bike->srvAddr.sin_port = htons(ntohs(server->srvAddr.sin_port) + bikeId);
+    macLow = ((server->macAddr[4] << 8) | server->macAddr[5]) + bikeId;
+    bike->macAddr[4] = macLow >> 8;
+    bike->macAddr[5] = macLow & 0xff;
+    bike->serialNum = server->serialNum + bikeId;
+    serverInitRider(bike, bikeId);
+
+    if (serverInitBike(bike) != 0) {
+        // Undo whatever serverInitBike() managed to set up
+        if (bike->srvSockFd != 0) {
+            evLoopDelFd(bike->evLoop, bike->srvSockFd);
+            close(bike->srvSockFd);
+        }
+        if (bike->srvSock6Fd != 0) {
+            evLoopDelFd(bike->evLoop, bike->srvSock6Fd);
+            close(bike->srvSock6Fd);
+        }
+        serverFree(bike);
+        return NULL;
+    }
+
+    return bike;
+}
+
+// Create a new session of the specified bike (sharded mode).
+// The session has the same configuration and identity as the
+// bike, but its own ride state. The app connection is then
+// accepted on the specified listening socket.
+Server *serverNewSession(const Server *bike, EvLoop *evLoop, int lsnSockFd)
+{
+    static uint32_t sessCnt[SERVER_MAX_BIKES];
+    Server *server;
+    uint32_t sessNum;
+
+    if ((server = serverClone(bike)) == NULL) {
+        mlog(error, "Failed to alloc session of bike #%d!", bike->bikeId);
+        return NULL;
+    }
+
+    // Each session emulates a different rider of the bike.
+    // The sessions are counted per bike, so the riders of
+    // a bike don't depend on the sessions of the others.
+    sessNum = __atomic_add_fetch(&sessCnt[bike->bikeId], 1, __ATOMIC_RELAXED);
+    serverInitRider(server, (bike->bikeId + (sessNum * SERVER_MAX_BIKES)));
+
+    server->evLoop = evLoop;
+    server->srvSockFd = lsnSockFd;
+    server->numWorkers = 0;
+
+    if (serverInitState(server) != 0) {
+        serverFree(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+// Free a session object (sharded mode), or a bike that
+// failed to initialize.
+void serverFree(Server *server)
+{
+    Service *svc;
+
+    evTimerStop(server->evLoop, &server->clkTimer);
+
+    while ((svc = TAILQ_FIRST(&server->svcList)) != NULL) {
+        TAILQ_REMOVE(&server->svcList, svc, svcListEnt);
+        svcFree(svc);
+    }
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    trkPtStoreRelease(server->trkPtStore);
+#endif
+
+    free(server);
+}
+
+int serverLoadActivity(Server *server)
+{
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    TrkPtStore *store = NULL;
+    TrkPtSrcKey key, *srcKey = NULL;
+
+    if ((server->actFileName != NULL) &&
+        (trkPtSrcKeyInit(&key, server->actFileName, server->resample, server->resampleInterval) == 0)) {
+        srcKey = &key;
+    }
+
+    if (server->actCache != NULL) {
+        // Map the trackpoints from the cache file, if it
+        // has already been created from the same activity
+        // file and with the same resampling.
+        if ((store = trkPtStoreMap(server->actCache, srcKey)) != NULL) {
+            mlog(info, "Mapped %d trackpoints from cache file %s", store->numTrkPts, server->actCache);
+            if (server->actFile != NULL) {
+                fclose(server->actFile);
+                server->actFile = NULL;
+            }
+        }
+    }
+
+    if ((store == NULL) && (server->actFile != NULL)) {
+        // Load the FIT activity file. The trackpoints are
+        // never modified after this point, so they can be
+        // shared by all the bikes of the fleet.
+        store = serverParseActivity(server->actFile, server->resample, server->resampleInterval);
+        server->actFile = NULL;
+        if (store == NULL) {
+            return -1;
+        }
+        if ((server->actCache != NULL) && (trkPtStoreSave(store, server->actCache, srcKey) == 0)) {
+            mlog(info, "Saved %d trackpoints to cache file %s", store->numTrkPts, server->actCache);
+        }
     }
 
+    actSwap.store = store;
+    server->trkPtStore = trkPtStoreHold(store);
+#endif
+
     return 0;
 }
 
-static int serverProcConnReq(Server *server)
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+// Tell whether the file is a FIT file, or a trackpoint
+// cache file.
+static bool isFitFile(FILE *fp)
+{
+    uint8_t hdr[12];
+    bool fit;
+
+    fit = (fread(hdr, sizeof (hdr), 1, fp) == 1) && (memcmp(&hdr[8], ".FIT", 4) == 0);
+    rewind(fp);
+
+    return fit;
+}
+
+// Load the new activity, and make it the current one
+static void *serverActLoadThread(void *arg)
+{
+    ActLoadReq *req = arg;
+    TrkPtStore *store = NULL;
+    TrkPtStore *oldStore = NULL;
+    FILE *fp;
+    sigset_t sigSet;
+
+    // Let the main thread handle all the signals
+    sigfillset(&sigSet);
+    pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+
+    if ((fp = fopen(req->fileName, "r")) == NULL) {
+        mlog(error, "Can't open activity file %s!", req->fileName);
+    } else if (isFitFile(fp)) {
+        store = serverParseActivity(fp, req->resample, req->resampleInterval);
+    } else {
+        // Cache files are simply mapped, which is much
+        // faster than parsing a large FIT file.
+        fclose(fp);
+        store = trkPtStoreMap(req->fileName, NULL);
+    }
+
+    pthread_mutex_lock(&actSwap.lock);
+    if (store != NULL) {
+        oldStore = actSwap.store;
+        actSwap.store = store;
+        __atomic_store_n(&actSwap.gen, (actSwap.gen + 1), __ATOMIC_RELEASE);
+    }
+    actSwap.loading = false;
+    actSwap.failed = (store == NULL);
+    pthread_mutex_unlock(&actSwap.lock);
+
+    if (store != NULL) {
+        mlog(info, "Loaded %d trackpoints from activity file %s", store->numTrkPts, req->fileName);
+    }
+
+    // The riders still playing back the old activity
+    // hold their own references to it.
+    trkPtStoreRelease(oldStore);
+
+    free(req->fileName);
+    free(req);
+
+    return NULL;
+}
+#endif
+
+void serverGetActStatus(ActStatus *status)
+{
+    memset(status, 0, sizeof (*status));
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    pthread_mutex_lock(&actSwap.lock);
+    status->loading = actSwap.loading;
+    status->failed = actSwap.failed;
+    status->gen = actSwap.gen;
+    status->numTrkPts = (actSwap.store != NULL) ? actSwap.store->numTrkPts : 0;
+    pthread_mutex_unlock(&actSwap.lock);
+#endif
+}
+
+int serverSwapActivity(const Server *server, const char *fileName)
+{
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    ActLoadReq *req;
+    pthread_t thread;
+    pthread_attr_t attr;
+    int s;
+
+    // Only one activity can be loaded at a time, as the
+    // FIT decoder is not reentrant.
+    pthread_mutex_lock(&actSwap.lock);
+    if (actSwap.loading) {
+        pthread_mutex_unlock(&actSwap.lock);
+        mlog(info, "An activity is already being loaded!");
+        return -1;
+    }
+    actSwap.loading = true;
+    pthread_mutex_unlock(&actSwap.lock);
+
+    if (((req = calloc(1, sizeof (ActLoadReq))) == NULL) ||
+        ((req->fileName = strdup(fileName)) == NULL)) {
+        mlog(error, "Failed to alloc activity load request!");
+        free(req);
+        __atomic_store_n(&actSwap.loading, false, __ATOMIC_RELEASE);
+        return -1;
+    }
+    req->resample = server->resample;
+    req->resampleInterval = server->resampleInterval;
+
+    // Load the activity in the background, so the riders
+    // keep going while the file is being parsed.
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    s = pthread_create(&thread, &attr, serverActLoadThread, req);
+    pthread_attr_destroy(&attr);
+    if (s != 0) {
+        mlog(error, "Failed to start activity loader! (%s)", strerror(s));
+        free(req->fileName);
+        free(req);
+        __atomic_store_n(&actSwap.loading, false, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    return 0;
+#else
+    mlog(info, "Activity files not supported!");
+    return -1;
+#endif
+}
+
+void serverSyncActivity(Server *server)
+{
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    TrkPtStore *oldStore = server->trkPtStore;
+
+    if (__atomic_load_n(&actSwap.gen, __ATOMIC_ACQUIRE) == server->actGen) {
+        // Nothing new
+        return;
+    }
+
+    pthread_mutex_lock(&actSwap.lock);
+    server->trkPtStore = trkPtStoreHold(actSwap.store);
+    server->actGen = actSwap.gen;
+    pthread_mutex_unlock(&actSwap.lock);
+
+    trkPtStoreRelease(oldStore);
+
+    // Start the new activity at the rider's own offset
+    serverInitTrkPtCursor(server);
+
+    mlog(info, "Bike #%d: switched to activity #%u", server->bikeId, server->actGen);
+#endif
+}
+
+int serverProcConnReq(Server *server, int lsnSockFd)
 {
     DirconSession *sess = &server->dirconSession;
+    struct sockaddr_storage remCliAddr;
     int cliSockFd;
-    socklen_t addrLen = sizeof (sess->remCliAddr);
+    socklen_t addrLen = sizeof (remCliAddr);
 
     // Accept the connection from the upstream
     // client app.
-    if ((cliSockFd = accept(server->srvSockFd, (struct sockaddr *) &sess->remCliAddr, &addrLen)) < 0) {
+    if ((cliSockFd = accept(lsnSockFd, (struct sockaddr *) &remCliAddr, &addrLen)) < 0) {
         mlog(error, "accept() failed!");
         return -1;
     }
 
     if (sess->cliSockFd == 0) {
         int enable = true;
-        char locAddrBuf[INET_ADDRSTRLEN];
-        char remAddrBuf[INET_ADDRSTRLEN];
+        char remAddrBuf[INET6_ADDRSTRLEN + 7];
+
+        sess->remCliAddr = remCliAddr;
 
         // Set NODELAY option to reduce the latency of the
         // messages we send out over this DIRCON session.
@@ -595,21 +1471,46 @@ static int serverProcConnReq(Server *server)
         }
 
         // Get our local socket address
+        addrLen = sizeof (sess->locCliAddr);
         if (getsockname(cliSockFd, (struct sockaddr *) &sess->locCliAddr, &addrLen) < 0) {
             mlog(error, "getsockname() failed!");
             close(cliSockFd);
             return -1;
         }
 
-        inet_ntop(AF_INET, &sess->remCliAddr.sin_addr, remAddrBuf, sizeof (remAddrBuf));
-        inet_ntop(AF_INET, &sess->locCliAddr.sin_addr, locAddrBuf, sizeof (locAddrBuf));
-        mlog(info, "Client app connection established: %s[%u] -> %s[%u]",
-                remAddrBuf, ntohs(sess->remCliAddr.sin_port),
-                locAddrBuf, ntohs(sess->locCliAddr.sin_port));
+        snprintf(remAddrBuf, sizeof (remAddrBuf), "%s", fmtSockaddr(&sess->remCliAddr, true));
+        mlog(info, "Client app connection established: %s -> %s",
+                remAddrBuf, fmtSockaddr(&sess->locCliAddr, true));
 
         sess->cliSockFd = cliSockFd;
         sess->rxMesgCnt = 0;
         sess->txMesgCnt = 0;
+
+        if (evLoopAddFd(server->evLoop, cliSockFd, (POLLIN | POLLRDHUP), serverProcAppSockEvent, server) != 0) {
+            return serverProcConnDrop(server);
+        }
+
+        if (server->proxy) {
+            // The relay needs non-blocking sockets, so a full
+            // destination socket, or a partial message, don't
+            // stall the event loop.
+            if (serverSetNonBlocking(cliSockFd, true) != 0) {
+                return serverProcConnDrop(server);
+            }
+
+            // Open the DIRCON session with the upstream
+            // trainer on behalf of the app.
+            if (serverConnectToDirconTrainer(server) != 0) {
+                mlog(error, "Can't connect to the upstream trainer!");
+                return serverProcConnDrop(server);
+            }
+        }
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+        else if (server->recordDir != NULL) {
+            // Record the session
+            recStart(server, sess);
+        }
+#endif
     } else {
         // The server supports only one client at a
         // time!
@@ -620,148 +1521,122 @@ static int serverProcConnReq(Server *server)
     return 0;
 }
 
-int serverProcConnDrop(Server *server)
+int serverConnectToDirconTrainer(Server *server)
 {
-    DirconSession *sess = &server->dirconSession;
+    DirconSession *sess = &server->trainerSession;
+    socklen_t addrLen;
+    int enable = true;
+    int sd;
 
-    mlog(info, "Client app disconnected!");
+    // Connect in the background, so the event loop (and all
+    // the other bikes) don't stall while the trainer answers.
+    if ((sd = socket(server->trainerAddr.ss_family, (SOCK_STREAM | SOCK_NONBLOCK), 0)) < 0) {
+        mlog(error, "socket() failed!");
+        return -1;
+    }
 
-    // Clean up
-    server->indBikeState = stopped;
-    server->controlGranted = false;
-#ifdef CONFIG_CPS
-    server->cumulativeCrankRevolutions = 0;
-    server->lastCrankEventTime = 0;
-#endif
-    sess->cpmNotificationsEnabled = false;
-    sess->ibdNotificationsEnabled = false;
+    // Set NODELAY option to reduce the latency of the
+    // messages we relay over this DIRCON session.
+    if (setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof (enable)) != 0) {
+        mlog(error, "setsockopt(TCP_NODELAY) failed!");
+        close(sd);
+        return -1;
+    }
+
+    addrLen = (server->trainerAddr.ss_family == AF_INET6) ? sizeof (struct sockaddr_in6) : sizeof (struct sockaddr_in);
+    if ((connect(sd, (struct sockaddr *) &server->trainerAddr, addrLen) != 0) &&
+        (errno != EINPROGRESS)) {
+        mlog(error, "connect() to %s failed!", fmtSockaddr(&server->trainerAddr, true));
+        close(sd);
+        return -1;
+    }
+    memcpy(&sess->remCliAddr, &server->trainerAddr, sizeof (server->trainerAddr));
+
+    sess->cliSockFd = sd;
+    sess->connPend = true;
     sess->rxMesgCnt = 0;
     sess->txMesgCnt = 0;
 
-    // Close our end of the socket
-    close(sess->cliSockFd);
-    sess->cliSockFd = 0;
-    memset(&sess->locCliAddr, 0, sizeof (sess->locCliAddr));
-    memset(&sess->remCliAddr, 0, sizeof (sess->remCliAddr));
+    if (evLoopAddFd(server->evLoop, sd, POLLOUT, serverProcTrainerSockEvent, server) != 0) {
+        return -1;
+    }
+
+    // Hold the app's messages until the trainer is
+    // connected.
+    proxyUpdEvents(server);
 
     return 0;
 }
 
-int serverRun(Server *server)
+static void serverCloseRelayPipe(DirconSession *sess)
 {
-    const struct timeval pollInt = { .tv_sec = 0, .tv_usec = 10000 };   // 10 ms
-    struct timeval start = {0};
-    struct timeval end = {0};
-
-    // Main work loop
-    while (true) {
-        struct pollfd pollFdSet[6]; // max 6 fd: stdin, srv, app, dev, mdns, msgq
-        struct timeval delta, timeout;
-        int numFds, numEnt, msTimeo;
-
-        numFds = 0;
+    if (sess->relayPipe[0] != 0) {
+        close(sess->relayPipe[0]);
+        close(sess->relayPipe[1]);
+        sess->relayPipe[0] = sess->relayPipe[1] = 0;
+    }
+    sess->relayPend = 0;
+    sess->relayRxLen = 0;
+}
 
-#ifdef CONFIG_CLI
-        // CLI console input
-        pollFdSet[numFds].fd = server->stdinFd;
-        pollFdSet[numFds].events = POLLIN;
-        pollFdSet[numFds++].revents = 0;
-#endif
+int serverProcConnDrop(Server *server)
+{
+    DirconSession *sess = &server->dirconSession;
 
-        // Server socket input
-        pollFdSet[numFds].fd = server->srvSockFd;
-        pollFdSet[numFds].events = POLLIN;
-        pollFdSet[numFds++].revents = 0;
+    mlog(info, "Client app disconnected!");
 
-        // App client socket input
-        if (server->dirconSession.cliSockFd) {
-            pollFdSet[numFds].fd = server->dirconSession.cliSockFd;
-            pollFdSet[numFds].events = POLLIN | POLLRDHUP;
-            pollFdSet[numFds++].revents = 0;
-        }
+    if (server->proxy) {
+        DirconSession *trainer = &server->trainerSession;
 
-#ifdef CONFIG_MDNS_AGENT
-        // mDNS socket input
-        if (server->mdnsSockFd) {
-            pollFdSet[numFds].fd = server->mdnsSockFd;
-            pollFdSet[numFds].events = POLLIN;
-            pollFdSet[numFds++].revents = 0;
-        }
-#endif
+        proxyLogStats(server);
 
-        // Wait for data on any of the specified file
-        // descriptors, or until the timeout expires.
-        // To keep the timers accurate, we adjust the
-        // nominal poll interval by the amount of time
-        // spent in the last iteration of the work
-        // loop...
-        tvSub(&delta, &end, &start);
-        if (tvCmp(&pollInt, &delta) > 0) {
-            tvSub(&timeout, &pollInt, &delta);
-        } else {
-            timeout.tv_usec = 0;
+        // Tear down the session with the upstream trainer
+        if (trainer->cliSockFd != 0) {
+            evLoopDelFd(server->evLoop, trainer->cliSockFd);
+            close(trainer->cliSockFd);
         }
-        msTimeo = (timeout.tv_usec / 1000);
-        if ((numEnt = poll(pollFdSet, numFds, msTimeo)) < 0) {
-            if (errno != EINTR) {
-                mlog(fatal, "poll() failed!");
-                return -1;
-            }
-            numEnt = 0;
-        }
-
-        gettimeofday(&start, NULL);
+        serverCloseRelayPipe(trainer);
+        serverCloseRelayPipe(sess);
+        memset(trainer, 0, sizeof (*trainer));
+        memset(&sess->relayLat, 0, sizeof (sess->relayLat));
+    }
 
-        // Process DIRCON timers
-        dirconProcTimers(server, &start);
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    // Stop recording the session
+    recStop(server, sess);
 
-#ifdef CONFIG_MDNS_AGENT
-        // Process mDNS timers
-        mdnsProcTimers(server, &start);
+    // The playback is idle until the next session
+    trkPtCursorResync(&server->trkPtCursor);
 #endif
 
-        if (numEnt) {
-            for (int n = 0; (n < numFds); n++) {
-                if (pollFdSet[n].revents & POLLIN) {
-                    int fd = pollFdSet[n].fd;
-#ifdef CONFIG_CLI
-                    if (fd == server->stdinFd) {
-                        // Process CLI console input
-                        cliReadChar();
-                    } else
-#endif
-                    if (fd == server->srvSockFd) {
-                        // Process connection request
-                        serverProcConnReq(server);
-                    } else if (fd == server->dirconSession.cliSockFd) {
-                        if (pollFdSet[n].revents & POLLRDHUP) {
-                            // Process connection drop
-                            serverProcConnDrop(server);
-                        } else {
-                            // Process DIRCON message from app
-                            dirconProcMesg(server);
-                        }
-#ifdef CONFIG_MDNS_AGENT
-                    } else if (fd == server->mdnsSockFd) {
-                        // Process mDNS message
-                        mdnsProcMesg(server);
+    // Clean up
+    server->indBikeState = stopped;
+    server->controlGranted = false;
+#ifdef CONFIG_CPS
+    server->cumulativeCrankRevolutions = 0;
+    server->lastCrankEventTime = 0;
 #endif
-                    }
-                }
-            }
-        }
+    sess->cpmNotificationsEnabled = false;
+    sess->ibdNotificationsEnabled = false;
+    sess->rxMesgCnt = 0;
+    sess->txMesgCnt = 0;
 
-        gettimeofday(&end, NULL);
+    // Close our end of the socket
+    if (sess->cliSockFd == 0) {
+        // Already closed
+        return 0;
+    }
+    evLoopDelFd(server->evLoop, sess->cliSockFd);
+    close(sess->cliSockFd);
+    sess->cliSockFd = 0;
+    memset(&sess->locCliAddr, 0, sizeof (sess->locCliAddr));
+    memset(&sess->remCliAddr, 0, sizeof (sess->remCliAddr));
 
-        // Exit the tool?
-        if (server->exit) {
-            cliPreExitCleanup(server);
-            break;
-        }
+    if (server->worker != NULL) {
+        // Sharded mode: the session object goes away
+        // with the app connection.
+        workerEndSession(server->worker, server);
     }
 
     return 0;
 }
-
-
-
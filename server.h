@@ -19,20 +19,44 @@
 
 #pragma once
 
+#include <net/if.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <sys/queue.h>
+#include <sys/socket.h>
 
 #include "binbuf.h"
 #include "defs.h"
+#include "erg.h"
+#include "evloop.h"
+#include "fitwr.h"
+#include "fmtbuf.h"
+#include "livefeed.h"
+#include "perturb.h"
+#include "physics.h"
 #include "svc.h"
+#include "synth.h"
 #include "trkpt.h"
+#include "wko.h"
+
+// Max Rx/Tx message length
+#define MAX_MESG_LEN    512
+
+// Relay latency stats (proxy mode)
+typedef struct LatStats {
+    uint32_t numSamples;                    // number of relayed messages/chunks
+    uint32_t minLat;                        // min latency [us]
+    uint32_t maxLat;                        // max latency [us]
+    uint64_t sumLat;                        // sum of all latency samples [us]
+    uint64_t numBytes;                      // number of bytes relayed
+} LatStats;
 
 // DIRCON Session Info
 typedef struct DirconSession {
     int cliSockFd;                          // file descriptor of the client (connected) DIRCON socket
-    struct sockaddr_in locCliAddr;          // local-end of client socket address
-    struct sockaddr_in remCliAddr;          // remote-end of client socket address
+    int relayPipe[2];                       // pipe used to splice the data received on this session (proxy mode)
+    struct sockaddr_storage locCliAddr;     // local-end of client socket address (IPv4 or IPv6)
+    struct sockaddr_storage remCliAddr;     // remote-end of client socket address (IPv4 or IPv6)
     struct timeval rxMesgTimestamp;         // timestamp of last DIRCON message received
     struct timeval nextClkTick;             // when the next clock tick is due
     struct timeval lastSetIndBikeSimParms;  // last FMCP SET_INDOOR_BIKE_SIM_PARMS command received
@@ -44,6 +68,17 @@ typedef struct DirconSession {
     bool fmcpNotificationsEnabled;          // Fitness Machine Control Point notifications enabled
     bool ibdNotificationsEnabled;           // Indoor Bike Data notifications enabled
     bool respPend;                          // server-initiated DIRCON transaction in progress
+    LatStats relayLat;                      // latency added when relaying the data received on this session
+    struct timeval relayRxTime;             // when the data being relayed was received (wall-clock time)
+    size_t relayLen;                        // number of bytes being relayed
+    size_t relayPend;                       // bytes received on this session, waiting for the other end to be writable
+    uint8_t relayBuf[MAX_MESG_LEN];         // pending bytes (copy relay); the splice relay keeps them in relayPipe
+    size_t relayRxLen;                      // bytes of the partial message received so far (copy relay)
+    uint8_t relayRxBuf[MAX_MESG_LEN];       // message being assembled (copy relay)
+    bool connPend;                          // non-blocking connect() in progress
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    FitWr *recFile;                         // FIT activity file the session is recorded to
+#endif
 } DirconSession;
 
 // Indoor Bike State
@@ -59,12 +94,32 @@ typedef enum MesgDir {
     RxDir = 2,
 } MesgDir;
 
-// Max Rx/Tx message length
-#define MAX_MESG_LEN    512
-
 // Max number of arguments in a CLI command
 #define MAX_ARGS    8
 
+// Default serial number of the (first) bike
+#define SERVER_DEF_SERIAL_NUM   123456789
+
+// Max number of bikes in a fleet
+#define SERVER_MAX_BIKES    256
+
+// Max number of worker threads (sharded mode)
+#define SERVER_MAX_WORKERS  64
+
+// Max number of network interfaces served
+#define SERVER_MAX_INTFS    16
+
+// Number of bins of the tick lateness histogram
+#define SERVER_TICK_HIST_BINS   20
+
+// Network interface served by the bikes
+typedef struct NetIntf {
+    char name[IF_NAMESIZE];
+    unsigned int index;             // interface index
+    struct in_addr addr;            // IPv4 address (INADDR_ANY if none)
+    struct in6_addr addr6;          // IPv6 address (in6addr_any if none)
+} NetIntf;
+
 // Control Point response info
 typedef struct CpRespInfo {
     const Characteristic *chr;  // the characteristic to use for the NOTIFY message
@@ -73,26 +128,114 @@ typedef struct CpRespInfo {
     uint8_t resultCode;         // result code of the requested operation
 } CpRespInfo;
 
-// DIRCON Server
+#ifdef CONFIG_MDNS_AGENT
+// Number of pre-serialized mDNS messages per bike
+#define MDNS_NUM_PKTS   2
+
+// Number of PTR queries answered by the mDNS agent
+#define MDNS_NUM_RESPS  2
+
+// Number of records of a bike in the response to a PTR query
+#define MDNS_NUM_RECS   4
+
+// mDNS message, encoded once and then sent as-is
+typedef struct MdnsPkt {
+    size_t len;
+    uint8_t buf[MAX_MESG_LEN];
+} MdnsPkt;
+
+// mDNS state of a bike on one of the interfaces
+typedef struct MdnsIntfState {
+    MdnsPkt pkts[MDNS_NUM_PKTS];            // pre-serialized messages
+    in_port_t pktsPort;                     // TCP port the messages were encoded with
+    bool respPend[MDNS_NUM_RESPS];          // bike included in the pending response to each PTR query
+    struct timeval recTime[MDNS_NUM_RECS];  // last multicast of each response record
+} MdnsIntfState;
+#endif
+
+#ifdef CONFIG_MDNS_AGENT
+// mDNS advertisement state of a bike
+typedef enum MdnsState {
+    mdnsQuerying = 0,       // sending the initial queries
+    mdnsAnnouncing = 1,     // sending the initial announcements
+    mdnsAdvertising = 2,    // sending the periodic advertisements
+} MdnsState;
+#endif
+
+// Status of the activity loading (see serverSwapActivity)
+typedef struct ActStatus {
+    bool loading;           // a new activity is being loaded
+    bool failed;            // the last activity failed to load
+    uint32_t gen;           // generation of the current activity
+    int numTrkPts;          // number of trackpoints of the current activity
+} ActStatus;
+
+// DIRCON Server: one virtual bike. In fleet mode several
+// bikes run in the same process, sharing the event loop,
+// the mDNS socket and the activity data.
 typedef struct Server {
+    TAILQ_ENTRY(Server) fleetEnt;   // node in the fleet's list of bikes
+    EvLoop *evLoop;                 // event loop shared by all the bikes
+    EvTimer clkTimer;               // 1-sec timer of the DIRCON session
+    int bikeId;                     // index of the bike in the fleet
+    int numBikes;                   // number of bikes in the fleet
+    int numWorkers;                 // number of worker threads (sharded mode)
+    struct Worker *worker;          // worker thread serving this session (sharded mode)
+    TAILQ_ENTRY(Server) sessEnt;    // node in the worker's session table
+    bool zombie;                    // session ended, pending to be freed
+    uint32_t serialNum;             // serial number advertised via mDNS
+
     int stdinFd;                    // file descriptor of stdin stream
     int srvSockFd;                  // file descriptor of the server (listening) DIRCON socket
-    int mdnsSockFd;                 // file descriptor of the MDNS UDP socket
+    int srvSock6Fd;                 // file descriptor of the IPv6 listening DIRCON socket (0 if none)
 
     struct sockaddr_in srvAddr;     // listening socket address
-    struct sockaddr_in mdnsAddr;    // mDNS socket address
 
-    uint8_t macAddr[6];             // MAC address of the local network interface
+    const char *intfNames;          // interfaces to serve: "all", or a comma-separated list
+    NetIntf *intfs;                 // interfaces served (shared, read-only)
+    int numIntfs;
+
+    uint8_t macAddr[6];             // MAC address of the bike (derived from the interface's)
+
+#ifdef CONFIG_MDNS_AGENT
+    struct MdnsAgent *mdnsAgent;    // mDNS agent shared by all the bikes of the fleet
+    EvTimer mdnsTimer;              // mDNS advertisement timer
+    MdnsState mdnsState;            // mDNS advertisement state
+    int mdnsCount;                  // queries/announcements sent in the current state
+    char mdnsDeviceNameBuf[64];
+    FmtBuf mdnsDeviceName;          // "Wahoo-KICKR-NNNN.local"
+    char mdnsServiceNameBuf[128];
+    FmtBuf mdnsServiceName;         // "Wahoo KICKR NNNN._wahoo-fitness-tnp._tcp.local"
+    MdnsIntfState *mdnsIntfs;       // mDNS state on each one of the interfaces
+    bool mdnsKnownAns;              // PTR record of the bike listed as known answer of the query
+#endif
 
     // DIRCON session
     DirconSession dirconSession;
 
+    // DIRCON session with the upstream trainer (proxy mode)
+    DirconSession trainerSession;
+    struct sockaddr_storage trainerAddr;    // socket address of the upstream trainer (IPv4 or IPv6)
+
     // List of supported services/characteristics
     TAILQ_HEAD(SvcList, Service) svcList;
 
 #ifdef CONFIG_FIT_ACTIVITY_FILE
     FILE *actFile;                  // FIT/TCX activity file
-    TAILQ_HEAD(TrkPtList, TrkPt) trkPtList; // list of trackpoints from the activity file
+    const char *actFileName;        // name of the activity file
+    const char *actCache;           // trackpoint cache file (mapped read-only)
+    TrkPtStore *trkPtStore;         // trackpoints from the activity file (shared, read-only)
+    TrkPtCursor trkPtCursor;        // playback cursor of this bike/session
+    uint32_t actGen;                // generation of the activity being played back
+    uint32_t startOffset;           // playback start offset [sec]
+    uint32_t startStep;             // additional start offset of each bike [sec]
+    double playbackSpeed;           // playback speed factor
+    TrkPtGapMode gapMode;           // how the pauses of the activity are played back
+    TrkPtResample resample;         // how the trackpoints are resampled at load time
+    uint32_t resampleInterval;      // resampling interval [sec]
+    const char *batchOut;           // output file name (batch mode)
+    const char *schedFile;          // sim parameters and target power schedule (batch mode)
+    const char *recordDir;          // directory where the sessions are recorded
 #endif
 
     struct timeval baseTime;        // base time used to generate relative timestamps
@@ -115,6 +258,30 @@ typedef struct Server {
     uint16_t power;                 // Power [Watts]
     double speed;                   // Speed [m/s]
 
+    double mass;                    // rider + bike mass [kg]
+    PhyState phyState;              // bike dynamics state (physics mode)
+    ErgState erg;                   // ERG mode state
+    PerturbParms perturbParms;      // metric perturbation parameters
+    PerturbState perturb;           // metric perturbation state of this rider
+    SynthParms synthParms;          // synthetic workload parameters
+    SynthState synth;               // synthetic workload state of this rider
+    const char *wkoFile;            // structured workout file
+    uint32_t ftp;                   // rider's FTP, for the relative workout targets [W]
+    Workout *workout;               // structured workout (shared, read-only)
+    WkoCursor wkoCursor;            // position of this rider in the workout
+#ifdef CONFIG_CTRL_SOCKET
+    const char *ctrlSockName;       // path name of the control socket
+    uint32_t ctrlSeekGen;           // last seek request (control socket) handled
+#endif
+
+    uint32_t tickLateHist[SERVER_TICK_HIST_BINS];   // lateness of the notification ticks (log2 bins of [usec])
+
+#ifdef CONFIG_LIVE_FEED
+    const char *liveFeedName;       // shared memory object (or file) of the live feed
+    LiveFeed *liveFeed;             // live-metrics feed (shared, read-only)
+    bool liveFeedActive;            // the metrics of this rider come from the live feed
+#endif
+
 #ifdef CONFIG_CPS
     uint16_t cumulativeCrankRevolutions;
     uint16_t lastCrankEventTime;
@@ -132,20 +299,46 @@ typedef struct Server {
     bool exit;
     bool hexDumpMesg;
     bool noMdns;
+    bool physics;                   // derive speed and distance from the power
+    bool proxy;                     // relay the DIRCON messages to/from an upstream trainer
 } Server;
 
 __BEGIN_DECLS
 
 extern int serverInit(Server *server);
+extern Server *serverNewBike(const Server *server, int bikeId);
+extern Server *serverNewSession(const Server *bike, EvLoop *evLoop, int lsnSockFd);
+extern void serverFree(Server *server);
+extern int serverProcConnReq(Server *server, int lsnSockFd);
 extern int serverConnectToDirconTrainer(Server *server);
 extern int serverProcConnDrop(Server *server);
-extern int serverRun(Server *server);
+extern int serverLoadActivity(Server *server);
+
+// Load a new activity in the background, and switch all
+// the bikes and sessions over to it at their next tick.
+extern int serverSwapActivity(const Server *server, const char *fileName);
+
+// Get the status of the activity loading
+extern void serverGetActStatus(ActStatus *status);
+
+// Switch over to the latest activity, if it has been
+// swapped since the last call.
+extern void serverSyncActivity(Server *server);
+
+extern int serverSetTgtPower(Server *server, int tgtPower);
+extern void serverSetSimParms(Server *server, double windSpeed, double grade, double crr, double cw);
+extern void serverExitErgMode(Server *server);
+extern void serverUpdRideMetrics(Server *server, double dt);
 
 extern Service *serverAddService(Server *server, const Uuid128 *uuid);
 extern Service *serverFindService(const Server *server, const Uuid128 *uuid);
 extern Characteristic *serverFindCharacteristicByUuid128(const Server *server, const Uuid128 *uuid);
 
-extern const char *fmtSockaddr(const struct sockaddr_in *sockAddr, bool printPort);
+extern socklen_t serverGetLsnAddr(const Server *server, int family, struct sockaddr_storage *lsnAddr);
+extern int serverOpenLsnSock(const Server *server, int family, bool reusePort);
+
+extern const char *fmtSockaddr(const void *sockAddr, bool printPort);
+extern uint16_t sockaddrPort(const void *sockAddr);
 
 extern const char *fmtIndBikeState(IndBikeState state);
 
@@ -41,6 +41,7 @@ void svcFree(Service *svc)
     Characteristic *cha;
 
     while ((cha = TAILQ_FIRST(&svc->charList)) != NULL) {
+        TAILQ_REMOVE(&svc->charList, cha, charListEnt);
         charFree(cha);
     }
 
@@ -0,0 +1,134 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "synth.h"
+
+// Interval workout: work/rest periods [s], and power
+// relative to the mean power.
+#define SYNTH_WORK_TIME         240
+#define SYNTH_REST_TIME         180
+#define SYNTH_WORK_POWER        1.20
+#define SYNTH_REST_POWER        0.60
+
+// Sprint bursts: probability of starting a sprint in any
+// given second, min/max duration [s], and power relative
+// to the mean power.
+#define SYNTH_SPRINT_PROB       (1.0 / 300.0)
+#define SYNTH_SPRINT_MIN_TIME   8
+#define SYNTH_SPRINT_MAX_TIME   20
+#define SYNTH_SPRINT_POWER      2.50
+
+// Random walk: mean reversion rate [1/s], and volatility
+// relative to the mean power [1/sqrt(s)].
+#define SYNTH_WALK_THETA        0.05
+#define SYNTH_WALK_SIGMA        0.04
+
+// Heart rate: max value [BPM], and time constant of its
+// response to changes in the power [s].
+#define SYNTH_MAX_HEART_RATE    190.0
+#define SYNTH_HEART_RATE_TAU    30.0
+
+void synthInit(SynthState *ss, const SynthParms *parms, uint32_t riderId)
+{
+    ss->parms = parms;
+    rngInit(&ss->rng, parms->seed, riderId);
+    ss->elapsed = 0;
+
+    // Per-rider constants: +/-15% of the mean power, and a
+    // resting heart rate between 50 and 70 BPM.
+    ss->meanPower = parms->power * (1.0 + (rngRange(&ss->rng, 150) / 1000.0));
+    ss->restHeartRate = 60.0 + rngRange(&ss->rng, 10);
+
+    ss->walk = 0.0;
+    ss->sprintLeft = 0;
+    ss->cadence = 0.0;
+    ss->heartRate = ss->restHeartRate;
+}
+
+void synthUpdate(SynthState *ss, uint16_t *cadence, uint16_t *heartRate, uint16_t *power)
+{
+    const SynthParms *parms = ss->parms;
+    double target = ss->meanPower;
+    double pwr, cadTarget, hrTarget;
+
+    if (parms->model == synthIntervals) {
+        if ((ss->elapsed % (SYNTH_WORK_TIME + SYNTH_REST_TIME)) < SYNTH_WORK_TIME) {
+            target *= SYNTH_WORK_POWER;
+        } else {
+            target *= SYNTH_REST_POWER;
+        }
+    } else if (parms->model == synthSprints) {
+        if ((ss->sprintLeft == 0) && (rngUniform(&ss->rng) < SYNTH_SPRINT_PROB)) {
+            ss->sprintLeft = SYNTH_SPRINT_MIN_TIME +
+                             (rngNext(&ss->rng) % (SYNTH_SPRINT_MAX_TIME - SYNTH_SPRINT_MIN_TIME + 1));
+        }
+        if (ss->sprintLeft != 0) {
+            target *= SYNTH_SPRINT_POWER;
+            ss->sprintLeft--;
+        }
+    }
+
+    // Ornstein-Uhlenbeck random walk around the target
+    ss->walk += (-SYNTH_WALK_THETA * ss->walk) + (SYNTH_WALK_SIGMA * ss->meanPower * rngGauss(&ss->rng));
+    pwr = target + ss->walk;
+    if (pwr < 0.0) {
+        pwr = 0.0;
+    }
+
+    // The cadence follows the power: ~85 RPM at the mean
+    // power, spinning up in the sprints.
+    cadTarget = 65.0 + (20.0 * pwr / ss->meanPower);
+    if (cadTarget > 120.0) {
+        cadTarget = 120.0;
+    }
+    if (ss->cadence == 0.0) {
+        ss->cadence = cadTarget;
+    }
+    ss->cadence += (0.5 * (cadTarget - ss->cadence)) + rngRange(&ss->rng, 2);
+
+    // The heart rate lags behind the power
+    hrTarget = ss->restHeartRate + ((SYNTH_MAX_HEART_RATE - ss->restHeartRate) * pwr / (1.6 * ss->meanPower));
+    if (hrTarget > SYNTH_MAX_HEART_RATE) {
+        hrTarget = SYNTH_MAX_HEART_RATE;
+    }
+    ss->heartRate += (hrTarget - ss->heartRate) / SYNTH_HEART_RATE_TAU;
+
+    ss->elapsed++;
+
+    *power = (uint16_t) (pwr + 0.5);
+    *cadence = (uint16_t) (ss->cadence + 0.5);
+    *heartRate = (uint16_t) (ss->heartRate + 0.5);
+}
+
+const char *fmtSynthModel(SynthModel model)
+{
+    if (model == synthNone) {
+        return "none";
+    } else if (model == synthSteady) {
+        return "steady";
+    } else if (model == synthIntervals) {
+        return "intervals";
+    } else if (model == synthSprints) {
+        return "sprints";
+    }
+
+    return "???";
+}
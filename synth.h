@@ -0,0 +1,69 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "defs.h"
+#include "rng.h"
+
+// Default mean power of the synthetic rider [W]
+#define SYNTH_DEF_POWER     180
+
+// Synthetic workload model
+typedef enum SynthModel {
+    synthNone = 0,
+    synthSteady = 1,        // mean-reverting random walk around the mean power
+    synthIntervals = 2,     // work/rest intervals, plus the random walk
+    synthSprints = 3,       // random walk, plus random sprint bursts
+} SynthModel;
+
+// Synthetic workload parameters, shared by all the riders
+typedef struct SynthParms {
+    SynthModel model;
+    uint32_t power;         // mean power [W]
+    uint32_t seed;          // base seed
+} SynthParms;
+
+// Synthetic workload state of one rider (bike or session)
+typedef struct SynthState {
+    const SynthParms *parms;
+    Rng rng;                // PRNG state
+    uint32_t elapsed;       // elapsed time [s]
+    double meanPower;       // rider's mean power [W]
+    double restHeartRate;   // rider's resting heart rate [BPM]
+    double walk;            // random walk offset of the power [W]
+    uint32_t sprintLeft;    // remaining time of the current sprint [s]
+    double cadence;         // current cadence [RPM]
+    double heartRate;       // current heart rate [BPM]
+} SynthState;
+
+__BEGIN_DECLS
+
+extern void synthInit(SynthState *ss, const SynthParms *parms, uint32_t riderId);
+
+// Advance the workload by one second, and return the new
+// metrics.
+extern void synthUpdate(SynthState *ss, uint16_t *cadence, uint16_t *heartRate, uint16_t *power);
+
+extern const char *fmtSynthModel(SynthModel model);
+
+__END_DECLS
+
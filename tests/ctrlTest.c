@@ -0,0 +1,178 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Unit tests of the command parser of the control socket:
+// the syntax of the requests, the bike selectors, and the
+// effect of the metric overrides and seeks on the bikes.
+
+#include "config.h"
+
+// The control socket can be left out of the configuration,
+// but its parser is tested regardless.
+#ifndef CONFIG_CTRL_SOCKET
+#define CONFIG_CTRL_SOCKET
+#endif
+
+#include "test.h"
+#include "ctrl.c"
+
+#define TEST_NUM_BIKES  2
+
+static Fleet testFleet;
+static Server testBikes[TEST_NUM_BIKES];
+static int testSockFds[2];
+
+// Set up a fleet, and a connection over a socket pair to
+// read the replies from.
+static void mkFleet(void)
+{
+    TAILQ_INIT(&testFleet.bikeList);
+    for (int n = 0; n < TEST_NUM_BIKES; n++) {
+        testBikes[n].bikeId = n;
+        TAILQ_INSERT_TAIL(&testFleet.bikeList, &testBikes[n], fleetEnt);
+    }
+    testFleet.numBikes = TEST_NUM_BIKES;
+    ctrl.fleet = &testFleet;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, testSockFds);
+}
+
+// Run the request, and check the last line of its reply
+static bool runCmd(const char *req, const char *status)
+{
+    CtrlConn conn = { .sockFd = testSockFds[0] };
+    char line[CTRL_MAX_LINE];
+    char reply[CTRL_MAX_REPLY];
+    const char *last;
+    ssize_t len;
+
+    snprintf(line, sizeof (line), "%s", req);
+    if ((ctrlProcLine(&conn, line) != 0) ||
+        ((len = recv(testSockFds[1], reply, (sizeof (reply) - 1), MSG_DONTWAIT)) <= 0)) {
+        return false;
+    }
+    reply[len - 1] = '\0';
+    last = ((last = strrchr(reply, '\n')) != NULL) ? (last + 1) : reply;
+
+    return (strncmp(last, status, strlen(status)) == 0);
+}
+
+static void testSyntax(void)
+{
+    testCheck(runCmd("help", "OK"));
+    testCheck(runCmd("  stats\r", "OK"));
+    testCheck(runCmd("bogus", "ERR unknown command"));
+    testCheck(runCmd("help me", "ERR invalid syntax"));
+    testCheck(runCmd("clear", "ERR invalid syntax"));
+    testCheck(runCmd("set 0 power=1 power=2 power=3 power=4 power=5 power=6 power=7", "ERR invalid syntax"));
+    testCheck(runCmd("log-level verbose", "ERR invalid log level"));
+    testCheck(runCmd("log-level info", "OK"));
+}
+
+static void testBikeSelector(void)
+{
+    testCheck(runCmd("clear 0", "OK"));
+    testCheck(runCmd("clear 1", "OK"));
+    testCheck(runCmd("clear all", "OK"));
+    testCheck(runCmd("clear 2", "ERR invalid bike"));
+    testCheck(runCmd("clear -1", "ERR invalid bike"));
+    testCheck(runCmd("clear 1x", "ERR invalid bike"));
+    testCheck(runCmd("clear x", "ERR invalid bike"));
+    testCheck(runCmd("hist all", "ERR invalid bike"));
+    testCheck(runCmd("hist 1", "OK"));
+
+    // The ticks are not run by the main thread when sharded
+    testFleet.numWorkers = 1;
+    testCheck(runCmd("hist 1", "ERR not available in sharded mode"));
+    testFleet.numWorkers = 0;
+}
+
+static void testOverrides(void)
+{
+    Server *bike0 = &testBikes[0];
+    Server *bike1 = &testBikes[1];
+
+    testCheck(runCmd("set 0 power=250 cadence=90.5 speed=36 hr=140", "OK"));
+    ctrlOverrideMetrics(bike0);
+    testCheck((bike0->power == 250) && (bike0->cadence == 90) && (bike0->heartRate == 140));
+    testCheck((bike0->speed > 9.99) && (bike0->speed < 10.01));
+    ctrlOverrideMetrics(bike1);
+    testCheck(bike1->power == 0);
+
+    // Invalid requests are not applied at all
+    testCheck(runCmd("set all power=100 cadence=-1", "ERR invalid value"));
+    testCheck(runCmd("set all power=100 hr=256", "ERR invalid value"));
+    testCheck(runCmd("set all power=100 torque=10", "ERR invalid metric"));
+    testCheck(runCmd("set all power=100 cadence", "ERR invalid metric"));
+    testCheck(runCmd("set all power=100x", "ERR invalid value"));
+    ctrlOverrideMetrics(bike0);
+    ctrlOverrideMetrics(bike1);
+    testCheck((bike0->power == 250) && (bike1->power == 0));
+
+    // The overrides accumulate until cleared
+    testCheck(runCmd("set all power=300", "OK"));
+    bike0->cadence = 80;
+    ctrlOverrideMetrics(bike0);
+    ctrlOverrideMetrics(bike1);
+    testCheck((bike0->power == 300) && (bike0->cadence == 90) && (bike1->power == 300));
+    testCheck(runCmd("clear 0", "OK"));
+    bike0->power = 0;
+    bike1->power = 0;
+    ctrlOverrideMetrics(bike0);
+    ctrlOverrideMetrics(bike1);
+    testCheck((bike0->power == 0) && (bike1->power == 300));
+}
+
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+static void testSeek(void)
+{
+    uint32_t seekGen0 = ctrlSeekGen(0);
+    uint32_t seekGen1 = ctrlSeekGen(1);
+
+    testCheck(runCmd("seek 1 600", "OK"));
+    testCheck((ctrlSeekGen(0) == seekGen0) && (ctrlSeekGen(1) == (seekGen1 + 1)));
+    testCheck(ctrlBikeState[1].seekTime == 600);
+
+    testCheck(runCmd("seek all 60", "OK"));
+    testCheck((ctrlSeekGen(0) == (seekGen0 + 1)) && (ctrlSeekGen(1) == (seekGen1 + 2)));
+
+    testCheck(runCmd("seek 0 1m", "ERR invalid time"));
+    testCheck(runCmd("seek 0 -", "ERR invalid time"));
+    testCheck(runCmd("seek 2 60", "ERR invalid bike"));
+    testCheck((ctrlSeekGen(0) == (seekGen0 + 1)) && (ctrlSeekGen(1) == (seekGen1 + 2)));
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    mkFleet();
+
+    testSyntax();
+    testBikeSelector();
+    testOverrides();
+#ifdef CONFIG_FIT_ACTIVITY_FILE
+    testSeek();
+#endif
+
+    close(testSockFds[0]);
+    close(testSockFds[1]);
+
+    return testReport("ctrl");
+}
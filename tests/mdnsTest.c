@@ -0,0 +1,307 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Unit tests of the message logic of the mDNS agent: the
+// compression of the names in the messages it builds, the
+// parsing of the (compressed) names it receives, and the
+// known-answer suppression of its responses.
+
+#include "config.h"
+
+// The agent is left out of the default configuration, but
+// its message logic is tested regardless.
+#ifndef CONFIG_MDNS_AGENT
+#define CONFIG_MDNS_AGENT
+#endif
+
+#include "test.h"
+#include "mdns.c"
+
+// Set up a name
+static const FmtBuf *mkName(FmtBuf *name, char *buf, size_t bufSize, const char *str)
+{
+    fmtBufInit(name, buf, bufSize);
+    fmtBufAppend(name, "%s", str);
+
+    return name;
+}
+
+static void testNameCompression(void)
+{
+    static const char *names[] = {
+        "Wahoo KICKR 1234._wahoo-fitness-tnp._tcp.local",
+        "_wahoo-fitness-tnp._tcp.local",
+        "Wahoo-KICKR-1234.local",
+        "_TCP.LOCAL",
+    };
+    uint8_t buf[512] = { 0 };
+    char nameBufs[4][64], nameBuf[256];
+    FmtBuf name;
+    MdnsMesg mesg;
+    BinBuf rxBuf;
+    bool match = true;
+
+    // The message remembers where the names were written,
+    // so they must outlive it.
+    mdnsMesgInit(&mesg, buf, sizeof (buf));
+    mesg.buf.offset = sizeof (DnsMesgHdr);
+    for (int n = 0; n < 4; n++) {
+        mdnsAddName(&mesg, mkName(&name, nameBufs[n], sizeof (nameBufs[n]), names[n]));
+    }
+
+    // The first name is written in full: 4 labels and the
+    // terminating zero.
+    testCheck((buf[12] == 16) && (memcmp(&buf[13], "Wahoo KICKR 1234", 16) == 0));
+    testCheck((buf[29] == 18) && (buf[48] == 4) && (buf[53] == 5) && (buf[59] == 0));
+
+    // The second one is a pointer to its suffix in the
+    // first one.
+    testCheck((buf[60] == 0xc0) && (buf[61] == 29));
+
+    // The third one has a label of its own, and then a
+    // pointer to the "local" suffix.
+    testCheck((buf[62] == 16) && (buf[79] == 0xc0) && (buf[80] == 53));
+
+    // The suffixes are matched regardless of the case
+    testCheck((buf[81] == 0xc0) && (buf[82] == 48));
+    testCheck(mesg.buf.offset == 83);
+
+    // The names are decoded back, following the pointers
+    binBufInit(&rxBuf, buf, mesg.buf.offset, bigEndian);
+    rxBuf.offset = sizeof (DnsMesgHdr);
+    for (int n = 0; n < 4; n++) {
+        fmtBufInit(&name, nameBuf, sizeof (nameBuf));
+        match &= ((mdnsRemName(&rxBuf, &name) == 0) && (strcasecmp(name.buf, names[n]) == 0));
+    }
+    testCheck(match && (rxBuf.offset == mesg.buf.offset));
+}
+
+// Decode a name from a raw message
+static int remName(const uint8_t *data, size_t len, uint32_t offset)
+{
+    char nameBuf[256];
+    FmtBuf name;
+    BinBuf buf;
+
+    binBufInit(&buf, (uint8_t *) data, len, bigEndian);
+    buf.offset = offset;
+    fmtBufInit(&name, nameBuf, sizeof (nameBuf));
+
+    return mdnsRemName(&buf, &name);
+}
+
+static void testMalformedNames(void)
+{
+    static const uint8_t fwdPtr[] = { 0xc0, 0x02, 0x01, 'a', 0x00 };
+    static const uint8_t selfPtr[] = { 0x01, 'a', 0xc0, 0x02 };
+    static const uint8_t loopPtr[] = { 0x01, 'a', 0xc0, 0x04, 0xc0, 0x00 };   // 4 -> 0 -> 4 -> ...
+    static const uint8_t truncPtr[] = { 0x01, 'a', 0xc0 };
+    static const uint8_t truncLabel[] = { 0x05, 'a', 'b' };
+    static const uint8_t unterm[] = { 0x01, 'a' };
+    static const uint8_t rsvdFlags[] = { 0x40, 0x00 };
+    static const uint8_t backPtr[] = { 0x01, 'a', 0x00, 0x01, 'b', 0xc0, 0x00 };
+
+    // The pointers must point back to an earlier name
+    testCheck(remName(fwdPtr, sizeof (fwdPtr), 0) != 0);
+    testCheck(remName(selfPtr, sizeof (selfPtr), 0) != 0);
+    testCheck(remName(loopPtr, sizeof (loopPtr), 4) != 0);
+
+    // Truncated, unterminated, or reserved labels
+    testCheck(remName(truncPtr, sizeof (truncPtr), 0) != 0);
+    testCheck(remName(truncLabel, sizeof (truncLabel), 0) != 0);
+    testCheck(remName(unterm, sizeof (unterm), 0) != 0);
+    testCheck(remName(rsvdFlags, sizeof (rsvdFlags), 0) != 0);
+
+    testCheck(remName(backPtr, sizeof (backPtr), 3) == 0);
+}
+
+#define TEST_NUM_BIKES  3
+
+static Server testBikes[TEST_NUM_BIKES];
+static TAILQ_HEAD(TestBikeList, Server) testBikeList = TAILQ_HEAD_INITIALIZER(testBikeList);
+static EvLoop testEvLoop;
+
+// Set up an agent serving a fleet of bikes on a single
+// interface, without any sockets.
+static MdnsAgent *mkAgent(void)
+{
+    MdnsAgent *agent = calloc(1, sizeof (MdnsAgent));
+
+    fmtBufInit(&wahooFitnessTnpName, wahooFitnessTnpNameBuf, sizeof (wahooFitnessTnpNameBuf));
+    fmtBufAppend(&wahooFitnessTnpName, "_wahoo-fitness-tnp._tcp.local");
+
+    fmtBufInit(&servicesDnsSdName, servicesDnsSdNameBuf, sizeof (servicesDnsSdNameBuf));
+    fmtBufAppend(&servicesDnsSdName, "_services._dns-sd._udp.local");
+
+    clkInit(realTime, 1.0);
+    evLoopInit(&testEvLoop);
+
+    for (int n = 0; n < TEST_NUM_BIKES; n++) {
+        Server *bike = &testBikes[n];
+        bike->bikeId = n;
+        bike->evLoop = &testEvLoop;
+        bike->numIntfs = 1;
+        bike->mdnsIntfs = calloc(1, sizeof (MdnsIntfState));
+        fmtBufInit(&bike->mdnsServiceName, bike->mdnsServiceNameBuf, sizeof (bike->mdnsServiceNameBuf));
+        fmtBufAppend(&bike->mdnsServiceName, "Wahoo KICKR %04X._wahoo-fitness-tnp._tcp.local", n);
+        TAILQ_INSERT_TAIL(&testBikeList, bike, fleetEnt);
+    }
+    agent->fleet = &testBikes[0];
+
+    for (int r = 0; r < MDNS_NUM_RESPS; r++) {
+        MdnsPendResp *pendResp = &agent->pendResps[0][r];
+        pendResp->agent = agent;
+        pendResp->intfIdx = 0;
+        pendResp->respId = r;
+        evTimerInit(&pendResp->timer, mdnsRespTimerHandler, pendResp);
+    }
+
+    return agent;
+}
+
+// Drop the pending responses without sending them
+static void resetResps(MdnsAgent *agent)
+{
+    for (int r = 0; r < MDNS_NUM_RESPS; r++) {
+        MdnsPendResp *pendResp = &agent->pendResps[0][r];
+        evTimerStop(&testEvLoop, &pendResp->timer);
+        pendResp->families = 0;
+        pendResp->numQueries = 0;
+        pendResp->tcPend = false;
+    }
+
+    for (int n = 0; n < TEST_NUM_BIKES; n++) {
+        memset(testBikes[n].mdnsIntfs, 0, sizeof (MdnsIntfState));
+    }
+}
+
+// Build a PTR query for the specified name (if any), with
+// the specified known answers, and feed it to the agent.
+static void rxQuery(MdnsAgent *agent, uint16_t flags, const FmtBuf *qname, const FmtBuf *ansName,
+                    const FmtBuf **knownAns, int numKnownAns, uint32_t ttl, in_addr_t fromAddr)
+{
+    uint8_t buf[MDNS_MAX_PKT_LEN];
+    struct sockaddr_storage from = { 0 };
+    struct sockaddr_in *sin = (struct sockaddr_in *) &from;
+    MdnsMesg mesg;
+
+    mdnsMesgInit(&mesg, buf, sizeof (buf));
+    binBufPutUINT16(&mesg.buf, 0);                          // ID
+    binBufPutUINT16(&mesg.buf, flags);                      // QR=0, OPCODE=QUERY, TC
+    binBufPutUINT16(&mesg.buf, (qname != NULL) ? 1 : 0);    // QDCOUNT
+    binBufPutUINT16(&mesg.buf, numKnownAns);                // ANCOUNT
+    binBufPutUINT16(&mesg.buf, 0);                          // NSCOUNT=0
+    binBufPutUINT16(&mesg.buf, 0);                          // ARCOUNT=0
+
+    if (qname != NULL) {
+        mdnsAddQuestion(&mesg, qname, TYPE_PTR, CLASS_IN);
+    }
+
+    for (int n = 0; n < numKnownAns; n++) {
+        uint32_t rdlen = mdnsBeginResourceRec(&mesg, ansName, TYPE_PTR, CLASS_IN, ttl);
+        mdnsAddName(&mesg, knownAns[n]);
+        mdnsEndResourceRec(&mesg, rdlen);
+    }
+
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(MDNS_UDP_PORT);
+    sin->sin_addr.s_addr = fromAddr;
+
+    mdnsProcRxMesg(agent, mdnsIPv4, 0, buf, mesg.buf.offset, &from);
+}
+
+// Check which bikes are included in the pending response
+static bool respPend(int respId, bool pend0, bool pend1, bool pend2)
+{
+    return (testBikes[0].mdnsIntfs[0].respPend[respId] == pend0) &&
+           (testBikes[1].mdnsIntfs[0].respPend[respId] == pend1) &&
+           (testBikes[2].mdnsIntfs[0].respPend[respId] == pend2);
+}
+
+static void testKnownAnswers(void)
+{
+    MdnsAgent *agent = mkAgent();
+    MdnsPendResp *tnpResp = &agent->pendResps[0][mdnsTnpResp];
+    MdnsPendResp *svcsResp = &agent->pendResps[0][mdnsSvcsResp];
+    const FmtBuf *bike0[] = { &testBikes[0].mdnsServiceName };
+    const FmtBuf *bike1[] = { &testBikes[1].mdnsServiceName };
+    const FmtBuf *allBikes[] = { &testBikes[0].mdnsServiceName,
+                                 &testBikes[1].mdnsServiceName,
+                                 &testBikes[2].mdnsServiceName };
+    const FmtBuf *tnp[] = { &wahooFitnessTnpName };
+    in_addr_t querierA = inet_addr("192.168.1.10");
+    in_addr_t querierB = inet_addr("192.168.1.11");
+
+    // The bikes the querier knows about are left out
+    rxQuery(agent, 0, &wahooFitnessTnpName, &wahooFitnessTnpName, bike1, 1, MDNS_PTR_TTL, querierA);
+    testCheck(respPend(mdnsTnpResp, true, false, true) && (tnpResp->timer.list != NULL));
+    testCheck(svcsResp->timer.list == NULL);
+    resetResps(agent);
+
+    // ... unless the TTL the querier knows is less than
+    // half of the true one.
+    rxQuery(agent, 0, &wahooFitnessTnpName, &wahooFitnessTnpName, bike1, 1, (MDNS_PTR_TTL / 2 - 1), querierA);
+    testCheck(respPend(mdnsTnpResp, true, true, true));
+    resetResps(agent);
+
+    // Nothing to send if the querier knows all of them
+    rxQuery(agent, 0, &wahooFitnessTnpName, &wahooFitnessTnpName, allBikes, 3, MDNS_PTR_TTL, querierA);
+    testCheck(respPend(mdnsTnpResp, false, false, false) && (tnpResp->timer.list == NULL));
+    resetResps(agent);
+
+    // Same for the service type enumeration
+    rxQuery(agent, 0, &servicesDnsSdName, &servicesDnsSdName, tnp, 1, MDNS_PTR_TTL, querierA);
+    testCheck(respPend(mdnsSvcsResp, false, false, false) && (svcsResp->timer.list == NULL));
+    rxQuery(agent, 0, &servicesDnsSdName, NULL, NULL, 0, 0, querierA);
+    testCheck(respPend(mdnsSvcsResp, true, true, true) && (svcsResp->timer.list != NULL));
+    resetResps(agent);
+
+    // The rest of the known answers of a truncated query
+    // are only taken from the querier that sent it.
+    rxQuery(agent, 0x0200, &wahooFitnessTnpName, &wahooFitnessTnpName, bike0, 1, MDNS_PTR_TTL, querierA);
+    testCheck(respPend(mdnsTnpResp, false, true, true) && tnpResp->tcPend && (tnpResp->timer.list != NULL));
+    rxQuery(agent, 0, NULL, &wahooFitnessTnpName, bike1, 1, MDNS_PTR_TTL, querierB);
+    testCheck(respPend(mdnsTnpResp, false, true, true));
+    rxQuery(agent, 0, NULL, &wahooFitnessTnpName, bike1, 1, MDNS_PTR_TTL, querierA);
+    testCheck(respPend(mdnsTnpResp, false, false, true));
+    resetResps(agent);
+
+    // With several queriers, a bike is only left out if
+    // all of them know about it.
+    rxQuery(agent, 0, &wahooFitnessTnpName, &wahooFitnessTnpName, bike0, 1, MDNS_PTR_TTL, querierA);
+    rxQuery(agent, 0, &wahooFitnessTnpName, &wahooFitnessTnpName, bike1, 1, MDNS_PTR_TTL, querierB);
+    testCheck(respPend(mdnsTnpResp, true, true, true) && (tnpResp->numQueries == 2));
+    resetResps(agent);
+
+    for (int n = 0; n < TEST_NUM_BIKES; n++) {
+        free(testBikes[n].mdnsIntfs);
+    }
+    evLoopCleanup(&testEvLoop);
+    free(agent);
+}
+
+int main(int argc, char *argv[])
+{
+    testNameCompression();
+    testMalformedNames();
+    testKnownAnswers();
+
+    return testReport("mdns");
+}
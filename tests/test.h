@@ -0,0 +1,48 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdio.h>
+
+// Minimal unit test harness. Each test program includes the
+// source file of the module under test, so it can check its
+// static functions too, and runs all its checks. A failed
+// check is reported, but it doesn't stop the rest of them;
+// the program exits with a non-zero status if any failed.
+
+static int testNumChecks;
+static int testNumFails;
+
+#define testCheck(cond) \
+    do { \
+        testNumChecks++; \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            testNumFails++; \
+        } \
+    } while (0)
+
+static __inline__ int testReport(const char *testName)
+{
+    printf("%s: %d checks, %d failed\n", testName, testNumChecks, testNumFails);
+
+    return (testNumFails == 0) ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Unit tests of the trackpoint store and of the playback
+// cursors: the resampling of the trackpoints, the seeks,
+// and the time-based advancement of the cursor, with and
+// without the pauses.
+
+#include "test.h"
+#include "trkpt.c"
+
+// Build a store with the trackpoints at the specified
+// times (relative to an arbitrary start time), and a
+// power value equal to the index of each one.
+static TrkPtStore *buildStore(const time_t *times, int numTimes)
+{
+    TrkPtStore *store = trkPtStoreNew();
+
+    for (int n = 0; n < numTimes; n++) {
+        TrkPt tp = { .timestamp = (1000000 + times[n]), .power = n, .cadence = 90, .speed = 10.0 };
+        trkPtStoreAppend(store, &tp);
+    }
+
+    return store;
+}
+
+// 10 trackpoints 1 s apart, a 91 s pause, and another 10
+static const time_t pauseTimes[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+    100, 101, 102, 103, 104, 105, 106, 107, 108, 109,
+};
+
+#define NUM_PAUSE_TIMES (sizeof (pauseTimes) / sizeof (pauseTimes[0]))
+
+static void testStoreTimes(void)
+{
+    TrkPtStore *store = buildStore(pauseTimes, NUM_PAUSE_TIMES);
+
+    testCheck(store->numTrkPts == NUM_PAUSE_TIMES);
+    testCheck((store->trkPts[10].elapsed == 100) && (store->trkPts[19].elapsed == 109));
+
+    // The pause only counts as 1 second of moving time
+    testCheck((store->trkPts[10].movingTime == 10) && (store->trkPts[19].movingTime == 19));
+
+    trkPtStoreRelease(store);
+}
+
+static void testSeek(void)
+{
+    TrkPtStore *store = buildStore(pauseTimes, NUM_PAUSE_TIMES);
+    TrkPtCursor cur;
+
+    // Skip the pauses: seek by moving time
+    trkPtCursorInit(&cur, store, trkPtSkipGaps, 0, 1.0);
+    testCheck((cur.index == 0) && !cur.paused);
+    trkPtCursorSeek(&cur, 5);
+    testCheck(cur.index == 5);
+    trkPtCursorSeek(&cur, 9.5);
+    testCheck((cur.index == 9) && !cur.paused);
+    trkPtCursorSeek(&cur, 10);
+    testCheck(cur.index == 10);
+    trkPtCursorSeek(&cur, 2);
+    testCheck(cur.index == 2);
+    trkPtCursorSeek(&cur, 19.5);
+    testCheck((cur.index == 19) && (trkPtCursorGet(&cur) == &store->trkPts[19]));
+
+    // Past the end of the activity
+    trkPtCursorSeek(&cur, 20);
+    testCheck(trkPtCursorGet(&cur) == NULL);
+
+    // Keep the pauses: seek by elapsed time
+    trkPtCursorInit(&cur, store, trkPtKeepGaps, 50, 1.0);
+    testCheck((cur.index == 9) && cur.paused);
+    trkPtCursorSeek(&cur, 9.5);
+    testCheck((cur.index == 9) && !cur.paused);
+    trkPtCursorSeek(&cur, 100);
+    testCheck((cur.index == 10) && !cur.paused);
+    trkPtCursorSeek(&cur, 109);
+    testCheck(cur.index == 19);
+
+    trkPtStoreRelease(store);
+}
+
+static void testUpdate(void)
+{
+    TrkPtStore *store = buildStore(pauseTimes, NUM_PAUSE_TIMES);
+    struct timeval now = { .tv_sec = 5000, .tv_usec = 0 };
+    TrkPtCursor cur;
+
+    trkPtCursorInit(&cur, store, trkPtSkipGaps, 0, 1.0);
+
+    // The first update moves the cursor on by one tick
+    trkPtCursorUpdate(&cur, &now);
+    testCheck((cur.time == 1.0) && (cur.index == 1));
+
+    // One trackpoint per second
+    now.tv_sec++;
+    trkPtCursorUpdate(&cur, &now);
+    testCheck((cur.time == 2.0) && (cur.index == 2));
+
+    // A late update catches up with the elapsed time,
+    // right across the pause.
+    now.tv_sec += 12;
+    trkPtCursorUpdate(&cur, &now);
+    testCheck((cur.time == 14.0) && (cur.index == 14));
+
+    // After a resync, the idle time is not caught up
+    trkPtCursorResync(&cur);
+    now.tv_sec += 100;
+    trkPtCursorUpdate(&cur, &now);
+    testCheck((cur.time == 15.0) && (cur.index == 15));
+
+    // Faster playback
+    trkPtCursorInit(&cur, store, trkPtKeepGaps, 0, 4.0);
+    trkPtCursorUpdate(&cur, &now);
+    testCheck((cur.time == 4.0) && (cur.index == 4));
+
+    // A long jump, into the pause
+    now.tv_sec += 10;
+    trkPtCursorUpdate(&cur, &now);
+    testCheck((cur.time == 44.0) && (cur.index == 9) && cur.paused);
+
+    trkPtStoreRelease(store);
+}
+
+// Irregular trackpoints ("smart recording"), and a pause
+static const time_t irregTimes[] = { 0, 3, 4, 30, 31 };
+static const uint32_t irregPowers[] = { 100, 400, 500, 600, 700 };
+
+#define NUM_IRREG_TIMES (sizeof (irregTimes) / sizeof (irregTimes[0]))
+
+// Check the timestamps (relative to the first one) and the
+// power values of the resampled trackpoints.
+static bool chkResample(const TrkPtStore *store, const time_t *times, const uint32_t *powers, int numTrkPts)
+{
+    if (store->numTrkPts != numTrkPts) {
+        return false;
+    }
+
+    for (int n = 0; n < numTrkPts; n++) {
+        const TrkPt *tp = &store->trkPts[n];
+        if (((tp->timestamp - store->trkPts[0].timestamp) != times[n]) || (tp->power != powers[n])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void testResample(void)
+{
+    TrkPtStore *store = buildStore(irregTimes, NUM_IRREG_TIMES);
+    TrkPtStore *out;
+
+    for (int n = 0; n < NUM_IRREG_TIMES; n++) {
+        store->trkPts[n].power = irregPowers[n];
+    }
+
+    // Linear interpolation, 1 s apart; no trackpoints are
+    // made up within the pause.
+    {
+        static const time_t times[] = { 0, 1, 2, 3, 4, 30, 31 };
+        static const uint32_t powers[] = { 100, 200, 300, 400, 500, 600, 700 };
+        out = trkPtStoreResample(store, trkPtLinear, 1);
+        testCheck(chkResample(out, times, powers, 7));
+        testCheck((out->trkPts[5].elapsed == 30) && (out->trkPts[5].movingTime == 5));
+        trkPtStoreRelease(out);
+    }
+
+    // Sample and hold
+    {
+        static const time_t times[] = { 0, 1, 2, 3, 4, 30, 31 };
+        static const uint32_t powers[] = { 100, 100, 100, 400, 500, 600, 700 };
+        out = trkPtStoreResample(store, trkPtPrevious, 1);
+        testCheck(chkResample(out, times, powers, 7));
+        trkPtStoreRelease(out);
+    }
+
+    // Linear interpolation, 2 s apart: the sample grid
+    // resumes right at the end of the pause.
+    {
+        static const time_t times[] = { 0, 2, 4, 30 };
+        static const uint32_t powers[] = { 100, 300, 500, 600 };
+        out = trkPtStoreResample(store, trkPtLinear, 2);
+        testCheck(chkResample(out, times, powers, 4));
+        trkPtStoreRelease(out);
+    }
+
+    trkPtStoreRelease(store);
+
+    // Nothing to resample
+    store = trkPtStoreNew();
+    out = trkPtStoreResample(store, trkPtLinear, 1);
+    testCheck((out != NULL) && (out->numTrkPts == 0));
+    trkPtStoreRelease(out);
+    trkPtStoreRelease(store);
+}
+
+int main(int argc, char *argv[])
+{
+    testStoreTimes();
+    testResample();
+    testSeek();
+    testUpdate();
+
+    return testReport("trkpt");
+}
@@ -0,0 +1,180 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Unit tests of the structured workouts: the parsing of the
+// workout files into the step table, and the lookup of the
+// step at the elapsed time of a rider.
+
+#include "test.h"
+#include "wko.c"
+
+static const char zwoWorkout[] =
+    "<workout_file>\n"
+    "  <workout>\n"
+    "    <Warmup Duration=\"600\" PowerLow=\"0.25\" PowerHigh=\"0.75\"/>\n"
+    "    <SteadyState Duration=\"300\" Power=\"0.88\" Cadence=\"90\"/>\n"
+    "    <SteadyState Duration=\"0\" Power=\"1.5\"/>\n"
+    "    <IntervalsT Repeat=\"3\" OnDuration=\"30\" OffDuration=\"90\" OnPower=\"1.2\" OffPower=\"0.5\"/>\n"
+    "    <Cooldown Duration=\"300\" PowerLow=\"0.75\" PowerHigh=\"0.25\"/>\n"
+    "  </workout>\n"
+    "</workout_file>\n";
+
+static const char mrcWorkout[] =
+    "[COURSE HEADER]\n"
+    "MINUTES PERCENT\n"
+    "[END COURSE HEADER]\n"
+    "[COURSE DATA]\n"
+    "0.00    50\n"
+    "5.00    50\n"
+    "5.00    90\n"
+    "10.00   90\n"
+    "[END COURSE DATA]\n";
+
+// Parse a workout from a string, as wkoLoad() does
+static Workout *parseWorkout(const char *text, bool zwo)
+{
+    Workout *wko = calloc(1, sizeof (Workout));
+    char *buf = strdup(text);
+    int rc = zwo ? zwoParse(wko, buf, WKO_DEF_FTP) : ergParse(wko, buf, WKO_DEF_FTP);
+
+    free(buf);
+    if (rc != 0) {
+        wkoFree(wko);
+        return NULL;
+    }
+
+    return wko;
+}
+
+// Reference lookup: a linear scan of the step table
+static int findStep(const Workout *wko, uint32_t elapsed)
+{
+    for (int n = 0; n < wko->numSteps; n++) {
+        const WkoStep *step = &wko->steps[n];
+        if ((elapsed >= step->start) && (elapsed < (step->start + step->duration))) {
+            return n;
+        }
+    }
+
+    return -1;
+}
+
+static void testZwoParse(void)
+{
+    Workout *wko = parseWorkout(zwoWorkout, true);
+
+    testCheck(wko != NULL);
+    if (wko == NULL) {
+        return;
+    }
+
+    // Warmup, steady state, 3 x (on, off), cooldown; the
+    // zero-length step is left out.
+    testCheck(wko->numSteps == 9);
+    testCheck(wko->duration == (600 + 300 + (3 * (30 + 90)) + 300));
+
+    testCheck((wko->steps[0].powerLow == 50) && (wko->steps[0].powerHigh == 150));
+    testCheck((wko->steps[1].start == 600) && (wko->steps[1].powerLow == 176) && (wko->steps[1].cadence == 90));
+    testCheck((wko->steps[2].duration == 30) && (wko->steps[2].powerLow == 240));
+    testCheck((wko->steps[3].duration == 90) && (wko->steps[3].powerLow == 100));
+    testCheck((wko->steps[8].powerLow == 150) && (wko->steps[8].powerHigh == 50));
+
+    wkoFree(wko);
+}
+
+static void testZwoRepeatCap(void)
+{
+    char text[256];
+
+    snprintf(text, sizeof (text),
+             "<workout><IntervalsT Repeat=\"%d\" OnDuration=\"1\" OffDuration=\"1\" OnPower=\"1\" OffPower=\"0.5\"/></workout>",
+             (WKO_MAX_REPEAT + 1));
+    testCheck(parseWorkout(text, true) == NULL);
+}
+
+static void testMrcParse(void)
+{
+    Workout *wko = parseWorkout(mrcWorkout, false);
+
+    testCheck(wko != NULL);
+    if (wko == NULL) {
+        return;
+    }
+
+    // The two points at 5 minutes are a step change
+    testCheck(wko->numSteps == 2);
+    testCheck(wko->duration == 600);
+    testCheck((wko->steps[0].powerLow == 100) && (wko->steps[0].powerHigh == 100));
+    testCheck((wko->steps[1].start == 300) && (wko->steps[1].powerLow == 180));
+
+    wkoFree(wko);
+}
+
+static void testLookup(void)
+{
+    Workout *wko = parseWorkout(zwoWorkout, true);
+    WkoCursor cur = { 0 };
+    const WkoStep *step;
+    bool match = true;
+
+    if (wko == NULL) {
+        testCheck(wko != NULL);
+        return;
+    }
+
+    // Ride the whole workout, one second at a time
+    for (cur.elapsed = 0; cur.elapsed < wko->duration; cur.elapsed++) {
+        step = wkoLookup(wko, &cur);
+        match &= ((step != NULL) && ((step - wko->steps) == findStep(wko, cur.elapsed)));
+    }
+    testCheck(match);
+
+    // The workout is over
+    testCheck(wkoLookup(wko, &cur) == NULL);
+
+    // Seek back and forth
+    match = true;
+    for (uint32_t elapsed = 0; elapsed < wko->duration; elapsed += 97) {
+        cur.elapsed = wko->duration - 1 - elapsed;
+        step = wkoLookup(wko, &cur);
+        match &= ((step != NULL) && ((step - wko->steps) == findStep(wko, cur.elapsed)));
+        cur.elapsed = elapsed;
+        step = wkoLookup(wko, &cur);
+        match &= ((step != NULL) && ((step - wko->steps) == findStep(wko, cur.elapsed)));
+    }
+    testCheck(match);
+
+    // The power target ramps along the warmup
+    cur.elapsed = 300;
+    step = wkoLookup(wko, &cur);
+    testCheck(wkoPower(step, &cur) == 100);
+
+    wkoFree(wko);
+}
+
+int main(int argc, char *argv[])
+{
+    testZwoParse();
+    testZwoRepeatCap();
+    testMrcParse();
+    testLookup();
+
+    return testReport("wko");
+}
@@ -0,0 +1,224 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Stand-in producer of the live-metrics feed of the indBikeSim
+// app (see livefeed.h). It creates the feed, and then publishes
+// the metrics of each bike at the specified rate, either from a
+// generated workload (a slow power wave, different for each
+// bike) or from the lines read from stdin:
+//
+//   <bike> <power> <cadence> <heart-rate> [<speed>]
+//
+// In stdin mode the last metrics of each bike are published
+// again at the specified rate, so they don't go stale.
+
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "livefeed.h"
+#include "mlog.h"
+
+static const char *help =
+        "SYNTAX:\n"
+        "    liveFeedGen <name> [OPTIONS]\n"
+        "\n"
+        "OPTIONS:\n"
+        "    --bikes <num>\n"
+        "        Number of channels of the feed (one per bike). Default is 1.\n"
+        "    --power <watts>\n"
+        "        Mean power of the generated workload. Default is 180 W.\n"
+        "    --rate <hz>\n"
+        "        Number of records published per second on each channel.\n"
+        "        Default is 4.\n"
+        "    --ring <num>\n"
+        "        Number of records of the ring of each channel (power of 2).\n"
+        "        Default is 64.\n"
+        "    --stdin\n"
+        "        Read the metrics from stdin, instead of generating them.\n";
+
+static volatile sig_atomic_t done;
+
+static void sigHandler(int signum)
+{
+    done = 1;
+}
+
+// Generate the metrics of a bike: a 60-sec power wave around
+// the mean power, with the cadence and the heart rate
+// following the power.
+static void genMetrics(uint32_t bike, double t, uint32_t meanPower, LiveMetrics *metrics)
+{
+    double power = meanPower + (10.0 * bike) + (0.3 * meanPower * sin((2.0 * M_PI * t) / 60.0));
+
+    metrics->power = (uint16_t) power;
+    metrics->cadence = (uint16_t) (70.0 + (power / 10.0));
+    metrics->heartRate = (uint16_t) (90.0 + (power / 4.0));
+    metrics->speedValid = false;
+    metrics->speed = 0.0;
+}
+
+// Parse a line of metrics read from stdin
+static int parseMetrics(const char *line, uint32_t numBikes, uint32_t *bike, LiveMetrics *metrics)
+{
+    unsigned int b, power, cadence, heartRate;
+    double speed;
+    int n;
+
+    if ((n = sscanf(line, "%u %u %u %u %lf", &b, &power, &cadence, &heartRate, &speed)) < 4) {
+        return -1;
+    }
+    if ((b >= numBikes) || (power > UINT16_MAX) || (cadence > UINT16_MAX) || (heartRate > UINT16_MAX)) {
+        return -1;
+    }
+
+    *bike = b;
+    metrics->power = power;
+    metrics->cadence = cadence;
+    metrics->heartRate = heartRate;
+    metrics->speedValid = (n == 5);
+    metrics->speed = (n == 5) ? (speed / 3.6) : 0.0;    // convert km/h to m/s
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = NULL;
+    uint32_t numBikes = 1;
+    uint32_t meanPower = 180;
+    uint32_t rate = 4;
+    uint32_t numRecs = 64;
+    bool useStdin = false;
+    LiveMetrics *lastMetrics;
+    bool *published;
+    LiveFeed *feed;
+    struct timespec start, now;
+
+    for (int n = 1; n < argc; n++) {
+        const char *arg = argv[n];
+        const char *val = argv[n+1];
+
+        if (strcmp(arg, "--help") == 0) {
+            fprintf(stdout, "%s\n", help);
+            return 0;
+        } else if (strcmp(arg, "--stdin") == 0) {
+            useStdin = true;
+            continue;
+        } else if (arg[0] != '-') {
+            name = arg;
+            continue;
+        } else if (val == NULL) {
+            fprintf(stderr, "Missing value: %s\n", arg);
+            return -1;
+        } else if (strcmp(arg, "--bikes") == 0) {
+            numBikes = strtoul(val, NULL, 0);
+        } else if (strcmp(arg, "--power") == 0) {
+            meanPower = strtoul(val, NULL, 0);
+        } else if (strcmp(arg, "--rate") == 0) {
+            rate = strtoul(val, NULL, 0);
+        } else if (strcmp(arg, "--ring") == 0) {
+            numRecs = strtoul(val, NULL, 0);
+        } else {
+            fprintf(stderr, "Invalid argument: %s\n", arg);
+            return -1;
+        }
+        n++;
+    }
+
+    if ((name == NULL) || (rate == 0) || (rate > 1000)) {
+        fprintf(stdout, "%s\n", help);
+        return -1;
+    }
+
+    if ((feed = liveFeedCreate(name, numBikes, numRecs)) == NULL) {
+        return -1;
+    }
+
+    lastMetrics = calloc(numBikes, sizeof (LiveMetrics));
+    published = calloc(numBikes, sizeof (bool));
+    if ((lastMetrics == NULL) || (published == NULL)) {
+        liveFeedFree(feed);
+        return -1;
+    }
+
+    // The lines are read one at a time, as soon as they
+    // arrive, so don't let stdio buffer them.
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    signal(SIGINT, sigHandler);
+    signal(SIGTERM, sigHandler);
+
+    fprintf(stderr, "Publishing live feed %s: bikes=%u rate=%u [Hz] ring=%u\n", name, numBikes, rate, numRecs);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!done) {
+        if (useStdin) {
+            struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+            char line[128];
+
+            if ((poll(&pfd, 1, (1000 / rate)) == 1) && (pfd.revents & (POLLIN | POLLHUP))) {
+                LiveMetrics metrics;
+                uint32_t bike;
+                if (fgets(line, sizeof (line), stdin) == NULL) {
+                    // End of input
+                    break;
+                }
+                if (parseMetrics(line, numBikes, &bike, &metrics) != 0) {
+                    fprintf(stderr, "Invalid metrics: %s", line);
+                    continue;
+                }
+                lastMetrics[bike] = metrics;
+                liveFeedPublish(feed, bike, &lastMetrics[bike]);
+                published[bike] = true;
+                continue;
+            }
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double t = (now.tv_sec - start.tv_sec) + ((now.tv_nsec - start.tv_nsec) / 1e9);
+            for (uint32_t b = 0; b < numBikes; b++) {
+                genMetrics(b, t, meanPower, &lastMetrics[b]);
+                published[b] = true;
+            }
+            usleep(1000000 / rate);
+        }
+
+        for (uint32_t b = 0; b < numBikes; b++) {
+            if (published[b]) {
+                liveFeedPublish(feed, b, &lastMetrics[b]);
+            }
+        }
+    }
+
+    free(published);
+    free(lastMetrics);
+    liveFeedFree(feed);
+    if (strchr(name + 1, '/') == NULL) {
+        shm_unlink(name);
+    }
+
+    return 0;
+}
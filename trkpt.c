@@ -17,25 +17,423 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "defs.h"
+#include "mlog.h"
 #include "trkpt.h"
 
 #ifdef CONFIG_FIT_ACTIVITY_FILE
 
-TrkPt *trkPtNew(int index)
+#define TRKPT_STORE_MAGIC       "IBSTRKPT"
+#define TRKPT_STORE_VERSION     3
+
+// Header of the trackpoint cache file. It is followed by
+// the array of trackpoints, in the host's native format.
+typedef struct TrkPtStoreHdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t trkPtSize;     // sizeof (TrkPt)
+    uint32_t numTrkPts;
+    uint32_t reserved;
+    TrkPtSrcKey key;        // source of the trackpoints
+} TrkPtStoreHdr;
+
+TrkPtStore *trkPtStoreNew(void)
 {
-    TrkPt *tp = calloc(1, sizeof (TrkPt));
+    TrkPtStore *store = calloc(1, sizeof (TrkPtStore));
 
-    if (tp != NULL)
-        tp->index = index;
+    if (store != NULL) {
+        store->refCnt = 1;
+    }
 
-    return tp;
+    return store;
 }
 
-void trkPtFree(TrkPt *tp)
+int trkPtStoreAppend(TrkPtStore *store, const TrkPt *tp)
 {
-    free(tp);
+    if (store->numTrkPts == store->maxTrkPts) {
+        int maxTrkPts = (store->maxTrkPts != 0) ? (store->maxTrkPts * 2) : 4096;
+        TrkPt *trkPts;
+
+        if ((trkPts = realloc(store->trkPts, maxTrkPts * sizeof (TrkPt))) == NULL) {
+            mlog(error, "Failed to grow trackpoint store!");
+            return -1;
+        }
+        store->trkPts = trkPts;
+        store->maxTrkPts = maxTrkPts;
+    }
+
+    store->trkPts[store->numTrkPts] = *tp;
+    store->trkPts[store->numTrkPts].index = store->numTrkPts;
+
+    // Figure out the elapsed and moving times, which are
+    // used to seek the trackpoints in time order. A pause
+    // only counts as 1 second of moving time.
+    if (store->numTrkPts != 0) {
+        const TrkPt *prev = &store->trkPts[store->numTrkPts - 1];
+        time_t gap = tp->timestamp - prev->timestamp;
+
+        if (gap < 0) {
+            gap = 0;
+        }
+        store->trkPts[store->numTrkPts].elapsed = prev->elapsed + gap;
+        store->trkPts[store->numTrkPts].movingTime = prev->movingTime + ((gap > TRKPT_PAUSE_GAP) ? 1 : gap);
+    } else {
+        store->trkPts[0].elapsed = store->trkPts[0].movingTime = 0;
+    }
+
+    store->numTrkPts++;
+
+    return 0;
+}
+
+int trkPtSrcKeyInit(TrkPtSrcKey *key, const char *srcName, TrkPtResample method, uint32_t interval)
+{
+    char *path;
+    struct stat st;
+
+    if (stat(srcName, &st) != 0) {
+        mlog(error, "Can't stat activity file %s!", srcName);
+        return -1;
+    }
+
+    memset(key, 0, sizeof (*key));
+
+    // FNV-1a hash of the path
+    path = realpath(srcName, NULL);
+    key->pathHash = 0xcbf29ce484222325ULL;
+    for (const char *p = (path != NULL) ? path : srcName; *p != '\0'; p++) {
+        key->pathHash = (key->pathHash ^ (uint8_t) *p) * 0x100000001b3ULL;
+    }
+    free(path);
+
+    key->size = st.st_size;
+    key->mtimeSec = st.st_mtim.tv_sec;
+    key->mtimeNsec = st.st_mtim.tv_nsec;
+    key->resample = method;
+    key->interval = (method != trkPtNoResample) ? interval : 0;
+
+    return 0;
+}
+
+// Write the trackpoints to a cache file that can later be
+// mapped by trkPtStoreMap(). The file is written under a
+// temporary name and then renamed, so that other processes
+// never get to map a partially written file.
+int trkPtStoreSave(const TrkPtStore *store, const char *fileName, const TrkPtSrcKey *key)
+{
+    TrkPtStoreHdr hdr = {{0}};
+    char tmpName[PATH_MAX];
+    FILE *fp;
+
+    memcpy(hdr.magic, TRKPT_STORE_MAGIC, sizeof (hdr.magic));
+    hdr.version = TRKPT_STORE_VERSION;
+    hdr.trkPtSize = sizeof (TrkPt);
+    hdr.numTrkPts = store->numTrkPts;
+    if (key != NULL) {
+        hdr.key = *key;
+    }
+
+    if (snprintf(tmpName, sizeof (tmpName), "%s.%d", fileName, getpid()) >= sizeof (tmpName)) {
+        mlog(error, "Trackpoint cache file name %s is too long!", fileName);
+        return -1;
+    }
+    if ((fp = fopen(tmpName, "w")) == NULL) {
+        mlog(error, "Can't create trackpoint cache file %s! (%s)", tmpName, strerror(errno));
+        return -1;
+    }
+
+    if ((fwrite(&hdr, sizeof (hdr), 1, fp) != 1) ||
+        (fwrite(store->trkPts, sizeof (TrkPt), store->numTrkPts, fp) != store->numTrkPts)) {
+        mlog(error, "Failed to write trackpoint cache file %s! (%s)", tmpName, strerror(errno));
+        fclose(fp);
+        unlink(tmpName);
+        return -1;
+    }
+
+    if ((fclose(fp) != 0) || (rename(tmpName, fileName) != 0)) {
+        mlog(error, "Failed to save trackpoint cache file %s! (%s)", fileName, strerror(errno));
+        unlink(tmpName);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Map the trackpoints from a cache file created by
+// trkPtStoreSave(). The mapping is read-only and shared,
+// so all the processes that map the same file use a
+// single copy of the trackpoints in memory. Returns NULL
+// if the file doesn't exist, is not valid, or is stale.
+TrkPtStore *trkPtStoreMap(const char *fileName, const TrkPtSrcKey *key)
+{
+    TrkPtStore *store;
+    const TrkPtStoreHdr *hdr;
+    struct stat st;
+    void *mapAddr;
+    int fd;
+
+    if ((fd = open(fileName, O_RDONLY)) < 0) {
+        return NULL;
+    }
+
+    if ((fstat(fd, &st) != 0) || (st.st_size < sizeof (TrkPtStoreHdr))) {
+        close(fd);
+        return NULL;
+    }
+
+    mapAddr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapAddr == MAP_FAILED) {
+        mlog(error, "Failed to map trackpoint cache file %s! (%s)", fileName, strerror(errno));
+        return NULL;
+    }
+
+    hdr = mapAddr;
+    if ((memcmp(hdr->magic, TRKPT_STORE_MAGIC, sizeof (hdr->magic)) != 0) ||
+        (hdr->version != TRKPT_STORE_VERSION) ||
+        (hdr->trkPtSize != sizeof (TrkPt)) ||
+        (st.st_size != (sizeof (TrkPtStoreHdr) + ((size_t) hdr->numTrkPts * sizeof (TrkPt))))) {
+        mlog(error, "Invalid trackpoint cache file %s!", fileName);
+        munmap(mapAddr, st.st_size);
+        return NULL;
+    }
+
+    if ((key != NULL) && (memcmp(&hdr->key, key, sizeof (*key)) != 0)) {
+        mlog(info, "Trackpoint cache file %s is stale.", fileName);
+        munmap(mapAddr, st.st_size);
+        return NULL;
+    }
+
+    if ((store = trkPtStoreNew()) == NULL) {
+        munmap(mapAddr, st.st_size);
+        return NULL;
+    }
+
+    store->trkPts = (TrkPt *) (hdr + 1);
+    store->numTrkPts = store->maxTrkPts = hdr->numTrkPts;
+    store->mapAddr = mapAddr;
+    store->mapLen = st.st_size;
+
+    return store;
+}
+
+static uint32_t lerp(uint32_t a, uint32_t b, double frac)
+{
+    return (uint32_t) (a + ((double) b - a) * frac + 0.5);
+}
+
+// Resample the trackpoints to a uniform rate of one every
+// 'interval' seconds. This takes care of the variable
+// intervals of "smart recording", and of the duplicated
+// timestamps, so the playback always sees uniformly spaced
+// trackpoints. The pauses are preserved: no trackpoints
+// are made up within them.
+TrkPtStore *trkPtStoreResample(const TrkPtStore *store, TrkPtResample method, uint32_t interval)
+{
+    const TrkPt *src = store->trkPts;
+    int numTrkPts = store->numTrkPts;
+    TrkPtStore *out;
+    time_t t;
+    int n = 0;
+
+    if ((out = trkPtStoreNew()) == NULL) {
+        return NULL;
+    }
+
+    if (numTrkPts == 0) {
+        return out;
+    }
+
+    for (t = src[0].timestamp; t <= src[numTrkPts - 1].timestamp; t += interval) {
+        TrkPt tp;
+
+        // Move on to the last trackpoint at, or before,
+        // the sample time.
+        while (((n + 1) < numTrkPts) && (src[n + 1].timestamp <= t)) {
+            n++;
+        }
+
+        if (((n + 1) < numTrkPts) && ((src[n + 1].timestamp - src[n].timestamp) > TRKPT_PAUSE_GAP) &&
+            (t > src[n].timestamp)) {
+            // Skip the pause, resuming on the sample
+            // grid right at the end of it.
+            t = src[n + 1].timestamp - interval;
+            continue;
+        }
+
+        tp = src[n];
+        tp.timestamp = t;
+
+        if ((method == trkPtLinear) && ((n + 1) < numTrkPts) && (t > src[n].timestamp)) {
+            const TrkPt *next = &src[n + 1];
+            double frac = (double) (t - src[n].timestamp) / (next->timestamp - src[n].timestamp);
+
+            tp.cadence = lerp(src[n].cadence, next->cadence, frac);
+            tp.heartRate = lerp(src[n].heartRate, next->heartRate, frac);
+            tp.power = lerp(src[n].power, next->power, frac);
+            tp.speed = src[n].speed + (next->speed - src[n].speed) * frac;
+        }
+
+        if (trkPtStoreAppend(out, &tp) != 0) {
+            trkPtStoreFree(out);
+            return NULL;
+        }
+    }
+
+    return out;
+}
+
+void trkPtStoreFree(TrkPtStore *store)
+{
+    if (store->mapAddr != NULL) {
+        munmap(store->mapAddr, store->mapLen);
+    } else {
+        free(store->trkPts);
+    }
+
+    free(store);
+}
+
+TrkPtStore *trkPtStoreHold(TrkPtStore *store)
+{
+    if (store != NULL) {
+        __atomic_add_fetch(&store->refCnt, 1, __ATOMIC_RELAXED);
+    }
+
+    return store;
+}
+
+void trkPtStoreRelease(TrkPtStore *store)
+{
+    if ((store != NULL) && (__atomic_sub_fetch(&store->refCnt, 1, __ATOMIC_ACQ_REL) == 0)) {
+        trkPtStoreFree(store);
+    }
+}
+
+// Time of the specified trackpoint, in the cursor's
+// time base.
+static double trkPtTime(const TrkPtCursor *cur, int index)
+{
+    const TrkPt *tp = &cur->store->trkPts[index];
+
+    return (cur->gapMode == trkPtKeepGaps) ? tp->elapsed : tp->movingTime;
+}
+
+// Find out whether the activity time is in a pause: i.e.
+// over 1 second past the current trackpoint, with the next
+// one still over TRKPT_PAUSE_GAP seconds away.
+static void trkPtCursorChkPause(TrkPtCursor *cur)
+{
+    int index = cur->index;
+
+    cur->paused = (cur->gapMode == trkPtKeepGaps) &&
+                  ((index + 1) < cur->store->numTrkPts) &&
+                  ((trkPtTime(cur, index + 1) - trkPtTime(cur, index)) > TRKPT_PAUSE_GAP) &&
+                  (cur->time >= (trkPtTime(cur, index) + 1.0));
+}
+
+void trkPtCursorSeek(TrkPtCursor *cur, double time)
+{
+    int lo = 0, hi;
+
+    cur->time = time;
+
+    if ((cur->store == NULL) || (cur->store->numTrkPts == 0)) {
+        return;
+    }
+
+    // Binary search: find the last trackpoint at, or
+    // before, the specified time.
+    hi = cur->store->numTrkPts - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+
+        if (trkPtTime(cur, mid) <= time) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    cur->index = lo;
+    trkPtCursorChkPause(cur);
+}
+
+// Position the cursor 'offset' seconds into the activity.
+// The cursor then moves forward at 'speed' times the rate
+// of the app's clock: e.g. with a speed of 2, a 1-hour
+// activity is played back in 30 minutes.
+void trkPtCursorInit(TrkPtCursor *cur, const TrkPtStore *store, TrkPtGapMode gapMode, uint32_t offset, double speed)
+{
+    cur->store = store;
+    cur->gapMode = gapMode;
+    cur->speed = speed;
+    cur->index = 0;
+    cur->paused = false;
+    trkPtCursorResync(cur);
+    trkPtCursorSeek(cur, offset);
+}
+
+void trkPtCursorResync(TrkPtCursor *cur)
+{
+    cur->lastUpdate.tv_sec = cur->lastUpdate.tv_usec = 0;
+}
+
+void trkPtCursorUpdate(TrkPtCursor *cur, const struct timeval *now)
+{
+    double dt = 1.0;
+    int n;
+
+    if (cur->lastUpdate.tv_sec != 0) {
+        // A late update catches up with the time
+        // elapsed since the previous one.
+        struct timeval deltaT;
+
+        tvSub(&deltaT, now, &cur->lastUpdate);
+        dt = deltaT.tv_sec + (deltaT.tv_usec / 1000000.0);
+    }
+    cur->lastUpdate = *now;
+
+    if ((cur->store == NULL) || (cur->store->numTrkPts == 0)) {
+        return;
+    }
+
+    cur->time += dt * cur->speed;
+
+    // Normally the cursor moves on by one trackpoint or
+    // so; after a long delay, or at a high playback speed,
+    // it seeks the trackpoint instead.
+    for (n = 0; (n < 8) && ((cur->index + 1) < cur->store->numTrkPts); n++) {
+        if (trkPtTime(cur, cur->index + 1) > cur->time) {
+            trkPtCursorChkPause(cur);
+            return;
+        }
+        cur->index++;
+    }
+
+    trkPtCursorSeek(cur, cur->time);
+}
+
+// Get the current trackpoint, or NULL if the cursor
+// has reached the end of the activity.
+const TrkPt *trkPtCursorGet(const TrkPtCursor *cur)
+{
+    if ((cur->store == NULL) || (cur->store->numTrkPts == 0) ||
+        (cur->time >= (trkPtTime(cur, cur->store->numTrkPts - 1) + 1.0))) {
+        return NULL;
+    }
+
+    return &cur->store->trkPts[cur->index];
 }
 
 #endif  // CONFIG_FIT_ACTIVITY_FILE
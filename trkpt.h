@@ -19,22 +19,28 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <sys/queue.h>
+#include <sys/time.h>
 #include <time.h>
 
 #include "config.h"
 
 #ifdef CONFIG_FIT_ACTIVITY_FILE
 
+// A gap between two trackpoints longer than this is
+// considered a pause of the activity [s]
+#define TRKPT_PAUSE_GAP     10
+
 // Activity Track Point
 typedef struct TrkPt {
-    TAILQ_ENTRY(TrkPt) tqEntry;   // node in the trkPtList
-
     int index;          // TrkPt index (0..N-1)
 
     // Timestamp from FIT file
     time_t timestamp;   // in seconds since the Epoch
+    uint32_t elapsed;   // time since the first trackpoint [s]
+    uint32_t movingTime;    // elapsed time, minus the pauses [s]
 
     // Activity metrics from FIT file
     uint32_t cadence;   // cadence (in RPM)
@@ -43,10 +49,97 @@ typedef struct TrkPt {
     double speed;       // speed (in m/s)
 } TrkPt;
 
+// Store of the trackpoints of an activity. Once loaded,
+// the store is read-only, so it can be shared by any
+// number of bikes and sessions, each one playing it
+// back with its own cursor. The trackpoints are kept
+// in a flat array, either in the heap or mapped from
+// a cache file. The store is reference counted, so the
+// activity can be swapped at runtime while some of the
+// riders are still playing back the old one.
+typedef struct TrkPtStore {
+    int refCnt;         // number of holders of the store
+    TrkPt *trkPts;      // array of trackpoints
+    int numTrkPts;      // number of trackpoints in the array
+    int maxTrkPts;      // capacity of the array (heap store)
+    void *mapAddr;      // base address of the mapping (mapped store)
+    size_t mapLen;      // length of the mapping (mapped store)
+} TrkPtStore;
+
+// How the trackpoints are resampled at load time
+typedef enum TrkPtResample {
+    trkPtNoResample = 0,    // use the trackpoints as recorded
+    trkPtLinear = 1,        // linear interpolation
+    trkPtPrevious = 2,      // previous value (sample and hold)
+} TrkPtResample;
+
+// Identity of the source of the trackpoints in a cache
+// file. The cache is stale, and must be rebuilt, if any
+// of these don't match.
+typedef struct TrkPtSrcKey {
+    uint64_t pathHash;      // hash of the (real) path of the FIT file
+    uint64_t size;          // size of the FIT file
+    int64_t mtimeSec;       // modification time of the FIT file
+    int64_t mtimeNsec;
+    uint32_t resample;      // TrkPtResample
+    uint32_t interval;      // resampling interval [s]
+} TrkPtSrcKey;
+
+// How the pauses of the activity are played back
+typedef enum TrkPtGapMode {
+    trkPtSkipGaps = 0,  // skip the pauses (moving time)
+    trkPtKeepGaps = 1,  // play the pauses, with zero power, cadence and speed
+} TrkPtGapMode;
+
+// Playback cursor into a trackpoint store. The cursor is
+// driven by the elapsed time, and it is positioned at the
+// last trackpoint at, or before, the current activity time.
+typedef struct TrkPtCursor {
+    const TrkPtStore *store;
+    TrkPtGapMode gapMode;
+    double time;        // current activity time [s]
+    double speed;       // playback speed factor
+    int index;          // index of the current trackpoint
+    bool paused;        // the activity time is in a pause
+    struct timeval lastUpdate;  // time of the last update
+} TrkPtCursor;
+
 __BEGIN_DECLS
 
-extern TrkPt *trkPtNew(int index);
-extern void trkPtFree(TrkPt *tp);
+extern TrkPtStore *trkPtStoreNew(void);
+extern int trkPtStoreAppend(TrkPtStore *store, const TrkPt *tp);
+
+// Figure out the key of the trackpoints loaded from the
+// specified FIT file.
+extern int trkPtSrcKeyInit(TrkPtSrcKey *key, const char *srcName, TrkPtResample method, uint32_t interval);
+
+// Save the trackpoints to a cache file, and map them back
+// from it. If the key is not NULL, the file is only mapped
+// if it was created with the same key.
+extern int trkPtStoreSave(const TrkPtStore *store, const char *fileName, const TrkPtSrcKey *key);
+extern TrkPtStore *trkPtStoreMap(const char *fileName, const TrkPtSrcKey *key);
+extern TrkPtStore *trkPtStoreResample(const TrkPtStore *store, TrkPtResample method, uint32_t interval);
+extern void trkPtStoreFree(TrkPtStore *store);
+
+// Take/drop a reference to the store. The last release
+// frees it.
+extern TrkPtStore *trkPtStoreHold(TrkPtStore *store);
+extern void trkPtStoreRelease(TrkPtStore *store);
+
+extern void trkPtCursorInit(TrkPtCursor *cur, const TrkPtStore *store, TrkPtGapMode gapMode, uint32_t offset, double speed);
+
+// Move the cursor to the specified activity time
+extern void trkPtCursorSeek(TrkPtCursor *cur, double time);
+
+// Advance the activity time by the (playback speed scaled)
+// time elapsed since the last update.
+extern void trkPtCursorUpdate(TrkPtCursor *cur, const struct timeval *now);
+
+// Forget the time of the last update, so the next update
+// doesn't catch up with the time the playback was idle.
+extern void trkPtCursorResync(TrkPtCursor *cur);
+
+extern const TrkPt *trkPtCursorGet(const TrkPtCursor *cur);
 
 __END_DECLS
 
@@ -187,7 +187,7 @@ bool baseUuid128Eq(const Uuid128 *uuid1, const Uuid128 *uuid2)
 
 const char *fmtUuid128Name(const Uuid128 *uuid)
 {
-    static char strBuf[64];
+    static __thread char strBuf[64];
     FmtBuf fmtBuf;
 
     fmtBufInit(&fmtBuf, strBuf, sizeof (strBuf));
@@ -202,7 +202,7 @@ const char *fmtUuid128Name(const Uuid128 *uuid)
 // Format a 128-bit UUID
 const char *fmtUuid128(const Uuid128 *uuid)
 {
-    static char fmtBuf[38];
+    static __thread char fmtBuf[38];
     snprintf(fmtBuf, sizeof (fmtBuf), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
             uuid->data[0], uuid->data[1], uuid->data[2], uuid->data[3],
             uuid->data[4], uuid->data[5],
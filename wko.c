@@ -0,0 +1,299 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mlog.h"
+#include "wko.h"
+
+static int wkoAddStep(Workout *wko, double duration, double powerLow, double powerHigh, double cadence, bool freeRide)
+{
+    WkoStep *step;
+
+    if (duration < 0.5) {
+        // Ignore zero-length steps
+        return 0;
+    }
+
+    if (wko->numSteps == wko->maxSteps) {
+        int maxSteps = (wko->maxSteps != 0) ? (wko->maxSteps * 2) : 64;
+        WkoStep *steps;
+
+        if ((steps = realloc(wko->steps, maxSteps * sizeof (WkoStep))) == NULL) {
+            mlog(error, "Failed to grow workout step table!");
+            return -1;
+        }
+        wko->steps = steps;
+        wko->maxSteps = maxSteps;
+    }
+
+    step = &wko->steps[wko->numSteps++];
+    step->start = wko->duration;
+    step->duration = (uint32_t) (duration + 0.5);
+    step->powerLow = (uint16_t) (powerLow + 0.5);
+    step->powerHigh = (uint16_t) (powerHigh + 0.5);
+    step->cadence = (uint16_t) (cadence + 0.5);
+    step->freeRide = freeRide;
+
+    wko->duration += step->duration;
+
+    return 0;
+}
+
+// Get the value of the specified attribute of a ZWO tag
+static bool zwoAttr(const char *tag, const char *name, double *val)
+{
+    size_t len = strlen(name);
+    const char *p;
+
+    for (p = tag; (p = strstr(p, name)) != NULL; p += len) {
+        if (isspace((unsigned char) p[-1]) && (p[len] == '=') &&
+            ((p[len+1] == '"') || (p[len+1] == '\''))) {
+            return (sscanf(&p[len+2], "%lf", val) == 1);
+        }
+    }
+
+    return false;
+}
+
+// Parse a Zwift workout file. Only the elements of the
+// workout itself are of interest; e.g.
+//
+//   <Warmup Duration="600" PowerLow="0.25" PowerHigh="0.75"/>
+//   <SteadyState Duration="300" Power="0.88" Cadence="90"/>
+//   <IntervalsT Repeat="5" OnDuration="30" OffDuration="90" OnPower="1.2" OffPower="0.5"/>
+//   <Cooldown Duration="300" PowerLow="0.75" PowerHigh="0.25"/>
+//
+static int zwoParse(Workout *wko, char *buf, uint32_t ftp)
+{
+    char *tag;
+
+    for (tag = buf; (tag = strchr(tag, '<')) != NULL; ) {
+        char name[32];
+        char *end;
+        double dur = 0, lo = 0, hi = 0, pwr = 0, cad = 0;
+        int rc = 0;
+
+        if ((end = strchr(tag, '>')) == NULL) {
+            break;
+        }
+        *end = '\0';
+
+        if (sscanf(tag, "<%31[A-Za-z]", name) == 1) {
+            zwoAttr(tag, "Duration", &dur);
+            zwoAttr(tag, "Cadence", &cad);
+
+            if ((strcmp(name, "Warmup") == 0) ||
+                (strcmp(name, "Cooldown") == 0) ||
+                (strcmp(name, "Ramp") == 0)) {
+                zwoAttr(tag, "PowerLow", &lo);
+                zwoAttr(tag, "PowerHigh", &hi);
+                rc = wkoAddStep(wko, dur, (lo * ftp), (hi * ftp), cad, false);
+            } else if (strcmp(name, "SteadyState") == 0) {
+                if (!zwoAttr(tag, "Power", &pwr) &&
+                    zwoAttr(tag, "PowerLow", &lo) && zwoAttr(tag, "PowerHigh", &hi)) {
+                    pwr = (lo + hi) / 2;
+                }
+                rc = wkoAddStep(wko, dur, (pwr * ftp), (pwr * ftp), cad, false);
+            } else if (strcmp(name, "IntervalsT") == 0) {
+                double repeat = 1, onDur = 0, offDur = 0, onPwr = 0, offPwr = 0, offCad = 0;
+                int n;
+
+                zwoAttr(tag, "Repeat", &repeat);
+                zwoAttr(tag, "OnDuration", &onDur);
+                zwoAttr(tag, "OffDuration", &offDur);
+                if (!zwoAttr(tag, "OnPower", &onPwr)) {
+                    zwoAttr(tag, "PowerOnHigh", &onPwr);
+                }
+                if (!zwoAttr(tag, "OffPower", &offPwr)) {
+                    zwoAttr(tag, "PowerOffLow", &offPwr);
+                }
+                zwoAttr(tag, "CadenceResting", &offCad);
+                if ((repeat < 0) || (repeat > WKO_MAX_REPEAT)) {
+                    mlog(error, "Invalid interval repeat count %g!", repeat);
+                    return -1;
+                }
+                for (n = 0; (n < (int) repeat) && (rc == 0); n++) {
+                    if ((rc = wkoAddStep(wko, onDur, (onPwr * ftp), (onPwr * ftp), cad, false)) == 0) {
+                        rc = wkoAddStep(wko, offDur, (offPwr * ftp), (offPwr * ftp), offCad, false);
+                    }
+                }
+            } else if ((strcmp(name, "FreeRide") == 0) ||
+                       (strcmp(name, "MaxEffort") == 0)) {
+                rc = wkoAddStep(wko, dur, 0, 0, cad, true);
+            }
+        }
+
+        if (rc != 0) {
+            return -1;
+        }
+
+        tag = end + 1;
+    }
+
+    return 0;
+}
+
+// Parse an ERG (absolute power) or MRC (percent of FTP)
+// workout file. The course data is a list of points of
+// a piecewise-linear power profile; e.g.
+//
+//   [COURSE HEADER]
+//   MINUTES PERCENT
+//   [END COURSE HEADER]
+//   [COURSE DATA]
+//   0.00    50
+//   5.00    50
+//   5.00    90
+//   [END COURSE DATA]
+//
+// where two points at the same time are a step change
+// of the power.
+static int ergParse(Workout *wko, char *buf, uint32_t ftp)
+{
+    char *line, *savePtr;
+    double scale = 1.0;
+    double prevTime = -1, prevPwr = 0;
+    bool courseData = false;
+
+    for (line = strtok_r(buf, "\r\n", &savePtr); line != NULL; line = strtok_r(NULL, "\r\n", &savePtr)) {
+        double time, pwr;
+
+        while (isspace((unsigned char) *line)) {
+            line++;
+        }
+
+        if (strncmp(line, "[COURSE DATA]", 13) == 0) {
+            courseData = true;
+        } else if (strncmp(line, "[END COURSE DATA]", 17) == 0) {
+            courseData = false;
+        } else if (!courseData && (strncmp(line, "MINUTES", 7) == 0)) {
+            // MINUTES WATTS or MINUTES PERCENT
+            scale = (strstr(line, "PERCENT") != NULL) ? (ftp / 100.0) : 1.0;
+        } else if (courseData && (sscanf(line, "%lf %lf", &time, &pwr) == 2)) {
+            if ((prevTime >= 0) && (time > prevTime)) {
+                if (wkoAddStep(wko, ((time - prevTime) * 60), (prevPwr * scale), (pwr * scale), 0, false) != 0) {
+                    return -1;
+                }
+            }
+            prevTime = time;
+            prevPwr = pwr;
+        }
+    }
+
+    return 0;
+}
+
+Workout *wkoLoad(const char *fileName, uint32_t ftp)
+{
+    Workout *wko;
+    FILE *fp;
+    char *buf;
+    long len;
+    int rc;
+
+    if ((fp = fopen(fileName, "r")) == NULL) {
+        mlog(error, "Can't open workout file %s! (%s)", fileName, strerror(errno));
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+
+    if ((len < 0) || ((buf = malloc(len + 1)) == NULL)) {
+        fclose(fp);
+        return NULL;
+    }
+    len = fread(buf, 1, len, fp);
+    buf[len] = '\0';
+    fclose(fp);
+
+    if ((wko = calloc(1, sizeof (Workout))) == NULL) {
+        free(buf);
+        return NULL;
+    }
+
+    if (strchr(buf, '<') != NULL) {
+        rc = zwoParse(wko, buf, ftp);
+    } else {
+        rc = ergParse(wko, buf, ftp);
+    }
+    free(buf);
+
+    if ((rc != 0) || (wko->numSteps == 0)) {
+        mlog(error, "Invalid workout file %s!", fileName);
+        wkoFree(wko);
+        return NULL;
+    }
+
+    mlog(info, "Loaded workout %s: %d steps, duration %u [s]", fileName, wko->numSteps, wko->duration);
+
+    return wko;
+}
+
+void wkoFree(Workout *wko)
+{
+    free(wko->steps);
+    free(wko);
+}
+
+const WkoStep *wkoLookup(const Workout *wko, WkoCursor *cur)
+{
+    const WkoStep *step;
+    int lo = 0, hi = wko->numSteps - 1;
+
+    if (cur->elapsed >= wko->duration) {
+        return NULL;
+    }
+
+    // Most lookups fall in the same step as the
+    // previous one.
+    step = &wko->steps[cur->step];
+    if ((cur->elapsed >= step->start) && (cur->elapsed < (step->start + step->duration))) {
+        return step;
+    }
+
+    // Binary search: find the last step that starts
+    // at, or before, the elapsed time.
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+
+        if (wko->steps[mid].start <= cur->elapsed) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    cur->step = lo;
+
+    return &wko->steps[lo];
+}
+
+uint16_t wkoPower(const WkoStep *step, const WkoCursor *cur)
+{
+    double frac = (double) (cur->elapsed - step->start) / step->duration;
+
+    return step->powerLow + (int) ((step->powerHigh - step->powerLow) * frac);
+}
@@ -0,0 +1,79 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defs.h"
+
+// Default Functional Threshold Power [W], used to convert
+// the relative power targets of the workouts to Watts.
+#define WKO_DEF_FTP     200
+
+// Max number of repeats of a set of intervals
+#define WKO_MAX_REPEAT  1000
+
+// Workout step: a constant or linearly ramping power target
+typedef struct WkoStep {
+    uint32_t start;         // start time [s]
+    uint32_t duration;      // duration [s]
+    uint16_t powerLow;      // power at the start of the step [W]
+    uint16_t powerHigh;     // power at the end of the step [W]
+    uint16_t cadence;       // cadence target [RPM] (0 if none)
+    bool freeRide;          // no power target
+} WkoStep;
+
+// Structured workout, compiled into a table of steps
+// sorted by start time. Once loaded, the workout is
+// read-only, so it can be shared by all the bikes and
+// sessions.
+typedef struct Workout {
+    WkoStep *steps;
+    int numSteps;
+    int maxSteps;
+    uint32_t duration;      // total duration [s]
+} Workout;
+
+// Per-rider position in the workout
+typedef struct WkoCursor {
+    uint32_t elapsed;       // elapsed time [s]
+    int step;               // index of the last step looked up
+} WkoCursor;
+
+__BEGIN_DECLS
+
+// Load a workout file: Zwift (.zwo), or ERG/MRC. The relative
+// power targets are converted to Watts using the specified
+// FTP value.
+extern Workout *wkoLoad(const char *fileName, uint32_t ftp);
+
+extern void wkoFree(Workout *wko);
+
+// Get the workout step at the cursor's elapsed time, or NULL
+// if the workout is over.
+extern const WkoStep *wkoLookup(const Workout *wko, WkoCursor *cur);
+
+// Get the power target of the step at the cursor's
+// elapsed time.
+extern uint16_t wkoPower(const WkoStep *step, const WkoCursor *cur);
+
+__END_DECLS
+
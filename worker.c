@@ -0,0 +1,190 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fleet.h"
+#include "mlog.h"
+#include "worker.h"
+
+static void workerProcLsnSockEvent(void *arg, int fd, short revents)
+{
+    WorkerLsnr *lsnr = arg;
+    Worker *worker = lsnr->worker;
+    Server *sess;
+
+    if ((sess = serverNewSession(lsnr->bike, &worker->evLoop, fd)) == NULL) {
+        // Reject the connection
+        int sd;
+        if ((sd = accept(fd, NULL, NULL)) >= 0) {
+            close(sd);
+        }
+        return;
+    }
+
+    sess->worker = worker;
+    TAILQ_INSERT_TAIL(&worker->sessList, sess, sessEnt);
+    worker->numSessions++;
+
+    if ((serverProcConnReq(sess, fd) != 0) || (sess->dirconSession.cliSockFd == 0)) {
+        workerEndSession(worker, sess);
+    }
+}
+
+void workerEndSession(Worker *worker, Server *sess)
+{
+    if (!sess->zombie) {
+        // We may be running in the context of one of the
+        // session's handlers, so the session object is
+        // freed at the end of the loop iteration.
+        sess->zombie = true;
+        evTimerStop(&worker->evLoop, &sess->clkTimer);
+        TAILQ_REMOVE(&worker->sessList, sess, sessEnt);
+        TAILQ_INSERT_TAIL(&worker->deadList, sess, sessEnt);
+        worker->numSessions--;
+    }
+}
+
+static void workerReapSessions(Worker *worker)
+{
+    Server *sess;
+
+    while ((sess = TAILQ_FIRST(&worker->deadList)) != NULL) {
+        TAILQ_REMOVE(&worker->deadList, sess, sessEnt);
+        serverFree(sess);
+    }
+}
+
+static void *workerThread(void *arg)
+{
+    Worker *worker = arg;
+    Server *sess;
+    sigset_t sigSet;
+
+    // Leave the signals to the main thread
+    sigemptyset(&sigSet);
+    sigaddset(&sigSet, SIGINT);
+    sigaddset(&sigSet, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+
+    while (!__atomic_load_n(&worker->exit, __ATOMIC_ACQUIRE)) {
+        if (evLoopRunOnce(&worker->evLoop) != 0) {
+            break;
+        }
+        workerReapSessions(worker);
+    }
+
+    // Drop all the sessions
+    while ((sess = TAILQ_FIRST(&worker->sessList)) != NULL) {
+        serverProcConnDrop(sess);
+        workerEndSession(worker, sess);
+    }
+    workerReapSessions(worker);
+
+    return NULL;
+}
+
+// Close the listening sockets of the worker, and release
+// its event loop.
+static void workerCleanup(Worker *worker)
+{
+    for (int n = 0; n < worker->numLsnrs; n++) {
+        close(worker->lsnrTbl[n].sockFd);
+    }
+    free(worker->lsnrTbl);
+    worker->lsnrTbl = NULL;
+    worker->numLsnrs = 0;
+
+    evLoopCleanup(&worker->evLoop);
+}
+
+int workerStart(Worker *worker, int workerId, Fleet *fleet)
+{
+    Server *bike;
+    int s;
+
+    worker->workerId = workerId;
+    worker->exit = false;
+    worker->numLsnrs = 0;
+    TAILQ_INIT(&worker->sessList);
+    TAILQ_INIT(&worker->deadList);
+    evLoopInit(&worker->evLoop);
+
+    if ((worker->lsnrTbl = calloc((fleet->numBikes * 2), sizeof (WorkerLsnr))) == NULL) {
+        mlog(error, "Failed to alloc listener table of worker #%d!", workerId);
+        workerCleanup(worker);
+        return -1;
+    }
+
+    TAILQ_FOREACH(bike, &fleet->bikeList, fleetEnt) {
+        static const int families[] = { AF_INET, AF_INET6 };
+
+        for (int f = 0; f < 2; f++) {
+            WorkerLsnr *lsnr = &worker->lsnrTbl[worker->numLsnrs];
+            int sd;
+
+            if ((sd = serverOpenLsnSock(bike, families[f], true)) < 0) {
+                if (families[f] == AF_INET6) {
+                    // IPv4 clients can still connect
+                    mlog(warning, "Bike #%d: DIRCON connections not accepted over IPv6 by worker #%d",
+                         bike->bikeId, workerId);
+                    continue;
+                }
+                mlog(error, "Failed to init listening socket of worker #%d!", workerId);
+                workerCleanup(worker);
+                return -1;
+            } else if (sd == 0) {
+                // Address family not served
+                continue;
+            }
+
+            lsnr->worker = worker;
+            lsnr->bike = bike;
+            lsnr->sockFd = sd;
+            worker->numLsnrs++;
+            if (evLoopAddFd(&worker->evLoop, lsnr->sockFd, POLLIN, workerProcLsnSockEvent, lsnr) != 0) {
+                workerCleanup(worker);
+                return -1;
+            }
+        }
+    }
+
+    if ((s = pthread_create(&worker->thread, NULL, workerThread, worker)) != 0) {
+        mlog(error, "Failed to start worker #%d! (%s)", workerId, strerror(s));
+        workerCleanup(worker);
+        return -1;
+    }
+
+    return 0;
+}
+
+void workerStop(Worker *worker)
+{
+    __atomic_store_n(&worker->exit, true, __ATOMIC_RELEASE);
+    pthread_join(worker->thread, NULL);
+
+    workerCleanup(worker);
+}
@@ -0,0 +1,64 @@
+/*
+    indBikeSim - An app that simulates a basic FTMS indoor bike
+
+    Copyright (C) 2025  Marcelo Mourier  marcelo_mourier@yahoo.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/queue.h>
+
+#include "evloop.h"
+#include "server.h"
+
+struct Fleet;
+
+// Listening socket of a worker thread for one of the
+// bikes of the fleet, and one of the address families.
+typedef struct WorkerLsnr {
+    struct Worker *worker;
+    Server *bike;
+    int sockFd;
+} WorkerLsnr;
+
+// Worker thread (sharded mode). Each worker has its own
+// SO_REUSEPORT listening sockets for each bike, its own
+// event loop and timer wheel, and its own table of
+// sessions, so the workers don't share any mutable state
+// on the per-message path. The kernel spreads the app
+// connections across the workers.
+typedef struct Worker {
+    int workerId;
+    pthread_t thread;
+    EvLoop evLoop;
+    WorkerLsnr *lsnrTbl;                    // one listening socket per bike and address family
+    int numLsnrs;
+    TAILQ_HEAD(SessList, Server) sessList;  // sessions served by this worker
+    struct SessList deadList;               // ended sessions, pending to be freed
+    int numSessions;
+    bool exit;                              // accessed with the __atomic builtins
+} Worker;
+
+__BEGIN_DECLS
+
+extern int workerStart(Worker *worker, int workerId, struct Fleet *fleet);
+extern void workerStop(Worker *worker);
+extern void workerEndSession(Worker *worker, Server *sess);
+
+__END_DECLS